@@ -0,0 +1,48 @@
+#pragma once
+
+#include "types.hpp"
+#include "Space.hpp"
+
+namespace ann_dkvs
+{
+  /**
+   * Computes the inverse euclidean norm 1 / ||vector|| of a vector.
+   *
+   * The inverse norm of the zero vector is defined as 0 so that its
+   * cosine distance to any other vector is 1.
+   *
+   * @param vector A pointer to the vector.
+   * @param vector_dim Dimension of the vector.
+   * @return The inverse norm.
+   */
+  distance_t get_inverse_norm(const vector_el_t *vector, size_t vector_dim);
+
+  /**
+   * Space of the cosine distance 1 - <a, b> / (||a|| * ||b||).
+   *
+   * The distance function computes both norms on every call. Indices storing
+   * many vectors should precompute the inverse norms of the stored vectors
+   * with get_inverse_norm() and combine them with get_inner_product_func()
+   * instead, as StorageLists and StorageIndex do.
+   */
+  class CosineSpace : public Space
+  {
+  public:
+    /**
+     * Creates a cosine space using the fastest kernel
+     * supported by the CPU the process is running on.
+     *
+     * @param vector_dim Dimension of the vectors.
+     */
+    CosineSpace(size_t vector_dim);
+
+    /**
+     * Creates a cosine space using the kernel for the given SIMD level.
+     *
+     * @param vector_dim Dimension of the vectors.
+     * @param simd_level The SIMD level of the kernel to use.
+     * @throws std::invalid_argument If the CPU does not support the SIMD level.
+     */
+    CosineSpace(size_t vector_dim, simd_level_t simd_level);
+  };
+} // namespace ann_dkvs
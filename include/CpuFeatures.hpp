@@ -0,0 +1,44 @@
+#pragma once
+
+#ifndef USE_SIMD
+#define USE_SIMD 1
+#endif
+
+namespace ann_dkvs
+{
+  /**
+   * Instruction set extensions a distance kernel can be compiled for,
+   * ordered from the least to the most capable one.
+   *
+   * SIMD_AVX2_FMA and above also imply F16C, which every CPU
+   * with AVX2 supports.
+   */
+  enum simd_level_t
+  {
+    SIMD_NONE = 0,
+    SIMD_AVX = 1,
+    SIMD_AVX2_FMA = 2,
+    SIMD_AVX512 = 3
+  };
+
+  /**
+   * Returns the most capable instruction set extension supported
+   * by the CPU and the operating system the process is running on.
+   *
+   * The CPU is queried with cpuid on the first call only,
+   * subsequent calls return the cached result.
+   * Always returns SIMD_NONE if compiled with USE_SIMD=0
+   * or for a target other than x86-64.
+   *
+   * @return The detected SIMD level.
+   */
+  simd_level_t get_simd_level();
+
+  /**
+   * Returns a human-readable name of the given SIMD level.
+   *
+   * @param simd_level The SIMD level.
+   * @return The name of the SIMD level.
+   */
+  const char *get_simd_level_name(const simd_level_t simd_level);
+}
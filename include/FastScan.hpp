@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "types.hpp"
+
+/**
+ * Number of codes interleaved within a block of a fast-scan list,
+ * i.e. the number of codes looked up by one 256-bit shuffle.
+ */
+#define FAST_SCAN_BLOCK_SIZE 32
+
+/**
+ * Number of centroids per codebook of a quantizer
+ * whose codes can be scanned with fast-scan, i.e. 4-bit codes.
+ */
+#define FAST_SCAN_N_CENTROIDS 16
+
+/**
+ * Largest code size in bytes which can be scanned with fast-scan
+ * without overflowing the 16-bit accumulators.
+ */
+#define FAST_SCAN_MAX_CODE_SIZE 128
+
+namespace ann_dkvs
+{
+  /**
+   * Returns the number of bytes taken up by the given number of codes
+   * in the fast-scan layout, i.e. rounded up to whole blocks.
+   *
+   * @param n_codes The number of codes.
+   * @param code_size The size of a code in bytes.
+   * @return The size in bytes.
+   */
+  size_t get_fast_scan_size(const len_t n_codes, const size_t code_size);
+
+  /**
+   * Stores a packed 4-bit code, with the even subvector of each byte
+   * in the low nibble, at the given position of fast-scan blocks.
+   *
+   * Within a block of FAST_SCAN_BLOCK_SIZE codes, the 16 bytes
+   * starting at 16 * m hold subvector m of all codes of the block,
+   * the first 16 codes in the low nibbles, the last 16 in the high nibbles.
+   * Two consecutive subvectors thus fill one 256-bit register.
+   *
+   * @param blocks A pointer to the first block.
+   * @param code_size The size of a code in bytes.
+   * @param position The position of the code.
+   * @param code The packed code.
+   */
+  void set_fast_scan_code(uint8_t *blocks, const size_t code_size, const len_t position, const uint8_t *code);
+
+  /**
+   * Reads the packed 4-bit code at the given position of fast-scan blocks.
+   *
+   * @param blocks A pointer to the first block.
+   * @param code_size The size of a code in bytes.
+   * @param position The position of the code.
+   * @param code The output buffer of code_size bytes.
+   */
+  void get_fast_scan_code(const uint8_t *blocks, const size_t code_size, const len_t position, uint8_t *code);
+
+  /**
+   * An ADC lookup table of 4-bit codes quantized to 8 bits per entry
+   * so that the table of two subvectors fits into a 256-bit register
+   * and the codes of a block are looked up with vpshufb instead of loads.
+   *
+   * The table of each subvector is shifted by its minimum and all tables
+   * are scaled by the same factor, so an approximate distance is
+   * bias + (sum of the quantized entries) / scale.
+   */
+  class FastScanTable
+  {
+  private:
+    /**
+     * Size of the codes the table is used for in bytes.
+     */
+    size_t code_size;
+
+    /**
+     * The quantized table, FAST_SCAN_N_CENTROIDS entries per subvector,
+     * padded with zeros to 2 * code_size subvectors.
+     */
+    std::vector<uint8_t> lut;
+
+    /**
+     * Sum of the minima of the tables of all subvectors.
+     */
+    distance_t bias;
+
+    /**
+     * Factor the shifted tables are multiplied with before rounding.
+     */
+    distance_t scale;
+
+    /**
+     * Number of subvectors of the quantizer, without padding.
+     */
+    len_t n_subvectors;
+
+  public:
+    /**
+     * Quantizes the given ADC lookup table.
+     *
+     * @param table A table computed by ProductQuantizer::compute_table()
+     *              of a quantizer with 4-bit codes.
+     * @param n_subvectors The number of subvectors of the quantizer.
+     * @throws std::invalid_argument If the codes are too large to be scanned.
+     */
+    FastScanTable(const distance_t *table, const len_t n_subvectors);
+
+    /**
+     * Computes the approximate table sums of the given codes.
+     *
+     * @param blocks A pointer to the first block of codes in the fast-scan layout.
+     * @param n_codes The number of codes, the last block may be incomplete.
+     * @param distances The output buffer of n_codes elements.
+     */
+    void scan(const uint8_t *blocks, const len_t n_codes, distance_t *distances) const;
+
+    /**
+     * Returns the largest error of an approximate sum
+     * caused by rounding the table entries.
+     */
+    distance_t get_max_error() const;
+  };
+} // namespace ann_dkvs
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+namespace ann_dkvs
+{
+  /**
+   * Converts a float to an IEEE half-precision float,
+   * rounding to the nearest representable value (ties to even).
+   * Values too large for half precision become infinity.
+   */
+  static inline uint16_t float_to_fp16(const float value)
+  {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    uint32_t abs_bits = bits & 0x7FFFFFFF;
+    if (abs_bits >= 0x7F800000)
+    {
+      // infinity or NaN
+      return sign | 0x7C00 | (abs_bits > 0x7F800000 ? 0x0200 : 0);
+    }
+    if (abs_bits >= 0x477FF000)
+    {
+      // rounds to a value larger than 65504
+      return sign | 0x7C00;
+    }
+    if (abs_bits < 0x38800000)
+    {
+      // subnormal half, i.e. a multiple of 2^-24
+      float abs_value;
+      memcpy(&abs_value, &abs_bits, sizeof(abs_value));
+      return sign | (uint16_t)std::nearbyint(abs_value * 16777216.0f);
+    }
+    uint32_t rounded = abs_bits + 0x0FFF + ((abs_bits >> 13) & 1);
+    return sign | (uint16_t)((rounded - 0x38000000) >> 13);
+  }
+
+  /**
+   * Converts an IEEE half-precision float to a float.
+   */
+  static inline float fp16_to_float(const uint16_t half)
+  {
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1F;
+    uint32_t mantissa = half & 0x03FF;
+    uint32_t bits;
+    if (exponent == 0x1F)
+    {
+      bits = sign | 0x7F800000 | (mantissa << 13);
+    }
+    else if (exponent == 0)
+    {
+      // zero or subnormal, i.e. mantissa * 2^-24
+      float value = mantissa / 16777216.0f;
+      memcpy(&bits, &value, sizeof(bits));
+      bits |= sign;
+    }
+    else
+    {
+      bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  /**
+   * Converts a float to a bfloat16, i.e. to its upper 16 bits,
+   * rounding to the nearest representable value (ties to even).
+   */
+  static inline uint16_t float_to_bf16(const float value)
+  {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if ((bits & 0x7FFFFFFF) > 0x7F800000)
+    {
+      // keep NaNs quiet instead of rounding them to infinity
+      return (uint16_t)((bits >> 16) | 0x0040);
+    }
+    bits += 0x7FFF + ((bits >> 16) & 1);
+    return (uint16_t)(bits >> 16);
+  }
+
+  /**
+   * Converts a bfloat16 to a float.
+   */
+  static inline float bf16_to_float(const uint16_t bf16)
+  {
+    uint32_t bits = (uint32_t)bf16 << 16;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+} // namespace ann_dkvs
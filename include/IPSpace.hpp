@@ -0,0 +1,130 @@
+#pragma once
+
+#include "types.hpp"
+#include "Space.hpp"
+#include "Float16.hpp"
+
+namespace ann_dkvs
+{
+  static inline float InnerProduct(
+      const void *pVect1v,
+      const void *pVect2v,
+      const void *qty_ptr)
+  {
+    float *pVect1 = (float *)pVect1v;
+    float *pVect2 = (float *)pVect2v;
+    size_t qty = *((size_t *)qty_ptr);
+
+    float res = 0;
+    for (size_t i = 0; i < qty; i++)
+    {
+      res += pVect1[i] * pVect2[i];
+    }
+    return res;
+  }
+
+  /**
+   * Inner product of a float vector and a vector of fp16 elements.
+   */
+  static inline float InnerProductFp16(const vector_el_t *query, const uint8_t *code, const distance_t *, size_t qty)
+  {
+    const uint16_t *halfs = (const uint16_t *)code;
+    float res = 0;
+    for (size_t i = 0; i < qty; i++)
+    {
+      res += query[i] * fp16_to_float(halfs[i]);
+    }
+    return res;
+  }
+
+  /**
+   * Inner product of a float vector and a vector of bf16 elements.
+   */
+  static inline float InnerProductBf16(const vector_el_t *query, const uint8_t *code, const distance_t *, size_t qty)
+  {
+    const uint16_t *bf16s = (const uint16_t *)code;
+    float res = 0;
+    for (size_t i = 0; i < qty; i++)
+    {
+      res += query[i] * bf16_to_float(bf16s[i]);
+    }
+    return res;
+  }
+
+  /**
+   * Inner product of a float vector and an 8-bit code.
+   */
+  static inline float InnerProductSQ8(const vector_el_t *query, const uint8_t *code, const distance_t *, size_t qty)
+  {
+    float res = 0;
+    for (size_t i = 0; i < qty; i++)
+    {
+      res += query[i] * code[i];
+    }
+    return res;
+  }
+
+#if USE_SIMD && defined(__x86_64__)
+  /**
+   * SIMD variants of InnerProduct(), compiled for their own instruction set.
+   * Only call a kernel if get_simd_level() reports support for it.
+   */
+  float InnerProductAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr);
+  float InnerProductAVX2FMA(const void *pVect1v, const void *pVect2v, const void *qty_ptr);
+  float InnerProductAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr);
+
+  /**
+   * SIMD variants of the kernels multiplying a float vector
+   * with a scalar-quantized vector, requiring AVX2, FMA and F16C.
+   */
+  float InnerProductFp16AVX2FMA(const vector_el_t *query, const uint8_t *code, const distance_t *weights, size_t qty);
+  float InnerProductBf16AVX2FMA(const vector_el_t *query, const uint8_t *code, const distance_t *weights, size_t qty);
+  float InnerProductSQ8AVX2FMA(const vector_el_t *query, const uint8_t *code, const distance_t *weights, size_t qty);
+#endif
+
+  /**
+   * Returns the kernel computing the plain inner product of a float vector
+   * and a scalar-quantized vector for the given SIMD level.
+   *
+   * @param sq_type The element type of the quantized vectors.
+   * @param simd_level The SIMD level of the kernel.
+   * @return The inner product kernel.
+   */
+  code_distance_func_t get_inner_product_code_func(const sq_type_t sq_type, const simd_level_t simd_level);
+
+  /**
+   * Returns the kernel computing the plain inner product of two vectors
+   * for the given SIMD level.
+   *
+   * Unlike the distance function of IPSpace, the result is not converted
+   * into a distance, i.e. larger values mean that the vectors are closer.
+   *
+   * @param simd_level The SIMD level of the kernel.
+   * @return The inner product kernel.
+   */
+  distance_func_t get_inner_product_func(const simd_level_t simd_level);
+
+  /**
+   * Space of the inner product distance 1 - <a, b>.
+   */
+  class IPSpace : public Space
+  {
+  public:
+    /**
+     * Creates an inner product space using the fastest kernel
+     * supported by the CPU the process is running on.
+     *
+     * @param vector_dim Dimension of the vectors.
+     */
+    IPSpace(size_t vector_dim);
+
+    /**
+     * Creates an inner product space using the kernel for the given SIMD level.
+     *
+     * @param vector_dim Dimension of the vectors.
+     * @param simd_level The SIMD level of the kernel to use.
+     * @throws std::invalid_argument If the CPU does not support the SIMD level.
+     */
+    IPSpace(size_t vector_dim, simd_level_t simd_level);
+  };
+} // namespace ann_dkvs
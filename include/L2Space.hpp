@@ -1,12 +1,8 @@
 #pragma once
 
-#ifdef __AVX__
-#include <immintrin.h>
-#endif
-
 #include "types.hpp"
-
-#define PORTABLE_ALIGN32 __attribute__((aligned(32)))
+#include "Space.hpp"
+#include "Float16.hpp"
 
 namespace ann_dkvs
 {
@@ -30,67 +26,100 @@ namespace ann_dkvs
     return (res);
   }
 
-#ifdef __AVX__
-  static inline float L2SqrSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
+  /**
+   * Squared L2 distance between a float vector and a vector of fp16 elements.
+   */
+  static inline float L2SqrFp16(const vector_el_t *query, const uint8_t *code, const distance_t *, size_t qty)
   {
-    float *pVect1 = (float *)pVect1v;
-    float *pVect2 = (float *)pVect2v;
-    size_t qty = *((size_t *)qty_ptr);
-    float PORTABLE_ALIGN32 TmpRes[8];
-    size_t qty16 = qty >> 4;
-
-    const float *pEnd1 = pVect1 + (qty16 << 4);
-
-    __m256 diff, v1, v2;
-    __m256 sum = _mm256_set1_ps(0);
-
-    while (pVect1 < pEnd1)
+    const uint16_t *halfs = (const uint16_t *)code;
+    float res = 0;
+    for (size_t i = 0; i < qty; i++)
     {
-      v1 = _mm256_loadu_ps(pVect1);
-      pVect1 += 8;
-      v2 = _mm256_loadu_ps(pVect2);
-      pVect2 += 8;
-      diff = _mm256_sub_ps(v1, v2);
-      sum = _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
-
-      v1 = _mm256_loadu_ps(pVect1);
-      pVect1 += 8;
-      v2 = _mm256_loadu_ps(pVect2);
-      pVect2 += 8;
-      diff = _mm256_sub_ps(v1, v2);
-      sum = _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
+      float t = query[i] - fp16_to_float(halfs[i]);
+      res += t * t;
     }
-
-    _mm256_store_ps(TmpRes, sum);
-    return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+    return res;
   }
 
-  static inline float L2SqrSIMD16ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
+  /**
+   * Squared L2 distance between a float vector and a vector of bf16 elements.
+   */
+  static inline float L2SqrBf16(const vector_el_t *query, const uint8_t *code, const distance_t *, size_t qty)
   {
-    size_t qty = *((size_t *)qty_ptr);
-    size_t qty16 = qty >> 4 << 4;
-    float res = L2SqrSIMD16ExtAVX(pVect1v, pVect2v, &qty16);
-    float *pVect1 = (float *)pVect1v + qty16;
-    float *pVect2 = (float *)pVect2v + qty16;
+    const uint16_t *bf16s = (const uint16_t *)code;
+    float res = 0;
+    for (size_t i = 0; i < qty; i++)
+    {
+      float t = query[i] - bf16_to_float(bf16s[i]);
+      res += t * t;
+    }
+    return res;
+  }
 
-    size_t qty_left = qty - qty16;
-    float res_tail = L2Sqr(pVect1, pVect2, &qty_left);
-    return (res + res_tail);
+  /**
+   * Weighted squared L2 distance sum(weights[i] * (query[i] - code[i])^2)
+   * between a query transformed into the units of 8-bit codes and a code.
+   */
+  static inline float L2SqrSQ8(const vector_el_t *query, const uint8_t *code, const distance_t *weights, size_t qty)
+  {
+    float res = 0;
+    for (size_t i = 0; i < qty; i++)
+    {
+      float t = query[i] - code[i];
+      res += weights[i] * t * t;
+    }
+    return res;
   }
 
+#if USE_SIMD && defined(__x86_64__)
+  /**
+   * SIMD variants of L2Sqr(). Each kernel handles any number of dimensions
+   * and is compiled for its own instruction set regardless of the flags
+   * the rest of the binary is compiled with. Only call a kernel
+   * if get_simd_level() reports support for its instruction set.
+   */
+  float L2SqrAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr);
+  float L2SqrAVX2FMA(const void *pVect1v, const void *pVect2v, const void *qty_ptr);
+  float L2SqrAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr);
+
+  /**
+   * SIMD variants of the kernels comparing a float vector
+   * with a scalar-quantized vector, requiring AVX2, FMA and F16C.
+   */
+  float L2SqrFp16AVX2FMA(const vector_el_t *query, const uint8_t *code, const distance_t *weights, size_t qty);
+  float L2SqrBf16AVX2FMA(const vector_el_t *query, const uint8_t *code, const distance_t *weights, size_t qty);
+  float L2SqrSQ8AVX2FMA(const vector_el_t *query, const uint8_t *code, const distance_t *weights, size_t qty);
 #endif
 
-  using distance_func_t = distance_t (*)(const void *, const void *, const void *);
-  class L2Space
+  /**
+   * Returns the kernel computing the squared L2 distance between
+   * a float vector and a scalar-quantized vector for the given SIMD level.
+   *
+   * @param sq_type The element type of the quantized vectors.
+   * @param simd_level The SIMD level of the kernel.
+   * @return The distance kernel.
+   */
+  code_distance_func_t get_l2_code_distance_func(const sq_type_t sq_type, const simd_level_t simd_level);
+
+  class L2Space : public Space
   {
-  private:
-    size_t vector_dim;
-    distance_func_t distance_func;
-
   public:
+    /**
+     * Creates a squared L2 space using the fastest kernel
+     * supported by the CPU the process is running on.
+     *
+     * @param vector_dim Dimension of the vectors.
+     */
     L2Space(size_t vector_dim);
-    distance_func_t get_distance_func() const;
-    size_t get_vector_dim() const;
+
+    /**
+     * Creates a squared L2 space using the kernel for the given SIMD level.
+     *
+     * @param vector_dim Dimension of the vectors.
+     * @param simd_level The SIMD level of the kernel to use.
+     * @throws std::invalid_argument If the CPU does not support the SIMD level.
+     */
+    L2Space(size_t vector_dim, simd_level_t simd_level);
   };
 
-} // namespace ann_dkvs
\ No newline at end of file
+} // namespace ann_dkvs
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <sched.h>
+
+#include "types.hpp"
+
+namespace ann_dkvs
+{
+  /**
+   * Returns the number of NUMA nodes of the machine the process is running on,
+   * read from /sys/devices/system/node/online on the first call only.
+   *
+   * @return The number of NUMA nodes, 1 if it cannot be determined.
+   */
+  len_t get_n_numa_nodes();
+
+  /**
+   * Returns the NUMA node of the CPU the calling thread is running on.
+   * Unless the thread is pinned to the CPUs of a node, e.g. with
+   * OMP_PLACES=sockets and OMP_PROC_BIND=close, it may be moved to
+   * another node at any time.
+   *
+   * @return The NUMA node, 0 if it cannot be determined.
+   */
+  int get_current_numa_node();
+
+  /**
+   * Sets the CPUs of the given NUMA node,
+   * read from /sys/devices/system/node/node<node>/cpulist.
+   *
+   * @param node The NUMA node.
+   * @param cpus Set to the CPUs of the node.
+   * @return Whether the CPUs could be determined.
+   */
+  bool get_numa_node_cpus(const int node, cpu_set_t *cpus);
+
+  /**
+   * Pins the calling thread to those CPUs of the given NUMA node
+   * it is allowed to run on, so that it stays on the node until it is unpinned.
+   *
+   * @param node The NUMA node.
+   * @param previous_cpus Set to the CPUs the thread was allowed to run on before.
+   * @return Whether the thread was pinned, false e.g. if the node does not
+   *         exist or the thread may not run on any of its CPUs.
+   */
+  bool pin_thread_to_numa_node(const int node, cpu_set_t *previous_cpus);
+
+  /**
+   * Allows the calling thread to run on the given CPUs again,
+   * see pin_thread_to_numa_node().
+   *
+   * @param previous_cpus The CPUs returned by pin_thread_to_numa_node().
+   */
+  void unpin_thread(const cpu_set_t *previous_cpus);
+
+  /**
+   * Migrates the pages of the given memory range which are resident in memory
+   * to the given NUMA node. Pages which are not resident are skipped without
+   * being read. Pages which are shared with other processes or cannot be
+   * moved for another reason are left in place.
+   * The system calls are made directly, so libnuma is not required.
+   *
+   * @param addr The start of the range, which is aligned down to a page.
+   * @param size The size of the range in bytes.
+   * @param node The NUMA node to move the pages to.
+   * @return Whether the pages could be moved, false e.g. if the node does not exist
+   *         or the system call is not permitted.
+   */
+  bool move_pages_to_numa_node(const void *addr, const size_t size, const int node);
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "types.hpp"
+#include "Space.hpp"
+
+#ifndef PQ_N_TRAINING_ITERATIONS
+#define PQ_N_TRAINING_ITERATIONS 25
+#endif
+#ifndef PQ_TRAINING_SEED
+#define PQ_TRAINING_SEED 1234
+#endif
+
+namespace ann_dkvs
+{
+  /**
+   * A product quantizer splitting vectors into n_subvectors subvectors
+   * and encoding each subvector as the id of its nearest centroid
+   * in a codebook of 2^n_bits centroids. With 8 bits, each subvector takes
+   * one byte. With 4 bits, two subvectors share a byte, the even one
+   * in the low nibble, and the codes can be scanned with fast-scan.
+   *
+   * Quantized vectors are compared with a query by asymmetric distance
+   * computation (ADC): a lookup table holds the distance of each subvector
+   * of the query to every centroid of the respective codebook, so the
+   * distance to a code is the sum of n_subvectors table lookups.
+   *
+   * When used within an inverted file index, the quantizer encodes
+   * the residuals of the vectors to the centroids of their lists.
+   */
+  class ProductQuantizer
+  {
+  private:
+    /**
+     * Dimension of the vectors to be quantized.
+     */
+    len_t vector_dim;
+
+    /**
+     * Number of subvectors, i.e. number of codebooks.
+     */
+    len_t n_subvectors;
+
+    /**
+     * Number of bits per subvector code, either 4 or 8.
+     */
+    len_t n_bits;
+
+    /**
+     * Number of centroids per codebook, i.e. 2^n_bits.
+     */
+    len_t n_centroids;
+
+    /**
+     * Dimension of each subvector.
+     */
+    size_t subvector_dim;
+
+    /**
+     * The codebooks of all subvectors, i.e. n_subvectors * n_centroids
+     * centroids of subvector_dim elements each.
+     */
+    std::vector<vector_el_t> codebooks;
+
+    /**
+     * Squared L2 distance kernel for subvectors.
+     */
+    distance_func_t subvector_distance_func;
+
+    /**
+     * Returns a pointer to the given centroid of the given codebook.
+     */
+    const vector_el_t *get_centroid(const len_t subvector, const len_t centroid) const;
+
+    /**
+     * Returns the centroid id of the given subvector within a code.
+     */
+    len_t get_subvector_code(const uint8_t *code, const len_t subvector) const;
+
+    /**
+     * Sets the centroid id of the given subvector within a code.
+     */
+    void set_subvector_code(uint8_t *code, const len_t subvector, const len_t centroid) const;
+
+    /**
+     * Initializes the members derived from the vector dimension,
+     * the number of subvectors and the number of bits.
+     *
+     * @throws std::invalid_argument If the parameters are invalid.
+     */
+    void init_dimensions();
+
+    /**
+     * Runs k-means on the given subvectors of the training vectors
+     * and stores the resulting centroids in the respective codebook.
+     *
+     * @param subvector The index of the subvector and its codebook.
+     * @param vectors The training vectors.
+     * @param n_vectors The number of training vectors.
+     * @param n_iterations The number of k-means iterations.
+     */
+    void train_codebook(const len_t subvector, const vector_el_t *vectors, const len_t n_vectors, const len_t n_iterations);
+
+  public:
+    /**
+     * Creates an untrained product quantizer.
+     *
+     * @param vector_dim The dimension of the vectors.
+     * @param n_subvectors The number of subvectors.
+     * @param n_bits The number of bits per subvector code, either 4 or 8.
+     * @throws std::invalid_argument If vector_dim is not a multiple of n_subvectors
+     *                               or if n_bits is neither 4 nor 8.
+     */
+    ProductQuantizer(const len_t vector_dim, const len_t n_subvectors, const len_t n_bits = 8);
+
+    /**
+     * Loads a product quantizer previously stored with save().
+     *
+     * @param filename The name of the file.
+     * @throws std::runtime_error If the file cannot be read.
+     */
+    ProductQuantizer(const std::string &filename);
+
+    /**
+     * Stores the codebooks of the quantizer in a file.
+     *
+     * @param filename The name of the file.
+     * @throws std::runtime_error If the file cannot be written.
+     */
+    void save(const std::string &filename) const;
+
+    /**
+     * Trains the codebooks on the given vectors with k-means.
+     *
+     * If centroids and list ids are given, the codebooks are trained
+     * on the residuals of the vectors to the centroids of their lists.
+     *
+     * @param vectors The training vectors.
+     * @param n_vectors The number of training vectors.
+     * @param centroids The centroids of the lists or nullptr.
+     * @param list_ids The list id of each training vector or nullptr.
+     * @param n_iterations The number of k-means iterations.
+     * @throws std::invalid_argument If no training vectors are given.
+     */
+    void train(
+        const vector_el_t *vectors,
+        const len_t n_vectors,
+        const vector_el_t *centroids = nullptr,
+        const list_id_t *list_ids = nullptr,
+        const len_t n_iterations = PQ_N_TRAINING_ITERATIONS);
+
+    /**
+     * Encodes the given vectors.
+     *
+     * If a centroid is given, the residuals of the vectors
+     * to the centroid are encoded.
+     *
+     * @param vectors The vectors to encode.
+     * @param n_vectors The number of vectors.
+     * @param codes The output buffer of n_vectors * get_code_size() bytes.
+     * @param centroid The centroid of the list of the vectors or nullptr.
+     */
+    void encode(const vector_el_t *vectors, const len_t n_vectors, uint8_t *codes, const vector_el_t *centroid = nullptr) const;
+
+    /**
+     * Reconstructs the vectors of the given codes.
+     *
+     * @param codes The codes to decode.
+     * @param n_vectors The number of codes.
+     * @param vectors The output buffer of n_vectors * vector_dim elements.
+     * @param centroid The centroid the codes were encoded relative to or nullptr.
+     */
+    void decode(const uint8_t *codes, const len_t n_vectors, vector_el_t *vectors, const vector_el_t *centroid = nullptr) const;
+
+    /**
+     * Computes the ADC lookup table of a query, i.e. the squared L2 distance
+     * (METRIC_L2) or the inner product (METRIC_INNER_PRODUCT) of each subvector
+     * of the query to every centroid of the respective codebook.
+     *
+     * @param query The query vector, e.g. its residual to a list centroid.
+     * @param metric The metric, either METRIC_L2 or METRIC_INNER_PRODUCT.
+     * @param table The output buffer of get_table_size() elements.
+     * @throws std::invalid_argument If the metric is METRIC_COSINE.
+     */
+    void compute_table(const vector_el_t *query, const metric_t metric, distance_t *table) const;
+
+    /**
+     * Sums up the table entries of each of the given codes.
+     *
+     * @param table A lookup table computed by compute_table().
+     * @param codes The codes.
+     * @param n_codes The number of codes.
+     * @param sums The output buffer of n_codes elements.
+     */
+    void lookup_codes(const distance_t *table, const uint8_t *codes, const len_t n_codes, distance_t *sums) const;
+
+    len_t get_vector_dim() const;
+    len_t get_n_subvectors() const;
+    len_t get_n_bits() const;
+    len_t get_n_centroids() const;
+
+    /**
+     * Returns the size of a code in bytes.
+     */
+    size_t get_code_size() const;
+
+    /**
+     * Returns the number of elements of a lookup table.
+     */
+    size_t get_table_size() const;
+  };
+} // namespace ann_dkvs
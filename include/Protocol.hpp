@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "types.hpp"
+#include "Query.hpp"
+
+/**
+ * Magic number at the start of every frame, "ADKV" in little endian.
+ */
+#define PROTOCOL_MAGIC 0x564B4441
+
+#ifndef PROTOCOL_MAX_FRAME_SIZE
+/**
+ * Largest body of a frame in bytes which is accepted by a receiver.
+ * Larger frames are rejected before their body is read.
+ */
+#define PROTOCOL_MAX_FRAME_SIZE (1UL << 30)
+#endif
+
+namespace ann_dkvs
+{
+  /**
+   * Types of the messages exchanged between nodes.
+   */
+  enum message_type_t : uint32_t
+  {
+    MESSAGE_SEARCH_REQUEST = 1,
+    MESSAGE_SEARCH_RESPONSE = 2,
+    MESSAGE_ERROR = 3
+  };
+
+  /**
+   * Header preceding the body of every message.
+   *
+   * All fields of the binary framing are stored in the byte order
+   * of the host, i.e. little endian on the supported platforms.
+   */
+  struct FrameHeader
+  {
+    uint32_t magic;
+    uint32_t message_type;
+    uint64_t body_size;
+  };
+
+  /**
+   * Header of the body of a search request.
+   *
+   * The body of a search request is laid out as
+   *   SearchRequestHeader
+   *   QueryHeader[n_queries]
+   *   list_id_t lists_to_probe[sum of n_probes]
+   *   vector_el_t vectors[n_queries * vector_dim]
+   * so that every array is aligned to its element size if the body is,
+   * and the queries of a request can point into the received body.
+   */
+  struct SearchRequestHeader
+  {
+    uint64_t n_queries;
+    uint64_t vector_dim;
+  };
+
+  /**
+   * Per-query header of a search request.
+   */
+  struct QueryHeader
+  {
+    uint32_t n_results;
+    uint32_t n_probes;
+  };
+
+  /**
+   * Header of the body of a search response.
+   *
+   * The body of a search response is laid out as
+   *   SearchResponseHeader
+   *   uint64_t n_results[n_queries]
+   *   vector_id_t vector_ids[n_results_total]
+   *   distance_t distances[n_results_total]
+   */
+  struct SearchResponseHeader
+  {
+    uint64_t n_queries;
+    uint64_t n_results_total;
+  };
+
+  /**
+   * Encodes a batch of pre-assigned queries as a search request frame,
+   * i.e. a frame header followed by the body.
+   *
+   * @param queries A batch of queries whose lists to probe are set.
+   * @param vector_dim The dimension of the query vectors.
+   * @param frame The output buffer, which is resized to the frame.
+   */
+  void write_search_request(const QueryBatch &queries, const len_t vector_dim, std::vector<uint8_t> &frame);
+
+  /**
+   * Decodes the body of a search request without copying the query vectors
+   * and the lists to probe: the returned queries point into the body,
+   * which must be aligned to 8 bytes and outlive the queries.
+   * The caller is responsible for deleting the query objects.
+   *
+   * @param body The body of a search request frame.
+   * @param body_size The size of the body in bytes.
+   * @param vector_dim Is set to the dimension of the query vectors.
+   * @return A batch of queries.
+   * @throws std::invalid_argument If the body is malformed.
+   */
+  QueryBatch read_search_request(uint8_t *body, const size_t body_size, len_t *vector_dim);
+
+  /**
+   * Encodes the results of a batch of queries as a search response frame.
+   *
+   * @param results A batch of query results.
+   * @param frame The output buffer, which is resized to the frame.
+   */
+  void write_search_response(const QueryResultsBatch &results, std::vector<uint8_t> &frame);
+
+  /**
+   * Decodes the body of a search response.
+   *
+   * @param body The body of a search response frame.
+   * @param body_size The size of the body in bytes.
+   * @return A batch of query results.
+   * @throws std::invalid_argument If the body is malformed.
+   */
+  QueryResultsBatch read_search_response(const uint8_t *body, const size_t body_size);
+
+  /**
+   * Encodes an error message as an error frame.
+   *
+   * @param message The message describing the error.
+   * @param frame The output buffer, which is resized to the frame.
+   */
+  void write_error(const std::string &message, std::vector<uint8_t> &frame);
+
+  /**
+   * Checks the magic number and the body size of a frame header.
+   *
+   * @param header The header of a received frame.
+   * @throws std::invalid_argument If the header is not valid.
+   */
+  void check_frame_header(const FrameHeader &header);
+} // namespace ann_dkvs
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "types.hpp"
+#include "Space.hpp"
+
+namespace ann_dkvs
+{
+  /**
+   * A scalar quantizer storing each element of a vector in a smaller type,
+   * i.e. in one byte (SQ_8BIT) or in two bytes (SQ_FP16, SQ_BF16).
+   *
+   * SQ_8BIT maps each dimension linearly onto 256 steps between the minimum
+   * and the maximum of the training vectors in that dimension. The 16-bit
+   * types need no training.
+   *
+   * Codes are compared with a query without decoding them: the query is
+   * prepared once, e.g. transformed into the units of the 8-bit steps,
+   * and then compared with every code by a SIMD kernel of L2Space or IPSpace.
+   */
+  class ScalarQuantizer
+  {
+  private:
+    /**
+     * Dimension of the vectors to be quantized.
+     */
+    len_t vector_dim;
+
+    /**
+     * Element type of the codes.
+     */
+    sq_type_t sq_type;
+
+    /**
+     * Per-dimension minimum and maximum of the training vectors,
+     * only used for SQ_8BIT.
+     */
+    std::vector<vector_el_t> min_values;
+    std::vector<vector_el_t> max_values;
+
+    /**
+     * Per-dimension size of an 8-bit step, (max - min) / 255.
+     */
+    std::vector<distance_t> steps;
+
+    /**
+     * Per-dimension weights of the 8-bit L2 kernel, i.e. the squared steps.
+     */
+    std::vector<distance_t> l2_weights;
+
+    /**
+     * Kernels comparing a prepared query with a code.
+     */
+    code_distance_func_t l2_func;
+    code_distance_func_t inner_product_func;
+
+    /**
+     * Initializes the members derived from the vector dimension and type.
+     *
+     * @throws std::out_of_range If the vector dimension is 0.
+     */
+    void init();
+
+    /**
+     * Recomputes the steps and weights after the range has changed.
+     */
+    void update_steps();
+
+  public:
+    /**
+     * Creates a scalar quantizer.
+     *
+     * @param vector_dim The dimension of the vectors.
+     * @param sq_type The element type of the codes.
+     * @throws std::out_of_range If the vector dimension is 0.
+     */
+    ScalarQuantizer(const len_t vector_dim, const sq_type_t sq_type);
+
+    /**
+     * Loads a scalar quantizer previously stored with save().
+     *
+     * @param filename The name of the file.
+     * @throws std::runtime_error If the file cannot be read.
+     */
+    ScalarQuantizer(const std::string &filename);
+
+    /**
+     * Stores the quantizer in a file.
+     *
+     * @param filename The name of the file.
+     * @throws std::runtime_error If the file cannot be written.
+     */
+    void save(const std::string &filename) const;
+
+    /**
+     * Extends the per-dimension range of SQ_8BIT to the given vectors.
+     *
+     * May be called repeatedly to train on vectors read in chunks,
+     * but codes encoded before are not updated. Does nothing
+     * for the 16-bit types.
+     *
+     * @param vectors The training vectors.
+     * @param n_vectors The number of training vectors.
+     */
+    void train(const vector_el_t *vectors, const len_t n_vectors);
+
+    /**
+     * Checks if vectors can be encoded, i.e. if the quantizer has seen
+     * at least one training vector or uses a 16-bit type.
+     *
+     * @return True if the quantizer is trained.
+     */
+    bool is_trained() const;
+
+    /**
+     * Encodes the given vectors. Elements outside of the trained range
+     * are clamped to the range.
+     *
+     * @param vectors The vectors to encode.
+     * @param n_vectors The number of vectors.
+     * @param codes The output buffer of n_vectors * get_code_size() bytes.
+     * @throws std::logic_error If the quantizer is not trained.
+     */
+    void encode(const vector_el_t *vectors, const len_t n_vectors, uint8_t *codes) const;
+
+    /**
+     * Reconstructs the vectors of the given codes.
+     *
+     * @param codes The codes to decode.
+     * @param n_vectors The number of codes.
+     * @param vectors The output buffer of n_vectors * vector_dim elements.
+     */
+    void decode(const uint8_t *codes, const len_t n_vectors, vector_el_t *vectors) const;
+
+    /**
+     * Prepares a query to be compared with codes by compute_distances().
+     *
+     * @param query The query vector.
+     * @param metric The metric, either METRIC_L2 or METRIC_INNER_PRODUCT.
+     * @param prepared_query The output buffer of vector_dim elements.
+     * @return The part of the distance which does not depend on the codes.
+     * @throws std::invalid_argument If the metric is METRIC_COSINE.
+     */
+    distance_t prepare_query(const vector_el_t *query, const metric_t metric, vector_el_t *prepared_query) const;
+
+    /**
+     * Computes the distances of a prepared query to the given codes.
+     *
+     * @param prepared_query A query prepared by prepare_query().
+     * @param query_term The value returned by prepare_query().
+     * @param metric The metric the query was prepared for.
+     * @param codes The codes.
+     * @param n_codes The number of codes.
+     * @param distances The output buffer of n_codes elements.
+     */
+    void compute_distances(
+        const vector_el_t *prepared_query,
+        const distance_t query_term,
+        const metric_t metric,
+        const uint8_t *codes,
+        const len_t n_codes,
+        distance_t *distances) const;
+
+    len_t get_vector_dim() const;
+    sq_type_t get_sq_type() const;
+
+    /**
+     * Returns the size of a code in bytes.
+     */
+    size_t get_code_size() const;
+  };
+} // namespace ann_dkvs
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "CpuFeatures.hpp"
+
+#if USE_SIMD && defined(__x86_64__)
+#include <cstdint>
+#include <immintrin.h>
+
+#define PORTABLE_ALIGN32 __attribute__((aligned(32)))
+#define PORTABLE_ALIGN64 __attribute__((aligned(64)))
+
+namespace ann_dkvs
+{
+  __attribute__((target("avx"))) static inline float horizontal_sum_avx(__m256 sum)
+  {
+    __m128 lo = _mm256_castps256_ps128(sum);
+    __m128 hi = _mm256_extractf128_ps(sum, 1);
+    lo = _mm_add_ps(lo, hi);
+    lo = _mm_hadd_ps(lo, lo);
+    lo = _mm_hadd_ps(lo, lo);
+    return _mm_cvtss_f32(lo);
+  }
+
+  __attribute__((target("avx512f"))) static inline float horizontal_sum_avx512(__m512 sum)
+  {
+    float PORTABLE_ALIGN64 TmpRes[16];
+    _mm512_store_ps(TmpRes, sum);
+    __m256 lo = _mm256_load_ps(TmpRes);
+    __m256 hi = _mm256_load_ps(TmpRes + 8);
+    return horizontal_sum_avx(_mm256_add_ps(lo, hi));
+  }
+
+  /**
+   * Loads 8 fp16 elements and converts them to floats.
+   */
+  __attribute__((target("avx2,f16c"))) static inline __m256 load_fp16_avx2(const uint16_t *halfs)
+  {
+    return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)halfs));
+  }
+
+  /**
+   * Loads 8 bf16 elements and converts them to floats.
+   */
+  __attribute__((target("avx2"))) static inline __m256 load_bf16_avx2(const uint16_t *bf16s)
+  {
+    __m256i bits = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)bf16s));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(bits, 16));
+  }
+
+  /**
+   * Loads 8 bytes of an 8-bit code and converts them to floats.
+   */
+  __attribute__((target("avx2"))) static inline __m256 load_sq8_avx2(const uint8_t *code)
+  {
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)code)));
+  }
+
+  /**
+   * Returns a mask selecting the first n_left lanes of a 512-bit register
+   * of floats, used to load the tail of a vector without a scalar loop.
+   */
+  static inline __mmask16 get_tail_mask16(size_t n_left)
+  {
+    return (__mmask16)((1u << n_left) - 1);
+  }
+}
+#endif
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "types.hpp"
+
+#ifndef SOCKET_LISTEN_BACKLOG
+/**
+ * Number of pending connections a listening socket queues
+ * before refusing new ones.
+ */
+#define SOCKET_LISTEN_BACKLOG 128
+#endif
+
+namespace ann_dkvs
+{
+  /**
+   * Creates a TCP socket listening on the given address.
+   *
+   * @param host The host name or address to listen on, e.g. "127.0.0.1".
+   * @param port The port to listen on, or 0 to pick a free port.
+   * @return The file descriptor of the socket.
+   * @throws std::runtime_error If the socket cannot be created.
+   */
+  int listen_tcp_socket(const std::string &host, const uint16_t port);
+
+  /**
+   * Creates a Unix domain socket listening on the given path.
+   * A file already existing at the path is replaced.
+   *
+   * @param path The path of the socket.
+   * @return The file descriptor of the socket.
+   * @throws std::runtime_error If the socket cannot be created.
+   */
+  int listen_unix_socket(const std::string &path);
+
+  /**
+   * Connects a blocking TCP socket to the given address.
+   *
+   * @param host The host name or address to connect to.
+   * @param port The port to connect to.
+   * @return The file descriptor of the socket.
+   * @throws std::runtime_error If the connection fails.
+   */
+  int connect_tcp_socket(const std::string &host, const uint16_t port);
+
+  /**
+   * Connects a blocking Unix domain socket to the given path.
+   *
+   * @param path The path of the socket.
+   * @return The file descriptor of the socket.
+   * @throws std::runtime_error If the connection fails.
+   */
+  int connect_unix_socket(const std::string &path);
+
+  /**
+   * Returns the local port a TCP socket is bound to.
+   *
+   * @param fd The file descriptor of the socket.
+   * @return The port.
+   * @throws std::runtime_error If the address of the socket cannot be read.
+   */
+  uint16_t get_socket_port(const int fd);
+
+  /**
+   * Switches a socket to non-blocking mode.
+   *
+   * @param fd The file descriptor of the socket.
+   * @throws std::runtime_error If the mode cannot be changed.
+   */
+  void set_socket_nonblocking(const int fd);
+
+  /**
+   * Sends all bytes of a buffer over a blocking socket.
+   *
+   * @param fd The file descriptor of the socket.
+   * @param data The buffer.
+   * @param size The number of bytes to send.
+   * @throws std::runtime_error If the connection fails.
+   */
+  void send_all(const int fd, const void *data, const size_t size);
+
+  /**
+   * Receives exactly the given number of bytes from a blocking socket.
+   *
+   * @param fd The file descriptor of the socket.
+   * @param data The output buffer.
+   * @param size The number of bytes to receive.
+   * @throws std::runtime_error If the connection fails or is closed.
+   */
+  void receive_all(const int fd, void *data, const size_t size);
+} // namespace ann_dkvs
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "types.hpp"
+#include "CpuFeatures.hpp"
+
+namespace ann_dkvs
+{
+  /**
+   * Metrics supported by the indices. For every metric,
+   * a smaller distance means that two vectors are closer.
+   *
+   * - METRIC_L2: squared euclidean distance
+   * - METRIC_INNER_PRODUCT: 1 - inner product
+   * - METRIC_COSINE: 1 - cosine similarity
+   */
+  enum metric_t
+  {
+    METRIC_L2 = 0,
+    METRIC_INNER_PRODUCT = 1,
+    METRIC_COSINE = 2
+  };
+
+  using distance_func_t = distance_t (*)(const void *, const void *, const void *);
+
+  /**
+   * Element types of scalar-quantized vectors.
+   *
+   * - SQ_8BIT: one byte per element, mapped linearly onto the trained
+   *   range of its dimension
+   * - SQ_FP16: IEEE half-precision floats
+   * - SQ_BF16: bfloat16, i.e. floats rounded to their upper 16 bits
+   */
+  enum sq_type_t
+  {
+    SQ_8BIT = 0,
+    SQ_FP16 = 1,
+    SQ_BF16 = 2
+  };
+
+  /**
+   * Kernel comparing a float query with a scalar-quantized vector without
+   * decoding it first, called as code_distance_func(query, code, weights, vector_dim).
+   *
+   * The weights are per-dimension factors used by the SQ_8BIT kernels only.
+   */
+  using code_distance_func_t = distance_t (*)(const vector_el_t *, const uint8_t *, const distance_t *, size_t);
+
+  /**
+   * Base class of the metric spaces. A space selects the distance kernel
+   * of its metric for a given SIMD level and vector dimension.
+   *
+   * The distance function is called as distance_func(a, b, &vector_dim).
+   */
+  class Space
+  {
+  protected:
+    size_t vector_dim;
+    simd_level_t simd_level;
+    metric_t metric;
+    distance_func_t distance_func;
+
+    /**
+     * Initializes the members shared by all spaces.
+     *
+     * @param vector_dim Dimension of the vectors.
+     * @param simd_level The SIMD level of the kernel to use.
+     * @param metric The metric of the space.
+     * @throws std::invalid_argument If the CPU does not support the SIMD level.
+     */
+    Space(size_t vector_dim, simd_level_t simd_level, metric_t metric);
+
+  public:
+    /**
+     * Creates the space of the given metric using the fastest kernel
+     * supported by the CPU the process is running on.
+     *
+     * @param metric The metric of the space.
+     * @param vector_dim Dimension of the vectors.
+     * @return The space.
+     */
+    static Space create(metric_t metric, size_t vector_dim);
+
+    distance_func_t get_distance_func() const;
+    size_t get_vector_dim() const;
+    simd_level_t get_simd_level() const;
+    metric_t get_metric() const;
+  };
+} // namespace ann_dkvs
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include "types.hpp"
+
+#ifndef TOP_K_INLINE_CAPACITY
+/**
+ * Largest k for which the results of a TopK object are stored inline,
+ * i.e. on the stack or within the object owning it. Larger values of k
+ * fall back to a buffer on the heap.
+ */
+#define TOP_K_INLINE_CAPACITY 128
+#endif
+
+#ifndef TOP_K_BLOCK_SIZE
+/**
+ * Number of distances computed at once before the candidates
+ * are passed to TopK::push_batch().
+ */
+#define TOP_K_BLOCK_SIZE 256
+#endif
+
+#ifndef TOP_K_FILTER_CHUNK_SIZE
+/**
+ * Number of candidates filtered against the same threshold
+ * by TopK::push_batch() before the threshold is updated.
+ */
+#define TOP_K_FILTER_CHUNK_SIZE 64
+#endif
+
+namespace ann_dkvs
+{
+  /**
+   * Writes the indices of all distances smaller than or equal
+   * to the threshold to indices, using the fastest kernel
+   * supported by the CPU the process is running on.
+   *
+   * @param distances The distances to filter.
+   * @param n_distances The number of distances.
+   * @param threshold The largest distance to keep.
+   * @param indices The output buffer, large enough for n_distances indices.
+   * @return The number of indices written.
+   */
+  len_t filter_distances(const distance_t *distances, len_t n_distances, distance_t threshold, uint32_t *indices);
+
+  /**
+   * A fixed-capacity max heap keeping the k smallest results pushed to it,
+   * ordered by operator< of the results, e.g. by distance and then by id.
+   *
+   * The results are stored inline for k <= inline_capacity, so no memory
+   * is allocated for small k. Candidates pushed in batches are first
+   * filtered with SIMD against the distance of the current k-th result,
+   * so only the few candidates which may enter the heap are compared exactly.
+   *
+   * @tparam result_t Type of the results, with members distance and operator<.
+   * @tparam inline_capacity Largest k for which the results are stored inline.
+   */
+  template <typename result_t, len_t inline_capacity = TOP_K_INLINE_CAPACITY>
+  class TopK
+  {
+  private:
+    len_t k;
+    len_t n_results = 0;
+    result_t inline_results[inline_capacity];
+    std::vector<result_t> heap_results;
+
+    result_t *get_results()
+    {
+      return k <= inline_capacity ? inline_results : heap_results.data();
+    }
+
+    const result_t *get_results() const
+    {
+      return k <= inline_capacity ? inline_results : heap_results.data();
+    }
+
+    /**
+     * Replaces the largest result with a smaller one
+     * and restores the heap property.
+     */
+    void replace_top(const result_t &result)
+    {
+      result_t *results = get_results();
+      len_t parent = 0;
+      len_t child = 1;
+      while (child < n_results)
+      {
+        if (child + 1 < n_results && results[child] < results[child + 1])
+        {
+          child++;
+        }
+        if (!(result < results[child]))
+        {
+          break;
+        }
+        results[parent] = results[child];
+        parent = child;
+        child = 2 * parent + 1;
+      }
+      results[parent] = result;
+    }
+
+  public:
+    /**
+     * Creates an empty top-k object.
+     *
+     * @param k The maximum number of results to keep.
+     */
+    TopK(len_t k) : k(k)
+    {
+      if (k > inline_capacity)
+      {
+        heap_results.resize(k);
+      }
+    }
+
+    TopK(const TopK &other) : k(other.k), n_results(other.n_results), heap_results(other.heap_results)
+    {
+      std::copy(other.inline_results, other.inline_results + (k <= inline_capacity ? n_results : 0), inline_results);
+    }
+
+    TopK &operator=(const TopK &other)
+    {
+      k = other.k;
+      n_results = other.n_results;
+      heap_results = other.heap_results;
+      std::copy(other.inline_results, other.inline_results + (k <= inline_capacity ? n_results : 0), inline_results);
+      return *this;
+    }
+
+    len_t size() const
+    {
+      return n_results;
+    }
+
+    len_t get_k() const
+    {
+      return k;
+    }
+
+    /**
+     * Returns the largest of the kept results.
+     * Must not be called on an empty object.
+     */
+    const result_t &top() const
+    {
+      return get_results()[0];
+    }
+
+    /**
+     * Returns the largest distance a candidate may have to be kept,
+     * i.e. infinity while fewer than k results are kept.
+     */
+    distance_t get_threshold() const
+    {
+      if (n_results < k)
+      {
+        return std::numeric_limits<distance_t>::infinity();
+      }
+      return k == 0 ? -std::numeric_limits<distance_t>::infinity() : top().distance;
+    }
+
+    /**
+     * Adds a candidate if fewer than k results are kept
+     * or if it is smaller than the largest kept result.
+     *
+     * @param result The candidate result.
+     */
+    void push(const result_t &result)
+    {
+      result_t *results = get_results();
+      if (n_results < k)
+      {
+        results[n_results++] = result;
+        std::push_heap(results, results + n_results);
+      }
+      else if (k > 0 && result < results[0])
+      {
+        replace_top(result);
+      }
+    }
+
+    /**
+     * Removes the largest of the kept results.
+     * Must not be called on an empty object.
+     */
+    void pop()
+    {
+      result_t *results = get_results();
+      std::pop_heap(results, results + n_results);
+      n_results--;
+    }
+
+    /**
+     * Adds a block of candidates given by their distances and ids,
+     * skipping all candidates further than the current threshold
+     * and those whose distance is NaN, e.g. deleted entries.
+     *
+     * @param distances The distances of the candidates.
+     * @param n_candidates The number of candidates.
+     * @param get_id A function returning the id of the i-th candidate.
+     */
+    template <typename get_id_t>
+    void push_batch(const distance_t *distances, len_t n_candidates, get_id_t get_id)
+    {
+      uint32_t indices[TOP_K_FILTER_CHUNK_SIZE];
+      for (len_t chunk_start = 0; chunk_start < n_candidates; chunk_start += TOP_K_FILTER_CHUNK_SIZE)
+      {
+        len_t chunk_size = std::min((len_t)TOP_K_FILTER_CHUNK_SIZE, n_candidates - chunk_start);
+        len_t n_selected = filter_distances(&distances[chunk_start], chunk_size, get_threshold(), indices);
+        for (len_t i = 0; i < n_selected; i++)
+        {
+          len_t candidate = chunk_start + indices[i];
+          push({distances[candidate], get_id(candidate)});
+        }
+      }
+    }
+
+    /**
+     * Returns the kept results in ascending order
+     * and leaves the object empty.
+     *
+     * @return The sorted results.
+     */
+    std::vector<result_t> extract_sorted()
+    {
+      result_t *results = get_results();
+      std::sort_heap(results, results + n_results);
+      std::vector<result_t> sorted(results, results + n_results);
+      n_results = 0;
+      return sorted;
+    }
+  };
+} // namespace ann_dkvs
@@ -1,10 +1,19 @@
 #pragma once
 
 #include <vector>
-#include <queue>
+#include <functional>
 
 #include "types.hpp"
 #include "Query.hpp"
+#include "Space.hpp"
+#include "TopK.hpp"
+
+#ifndef CENTROID_GROUPS_N_TRAINING_ITERATIONS
+#define CENTROID_GROUPS_N_TRAINING_ITERATIONS 10
+#endif
+#ifndef CENTROID_GROUPS_TRAINING_SEED
+#define CENTROID_GROUPS_TRAINING_SEED 4321
+#endif
 
 namespace ann_dkvs
 {
@@ -25,22 +34,10 @@ namespace ann_dkvs
   };
 
   /**
-   * @brief A class that implements a comparison function used for a max heap.
-   */
-  class CentroidsDistanceIdMaxHeapCompare
-  {
-  public:
-    bool operator()(const CentroidsResult &parent, const CentroidsResult &child)
-    {
-      bool swapParentWithChild = parent < child;
-      return swapParentWithChild;
-    }
-  };
-
-  /**
-   * Data structure used to store the centroid candidates.
+   * Data structure used to store the centroid candidates,
+   * i.e. the n_probe nearest centroids of a query.
    */
-  typedef std::priority_queue<CentroidsResult, std::vector<CentroidsResult>, CentroidsDistanceIdMaxHeapCompare> centroids_heap_t;
+  typedef TopK<CentroidsResult> centroids_heap_t;
 
   class RootIndex
   {
@@ -60,6 +57,55 @@ namespace ann_dkvs
      */
     len_t n_centroids;
 
+    /**
+     * Metric used to compare query vectors with the centroid vectors.
+     */
+    metric_t metric;
+
+    /**
+     * Distance function used to compute the distance
+     * between a query vector and the centroid vectors,
+     * selected once for the CPU the index runs on.
+     *
+     * For METRIC_COSINE, the centroids are normalized on construction
+     * and compared with the inner product distance, which ranks them
+     * the same as the cosine distance.
+     */
+    distance_func_t distance_func;
+
+    /**
+     * Number of groups the centroids are clustered into,
+     * or 0 if every centroid is compared with a query.
+     */
+    len_t n_groups;
+
+    /**
+     * Number of groups whose centroids are compared with a query.
+     */
+    len_t n_groups_to_probe;
+
+    /**
+     * The n_groups group centroids, normalized unless the metric is METRIC_L2.
+     */
+    std::vector<vector_el_t> group_centroids;
+
+    /**
+     * Copies of the centroids ordered by group, so that
+     * the centroids of a group are compared with a query in one pass.
+     */
+    std::vector<vector_el_t> grouped_centroids;
+
+    /**
+     * The list id of every centroid in grouped_centroids.
+     */
+    std::vector<list_id_t> grouped_list_ids;
+
+    /**
+     * The offset of the first centroid of every group in grouped_centroids,
+     * followed by n_centroids.
+     */
+    std::vector<len_t> group_offsets;
+
     /**
      * Given a query and the results of the nearest centroid search,
      * this function sets the lists to be searched for the query.
@@ -70,17 +116,46 @@ namespace ann_dkvs
     void allocate_list_ids(Query *query, centroids_heap_t *nearest_centroids);
 
     /**
-     * Given a query and a centroid candidate, this function adds the candidate
-     * to the heap of candidates.
+     * Pushes the distances between a vector and the given centroids
+     * to the given heap of centroid candidates.
+     *
+     * @param vector A pointer to the vector.
+     * @param vectors A pointer to the first centroid.
+     * @param n_vectors The number of centroids.
+     * @param list_ids The list id of every centroid, or nullptr
+     *                 if the list id of a centroid is its index.
+     * @param candidates The heap keeping the nearest centroids.
+     */
+    void push_centroids(const vector_el_t *vector, const vector_el_t *vectors, const len_t n_vectors,
+                        const list_id_t *list_ids, centroids_heap_t &candidates) const;
+
+    /**
+     * Pushes the distances between a vector and the centroids
+     * to the given heap of centroid candidates.
      *
-     * The heap is only updated if the candidate is closer than the furthest
-     * candidate in the heap or if the heap is not full.
+     * Without groups, every centroid is pushed. Otherwise only the centroids
+     * of the n_groups_to_probe groups nearest to the vector are pushed,
+     * unless these groups hold fewer centroids than the capacity of the heap.
      *
-     * @param query A pointer to the query object.
-     * @param candidate A centroid candidate.
-     * @param candidates A heap of the nearest centroid candidates.
+     * @param vector A pointer to the vector.
+     * @param candidates The heap keeping the nearest centroids.
+     */
+    void find_nearest_centroids(const vector_el_t *vector, centroids_heap_t &candidates) const;
+
+    /**
+     * Clusters the centroids into groups with k-means,
+     * sets the group centroids and the group of every centroid.
+     *
+     * @param n_groups The number of groups.
+     * @param n_iterations The number of k-means iterations, at least 1.
+     * @param groups A pointer to n_centroids group ids which are set.
+     */
+    void train_groups(const len_t n_groups, const len_t n_iterations, len_t *groups);
+
+    /**
+     * Scales all centroid vectors to unit length.
      */
-    void add_candidate(const Query *query, const CentroidsResult &candidate, centroids_heap_t &candidates);
+    void normalize_centroids();
 
   public:
     /**
@@ -91,8 +166,9 @@ namespace ann_dkvs
      * @param vector_dim Dimension of the centroid vectors.
      * @param centroids Pointer to the centroid vectors.
      * @param n_centroids Number of centroid vectors.
+     * @param metric Metric used to compare query vectors with the centroids.
      */
-    RootIndex(len_t vector_dim, vector_el_t *centroids, len_t n_centroids);
+    RootIndex(len_t vector_dim, vector_el_t *centroids, len_t n_centroids, metric_t metric = METRIC_L2);
 
     /**
      * Destroys the root index object.
@@ -113,8 +189,77 @@ namespace ann_dkvs
      * Finds the nearest centroids of a list of queries
      * and sets the list ids to be searched.
      *
+     * on_assigned is called with every query as soon as its lists are set,
+     * e.g. to prefetch the lists while the remaining queries are assigned.
+     * It is called by the threads assigning the queries.
+     *
      * @param queries A query batch object.
+     * @param on_assigned The function called with every assigned query, or nullptr.
+     */
+    void batch_preassign_queries(QueryBatch queries, const std::function<void(const Query *)> &on_assigned = nullptr);
+
+    /**
+     * Assigns every vector of a batch to the list of its nearest centroid,
+     * i.e. preassigns it with n_probe = 1. The vectors are assigned
+     * in parallel unless PMODE is 0.
+     *
+     * @param vectors A pointer to the first vector.
+     * @param n_vectors The number of vectors.
+     * @param list_ids A pointer to n_vectors list ids which are set.
+     * @throws std::logic_error If the root index has no centroids.
+     */
+    void batch_assign_vectors(const vector_el_t *vectors, const len_t n_vectors, list_id_t *list_ids) const;
+
+    /**
+     * Adds a batch of vectors to the index by assigning them to the lists
+     * of their nearest centroids, see batch_assign_vectors(). The root index
+     * does not store the vectors: the caller inserts them into the lists
+     * of their storage node, e.g. with StorageLists::batch_insert_entries(),
+     * which creates lists which do not exist yet.
+     *
+     * @param vectors A pointer to the first vector.
+     * @param n_vectors The number of vectors.
+     * @return The id of the list of every vector.
+     * @throws std::logic_error If the root index has no centroids.
+     */
+    std::vector<list_id_t> add(const vector_el_t *vectors, const len_t n_vectors) const;
+
+    /**
+     * Clusters the centroids into groups, turning the root index into
+     * a two-level index: a query is compared with every group centroid
+     * and then only with the centroids of its n_groups_to_probe nearest groups.
+     * A query then costs about n_groups + n_groups_to_probe * n_centroids / n_groups
+     * distance computations instead of n_centroids, e.g. n_groups is
+     * about the square root of n_centroids, at the cost of missing centroids
+     * outside the probed groups.
+     *
+     * The groups are also used by batch_assign_vectors() and add().
+     * They must not be changed while queries are preassigned.
+     *
+     * @param n_groups The number of groups, or 0 to compare every centroid
+     *                 with a query again.
+     * @param n_groups_to_probe The number of groups probed per query.
+     * @param n_iterations The number of k-means iterations.
+     * @throws std::invalid_argument If n_groups exceeds n_centroids or
+     *                               n_groups_to_probe is not in [1, n_groups].
+     */
+    void build_centroid_groups(const len_t n_groups, const len_t n_groups_to_probe,
+                               const len_t n_iterations = CENTROID_GROUPS_N_TRAINING_ITERATIONS);
+
+    /**
+     * Sets the number of groups probed per query,
+     * trading the cost of preassigning a query for its recall.
+     * It must not be changed while queries are preassigned.
+     *
+     * @param n_groups_to_probe The number of groups probed per query.
+     * @throws std::logic_error If the centroids are not grouped.
+     * @throws std::invalid_argument If n_groups_to_probe is not in [1, n_groups].
      */
-    void batch_preassign_queries(QueryBatch queries);
+    void set_n_groups_to_probe(const len_t n_groups_to_probe);
+
+    len_t get_vector_dim() const;
+    len_t get_n_centroids() const;
+    len_t get_n_groups() const;
+    len_t get_n_groups_to_probe() const;
   };
 } // namespace ann_dkvs
\ No newline at end of file
@@ -1,15 +1,163 @@
 #pragma once
 
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
 #include "RootIndex.hpp"
+#include "StorageNodeClient.hpp"
 
 namespace ann_dkvs
 {
+  /**
+   * Address of a storage node, either a TCP endpoint
+   * or, if socket_path is not empty, a Unix domain socket.
+   */
+  struct StorageNodeAddress
+  {
+    std::string host;
+    uint16_t port;
+    std::string socket_path;
+  };
+
+  /**
+   * A shard of the lists, i.e. a storage node and the connection to it,
+   * which is opened when the shard is first searched.
+   */
+  struct Shard
+  {
+    StorageNodeAddress address;
+    std::unique_ptr<StorageNodeClient> client;
+  };
+
+  /**
+   * The queries of a batch which are sent to a shard, searching only
+   * the lists owned by the shard.
+   */
+  struct ShardBatch
+  {
+    /**
+     * Indices of the queries in the original batch.
+     */
+    std::vector<len_t> query_ids;
+
+    /**
+     * Lists to probe of all queries, which the queries point into.
+     */
+    std::vector<list_id_t> lists_to_probe;
+    std::vector<std::unique_ptr<Query>> queries;
+  };
+
+  /**
+   * The entry point of the distributed index: assigns queries to lists
+   * with the root index, searches the lists on the storage nodes owning
+   * them and merges their results.
+   *
+   * A root node keeps one connection per shard and must thus not search
+   * batches from several threads at once.
+   */
   class RootNode
   {
   private:
-    const RootIndex &index;
+    RootIndex &index;
+
+    /**
+     * The storage nodes the lists are distributed among.
+     */
+    std::vector<Shard> shards;
+
+    /**
+     * The index of the shard owning each list.
+     */
+    std::unordered_map<list_id_t, len_t> shard_by_list;
+
+    /**
+     * Splits the lists to probe of a batch of queries by the shard
+     * owning them.
+     *
+     * @param queries A batch of pre-assigned queries.
+     * @return A batch per shard, empty if no query probes the shard.
+     * @throws std::invalid_argument If a list is not assigned to a shard.
+     */
+    std::vector<ShardBatch> split_by_shard(const QueryBatch &queries) const;
+
+    /**
+     * Returns the connection to a shard, connecting if necessary.
+     *
+     * @throws std::runtime_error If the connection fails.
+     */
+    StorageNodeClient &get_client(const len_t shard_id);
+
+    /**
+     * Merges the results of the shards into the n_results nearest results
+     * of each query. The results of each shard are ordered, so they are
+     * merged by repeatedly taking the nearest head of the shard results.
+     *
+     * @param queries A batch of queries.
+     * @param shard_batches The batches sent to the shards.
+     * @param shard_results The results of the shards.
+     * @return A batch of query results.
+     */
+    QueryResultsBatch merge_shard_results(
+        const QueryBatch &queries,
+        const std::vector<ShardBatch> &shard_batches,
+        const std::vector<QueryResultsBatch> &shard_results) const;
 
   public:
-    RootNode(const RootIndex &index);
+    /**
+     * Creates a root node without any shards.
+     *
+     * @param index The root index assigning queries to lists.
+     */
+    RootNode(RootIndex &index);
+
+    /**
+     * Adds a storage node serving some of the lists.
+     *
+     * @param address The address of the storage node.
+     * @return The id of the shard.
+     */
+    len_t add_shard(const StorageNodeAddress &address);
+
+    /**
+     * Sets the shard owning a list.
+     *
+     * @param list_id The id of the list.
+     * @param shard_id The id of the shard, see add_shard().
+     * @throws std::out_of_range If the shard does not exist.
+     */
+    void assign_list(const list_id_t list_id, const len_t shard_id);
+
+    /**
+     * Returns the number of shards.
+     */
+    len_t get_n_shards() const;
+
+    /**
+     * Searches a batch of pre-assigned queries. The lists to probe of each
+     * query are split by the shard owning them, the sub-batches are sent
+     * to all shards before any response is awaited, so that the shards
+     * search them in parallel, and the partial results are merged.
+     *
+     * @param queries A batch of queries whose lists to probe are set.
+     * @return A batch of query results.
+     * @throws std::invalid_argument If a list is not assigned to a shard.
+     * @throws std::runtime_error If a shard cannot be reached or reports
+     *                            an error.
+     */
+    QueryResultsBatch batch_search_preassigned(const QueryBatch &queries);
+
+    /**
+     * Assigns a batch of queries to their nearest lists with the root index
+     * and searches them, see batch_search_preassigned().
+     *
+     * @param queries A batch of queries.
+     * @return A batch of query results.
+     * @throws std::invalid_argument If a query probes more lists than
+     *                               the root index has centroids.
+     */
+    QueryResultsBatch batch_search(const QueryBatch &queries);
   };
-}
\ No newline at end of file
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+
+#include "types.hpp"
+#include "StorageLists.hpp"
+
+#ifndef ASYNC_READ_QUEUE_DEPTH
+/**
+ * Maximum number of list reads an AsyncListReader keeps in flight.
+ */
+#define ASYNC_READ_QUEUE_DEPTH 64
+#endif
+
+/**
+ * Alignment of the offsets, sizes and buffers of reads with O_DIRECT,
+ * which must be a multiple of the logical block size of the device.
+ */
+#define ASYNC_READ_ALIGNMENT 4096
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace ann_dkvs
+{
+  /**
+   * A list read from the lists file into a buffer.
+   *
+   * - list_id: the id of the list
+   * - layout: the layout of the list, see StorageLists::get_list_layout()
+   * - buffer: the aligned buffer holding the list, freed once the last copy is destroyed
+   * - data: a pointer to the start of the list within the buffer
+   */
+  struct ListBuffer
+  {
+    list_id_t list_id;
+    ListLayout layout;
+    std::shared_ptr<uint8_t> buffer;
+    const uint8_t *data;
+  };
+
+  /**
+   * Reads lists from a lists file with asynchronous io_uring reads,
+   * bypassing the page cache with O_DIRECT, so that reading a batch of lists
+   * does not stall on page faults and a list can be processed as soon as it is read.
+   *
+   * If io_uring is not available, e.g. on kernels before 5.6 or if it is
+   * disabled, the lists are read one after another with pread(). If the file
+   * system does not support O_DIRECT, the lists are read through the page cache.
+   * io_uring is set up with raw system calls, so liburing is not required.
+   *
+   * A reader is meant to be created once and reused for every batch of lists,
+   * so that the file is opened and the ring is set up only once. Concurrent
+   * calls of read_lists() share the ring one after another.
+   */
+  class AsyncListReader
+  {
+  private:
+    /**
+     * A read in flight, i.e. the list being read
+     * and the number of bytes read so far.
+     */
+    struct PendingRead
+    {
+      ListBuffer list;
+      size_t aligned_offset;
+      size_t aligned_size;
+      size_t required_size;
+      size_t n_bytes_read;
+    };
+
+    const std::string filename;
+    const len_t queue_depth;
+    const size_t max_read_size;
+    int fd;
+    bool is_direct;
+
+    /**
+     * Serializes the batches read with the ring and their pending reads.
+     */
+    std::mutex read_mutex;
+
+    int ring_fd;
+    void *sq_ring;
+    void *cq_ring;
+    io_uring_sqe *sqes;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    io_uring_cqe *cqes;
+
+    /**
+     * Sets up an io_uring instance with the queue depth as number of entries.
+     *
+     * @return Whether io_uring is available.
+     */
+    bool setup_ring();
+
+    void release_ring();
+
+    /**
+     * Allocates the aligned buffer of a list and computes the aligned range to read.
+     */
+    PendingRead prepare_read(const list_id_t list_id, const ListLayout &layout) const;
+
+    /**
+     * Returns the number of bytes requested by the next read of a pending read,
+     * i.e. the remaining bytes, but at most max_read_size bytes.
+     */
+    size_t get_read_size(const PendingRead &read) const;
+
+    /**
+     * Queues a read of the remaining bytes of a pending read.
+     * The submission is passed to the kernel by the next call to io_uring_enter().
+     */
+    void queue_read(PendingRead *read);
+
+    /**
+     * Submits the queued reads and waits for at least n_completions completions.
+     *
+     * @throws std::runtime_error If io_uring_enter() fails.
+     */
+    void submit_and_wait(const unsigned n_submissions, const unsigned n_completions);
+
+    /**
+     * Processes the result of a read.
+     *
+     * @return Whether the read is complete, otherwise the rest of it has to be read.
+     * @throws std::runtime_error If the read failed or reached the end of the file.
+     */
+    bool complete_read(PendingRead *read, const int result) const;
+
+    void read_lists_async(
+        const std::vector<std::pair<list_id_t, ListLayout>> &lists,
+        const std::function<void(const ListBuffer &)> &on_read);
+
+    void read_lists_sync(
+        const std::vector<std::pair<list_id_t, ListLayout>> &lists,
+        const std::function<void(const ListBuffer &)> &on_read) const;
+
+  public:
+    /**
+     * Opens a lists file for reading lists.
+     *
+     * @param filename The name of the lists file, see StorageLists::get_filename().
+     * @param queue_depth The maximum number of reads in flight.
+     * @param max_read_size The maximum number of bytes requested by a single read,
+     *                      0 for no limit. Larger lists are read with several reads.
+     * @param use_io_uring Whether to read with io_uring if available,
+     *                     otherwise the lists are always read with pread().
+     * @throws std::invalid_argument If the queue depth is 0 or the maximum read size
+     *                               is not a multiple of ASYNC_READ_ALIGNMENT.
+     * @throws std::runtime_error If the file cannot be opened.
+     */
+    AsyncListReader(
+        const std::string &filename,
+        const len_t queue_depth = ASYNC_READ_QUEUE_DEPTH,
+        const size_t max_read_size = 0,
+        const bool use_io_uring = true);
+
+    ~AsyncListReader();
+
+    AsyncListReader(const AsyncListReader &) = delete;
+    AsyncListReader &operator=(const AsyncListReader &) = delete;
+
+    /**
+     * Reads the given lists, keeping up to queue_depth reads in flight,
+     * and calls on_read with every list as soon as it has been read.
+     * The lists are passed in the order their reads complete.
+     *
+     * on_read is called on the calling thread. It may keep a copy of the
+     * list buffer, e.g. to process it on another thread. Concurrent calls
+     * wait until the lists of the previous call are read.
+     *
+     * @param lists The ids and layouts of the lists to read.
+     * @param on_read The function called with every list read.
+     * @throws std::runtime_error If a list cannot be read.
+     */
+    void read_lists(
+        const std::vector<std::pair<list_id_t, ListLayout>> &lists,
+        const std::function<void(const ListBuffer &)> &on_read);
+
+    /**
+     * Returns whether the lists are read asynchronously with io_uring.
+     */
+    bool is_async() const;
+
+    /**
+     * Returns whether the lists are read with O_DIRECT.
+     */
+    bool is_direct_io() const;
+  };
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+
+#include "types.hpp"
+
+#ifndef EPOCH_MAX_READERS
+/**
+ * Number of readers which can be pinned at the same time by an
+ * EpochManager. Further readers wait until a pinned reader leaves.
+ */
+#define EPOCH_MAX_READERS 256
+#endif
+
+/**
+ * Size of a cache line, so that the reader slots of different threads
+ * do not share cache lines.
+ */
+#define EPOCH_CACHE_LINE_SIZE 64
+
+namespace ann_dkvs
+{
+  /**
+   * Epoch-based reclamation of memory which is shared by lock-free readers
+   * and a writer.
+   *
+   * A reader pins the current epoch for as long as it reads shared data.
+   * The writer publishes new versions of the data with atomic stores and
+   * retires the old versions, which are only reclaimed once every reader
+   * which could still see them has left its epoch.
+   *
+   * Pinning and leaving an epoch is thread-safe and lock-free as long as
+   * fewer than EPOCH_MAX_READERS readers are pinned. Retiring, advancing and
+   * reclaiming are expected to be called by one writer at a time.
+   */
+  class EpochManager
+  {
+  private:
+    /**
+     * The epoch pinned by a reader, 0 if the slot is unused.
+     */
+    struct alignas(EPOCH_CACHE_LINE_SIZE) ReaderSlot
+    {
+      std::atomic<uint64_t> epoch;
+    };
+
+    /**
+     * A retired item and the epoch it was retired in.
+     */
+    struct RetiredItem
+    {
+      uint64_t epoch;
+      std::function<void()> reclaim;
+    };
+
+    std::atomic<uint64_t> global_epoch;
+    std::unique_ptr<ReaderSlot[]> reader_slots;
+    std::deque<RetiredItem> retired_items;
+
+    /**
+     * Releases the slot of a reader.
+     */
+    void unpin(const len_t slot);
+
+  public:
+    /**
+     * Keeps the epoch of a reader pinned until it is destroyed.
+     * An empty guard pins nothing.
+     */
+    class Guard
+    {
+    private:
+      EpochManager *manager;
+      len_t slot;
+
+    public:
+      Guard();
+      Guard(EpochManager *manager, const len_t slot);
+      Guard(Guard &&other);
+      Guard &operator=(Guard &&other);
+      Guard(const Guard &) = delete;
+      Guard &operator=(const Guard &) = delete;
+      ~Guard();
+    };
+
+    EpochManager();
+
+    /**
+     * Reclaims every retired item. There must not be any pinned readers.
+     */
+    ~EpochManager();
+
+    /**
+     * Pins the current epoch, so that data which is retired from now on
+     * is not reclaimed until the returned guard is destroyed.
+     *
+     * @return The guard of the pinned epoch.
+     */
+    Guard pin();
+
+    /**
+     * Retires an item which has been replaced by a new version,
+     * so that it is reclaimed once no reader can see it anymore.
+     * The new version must have been published before the epoch is advanced.
+     *
+     * @param reclaim Reclaims the item, e.g. frees its memory.
+     */
+    void retire(std::function<void()> reclaim);
+
+    /**
+     * Advances the global epoch, so that readers pinned from now on
+     * see the versions published so far.
+     */
+    void advance();
+
+    /**
+     * Reclaims the retired items which no pinned reader can see anymore,
+     * i.e. those retired before the oldest epoch which is still pinned.
+     *
+     * @return The number of reclaimed items.
+     */
+    len_t reclaim();
+
+    /**
+     * Returns the number of items which are retired but not reclaimed yet.
+     */
+    len_t get_n_retired() const;
+
+    /**
+     * Returns the number of readers which are currently pinned.
+     */
+    len_t get_n_pinned() const;
+  };
+}
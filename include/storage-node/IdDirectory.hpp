@@ -0,0 +1,204 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "types.hpp"
+
+#define ID_DIRECTORY_MAGIC 0x53444949
+#define ID_DIRECTORY_VERSION 1
+
+namespace ann_dkvs
+{
+  /**
+   * The location of an entry within the lists.
+   *
+   * - list_id: the id of the list holding the entry
+   * - offset: the index of the entry within the list
+   */
+  struct EntryLocation
+  {
+    list_id_t list_id;
+    len_t offset;
+  };
+
+  /**
+   * A hash table from vector ids to the locations of their entries,
+   * stored in a memory-mapped file so that it does not have to be rebuilt
+   * from the lists whenever they are opened.
+   *
+   * The table uses open addressing with linear probing and is at most
+   * half full, so that ids are found, set and removed in O(1) on average.
+   * It is not synchronized, every access has to be serialized by the caller.
+   *
+   * The file is only a cache of the lists. A token identifies the state of
+   * the lists the file was synced with, see sync(). The token is reset before
+   * the first modification after a sync, so that a file which was modified
+   * but not synced is detected and rebuilt from the lists.
+   */
+  class IdDirectory
+  {
+  private:
+    /**
+     * Header at the start of the file, followed by capacity slots.
+     */
+    struct Header
+    {
+      uint32_t magic;
+      uint32_t version;
+      uint64_t capacity;
+      uint64_t n_ids;
+      uint64_t token;
+    };
+
+    /**
+     * A slot of the table, which is empty if its offset is EMPTY_OFFSET.
+     */
+    struct Slot
+    {
+      vector_id_t id;
+      EntryLocation location;
+    };
+
+    static constexpr len_t EMPTY_OFFSET = (len_t)-1;
+    static constexpr len_t MIN_CAPACITY = 16;
+
+    const std::string filename;
+    int fd;
+    uint8_t *base_ptr;
+    size_t mapped_size;
+    Header *header;
+    Slot *slots;
+
+    /**
+     * Resizes the file to hold the given number of slots and maps it.
+     * The header and the slots are left as they are in the file.
+     *
+     * @throws std::runtime_error If the file cannot be resized or mapped.
+     */
+    void map_file(const len_t capacity);
+
+    /**
+     * Unmaps the file if it is mapped.
+     */
+    void unmap_file();
+
+    /**
+     * Resizes the file to the given number of slots and empties them.
+     */
+    void reset(const len_t capacity);
+
+    /**
+     * Returns the index of the slot holding the given id,
+     * or of the empty slot the id would be stored in.
+     */
+    len_t find_slot(const vector_id_t id) const;
+
+    /**
+     * Returns the index of the first slot probed for the given id.
+     */
+    len_t get_home_slot(const vector_id_t id) const;
+
+    /**
+     * Empties the slot at the given index and moves the ids probed
+     * past it back, so that no empty slot ends their probe sequences.
+     */
+    void remove_slot(len_t index);
+
+    /**
+     * Copies the ids into a table of the given capacity.
+     */
+    void rehash(const len_t capacity);
+
+    /**
+     * Resets the token of the file before its first modification
+     * since the last sync and writes the header back.
+     *
+     * @throws std::runtime_error If the header cannot be written.
+     */
+    void mark_modified();
+
+  public:
+    /**
+     * Opens the directory stored in the given file, creating an empty
+     * directory if the file does not exist or is not a valid directory.
+     *
+     * @param filename The name of the file.
+     * @throws std::runtime_error If the file cannot be opened or mapped.
+     */
+    IdDirectory(const std::string &filename);
+
+    ~IdDirectory();
+
+    IdDirectory(const IdDirectory &) = delete;
+    IdDirectory &operator=(const IdDirectory &) = delete;
+
+    /**
+     * Looks up the location of the entry of the given id.
+     *
+     * @param id The vector id.
+     * @param location Set to the location of the entry if the id is found.
+     * @return Whether the id is found.
+     */
+    bool find(const vector_id_t id, EntryLocation &location) const;
+
+    /**
+     * Sets the location of the entry of the given id,
+     * replacing its previous location if any.
+     *
+     * @param id The vector id.
+     * @param location The location of its entry.
+     */
+    void set(const vector_id_t id, const EntryLocation &location);
+
+    /**
+     * Removes the given id.
+     *
+     * @param id The vector id.
+     * @return Whether the id was found.
+     */
+    bool remove(const vector_id_t id);
+
+    /**
+     * Removes the given id if its entry is at the given location,
+     * e.g. when the entry is overwritten by another one.
+     *
+     * @param id The vector id.
+     * @param location The location of the entry which is removed.
+     * @return Whether the id was removed.
+     */
+    bool remove(const vector_id_t id, const EntryLocation &location);
+
+    /**
+     * Removes every id and makes room for the given number of ids,
+     * so that the table does not grow while they are set.
+     *
+     * @param n_ids The number of ids to make room for.
+     */
+    void clear(const len_t n_ids = 0);
+
+    /**
+     * Returns the number of ids in the directory.
+     */
+    len_t get_length() const;
+
+    /**
+     * Returns the token the directory was synced with,
+     * or 0 if it has been modified since.
+     */
+    uint64_t get_token() const;
+
+    /**
+     * Writes the directory back to the file and marks it with the given token.
+     *
+     * @param token The token identifying the state of the lists, not 0.
+     * @throws std::runtime_error If the file cannot be written.
+     */
+    void sync(const uint64_t token);
+
+    /**
+     * Returns the name of the file.
+     */
+    std::string get_filename() const;
+  };
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <functional>
+
+#include "types.hpp"
+
+#ifndef SORT_MEMORY_BUDGET
+/**
+ * Number of bytes of entries an InputFileSorter holds in memory at once.
+ */
+#define SORT_MEMORY_BUDGET (1UL << 30)
+#endif
+
+#ifndef SORT_MAX_N_OPEN_FILES
+/**
+ * Maximum number of bucket files an InputFileSorter writes at once,
+ * which keeps it below the default limit of open files of a process.
+ */
+#define SORT_MAX_N_OPEN_FILES 256
+#endif
+
+#define SORT_BUCKET_FILENAME "sort_bucket_"
+#define SORT_PART_FILENAME "sort_part_"
+#define SORT_BUCKET_FILE_EXT ".bin"
+
+namespace ann_dkvs
+{
+  /**
+   * Sorts the input files of StorageLists::bulk_insert_entries(), i.e. the
+   * vectors, vector ids and list ids of entries, by list id with bounded memory,
+   * so that the entries of every list are contiguous and bulk insertion writes
+   * the lists sequentially. Entries of the same list keep their order.
+   *
+   * The entries are sorted in two passes over the data. The first pass
+   * partitions the entries into bucket files, each of which holds the entries
+   * of consecutive lists and fits into the memory budget, unless it holds
+   * a single larger list. The second pass loads the buckets one by one in order
+   * of their list ids, places the entries of each list at their final
+   * offsets and appends them to the output files.
+   *
+   * At most max_n_open_files files are written at once. If there are more
+   * buckets, the entries are first partitioned into part files of consecutive
+   * buckets, which are partitioned again until every file is a bucket.
+   */
+  class InputFileSorter
+  {
+  private:
+    typedef std::map<list_id_t, len_t> list_id_counts_map_t;
+
+    /**
+     * The bucket of a list and the offset in the bucket at which
+     * the next entry of the list is placed.
+     */
+    struct ListPosition
+    {
+      len_t bucket;
+      len_t offset;
+    };
+    typedef std::unordered_map<list_id_t, ListPosition> list_positions_map_t;
+
+    /**
+     * Reads the given number of entries in the format of a bucket file.
+     */
+    typedef std::function<void(uint8_t *entries, const len_t n_entries)> entry_reader_t;
+
+    const len_t vector_dim;
+    const std::string tmp_dir;
+    const size_t memory_budget;
+    const len_t max_n_open_files;
+
+    /**
+     * Returns the size of an entry in a bucket file, i.e. of its list id,
+     * vector id and vector.
+     */
+    size_t get_entry_size() const;
+
+    /**
+     * Returns the maximum number of entries held in memory at once.
+     */
+    len_t get_max_n_entries_in_memory() const;
+
+    std::string get_bucket_filename(const len_t bucket) const;
+
+    /**
+     * Returns the name of a part file of buckets.
+     *
+     * @param depth The number of passes that partitioned the entries before the part.
+     * @param part The index of the part within its pass.
+     */
+    std::string get_part_filename(const len_t depth, const len_t part) const;
+
+    /**
+     * Checks that a file holds the entries of n_entries entries.
+     *
+     * @throws std::runtime_error If the file cannot be opened or its size differs.
+     */
+    void check_file_size(const std::string &filename, const size_t entry_size, const len_t n_entries) const;
+
+    /**
+     * Counts the entries of every list in the list ids file.
+     */
+    list_id_counts_map_t count_entries(const std::string &list_ids_filename, const len_t n_entries) const;
+
+    /**
+     * Assigns the lists in order of their ids to buckets,
+     * starting a new bucket whenever a list would not fit into the current one.
+     *
+     * @param list_counts The number of entries of every list.
+     * @param list_positions The positions of the lists at the start of their buckets.
+     * @return The number of entries of every bucket.
+     */
+    std::vector<len_t> plan_buckets(const list_id_counts_map_t &list_counts, list_positions_map_t &list_positions) const;
+
+    /**
+     * Reads the input files and appends every entry to the file of its bucket.
+     */
+    void partition_input_entries(
+        const std::string &vectors_filename,
+        const std::string &ids_filename,
+        const std::string &list_ids_filename,
+        const len_t n_entries,
+        const list_positions_map_t &list_positions,
+        const std::vector<len_t> &bucket_sizes) const;
+
+    /**
+     * Appends every entry of the given buckets to the file of its bucket.
+     * If there are more buckets than max_n_open_files, the entries are
+     * appended to part files of consecutive buckets, which are partitioned
+     * recursively and removed afterwards.
+     *
+     * @param read_entries Reads the entries to partition.
+     * @param n_entries The number of entries to partition.
+     * @param list_positions The buckets of the lists.
+     * @param bucket_sizes The number of entries of every bucket.
+     * @param first_bucket The first bucket the entries belong to.
+     * @param end_bucket The bucket after the last bucket the entries belong to.
+     * @param depth The number of passes that partitioned the entries before.
+     */
+    void partition_entries(
+        const entry_reader_t &read_entries,
+        const len_t n_entries,
+        const list_positions_map_t &list_positions,
+        const std::vector<len_t> &bucket_sizes,
+        const len_t first_bucket,
+        const len_t end_bucket,
+        const len_t depth) const;
+
+    /**
+     * Sorts the entries of a bucket file by list id and appends them to the output files.
+     *
+     * @param list_positions The positions of the lists of the bucket, which are
+     *                       moved to the ends of the lists.
+     */
+    void write_bucket(
+        const len_t bucket,
+        const len_t n_bucket_entries,
+        list_positions_map_t &list_positions,
+        std::ofstream &vectors_file,
+        std::ofstream &ids_file,
+        std::ofstream &list_ids_file) const;
+
+    void remove_bucket_files(const len_t n_buckets) const;
+
+  public:
+    /**
+     * Constructs a sorter for entries of the given dimension.
+     *
+     * @param vector_dim The dimension of the vectors.
+     * @param tmp_dir The directory in which the bucket files are stored
+     *                while sorting.
+     * @param memory_budget The number of bytes of entries held in memory at once.
+     * @param max_n_open_files The maximum number of bucket files written at once.
+     * @throws std::invalid_argument If the vector dimension is 0 or
+     *                               max_n_open_files is less than 2.
+     */
+    InputFileSorter(
+        const len_t vector_dim,
+        const std::string &tmp_dir,
+        const size_t memory_budget = SORT_MEMORY_BUDGET,
+        const len_t max_n_open_files = SORT_MAX_N_OPEN_FILES);
+
+    /**
+     * Sorts the entries of the input files by list id
+     * and writes them to the output files in the same format.
+     *
+     * @param vectors_filename The name of the file containing the vectors.
+     * @param ids_filename The name of the file containing the vector ids.
+     * @param list_ids_filename The name of the file containing the list ids.
+     * @param n_entries The number of entries in the input files.
+     * @param sorted_vectors_filename The name of the file the sorted vectors are written to.
+     * @param sorted_ids_filename The name of the file the sorted vector ids are written to.
+     * @param sorted_list_ids_filename The name of the file the sorted list ids are written to.
+     * @throws std::runtime_error If a file cannot be read or written.
+     */
+    void sort(
+        const std::string &vectors_filename,
+        const std::string &ids_filename,
+        const std::string &list_ids_filename,
+        const len_t n_entries,
+        const std::string &sorted_vectors_filename,
+        const std::string &sorted_ids_filename,
+        const std::string &sorted_list_ids_filename) const;
+  };
+}
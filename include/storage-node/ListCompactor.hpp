@@ -0,0 +1,105 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "types.hpp"
+#include "StorageLists.hpp"
+
+#ifndef COMPACTION_MIN_DELETED_RATIO
+/**
+ * Ratio of deleted entries of a list from which on it is compacted
+ * by a ListCompactor.
+ */
+#define COMPACTION_MIN_DELETED_RATIO 0.25f
+#endif
+#ifndef COMPACTION_INTERVAL_MS
+/**
+ * Interval in milliseconds at which a ListCompactor looks for lists to compact.
+ */
+#define COMPACTION_INTERVAL_MS 1000
+#endif
+
+namespace ann_dkvs
+{
+  /**
+   * Compacts the lists of which many entries are deleted in the background,
+   * see StorageLists::delete_entries() and StorageLists::compact_list().
+   *
+   * A background thread looks for lists to compact every interval and
+   * whenever compact() is called. Every list is compacted while holding
+   * the given write mutex, which every other thread modifying the lists
+   * has to hold as well, so that inserts are only delayed by the compaction
+   * of a single list. The lists should have concurrent reads enabled if
+   * they are searched while they are compacted, see
+   * StorageLists::enable_concurrent_reads().
+   */
+  class ListCompactor
+  {
+  private:
+    StorageLists *lists;
+    std::mutex &write_mutex;
+    const float min_deleted_ratio;
+    const len_t interval_ms;
+
+    /**
+     * The number of passes requested by compact() and done so far,
+     * so that wait() returns once the pass it waits for is done.
+     */
+    len_t n_passes_requested;
+    len_t n_passes_done;
+    len_t n_lists_compacted;
+    bool is_stopping;
+    std::mutex mutex;
+    std::condition_variable pass_requested;
+    std::condition_variable pass_done;
+    std::thread compaction_thread;
+
+    /**
+     * Compacts every list with enough deleted entries.
+     */
+    void compact_lists();
+
+    /**
+     * Compacts the lists every interval until the compactor is stopped.
+     */
+    void run();
+
+  public:
+    /**
+     * Creates a compactor for the given lists and starts its background thread.
+     *
+     * @param lists The lists to compact.
+     * @param write_mutex The mutex held by every thread modifying the lists.
+     * @param min_deleted_ratio The ratio of deleted entries from which on
+     *                          a list is compacted.
+     * @param interval_ms The interval at which lists to compact are looked for.
+     */
+    ListCompactor(StorageLists *lists, std::mutex &write_mutex, const float min_deleted_ratio = COMPACTION_MIN_DELETED_RATIO, const len_t interval_ms = COMPACTION_INTERVAL_MS);
+
+    /**
+     * Stops the background thread once the list being compacted is done.
+     */
+    ~ListCompactor();
+
+    ListCompactor(const ListCompactor &) = delete;
+    ListCompactor &operator=(const ListCompactor &) = delete;
+
+    /**
+     * Asks the background thread to look for lists to compact right away.
+     */
+    void compact();
+
+    /**
+     * Waits until the lists have been compacted by a pass
+     * which started after the last call of compact().
+     */
+    void wait();
+
+    /**
+     * Returns the number of lists compacted so far.
+     */
+    len_t get_n_lists_compacted();
+  };
+}
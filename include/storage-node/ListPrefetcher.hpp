@@ -0,0 +1,115 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "types.hpp"
+#include "Query.hpp"
+#include "StorageLists.hpp"
+
+namespace ann_dkvs
+{
+  /**
+   * Asks the kernel to read the lists probed by pre-assigned queries
+   * into the page cache before they are scanned, see StorageLists::prefetch_list().
+   *
+   * The lists are passed to prefetch() as soon as the queries are assigned,
+   * e.g. by RootIndex::batch_preassign_queries(), and are advised by a background
+   * thread, so that the disk reads overlap with the assignment of the remaining
+   * queries and with scanning the first lists. Pending lists are advised in order
+   * of the number of queries probing them, so the lists most queries wait for
+   * are read first.
+   *
+   * Prefetching is only a hint and has no effect on the results of a search.
+   * The lists are expected not to be resized while they are prefetched.
+   */
+  class ListPrefetcher
+  {
+  private:
+    /**
+     * A list waiting to be advised, ordered by the number of queries
+     * probing it (descending) and then by its id.
+     */
+    struct PendingList
+    {
+      len_t n_probes;
+      list_id_t list_id;
+      friend bool operator<(const PendingList &a, const PendingList &b)
+      {
+        return a.n_probes > b.n_probes || (a.n_probes == b.n_probes && a.list_id < b.list_id);
+      }
+    };
+
+    const StorageLists *lists;
+
+    /**
+     * The pending lists in the order they are advised,
+     * and the number of queries probing each pending list.
+     */
+    std::set<PendingList> pending_lists;
+    std::map<list_id_t, len_t> pending_n_probes;
+
+    len_t n_lists_prefetched;
+    bool is_prefetching;
+    bool is_stopping;
+    std::mutex mutex;
+    std::condition_variable lists_available;
+    std::condition_variable lists_prefetched;
+    std::thread prefetch_thread;
+
+    /**
+     * Adds a probe of a list to the pending lists. Expects the mutex to be held.
+     */
+    void add_probe(const list_id_t list_id);
+
+    /**
+     * Advises the pending lists until the prefetcher is stopped.
+     */
+    void run();
+
+  public:
+    /**
+     * Creates a prefetcher for the given lists and starts its background thread.
+     *
+     * @param lists The lists to prefetch.
+     */
+    ListPrefetcher(const StorageLists *lists);
+
+    /**
+     * Stops the background thread. Pending lists are not advised.
+     */
+    ~ListPrefetcher();
+
+    ListPrefetcher(const ListPrefetcher &) = delete;
+    ListPrefetcher &operator=(const ListPrefetcher &) = delete;
+
+    /**
+     * Queues the lists probed by a pre-assigned query for prefetching.
+     * Lists which do not exist are skipped. May be called by several threads.
+     *
+     * @param query A query whose lists to probe have been set.
+     */
+    void prefetch(const Query *query);
+
+    /**
+     * Queues the lists probed by a batch of pre-assigned queries for prefetching.
+     *
+     * @param queries A batch of queries whose lists to probe have been set.
+     */
+    void prefetch(const QueryBatch &queries);
+
+    /**
+     * Waits until all queued lists have been advised.
+     */
+    void wait();
+
+    /**
+     * Returns the number of lists advised so far.
+     */
+    len_t get_n_lists_prefetched();
+  };
+}
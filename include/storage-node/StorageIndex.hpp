@@ -1,30 +1,24 @@
 #pragma once
 
 #include <string>
-#include <queue>
+#include <map>
+#include <functional>
 
 #include "StorageLists.hpp"
-#include "L2Space.hpp"
+#include "Space.hpp"
 #include "Query.hpp"
+#include "TopK.hpp"
+#include "ProductQuantizer.hpp"
+#include "ScalarQuantizer.hpp"
+#include "AsyncListReader.hpp"
 
 namespace ann_dkvs
 {
   /**
-   * @brief A class that implements a comparison function used for a max heap.
+   * Data structure used to store the results of a query,
+   * i.e. its n_results nearest candidates.
    */
-  class VectorDistanceIdMaxHeapCompare
-  {
-  public:
-    bool operator()(const QueryResult &parent, const QueryResult &child) const
-    {
-      bool swapParentWithChild = parent < child;
-      return swapParentWithChild;
-    }
-  };
-  /**
-   * Data structure used to store the results of a query.
-   */
-  typedef std::priority_queue<QueryResult, std::vector<QueryResult>, VectorDistanceIdMaxHeapCompare> heap_t;
+  typedef TopK<QueryResult> heap_t;
 
   /**
    * Internal data structure representing a work iterm for a thread.
@@ -37,6 +31,31 @@ namespace ann_dkvs
    */
   typedef std::vector<QueryListPair> QueryListPairs;
 
+  /**
+   * Internal data structure grouping the work items of a batch by list,
+   * i.e. the id of a list and the indices of all work items probing it.
+   */
+  typedef std::map<list_id_t, std::vector<len_t>> ListWorkItemsMap;
+
+#ifndef BATCHED_SCAN_BLOCK_SIZE
+/**
+ * Number of list entries whose distances to the queries of a batch
+ * are computed together in PMODE 3. The block of vectors is read from
+ * the mmap'ed lists once and then stays in the cache while it is
+ * compared to every query probing the list.
+ */
+#define BATCHED_SCAN_BLOCK_SIZE 256
+#endif
+
+#ifndef PQ_RERANK_FACTOR
+/**
+ * If product-quantized lists are searched with re-ranking, each list
+ * keeps PQ_RERANK_FACTOR * n_results candidates by their approximate
+ * distance, which are then re-ranked by their exact distance.
+ */
+#define PQ_RERANK_FACTOR 4
+#endif
+
   class StorageIndex
   {
 
@@ -47,12 +66,117 @@ namespace ann_dkvs
      */
     const StorageLists *lists;
 
+    /**
+     * Metric of the stored vectors, taken from the storage lists object.
+     */
+    const metric_t metric;
+
     /**
      * Distance function used to compute the distance
      * between query vector and the vectors within a list.
      */
     const distance_func_t distance_func;
 
+    /**
+     * Inner product kernel which is combined with the precomputed
+     * inverse norms of the lists if the metric is METRIC_COSINE.
+     */
+    const distance_func_t inner_product_func;
+
+    /**
+     * Product quantizer the codes of the lists were encoded with,
+     * nullptr if the lists store raw vectors.
+     */
+    const ProductQuantizer *quantizer;
+
+    /**
+     * Centroids of the lists the residuals of the codes are relative to,
+     * where the centroid of list i starts at centroids[i * vector_dim].
+     * Only used if the lists store codes.
+     */
+    const vector_el_t *centroids;
+
+    /**
+     * Optional storage lists object holding the raw vectors
+     * of the product-quantized lists, used for re-ranking.
+     */
+    const StorageLists *raw_lists;
+
+    /**
+     * Scalar quantizer the codes of the lists were encoded with,
+     * nullptr unless the lists store scalar-quantized vectors.
+     */
+    const ScalarQuantizer *scalar_quantizer;
+
+    /**
+     * The reader of the lists of a batch if they are read from the lists file,
+     * created once by enable_async_reads() and reused for every batch,
+     * nullptr if the lists are accessed through the memory-mapped region.
+     */
+    std::unique_ptr<AsyncListReader> async_reader;
+
+    /**
+     * Returns the parts of a list within the memory-mapped lists.
+     *
+     * @param list_id The id of the list.
+     * @return The parts of the list.
+     */
+    ListData get_list_data(const list_id_t list_id) const;
+
+    /**
+     * Returns the parts of a list within the buffer it was read into.
+     *
+     * @param list The list read by an AsyncListReader.
+     * @return The parts of the list.
+     */
+    ListData get_list_data(const ListBuffer &list) const;
+
+    /**
+     * Sets the distances of the deleted entries within a block of a list
+     * to NaN, which TopK::push_batch() never keeps. The tombstones covering
+     * the block are checked a word of 64 entries at a time first, so blocks
+     * without deleted entries are left as they are.
+     *
+     * @param list The parts of the list.
+     * @param block_start The position of the first entry of the block.
+     * @param block_size The number of entries in the block.
+     * @param distances The distances of the entries of the block.
+     */
+    void mask_deleted_entries(const ListData &list, const size_t block_start, const size_t block_size, distance_t *distances) const;
+
+    /**
+     * Searches a single product-quantized list for the nearest neighbors
+     * of a query using ADC lookup tables.
+     *
+     * If raw lists are given, the PQ_RERANK_FACTOR * n_results nearest
+     * candidates by approximate distance are re-ranked by exact distance.
+     *
+     * @param query A pointer to a query object.
+     * @param list_id The id of the list to search.
+     * @param list The parts of the list to search.
+     * @param candidates A reference to a heap of query results used to store the query results.
+     */
+    void search_preassigned_quantized_list(
+        const Query *query,
+        const list_id_t list_id,
+        const ListData &list,
+        heap_t &candidates) const;
+
+    /**
+     * Searches a single scalar-quantized list for the nearest neighbors
+     * of a query, comparing the query with the codes without decoding them.
+     *
+     * @param query A pointer to a query object.
+     * @param list_id The id of the list to search.
+     * @param list The parts of the list to search.
+     * @param candidates A reference to a heap of query results used to store the query results.
+     */
+    void search_preassigned_scalar_quantized_list(
+        const Query *query,
+        const list_id_t list_id,
+        const ListData &list,
+        heap_t &candidates) const;
+
     /**
      * Converts a heap of results into a QueryResults object,
      * i.e. a vector of QueryResult objects.
@@ -67,11 +191,13 @@ namespace ann_dkvs
      *
      * @param query A pointer to a query object.
      * @param list_id The id of the list to search.
+     * @param list The parts of the list to search.
      * @param candidates A reference to a heap of query results used to store the query results.
      */
     void search_preassigned_list(
         const Query *query,
         const list_id_t list_id,
+        const ListData &list,
         heap_t &candidates) const;
 
     /**
@@ -85,30 +211,189 @@ namespace ann_dkvs
     QueryListPairs get_work_items(const QueryBatch &queries) const;
 
     /**
-     * Adds a given query result to the heap of candidate results.
+     * Groups the work items of a batch of queries by list,
+     * so that each list is scanned only once per batch.
      *
-     * Only updates the heap if the candidate result is closer
-     * than the furthest result in the heap or if the heap is not full.
+     * @param work_items The work items of a batch, see get_work_items().
+     * @return A map from list ids to the indices of the work items probing the list.
+     */
+    ListWorkItemsMap get_work_items_by_list(const QueryListPairs &work_items) const;
+
+    /**
+     * Checks if the lists are spread across NUMA nodes,
+     * see StorageLists::set_mapping_policy().
+     *
+     * @return True if the items are to be searched by search_items_on_numa_nodes().
+     */
+    bool is_numa_aware() const;
+
+    /**
+     * Searches items, e.g. work items, in parallel, where each item scans
+     * a single list. The items are grouped by the NUMA node of their list and
+     * every thread first searches the items of its node, so that it scans
+     * lists in local memory. Unless OpenMP binds the threads to places
+     * (OMP_PROC_BIND), the threads are spread evenly across the nodes and
+     * pinned to the CPUs of their node while searching. Otherwise, or if
+     * a thread cannot be pinned, its node is the one it is running on.
+     * Threads which are done then help with the items of the other nodes,
+     * so that the items of nodes without threads are searched as well.
+     *
+     * @param item_list_ids The id of the list each item scans.
+     * @param search_item The function searching the item of the given index.
+     */
+    void search_items_on_numa_nodes(
+        const std::vector<list_id_t> &item_list_ids,
+        const std::function<void(const len_t)> &search_item) const;
+
+    /**
+     * Merges the results of the work items of a batch into the results
+     * of each query. Every work item owns its slot in work_item_results,
+     * so the work items are searched without any synchronization and the
+     * queries are merged in parallel afterwards. As the work items of a
+     * query are contiguous and results are ordered by distance and vector id,
+     * the merged results do not depend on the number of threads.
+     *
+     * @param queries A batch of queries.
+     * @param work_item_results The results of each work item, see get_work_items().
+     * @return A batch of query results.
+     */
+    QueryResultsBatch merge_work_item_results(
+        const QueryBatch &queries,
+        const std::vector<QueryResults> &work_item_results) const;
+
+    /**
+     * Computes the term of the distance which only depends on the query,
+     * i.e. the inverse norm of the query for METRIC_COSINE, once per batch.
+     * Unused for the other metrics.
      *
      * @param query A pointer to a query object.
-     * @param candidate A query result,
-     *                   i.e. a pair of a distance and a vector id.
-     * @param candidates A reference to a heap of query results used to store the query results.
+     * @return The query term of the distance.
      */
-    void add_candidate(const Query *query, const QueryResult &candidate, heap_t &candidates) const;
+    distance_t get_query_term(const Query *query) const;
+
+    /**
+     * Searches a single list for the nearest neighbors of all queries
+     * probing it. The list is scanned in blocks of BATCHED_SCAN_BLOCK_SIZE
+     * entries and each block is compared to all queries before the next
+     * block is read, so that the block is loaded from memory once. The
+     * distances are computed exactly like in search_preassigned_list().
+     *
+     * @param queries A batch of queries.
+     * @param query_terms The query terms of the distances, see get_query_term().
+     * @param list_id The id of the list to search.
+     * @param list The parts of the list to search.
+     * @param query_ids The ids of the queries probing the list.
+     * @param candidates Heaps of query results, one per query id in query_ids.
+     */
+    void search_preassigned_list_batched(
+        const QueryBatch &queries,
+        const std::vector<distance_t> &query_terms,
+        const list_id_t list_id,
+        const ListData &list,
+        const std::vector<len_t> &query_ids,
+        std::vector<heap_t> &candidates) const;
+
+    /**
+     * Searches a single scalar-quantized list for the nearest neighbors
+     * of all queries probing it, block by block like
+     * search_preassigned_list_batched().
+     *
+     * @param queries A batch of queries.
+     * @param list_id The id of the list to search.
+     * @param list The parts of the list to search.
+     * @param query_ids The ids of the queries probing the list.
+     * @param candidates Heaps of query results, one per query id in query_ids.
+     */
+    void search_preassigned_scalar_quantized_list_batched(
+        const QueryBatch &queries,
+        const list_id_t list_id,
+        const ListData &list,
+        const std::vector<len_t> &query_ids,
+        std::vector<heap_t> &candidates) const;
+
+    /**
+     * Searches a list for all work items probing it, like a work item of PMODE 2
+     * or a list of PMODE 3, and stores the results of each work item.
+     *
+     * @param queries A batch of queries.
+     * @param query_terms The query terms of the distances, see get_query_term().
+     * @param list_id The id of the list to search.
+     * @param list The parts of the list to search.
+     * @param work_items The work items of the batch, see get_work_items().
+     * @param work_item_ids The indices of the work items probing the list.
+     * @param work_item_results The results of each work item.
+     */
+    void search_work_items_of_list(
+        const QueryBatch &queries,
+        const std::vector<distance_t> &query_terms,
+        const list_id_t list_id,
+        const ListData &list,
+        const QueryListPairs &work_items,
+        const std::vector<len_t> &work_item_ids,
+        std::vector<QueryResults> &work_item_results) const;
+
+    /**
+     * Searches a batch of queries, reading all lists probed by the batch
+     * with an AsyncListReader and searching each list as soon as it is read.
+     *
+     * @param queries A batch of queries.
+     * @return A batch of query results.
+     * @throws std::runtime_error If the lists cannot be read.
+     */
+    QueryResultsBatch batch_search_preassigned_async(const QueryBatch &queries) const;
 
   public:
     /**
      * Creates a new storage index object.
      *
+     * The vectors are compared with the metric of the storage lists object.
+     *
      * @param lists A pointer to a storage lists object
      */
     StorageIndex(const StorageLists *lists);
 
+    /**
+     * Creates a new storage index object searching product-quantized lists.
+     *
+     * The codes of list i must encode the residuals of its vectors to the
+     * centroid of list i. If raw lists are given, they must hold the
+     * original vectors of every list in the same order as the codes.
+     *
+     * Lists in the fast-scan layout are scanned with a quantized lookup
+     * table held in registers, which requires a quantizer with 4-bit codes.
+     *
+     * @param lists A pointer to a storage lists object storing codes.
+     * @param quantizer The product quantizer the codes were encoded with.
+     * @param centroids The centroids of the lists, e.g. of the root index.
+     * @param raw_lists A pointer to a storage lists object storing the raw
+     *                  vectors used for re-ranking, or nullptr.
+     * @throws std::invalid_argument If the lists, the quantizer and
+     *                               the raw lists do not match.
+     */
+    StorageIndex(
+        const StorageLists *lists,
+        const ProductQuantizer *quantizer,
+        const vector_el_t *centroids,
+        const StorageLists *raw_lists = nullptr);
+
+    /**
+     * Creates a new storage index object searching scalar-quantized lists.
+     *
+     * @param lists A pointer to a storage lists object storing the codes
+     *              of the scalar quantizer.
+     * @param scalar_quantizer The trained scalar quantizer the codes were encoded with.
+     * @throws std::invalid_argument If the lists and the quantizer do not match
+     *                               or if the quantizer is not trained.
+     */
+    StorageIndex(const StorageLists *lists, const ScalarQuantizer *scalar_quantizer);
+
     /**
      * Searches all lists of a query selected for probing
      * to find the query's nearest neighbors.
      *
+     * If concurrent reads of the lists are enabled, the lists are pinned
+     * while they are searched, so they may be modified by another thread.
+     *
      * @param query A pointer to a query object.
      * @return A vector of query results.
      */
@@ -118,10 +403,40 @@ namespace ann_dkvs
      * Searches all lists of a batch of queries selected for probing
      * to find the queries' nearest neighbors.
      *
+     * If concurrent reads of the lists are enabled, the lists are pinned
+     * until the whole batch is searched, see StorageLists::enable_concurrent_reads().
+     *
      * @param queries A batch of queries, i.e. a vector of query objects.
      * @return A batch of query results,
      *          i.e. a vector of vectors of query results.
      */
     QueryResultsBatch batch_search_preassigned(const QueryBatch &queries) const;
+
+    /**
+     * Reads the lists probed by a batch of queries from the lists file with
+     * asynchronous reads, see AsyncListReader, instead of accessing them through
+     * the memory-mapped region, which stalls on page faults if the lists do not
+     * fit into memory. The lists must have been written back to the file, e.g. by
+     * StorageLists::flush(). Single queries are still searched in the mapped region.
+     *
+     * The lists file is opened and io_uring is set up once, the reader
+     * is shared by all batches searched until async reads are disabled.
+     *
+     * @param queue_depth The maximum number of lists read at once.
+     * @throws std::invalid_argument If the queue depth is 0.
+     * @throws std::runtime_error If the lists file cannot be opened.
+     */
+    void enable_async_reads(const len_t queue_depth = ASYNC_READ_QUEUE_DEPTH);
+
+    /**
+     * Accesses the lists through the memory-mapped region again.
+     */
+    void disable_async_reads();
+
+    /**
+     * Returns the reader of the lists of a batch,
+     * nullptr if async reads are not enabled.
+     */
+    const AsyncListReader *get_async_reader() const;
   };
 }
\ No newline at end of file
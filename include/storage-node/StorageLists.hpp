@@ -1,15 +1,24 @@
 #pragma once
 
+#include <cstdint>
 #include <unordered_map>
+#include <map>
+#include <set>
 #include <vector>
 #include <string>
+#include <memory>
+#include <atomic>
 
 #include "types.hpp"
+#include "Space.hpp"
+#include "FastScan.hpp"
+#include "ScalarQuantizer.hpp"
+#include "WriteAheadLog.hpp"
+#include "EpochManager.hpp"
+#include "IdDirectory.hpp"
 
 #define PROT_READ 0x1
 #define PROT_WRITE 0x2
-#define FLAG_READ "r"
-#define FLAG_READ_WRITE "r+"
 
 #ifndef MIN_TOTAL_SIZE_BYTES
 #define MIN_TOTAL_SIZE_BYTES 32
@@ -23,9 +32,172 @@
 #ifndef DYNAMIC_INSERTION
 #define DYNAMIC_INSERTION 1
 #endif
+#ifndef BULK_INSERT_N_RANGES
+/**
+ * Number of ranges of the input files which are read in parallel
+ * by bulk_insert_entries() unless entries are inserted dynamically.
+ */
+#define BULK_INSERT_N_RANGES 64
+#endif
+#ifndef REGION_RESERVATION_SIZE
+/**
+ * Size in bytes of the range of virtual addresses reserved for the
+ * memory-mapped region, into which the file is mapped as it grows.
+ * Only address space is reserved, no memory.
+ */
+#define REGION_RESERVATION_SIZE (1UL << 40)
+#endif
+#ifndef WAL_CHECKPOINT_SIZE
+/**
+ * Size of the write-ahead log in bytes after which the lists are
+ * checkpointed, i.e. flushed, and the log is truncated.
+ */
+#define WAL_CHECKPOINT_SIZE (64UL << 20)
+#endif
+#ifndef LIST_ALIGNMENT
+/**
+ * Alignment in bytes of the vector block, the id block and the inverse norm
+ * block of every list, a power of two. The default of one cache line keeps
+ * lists from sharing cache lines, 4096 keeps them from sharing pages.
+ */
+#define LIST_ALIGNMENT 64
+#endif
+#ifndef USE_HUGE_PAGES
+/**
+ * Whether the memory-mapped region is backed by transparent huge pages
+ * by default, see StorageLists::set_mapping_policy().
+ */
+#define USE_HUGE_PAGES 0
+#endif
+#ifndef N_NUMA_NODES
+/**
+ * Number of NUMA nodes the lists are spread across by default,
+ * 0 for the number of nodes of the machine, see StorageLists::set_mapping_policy().
+ */
+#define N_NUMA_NODES 1
+#endif
+#ifndef NUMA_CHUNK_SIZE
+/**
+ * Size in bytes of the chunks of the memory-mapped region which are
+ * assigned to the NUMA nodes in turn, see StorageLists::set_mapping_policy().
+ */
+#define NUMA_CHUNK_SIZE (64UL << 20)
+#endif
+
+/**
+ * Size of a huge page in bytes. The reserved range of addresses
+ * is aligned to it, so that the region can be backed by huge pages.
+ */
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+/**
+ * The metadata of the lists, i.e. the location of every list and the free
+ * slots within the lists file, are stored in a sidecar file next to it.
+ */
+#define METADATA_FILE_EXT ".meta"
+#define METADATA_MAGIC 0x4154454D
+#define METADATA_VERSION 5
+
+/**
+ * The modifications since the last flush are logged to a file next to
+ * the lists file if the write-ahead log is enabled.
+ */
+#define LOG_FILE_EXT ".wal"
+
+/**
+ * The id directory of the lists is stored in a file next to
+ * the lists file if it is enabled.
+ */
+#define ID_DIRECTORY_FILE_EXT ".ids"
 
 namespace ann_dkvs
 {
+  /**
+   * Specifies how the codes of a list are laid out in memory.
+   *
+   * - CODE_LAYOUT_PACKED: the codes are stored one after another.
+   * - CODE_LAYOUT_FAST_SCAN: 4-bit codes are interleaved in blocks
+   *   of FAST_SCAN_BLOCK_SIZE codes, see set_fast_scan_code().
+   */
+  enum code_layout_t
+  {
+    CODE_LAYOUT_PACKED = 0,
+    CODE_LAYOUT_FAST_SCAN = 1
+  };
+
+  /**
+   * Specifies how an existing lists file is opened.
+   *
+   * - OPEN_MODE_READ_ONLY: the lists are mapped read-only and cannot be modified.
+   * - OPEN_MODE_READ_WRITE: the lists can be modified and their metadata
+   *   is written back by flush() and on destruction.
+   */
+  enum open_mode_t
+  {
+    OPEN_MODE_READ_ONLY = 0,
+    OPEN_MODE_READ_WRITE = 1
+  };
+
+  /**
+   * Position of an inverted list within the lists file and of its parts
+   * relative to the start of the list, used to read a list from the file
+   * instead of accessing it through the memory-mapped region.
+   *
+   * - offset: offset of the list in bytes relative to the start of the file
+   * - size: allocated size of the list in bytes
+   * - ids_offset: offset of the vector ids relative to the start of the list
+   * - inverse_norms_offset: offset of the inverse norms relative to the start of the list
+   * - tombstones_offset: offset of the tombstones relative to the start of the list
+   * - length: number of entries in use
+   */
+  struct ListLayout
+  {
+    size_t offset;
+    size_t size;
+    size_t ids_offset;
+    size_t inverse_norms_offset;
+    size_t tombstones_offset;
+    len_t length;
+  };
+
+  /**
+   * Points to the parts of a list, either within the memory-mapped lists
+   * or within a buffer the list was read into.
+   * The codes point to the raw vectors if the lists store vectors,
+   * the inverse norms are nullptr unless the metric is METRIC_COSINE.
+   * Bit i % 64 of tombstones[i / 64] is set if entry i has been deleted.
+   */
+  struct ListData
+  {
+    const uint8_t *codes;
+    const vector_id_t *ids;
+    const distance_t *inverse_norms;
+    const uint64_t *tombstones;
+    len_t length;
+  };
+
+  /**
+   * Specifies how the memory-mapped region of the lists is backed by memory.
+   *
+   * - use_huge_pages: whether the region is advised with MADV_HUGEPAGE,
+   *   which reduces TLB misses while scanning. The kernel only backs shared
+   *   file mappings on tmpfs by transparent huge pages, lists files on
+   *   e.g. ext4 or xfs keep regular pages
+   * - n_numa_nodes: number of NUMA nodes the lists are spread across, 1 to
+   *   leave the placement to the kernel. The region is split into chunks
+   *   of numa_chunk_size bytes, where chunk i is placed on node i % n_numa_nodes,
+   *   so that no page is shared by two nodes and the nodes of the existing
+   *   chunks do not change as the region grows
+   * - numa_chunk_size: size of the chunks in bytes, a multiple of the page
+   *   size, 0 for NUMA_CHUNK_SIZE
+   */
+  struct MappingPolicy
+  {
+    bool use_huge_pages;
+    len_t n_numa_nodes;
+    size_t numa_chunk_size;
+  };
+
   class StorageLists
   {
   private:
@@ -45,6 +217,42 @@ namespace ann_dkvs
       len_t used_entries;
     };
 
+    /**
+     * A version of an inverted list as seen by concurrent readers,
+     * see enable_concurrent_reads(). It points into the memory-mapped region
+     * directly, so that readers never access the members of the lists object
+     * which are modified by the writer.
+     */
+    struct ListVersion
+    {
+      ListData data;
+      ListLayout layout;
+    };
+
+    /**
+     * An entry of the table of published list versions. The id is written
+     * before the entry is marked as used and never changes afterwards.
+     */
+    struct PublishedListEntry
+    {
+      std::atomic<bool> is_used;
+      list_id_t list_id;
+      std::atomic<const ListVersion *> version;
+    };
+
+    /**
+     * A hash table with open addressing from list ids to the published
+     * versions of the lists, which is read without locks. Entries are never
+     * removed, so that readers can probe it while the writer inserts.
+     * It is at most half full and replaced by a larger copy otherwise.
+     */
+    struct PublishedListTable
+    {
+      len_t capacity;
+      len_t n_used;
+      std::unique_ptr<PublishedListEntry[]> entries;
+    };
+
     /**
      * Contains meta-data about a free slot of memory in the memory-mapped file
      * which can be used to allocate new inverted lists or extend existing ones.
@@ -58,6 +266,36 @@ namespace ann_dkvs
       size_t size;
     };
 
+    /**
+     * Fixed-size part of the metadata file, followed by n_lists pairs of
+     * a list id and an InvertedList and by n_free_slots Slot objects.
+     */
+    struct MetadataHeader
+    {
+      uint32_t magic;
+      uint32_t version;
+      uint64_t vector_dim;
+      uint64_t code_size;
+      uint64_t code_layout;
+      uint64_t metric;
+      uint64_t total_size;
+      uint64_t n_lists;
+      uint64_t n_free_slots;
+      uint64_t log_generation;
+      uint64_t list_alignment;
+      uint64_t id_directory_token;
+    };
+
+    /**
+     * The contents of a metadata file.
+     */
+    struct Metadata
+    {
+      MetadataHeader header;
+      std::vector<std::pair<list_id_t, InvertedList>> lists;
+      std::vector<Slot> free_slots;
+    };
+
     /**
      * A type that represents a map from list ids to inverted lists.
      */
@@ -70,11 +308,23 @@ namespace ann_dkvs
      */
     typedef std::unordered_map<list_id_t, len_t> list_id_counts_map_t;
 
+    /**
+     * A type that represents a map from the offsets of free slots
+     * to their sizes, ordered by offset.
+     */
+    typedef std::map<size_t, size_t> offset_size_map_t;
+
+    /**
+     * A type that represents a set of pairs of the size and the offset
+     * of free slots, ordered by size and then by offset.
+     */
+    typedef std::set<std::pair<size_t, size_t>> size_offset_set_t;
+
     /**
      * A type that represents an iterator over the slots
-     * in the free_slots vector used to allocate and free slots.
+     * in the free_slots map used to allocate and free slots.
      */
-    typedef std::vector<StorageLists::Slot>::iterator slot_it_t;
+    typedef offset_size_map_t::iterator slot_it_t;
 
     /**
      * Specifies the location of the memory-mapped file
@@ -88,40 +338,224 @@ namespace ann_dkvs
 
     /**
      * Specifies the size of the vectors stored in the inverted lists
-     * in bytes.
+     * in bytes, i.e. the size of a code if the lists store codes.
      */
     const size_t vector_size;
 
+    /**
+     * Specifies the size of the codes stored in the inverted lists in bytes
+     * if the lists store quantized vectors instead of raw vectors, else 0.
+     */
+    const size_t code_size;
+
+    /**
+     * Specifies how the codes are laid out within a list.
+     *
+     * For CODE_LAYOUT_FAST_SCAN, at least FAST_SCAN_BLOCK_SIZE entries
+     * are allocated per list so that lists always consist of whole blocks.
+     */
+    const code_layout_t code_layout;
+
+    /**
+     * Specifies the metric the stored vectors are compared with.
+     *
+     * For METRIC_COSINE, the inverse norm of every vector is stored
+     * next to its vector id so that searching does not have to
+     * normalize the vectors.
+     */
+    const metric_t metric;
+
+    /**
+     * Alignment in bytes of the blocks of every list, see LIST_ALIGNMENT.
+     * Taken from the metadata if the lists are opened from a file,
+     * so that files created with another alignment can still be read.
+     */
+    const size_t list_alignment;
+
+    /**
+     * Specifies whether the lists may be modified.
+     */
+    const open_mode_t open_mode;
+
     /**
      * Specifies the size of the mappping region in bytes.
      */
     size_t total_size;
 
     /**
-     * Holds a pointer to the base of the memory-mapped region.
+     * Holds a pointer to the base of the memory-mapped region,
+     * i.e. of the reserved range of addresses.
      */
     uint8_t *base_ptr;
 
+    /**
+     * The size of the range of addresses reserved at base_ptr
+     * and the size of its part the file is mapped to, in bytes.
+     * The mapped size is a multiple of the page size.
+     */
+    size_t reserved_size;
+    size_t mapped_size;
+
+    /**
+     * The policy the memory-mapped region is backed by.
+     */
+    MappingPolicy mapping_policy;
+
+    /**
+     * The descriptor of the lists file, which stays open
+     * once the file has been created or opened, or -1.
+     */
+    int fd;
+
     /**
      * In-memory data structure that maps list ids to inverted list objects.
      */
     list_id_list_map_t id_to_list_map;
 
     /**
-     * In-memory data structure that holds a list of free slots
-     * in the memory-mapped file.
+     * In-memory data structure that holds the free slots
+     * in the memory-mapped file ordered by offset,
+     * so that adjacent slots are found in O(log n) when freeing a slot.
+     */
+    offset_size_map_t free_slots;
+
+    /**
+     * The same free slots ordered by size,
+     * so that the smallest large enough slot is found in O(log n).
+     */
+    size_offset_set_t free_slots_by_size;
+
+    /**
+     * The log of the modifications since the last flush,
+     * or nullptr if the write-ahead log is disabled.
+     */
+    std::shared_ptr<WriteAheadLog> wal;
+
+    /**
+     * The generation of the log continuing the last flush,
+     * stored in the metadata to detect stale logs.
+     */
+    uint64_t log_generation;
+
+    /**
+     * Slots freed since the last flush while the write-ahead log is enabled.
+     *
+     * They are only reused after the next flush, so that the lists stored
+     * at the last flush are never overwritten and replaying the log
+     * allocates the same slots as the logged modifications did.
+     */
+    std::vector<Slot> deferred_free_slots;
+
+    /**
+     * The directory from vector ids to the locations of their entries,
+     * or nullptr if it is disabled.
+     */
+    std::shared_ptr<IdDirectory> id_directory;
+
+    /**
+     * The token of the id directory file which matches the lists,
+     * stored in the metadata, or 0 if no file matches them.
+     */
+    mutable uint64_t id_directory_token;
+
+    /**
+     * The depth of nested modifications, e.g. 2 while insert_entries()
+     * resizes a list, so that only the outermost modification is logged.
+     * Replayed modifications are nested within the replay.
+     */
+    mutable len_t n_nested_operations;
+
+    /**
+     * The state shared with concurrent readers.
+     *
+     * - epoch_manager: reclaims the memory of list versions, slots and mappings
+     *   once concurrent readers are done with them
+     * - published_lists: the versions of the lists concurrent readers see
+     */
+    struct ConcurrentReadState
+    {
+      EpochManager epoch_manager;
+      std::atomic<PublishedListTable *> published_lists;
+    };
+
+    /**
+     * The state shared with concurrent readers,
+     * or nullptr if concurrent reads are disabled.
+     */
+    std::shared_ptr<ConcurrentReadState> concurrent_reads;
+
+    /**
+     * The lists modified by the current modification, which are published
+     * once the outermost modification is done, so that readers never see
+     * entries which are not written yet.
+     */
+    std::vector<list_id_t> modified_lists;
+
+    /**
+     * Slots released by the current modification, which are retired
+     * once the lists no longer using them are published.
      */
-    std::vector<Slot> free_slots;
+    std::vector<Slot> unpublished_free_slots;
+
+    /**
+     * Retired slots which concurrent readers may still read,
+     * stored as free slots in the metadata.
+     */
+    offset_size_map_t retired_slots;
+
+    /**
+     * Counts the depth of a modification for as long as it exists.
+     */
+    struct NestedOperation
+    {
+      const StorageLists &lists;
+      NestedOperation(const StorageLists &lists) : lists(lists) { lists.n_nested_operations++; }
+      ~NestedOperation() { lists.n_nested_operations--; }
+    };
 
     /**
      * Memory-maps the file used to store the inverted lists
      * containing the vectors and vector ids on disk
-     * with read-write permissions.
+     * up to total_size, read-only if the lists are opened read-only.
+     *
+     * Only the pages not mapped yet are mapped into the reserved range,
+     * so that the region does not move and pointers into it stay valid.
+     * If the file outgrows the reserved range, it is mapped anew into
+     * a larger range.
      *
      * @throws std::runtime_error if the file cannot be opened or mapped.
      */
     void mmap_region();
 
+    /**
+     * Reserves a range of addresses for the memory-mapped region
+     * without mapping anything into it.
+     *
+     * @param size The size of the range in bytes.
+     * @throws std::runtime_error if the range cannot be reserved.
+     */
+    void reserve_region(const size_t size);
+
+    /**
+     * Returns the mapping policy given by USE_HUGE_PAGES and N_NUMA_NODES.
+     */
+    static MappingPolicy get_default_mapping_policy();
+
+    /**
+     * Advises the given part of the memory-mapped region according to
+     * whether huge pages are used. Failures are ignored.
+     *
+     * @param offset The offset of the part relative to the base pointer.
+     * @param size The size of the part in bytes.
+     */
+    void advise_huge_pages(const size_t offset, const size_t size) const;
+
+    /**
+     * Unmaps the memory-mapped region including the reserved range
+     * and closes the file.
+     */
+    void unmap_region();
+
     /**
      * Returns a pointer to the first vector within the memory region
      * associated with the given inverted list.
@@ -134,6 +568,18 @@ namespace ann_dkvs
      */
     vector_el_t *get_vectors_by_list(const InvertedList *list) const;
 
+    /**
+     * Returns a pointer to the first code within the memory region
+     * associated with the given inverted list.
+     *
+     * Codes are stored in place of the vectors if code_size is not 0.
+     *
+     * @param list A pointer to the inverted list
+     *             for which the codes are being requested.
+     * @return A pointer to the first code.
+     */
+    uint8_t *get_codes_by_list(const InvertedList *list) const;
+
     /**
      * Returns a pointer to the first vector id within the memory region
      * associated with the given inverted list.
@@ -146,6 +592,32 @@ namespace ann_dkvs
      */
     vector_id_t *get_ids_by_list(const InvertedList *list) const;
 
+    /**
+     * Returns a pointer to the first inverse vector norm within the memory
+     * region associated with the given inverted list.
+     *
+     * The inverse norms of a list are stored contiguously after its vector ids
+     * and only take up space if the metric is METRIC_COSINE.
+     *
+     * @param list A pointer to the inverted list
+     *             for which the inverse norms are being requested.
+     * @return A pointer to the first inverse norm.
+     */
+    distance_t *get_inverse_norms_by_list(const InvertedList *list) const;
+
+    /**
+     * Returns a pointer to the first word of the tombstones of the given
+     * inverted list, a bitmap marking its deleted entries.
+     *
+     * The tombstones of a list are stored after its inverse norms. The bits
+     * of entries beyond the used entries are always cleared.
+     *
+     * @param list A pointer to the inverted list
+     *             for which the tombstones are being requested.
+     * @return A pointer to the first word of the tombstones.
+     */
+    uint64_t *get_tombstones_by_list(const InvertedList *list) const;
+
     /**
      * Returns total size by the given amount of vector ids
      * when they are stored contiguously in memory.
@@ -173,6 +645,42 @@ namespace ann_dkvs
      */
     size_t get_list_ids_size(const len_t n_entries) const;
 
+    /**
+     * Returns total size by the given amount of inverse vector norms
+     * when they are stored contiguously in memory.
+     *
+     * @param n_entries The number of inverse norms.
+     * @return The total size in bytes, 0 unless the metric is METRIC_COSINE.
+     */
+    size_t get_inverse_norms_size(const len_t n_entries) const;
+
+    /**
+     * Returns total size of the tombstones of the given amount of entries,
+     * i.e. of one bit per entry rounded up to whole words.
+     *
+     * @param n_entries The number of entries.
+     * @return The total size in bytes.
+     */
+    size_t get_tombstones_size(const len_t n_entries) const;
+
+    /**
+     * Clears the tombstones of the entries of the given list
+     * from the given entry up to the allocated entries.
+     *
+     * @param list A pointer to the inverted list.
+     * @param start The first entry whose tombstone is cleared.
+     */
+    void clear_tombstones(const InvertedList *list, const len_t start) const;
+
+    /**
+     * Returns the number of used entries of the given list
+     * which have been deleted.
+     *
+     * @param list A pointer to the inverted list.
+     * @return The number of deleted entries.
+     */
+    len_t count_deleted_entries(const InvertedList *list) const;
+
     /**
      * Returns total allocated size of the given inverted list in bytes.
      *
@@ -181,6 +689,15 @@ namespace ann_dkvs
      */
     size_t get_total_list_size(const InvertedList *list) const;
 
+    /**
+     * Rounds the given size up to a multiple of the list alignment,
+     * so that the block following a block of this size is aligned.
+     *
+     * @param size The size in bytes.
+     * @return The aligned size in bytes.
+     */
+    size_t get_aligned_size(const size_t size) const;
+
     /**
      * Returns a slot reprensenting the memory region associated
      * with the given inverted list.
@@ -257,11 +774,12 @@ namespace ann_dkvs
     bool has_free_slot_at_end() const;
 
     /**
-     * If a file is already memory-mapped, it unmaps it.
-     * If not, it creates a new file without memory-mapping it
-     * in case the file does not already exist.
+     * Opens the file used to store the inverted lists unless it is open,
+     * creating it if the lists may be modified and it does not exist.
+     *
+     * @throws std::runtime_error if the file cannot be opened.
      */
-    void ensure_file_created_and_region_unmapped() const;
+    void open_file();
 
     /**
      * Resizes the file to the given size.
@@ -275,11 +793,20 @@ namespace ann_dkvs
      */
     void resize_file(const size_t size);
 
+    /**
+     * Returns the number of entries allocated for a list
+     * which should be able to hold the given number of entries.
+     *
+     * @param n_entries The number of entries.
+     * @return A power of two, at least the minimum length of a list.
+     */
+    len_t get_n_entries_to_allocate(const len_t n_entries) const;
+
     /**
      * Checks if the given inverted list needs to be reallocated.
      *
      * Reallocation is necessary unless the list uses between 50% and 100%
-     * of the allocated entries.
+     * of the allocated entries or is already of the minimum length.
      *
      * @param list A pointer to the inverted list.
      * @param new_length Number of entries the list should be able to hold.
@@ -291,6 +818,8 @@ namespace ann_dkvs
      * Copy the entries of one inverted list to another.
      *
      * Only as many entries as the smaller list holds are copied.
+     * The lists may overlap, e.g. if the slot of the source list was merged
+     * with a free slot in front of it before the destination was allocated.
      *
      * @param dst A pointer to the destination inverted list.
      * @param src A pointer to the source inverted list.
@@ -298,13 +827,27 @@ namespace ann_dkvs
     void copy_shared_data(const InvertedList *dst, const InvertedList *src) const;
 
     /**
-     * Iterates over the list of free slots and finds the first slot
-     * that is large enough to hold data of the given size.
+     * Moves the entries of an inverted list to another inverted list
+     * which starts at the same offset but has a different capacity.
+     *
+     * The vectors stay in place while the vector ids, inverse norms
+     * and tombstones are moved to their new location.
+     * Only as many entries as the smaller list holds are moved.
+     *
+     * @param dst A pointer to the destination inverted list.
+     * @param src A pointer to the source inverted list.
+     */
+    void move_shared_data_in_place(const InvertedList *dst, const InvertedList *src) const;
+
+    /**
+     * Finds the smallest free slot that is large enough to hold data
+     * of the given size, preferring the lowest offset among slots
+     * of the same size.
      *
      * @param size The minimum size of the slot to be found in bytes.
-     * @return An iterator to the slot.
+     * @return An iterator to the slot or the end iterator if there is none.
      */
-    slot_it_t find_large_enough_slot_index(const size_t size);
+    slot_it_t find_large_enough_slot(const size_t size);
 
     /**
      * Grows the memory-mapped region until it is large enough to hold
@@ -318,47 +861,19 @@ namespace ann_dkvs
     void grow_region_until_enough_space(size_t size);
 
     /**
-     * Finds the next slot to the right of the given slot.
-     *
-     * If the given slot is the last slot, the end iterator is returned.
-     *
-     * @param slot A pointer to the slot.
-     * @return An iterator to the next slot to the right.
-     */
-    slot_it_t find_next_slot_to_right(const Slot *slot);
-
-    /**
-     * Finds the next slot to the left of the given slot.
-     *
-     * If the given slot is the first slot, the end iterator is returned.
-     *
-     * @param next_slot_right An iterator to the slot to the right
-     *                        of the slot to be found.
-     * @return An iterator to the next slot to the left.
-     */
-    slot_it_t find_next_slot_to_left(const slot_it_t next_slot_right);
-
-    /**
-     * Checks if the given slots are adjacent.
+     * Adds a slot to the free slots without merging it with adjacent slots.
      *
-     * Two slots are adjacent if the right slot starts
-     * at the end of the left slot.
-     *
-     * @param slot_left A pointer to the left slot.
-     * @param slot_right A pointer to the right slot.
-     * @return True if the slots are adjacent.
+     * @param offset The offset of the slot relative to the base pointer.
+     * @param size The size of the slot in bytes.
      */
-    bool are_slots_adjacent(const Slot *slot_left, const Slot *slot_right) const;
+    void add_free_slot(const size_t offset, const size_t size);
 
     /**
-     * Converts an iterator to a slot to a pointer to the slot.
-     *
-     * If the iterator is the end iterator, a null pointer is returned.
+     * Removes a slot from the free slots.
      *
-     * @param it An iterator to a slot.
-     * @return A pointer to the slot.
+     * @param slot_it An iterator to the slot.
      */
-    Slot *to_slot(const slot_it_t it) const;
+    void remove_free_slot(const slot_it_t slot_it);
 
     /**
      * Grows the memory-mapped region until it is large enough to hold
@@ -369,71 +884,523 @@ namespace ann_dkvs
      */
     void reserve_space(const len_t n_entries);
 
+    /**
+     * Returns the index of the first entry of a range of the input files
+     * of bulk_insert_entries(), which are split into ranges of equal length.
+     *
+     * @param range The index of the range, up to the number of ranges.
+     * @param n_ranges The number of ranges.
+     * @param n_entries The number of entries in the files.
+     * @return The index of the first entry of the range.
+     */
+    len_t get_range_start(const len_t range, const len_t n_ranges, const len_t n_entries) const;
+
     /**
      * Preallocates inverted lists given a file of list ids.
      *
-     * @param entries_left A pointer to the map that should be populated
-     *                     with the number of entries of each list.
+     * The file is split into ranges whose entries are counted per list
+     * in parallel. The entries of each range are placed after those of the
+     * preceding ranges, so that the lists hold their entries in file order.
+     *
      * @param list_ids_filename The name of the file containing the list ids.
      * @param n_entries The number of entries in the file.
+     * @return For each range, a map from list ids to the offset within
+     *         the list at which the first entry of the range is stored.
+     * @throws std::runtime_error If the file cannot be read or does not
+     *                            contain n_entries list ids.
      */
-    void bulk_create_lists(list_id_counts_map_t &entries_left, const std::string &list_ids_filename, const len_t n_entries);
+    std::vector<list_id_counts_map_t> bulk_create_lists(const std::string &list_ids_filename, const len_t n_entries);
 
     /**
-     * Creates a file stream for the given file.
+     * Writes the entries of the given files into the preallocated lists,
+     * reading the ranges of the files in parallel, see bulk_create_lists().
      *
-     * @param filename The name of the file.
-     * @return A file stream for the file.
+     * @param vectors_filename The name of the file containing the vectors.
+     * @param ids_filename The name of the file containing the vector ids.
+     * @param list_ids_filename The name of the file containing the list ids.
+     * @param n_entries The number of entries in the files.
+     * @param scalar_quantizer The scalar quantizer encoding the vectors or nullptr.
+     * @param range_offsets The offsets returned by bulk_create_lists(),
+     *                      which are advanced past the written entries.
+     * @throws std::runtime_error If the files cannot be read.
      */
-    std::ifstream open_filestream(const std::string &filename) const;
+    void bulk_write_entries(const std::string &vectors_filename, const std::string &ids_filename, const std::string &list_ids_filename, const len_t n_entries, const ScalarQuantizer *scalar_quantizer, std::vector<list_id_counts_map_t> &range_offsets) const;
 
-  public:
     /**
-     * Creates a new storage lists object.
+     * Stores the inverse norms of the given vectors in the given list
+     * if the metric is METRIC_COSINE.
      *
-     * @param vector_dim The dimension of the vectors.
-     * @param filename The name of the file to be used for storage.
+     * @param list A pointer to the inverted list.
+     * @param vectors A pointer to the first vector.
+     * @param n_entries The number of vectors.
+     * @param offset The number of entries to skip before storing.
      */
-    StorageLists(const len_t vector_dim, const std::string &filename);
+    void set_inverse_norms(const InvertedList *list, const vector_el_t *vectors, const len_t n_entries, const size_t offset) const;
 
     /**
-     * Destroys the storage lists object.
+     * Makes room for the given number of entries at the end of the given list,
+     * creating the list if it does not exist yet.
      *
-     * Unmaps the memory-mapped region.
+     * @param list_id The id of the list.
+     * @param n_entries The number of entries to append.
+     * @return The number of entries of the list before appending.
      */
-    ~StorageLists();
+    len_t append_entries(const list_id_t list_id, const len_t n_entries);
 
     /**
-     * Returns the number of inverted lists that are currently stored.
+     * Returns the given list if the given entries can be written to it.
      *
-     * @return The number of lists.
+     * @param list_id The id of the list.
+     * @param n_entries The number of entries to write.
+     * @param offset The offset of the first entry to write.
+     * @return A pointer to the inverted list.
+     * @throws std::invalid_argument If the list does not exist.
+     * @throws std::out_of_range If the entries to be written are out of bounds.
+     * @throws std::logic_error If the lists are opened read-only.
      */
-    len_t get_length() const;
+    const InvertedList *find_writable_list(const list_id_t list_id, const len_t n_entries, const size_t offset) const;
 
     /**
-     * Returns the total size of the memory-mapped region.
+     * Logs an update of the given entries before they are overwritten
+     * and waits until the record is durable if it is logged.
      *
-     * @return The total size of the region in bytes.
+     * The entries may belong to the last checkpoint and are overwritten
+     * in place, so a crash could leave them partly written. Writing the
+     * record first ensures that it is replayed in that case.
+     *
+     * @param list_id The id of the list.
+     * @param data A pointer to the first vector or code to write.
+     * @param ids A pointer to the first id to write.
+     * @param n_entries The number of entries to write.
+     * @param offset The offset of the first entry to write.
+     * @throws std::invalid_argument If the list does not exist.
+     * @throws std::out_of_range If the entries to be written are out of bounds.
+     * @throws std::runtime_error If the log cannot be written.
      */
-    size_t get_total_size() const;
+    void log_update_ahead(const list_id_t list_id, const void *data, const vector_id_t *ids, const len_t n_entries, const size_t offset) const;
 
     /**
-     * Returns the total number of bytes that are currently free across
-     * all slots.
+     * Copies the given vectors or codes and ids into the given list.
      *
-     * @return The number of free bytes.
+     * @param list_id The id of the list.
+     * @param data A pointer to the first vector or code to copy.
+     * @param ids A pointer to the first id to copy.
+     * @param n_entries The number of entries to copy.
+     * @param offset The number of entries to skip before starting to copy.
+     * @return A pointer to the inverted list.
+     * @throws std::invalid_argument If the list does not exist.
+     * @throws std::out_of_range If the entries to be updated are out of bounds.
      */
-    size_t get_free_space() const;
+    const InvertedList *copy_entries(const list_id_t list_id, const void *data, const vector_id_t *ids, const len_t n_entries, const size_t offset) const;
 
     /**
-     * Returns the size of the largest continuous free space.
+     * Creates a file stream for the given file.
      *
-     * @return The size of the largest continuous free space in bytes.
+     * @param filename The name of the file.
+     * @return A file stream for the file.
      */
-    size_t get_largest_continuous_free_space() const;
+    std::ifstream open_filestream(const std::string &filename) const;
 
     /**
-     * Returns the total size of the vectors that can be stored.
+     * Opens an existing lists file with the given metadata.
+     */
+    StorageLists(const std::string &filename, const open_mode_t open_mode, const Metadata &metadata);
+
+    /**
+     * Reads the metadata file of a lists file.
+     *
+     * @param filename The name of the lists file.
+     * @return The metadata.
+     * @throws std::runtime_error If the metadata file cannot be read or is invalid.
+     */
+    static Metadata read_metadata(const std::string &filename);
+
+    /**
+     * Checks that the metadata read from a file describes lists which fit
+     * into the lists file.
+     *
+     * @throws std::runtime_error If a list or slot lies outside of the region
+     *                            or the lists file is too small.
+     */
+    void check_metadata() const;
+
+    /**
+     * Writes the metadata to a temporary file which then replaces
+     * the metadata file, so that the metadata file is always complete.
+     *
+     * @throws std::runtime_error If the file cannot be written.
+     */
+    void write_metadata() const;
+
+    /**
+     * Checks that the lists may be modified.
+     *
+     * @throws std::logic_error If the lists are opened read-only.
+     */
+    void check_writable() const;
+
+    /**
+     * Checks if the given modification is to be logged, i.e. if the
+     * write-ahead log is enabled and it is not part of another modification.
+     *
+     * @return True if the modification is to be logged.
+     */
+    bool is_logging() const;
+
+    /**
+     * Appends a record of a modification to the write-ahead log
+     * if it is to be logged, see is_logging(). Called by every modification,
+     * which also invalidates the id directory file if the directory is disabled.
+     *
+     * @param type The type of the modification.
+     * @param list_id The id of the modified list.
+     * @param n_entries The number of entries created, resized to or written
+     *                  or the number of ids deleted.
+     * @param offset The offset of the written entries.
+     * @param data A pointer to the written vectors or codes or nullptr.
+     * @param ids A pointer to the written or deleted ids or nullptr.
+     * @param is_continued Whether further records of the same operation
+     *                     follow, see WAL_RECORD_CONTINUED.
+     * @return The log sequence number of the record, or 0 if it is not logged.
+     * @throws std::runtime_error If the log cannot be written.
+     */
+    uint64_t log_operation(const wal_record_type_t type, const list_id_t list_id, const len_t n_entries, const size_t offset, const void *data, const vector_id_t *ids, const bool is_continued = false) const;
+
+    /**
+     * Flushes the lists if the write-ahead log has grown
+     * beyond WAL_CHECKPOINT_SIZE bytes.
+     */
+    void checkpoint_if_necessary();
+
+    /**
+     * Frees a slot, deferring it until the next flush
+     * if the write-ahead log is enabled, see deferred_free_slots,
+     * or until concurrent readers are done with it.
+     *
+     * @param slot A pointer to the slot to be freed.
+     */
+    void release_slot(const Slot *slot);
+
+    /**
+     * Frees a slot once no concurrent reader can read it anymore.
+     *
+     * @param slot The slot to be freed.
+     */
+    void retire_slot(const Slot &slot);
+
+    /**
+     * Returns the version of the given inverted list readers see.
+     *
+     * @param list A pointer to the inverted list.
+     * @return The version of the list.
+     */
+    ListVersion make_list_version(const InvertedList *list) const;
+
+    /**
+     * Returns the current version of the given list, read from the published
+     * versions if concurrent reads are enabled.
+     *
+     * @param list_id The id of the list.
+     * @return The version of the list.
+     * @throws std::invalid_argument If the list does not exist.
+     */
+    ListVersion get_list_version(const list_id_t list_id) const;
+
+    /**
+     * Creates an empty table of published list versions.
+     *
+     * @param n_lists The number of lists the table should be able to hold.
+     * @return The table.
+     */
+    static PublishedListTable *create_published_list_table(const len_t n_lists);
+
+    /**
+     * Returns the index of the entry of the given list in a table of
+     * published list versions, or of the unused entry where it belongs.
+     *
+     * @param table A pointer to the table.
+     * @param list_id The id of the list.
+     * @return The index of the entry.
+     */
+    static len_t find_published_list(const PublishedListTable *table, const list_id_t list_id);
+
+    /**
+     * Publishes a version of a list, replacing the table by a larger one
+     * if it is half full.
+     *
+     * @param list_id The id of the list.
+     * @param version The version of the list or nullptr if it does not exist.
+     * @return The version which is replaced or nullptr.
+     */
+    const ListVersion *publish_list(const list_id_t list_id, const ListVersion *version);
+
+    /**
+     * Records that the given list has been modified, see modified_lists.
+     *
+     * @param list_id The id of the list.
+     */
+    void mark_list_modified(const list_id_t list_id);
+
+    /**
+     * Publishes the lists modified by the outermost modification, retires
+     * the replaced versions and the released slots and reclaims those which
+     * readers are done with. Does nothing within a nested modification or
+     * if concurrent reads are disabled.
+     */
+    void publish_modified_lists();
+
+    /**
+     * Frees the published list versions and the retired items.
+     * There must not be any concurrent readers.
+     */
+    void release_published_lists();
+
+    /**
+     * Opens the log file of the lists and replays the modifications
+     * logged since the last flush, if any.
+     *
+     * @throws std::runtime_error If the log cannot be read or replayed
+     *                            or if the lists are opened read-only
+     *                            and the log has to be replayed.
+     */
+    void recover_from_log();
+
+    /**
+     * Applies a modification read from the write-ahead log.
+     *
+     * @param record The header of the log record.
+     * @param payload The vectors or codes and ids written by the modification.
+     * @throws std::runtime_error If the record does not match the lists.
+     */
+    void apply_log_record(const WalRecordHeader &record, const uint8_t *payload);
+
+    /**
+     * Throws if the id directory is disabled.
+     *
+     * @throws std::logic_error If the id directory is disabled.
+     */
+    void check_id_directory_enabled() const;
+
+    /**
+     * Fills the id directory with the entries of all lists
+     * which are not deleted.
+     */
+    void rebuild_id_directory();
+
+    /**
+     * Removes the ids of the given entries of a list from the id directory
+     * if they are located there, e.g. before the entries are overwritten.
+     * Does nothing if the id directory is disabled or the entries
+     * do not exist.
+     *
+     * @param list_id The id of the list.
+     * @param start The index of the first entry.
+     * @param end The index after the last entry.
+     */
+    void unindex_entries(const list_id_t list_id, const len_t start, const len_t end) const;
+
+    /**
+     * Sets the locations of the given entries in the id directory.
+     * Does nothing if the id directory is disabled.
+     *
+     * @param list_id The id of the list.
+     * @param ids A pointer to the ids of the entries.
+     * @param n_entries The number of entries.
+     * @param offset The index of the first entry within the list.
+     */
+    void index_entries(const list_id_t list_id, const vector_id_t *ids, const len_t n_entries, const size_t offset) const;
+
+    /**
+     * Implements upsert_entries() and upsert_codes(), where the data
+     * are the vectors or the codes of the entries.
+     */
+    void upsert(const list_id_t list_id, const uint8_t *data, const vector_id_t *ids, const len_t n_entries);
+
+  public:
+    /**
+     * Creates a new storage lists object.
+     *
+     * @param vector_dim The dimension of the vectors.
+     * @param filename The name of the file to be used for storage.
+     * @param metric The metric the vectors are compared with.
+     */
+    StorageLists(const len_t vector_dim, const std::string &filename, const metric_t metric = METRIC_L2);
+
+    /**
+     * Creates a new storage lists object storing a code of code_size bytes
+     * per entry, e.g. a product-quantized vector, instead of a raw vector.
+     *
+     * Codes are inserted with insert_codes() and read with get_codes().
+     *
+     * @param vector_dim The dimension of the encoded vectors.
+     * @param code_size The size of a code in bytes.
+     * @param filename The name of the file to be used for storage.
+     * @param metric The metric the encoded vectors are compared with.
+     * @param code_layout The layout of the codes within a list.
+     * @throws std::out_of_range If vector_dim or code_size is 0
+     *                           or if code_size exceeds FAST_SCAN_MAX_CODE_SIZE
+     *                           for CODE_LAYOUT_FAST_SCAN.
+     * @throws std::invalid_argument If the metric is METRIC_COSINE.
+     */
+    StorageLists(const len_t vector_dim, const size_t code_size, const std::string &filename, const metric_t metric = METRIC_L2, const code_layout_t code_layout = CODE_LAYOUT_PACKED);
+
+    /**
+     * Opens the lists stored in an existing file by a storage lists
+     * object which has been flushed or destroyed, without reading the lists.
+     *
+     * The dimension, code size, code layout and metric are taken from
+     * the metadata file stored next to the lists file.
+     *
+     * If a write-ahead log is stored next to the lists file, the
+     * modifications logged after the last flush are replayed, so that
+     * lists which were not flushed, e.g. after a crash, are restored up to
+     * the last synced modification, and the log stays enabled.
+     *
+     * @param filename The name of the file the lists are stored in.
+     * @param open_mode Whether the lists may be modified.
+     * @throws std::runtime_error If the files cannot be read or are invalid
+     *                            or if the lists are opened read-only
+     *                            and the log has to be replayed.
+     */
+    StorageLists(const std::string &filename, const open_mode_t open_mode);
+
+    /**
+     * Destroys the storage lists object.
+     *
+     * Flushes lists which may be modified and unmaps the memory-mapped region.
+     */
+    ~StorageLists();
+
+    /**
+     * Writes the modified lists back to the file and then stores
+     * the metadata, so that the lists can be opened again.
+     *
+     * This is a checkpoint of the write-ahead log, which is truncated
+     * afterwards. The id directory is written back as well if it is enabled.
+     *
+     * @throws std::runtime_error If the files cannot be written.
+     * @throws std::logic_error If the lists are opened read-only.
+     */
+    void flush();
+
+    /**
+     * Enables the write-ahead log, which records every modification
+     * of the lists, so that modifications made after the last flush can be
+     * recovered when the lists are opened again.
+     *
+     * Modifications are buffered and appended to the log in groups.
+     * They are durable once sync_write_ahead_log() or flush() returns.
+     * Modifications which are not durable may be lost, but replaying
+     * the log always restores the lists of a logged point in time, except
+     * for updates of entries stored at the last flush, which are written
+     * in place and may be partly visible.
+     *
+     * The lists are flushed first. Slots of lists are only reused
+     * after the next flush while the log is enabled.
+     *
+     * @throws std::runtime_error If the files cannot be written.
+     * @throws std::logic_error If the lists are opened read-only.
+     */
+    void enable_write_ahead_log();
+
+    /**
+     * Waits until all logged modifications are durable.
+     * Modifications of several threads are synced together.
+     *
+     * @throws std::runtime_error If the log cannot be written.
+     * @throws std::logic_error If the write-ahead log is disabled.
+     */
+    void sync_write_ahead_log();
+
+    /**
+     * Returns whether the write-ahead log is enabled.
+     */
+    bool is_write_ahead_log_enabled() const;
+
+    /**
+     * Enables reading the lists while another thread modifies them.
+     *
+     * Readers see a version of every list which is published atomically once
+     * a modification is done, and pin it with pin() for as long as they use
+     * the pointers returned by the getters. Lists which are reallocated are
+     * moved to new slots instead of being moved in place, and the old slots
+     * are only reused once every reader which could see them is unpinned.
+     * Entries written by update_entries() or update_codes() and the tombstones
+     * set by delete_entries() are written in place.
+     *
+     * Modifications are expected to be made by one thread at a time and
+     * the lists must not be read concurrently while this is called.
+     */
+    void enable_concurrent_reads();
+
+    /**
+     * Returns whether concurrent reads are enabled.
+     */
+    bool is_concurrent_reads_enabled() const;
+
+    /**
+     * Enables the id directory, which maps every vector id to the location
+     * of its entry, so that entries are looked up, upserted and deleted
+     * by id in O(1) instead of scanning the lists.
+     *
+     * The directory is kept in a memory-mapped file next to the lists file,
+     * which is written back by flush(). The file is reused if it matches
+     * the lists, otherwise the directory is rebuilt from the lists.
+     * Every id is expected to be stored once, otherwise the directory holds
+     * the entry the id was written to last. Lookups must not be made
+     * concurrently with modifications of the lists.
+     *
+     * @throws std::runtime_error If the directory file cannot be opened.
+     * @throws std::logic_error If the lists are opened read-only.
+     */
+    void enable_id_directory();
+
+    /**
+     * Returns whether the id directory is enabled.
+     */
+    bool is_id_directory_enabled() const;
+
+    /**
+     * Pins the versions of the lists which are currently published, so that
+     * the memory they point to is not reused until the returned guard is
+     * destroyed. Pinning is lock-free and only needed if concurrent reads
+     * are enabled, otherwise an empty guard is returned.
+     *
+     * @return The guard of the pinned versions.
+     */
+    EpochManager::Guard pin() const;
+
+    /**
+     * Returns the number of inverted lists that are currently stored.
+     *
+     * @return The number of lists.
+     */
+    len_t get_length() const;
+
+    /**
+     * Returns the total size of the memory-mapped region.
+     *
+     * @return The total size of the region in bytes.
+     */
+    size_t get_total_size() const;
+
+    /**
+     * Returns the total number of bytes that are currently free across
+     * all slots.
+     *
+     * @return The number of free bytes.
+     */
+    size_t get_free_space() const;
+
+    /**
+     * Returns the size of the largest continuous free space.
+     *
+     * @return The size of the largest continuous free space in bytes.
+     */
+    size_t get_largest_continuous_free_space() const;
+
+    /**
+     * Returns the total size of the vectors that can be stored.
      *
      * @return The size of a single vector in bytes.
      */
@@ -446,6 +1413,20 @@ namespace ann_dkvs
      */
     len_t get_vector_dim() const;
 
+    /**
+     * Returns the size of the codes stored in place of the vectors.
+     *
+     * @return The size of a code in bytes, 0 if raw vectors are stored.
+     */
+    size_t get_code_size() const;
+
+    /**
+     * Returns the layout of the codes within a list.
+     *
+     * @return The code layout, CODE_LAYOUT_PACKED if raw vectors are stored.
+     */
+    code_layout_t get_code_layout() const;
+
     /**
      * Returns the name of the file used to store the inverted lists.
      *
@@ -453,15 +1434,62 @@ namespace ann_dkvs
      */
     std::string get_filename() const;
 
+    /**
+     * Returns the name of the file storing the metadata of the lists.
+     *
+     * @return The name of the metadata file.
+     */
+    std::string get_metadata_filename() const;
+
+    /**
+     * Returns the name of the file storing the write-ahead log.
+     *
+     * @return The name of the log file.
+     */
+    std::string get_log_filename() const;
+
+    /**
+     * Returns the name of the file storing the id directory.
+     *
+     * @return The name of the id directory file.
+     */
+    std::string get_id_directory_filename() const;
+
+    /**
+     * Returns whether the lists may be modified.
+     *
+     * @return The open mode.
+     */
+    open_mode_t get_open_mode() const;
+
+    /**
+     * Returns the metric the stored vectors are compared with.
+     *
+     * @return The metric.
+     */
+    metric_t get_metric() const;
+
     /**
      * Returns a pointer to the vectors of the given list.
      *
      * @param list_id The id of the list.
      * @return A pointer to the first vector of the list.
      * @throws std::invalid_argument If the list does not exist.
+     * @throws std::logic_error If the lists store codes.
      */
     const vector_el_t *get_vectors(const list_id_t list_id) const;
 
+    /**
+     * Returns a pointer to the codes of the given list,
+     * i.e. to its first block for CODE_LAYOUT_FAST_SCAN.
+     *
+     * @param list_id The id of the list.
+     * @return A pointer to the first code of the list.
+     * @throws std::invalid_argument If the list does not exist.
+     * @throws std::logic_error If the lists store raw vectors.
+     */
+    const uint8_t *get_codes(const list_id_t list_id) const;
+
     /**
      * Returns a pointer to the ids of the given list.
      *
@@ -471,6 +1499,92 @@ namespace ann_dkvs
      */
     const vector_id_t *get_ids(const list_id_t list_id) const;
 
+    /**
+     * Returns a pointer to the inverse norms of the vectors of the given list.
+     *
+     * @param list_id The id of the list.
+     * @return A pointer to the inverse norm of the first vector of the list.
+     * @throws std::invalid_argument If the list does not exist.
+     * @throws std::logic_error If the metric is not METRIC_COSINE.
+     */
+    const distance_t *get_inverse_norms(const list_id_t list_id) const;
+
+    /**
+     * Returns the parts of the given list, all of which are taken
+     * from the same version of the list.
+     *
+     * @param list_id The id of the list.
+     * @return The parts of the list.
+     * @throws std::invalid_argument If the list does not exist.
+     */
+    ListData get_list_data(const list_id_t list_id) const;
+
+    /**
+     * Returns the position of the given list within the lists file.
+     *
+     * The layout only reflects the file once the list has been written back,
+     * e.g. by flush().
+     *
+     * @param list_id The id of the list.
+     * @return The layout of the list.
+     * @throws std::invalid_argument If the list does not exist.
+     */
+    ListLayout get_list_layout(const list_id_t list_id) const;
+
+    /**
+     * Asks the kernel to read the pages of the given list into memory
+     * in the background with madvise(MADV_WILLNEED), so that scanning
+     * the list later does not stall on page faults.
+     *
+     * @param list_id The id of the list.
+     * @throws std::invalid_argument If the list does not exist.
+     */
+    void prefetch_list(const list_id_t list_id) const;
+
+    /**
+     * Sets the policy the memory-mapped region is backed by.
+     *
+     * Huge pages are advised for the whole region, including the parts
+     * the file is mapped to as it grows. Resident pages are only moved to
+     * their NUMA node by place_lists_on_numa_nodes().
+     *
+     * @param policy The mapping policy, where 0 NUMA nodes stands for
+     *               the number of nodes of the machine.
+     * @throws std::invalid_argument If the chunk size is not a multiple of the page size.
+     */
+    void set_mapping_policy(const MappingPolicy &policy);
+
+    /**
+     * Returns the policy the memory-mapped region is backed by.
+     */
+    MappingPolicy get_mapping_policy() const;
+
+    /**
+     * Returns the NUMA node the given list is placed on according to
+     * the mapping policy, i.e. the node of the chunk holding the middle
+     * of the list, see MappingPolicy.
+     *
+     * @param list_id The id of the list.
+     * @return The NUMA node, 0 if the lists are not spread across nodes.
+     * @throws std::invalid_argument If the list does not exist.
+     */
+    int get_list_numa_node(const list_id_t list_id) const;
+
+    /**
+     * Moves the resident pages of every chunk of the memory-mapped region
+     * to the NUMA node of the chunk, see MappingPolicy. Pages which are
+     * not resident are not read, so that lists larger than memory stay
+     * on disk. The kernel allocates them on the node of the thread
+     * reading them, i.e. on their node when they are read by threads
+     * pinned to the node of the list, see StorageIndex.
+     *
+     * Does nothing unless the lists are spread across more than one node.
+     *
+     * @return Whether the pages could be moved, false e.g. if a node
+     *         does not exist or moving pages is not permitted.
+     */
+    bool place_lists_on_numa_nodes() const;
+
     /**
      * Returns the number of entries that are in used in the given list.
      *
@@ -497,12 +1611,49 @@ namespace ann_dkvs
      * @param vectors A pointer to the first vector to insert.
      * @param ids A pointer to the first id to insert.
      * @param n_entries The number of entries to insert.
+     * @throws std::logic_error If the lists store codes.
      */
     void insert_entries(const list_id_t list_id, const vector_el_t *vectors, const vector_id_t *ids, const len_t n_entries);
 
+    /**
+     * Inserts the given codes into the given list.
+     *
+     * The codes are always passed packed one after another
+     * and are interleaved here for CODE_LAYOUT_FAST_SCAN.
+     *
+     * @param list_id The id of the list.
+     * @param codes A pointer to the first code to insert.
+     * @param ids A pointer to the first id to insert.
+     * @param n_entries The number of entries to insert.
+     * @throws std::logic_error If the lists store raw vectors.
+     */
+    void insert_codes(const list_id_t list_id, const uint8_t *codes, const vector_id_t *ids, const len_t n_entries);
+
+    /**
+     * Inserts a batch of entries into the given lists, creating lists
+     * which do not exist yet.
+     *
+     * The entries are grouped by list first and every list is appended to
+     * by a single call of insert_entries(), so that it is resized at most
+     * once per batch. The entries of a list keep their order in the batch.
+     * The batch is a single modification: concurrent readers see the
+     * lists once all of them are inserted into, and the insertion into
+     * every list is logged before the lists are published.
+     *
+     * @param list_ids A pointer to the list id of every entry.
+     * @param vectors A pointer to the first vector to insert.
+     * @param ids A pointer to the first id to insert.
+     * @param n_entries The number of entries to insert.
+     * @throws std::logic_error If the lists store codes or are opened read-only.
+     */
+    void batch_insert_entries(const list_id_t *list_ids, const vector_el_t *vectors, const vector_id_t *ids, const len_t n_entries);
+
     /**
      * Updates the given entries in the given list.
      *
+     * If the write-ahead log is enabled, the update waits until
+     * its record is durable before the entries are overwritten.
+     *
      * @param list_id The id of the list.
      * @param vectors A pointer to the first vector to update.
      * @param ids A pointer to the first id to update.
@@ -510,9 +1661,159 @@ namespace ann_dkvs
      * @param offset The number of entries to skip before starting to update.
      * @throws std::invalid_argument If the list does not exist.
      * @throws std::out_of_range If the entries to be updated are out of bounds.
+     * @throws std::logic_error If the lists store codes.
      */
     void update_entries(const list_id_t list_id, const vector_el_t *vectors, const vector_id_t *ids, const len_t n_entries, const size_t offset) const;
 
+    /**
+     * Updates the given codes in the given list.
+     *
+     * If the write-ahead log is enabled, the update waits until
+     * its record is durable before the codes are overwritten.
+     *
+     * @param list_id The id of the list.
+     * @param codes A pointer to the first code to update.
+     * @param ids A pointer to the first id to update.
+     * @param n_entries The number of entries to update.
+     * @param offset The number of entries to skip before starting to update.
+     * @throws std::invalid_argument If the list does not exist.
+     * @throws std::out_of_range If the entries to be updated are out of bounds.
+     * @throws std::logic_error If the lists store raw vectors.
+     */
+    void update_codes(const list_id_t list_id, const uint8_t *codes, const vector_id_t *ids, const len_t n_entries, const size_t offset) const;
+
+    /**
+     * Marks the entries of the given list holding one of the given ids
+     * as deleted, i.e. sets their tombstones, so that they are skipped
+     * by searches. Entries are only removed by compact_list().
+     *
+     * An entry which is updated or inserted again is no longer deleted.
+     * If the id directory is enabled, the entries are located with it
+     * instead of scanning the list. If the write-ahead log is enabled,
+     * the deletion waits until its record is durable before the tombstones
+     * are set.
+     *
+     * @param list_id The id of the list.
+     * @param ids A pointer to the first id to delete.
+     * @param n_ids The number of ids to delete.
+     * @return The number of entries which have been deleted,
+     *         excluding those which were already deleted.
+     * @throws std::invalid_argument If the list does not exist.
+     * @throws std::runtime_error If the log cannot be written.
+     */
+    len_t delete_entries(const list_id_t list_id, const vector_id_t *ids, const len_t n_ids);
+
+    /**
+     * Returns the number of entries of the given list which are deleted
+     * but not yet removed by compact_list().
+     *
+     * @param list_id The id of the list.
+     * @return The number of deleted entries.
+     * @throws std::invalid_argument If the list does not exist.
+     */
+    len_t get_n_deleted_entries(const list_id_t list_id) const;
+
+    /**
+     * Rewrites the given list without its deleted entries into a slot
+     * of the remaining size and frees its old slot.
+     *
+     * The remaining entries keep their order but move to lower positions.
+     * A list whose entries are all deleted is kept with a length of 0.
+     *
+     * @param list_id The id of the list.
+     * @return The number of entries which have been removed.
+     * @throws std::invalid_argument If the list does not exist.
+     */
+    len_t compact_list(const list_id_t list_id);
+
+    /**
+     * Returns the ids of the lists of which at least the given ratio
+     * of the entries is deleted, see compact_list().
+     *
+     * @param min_deleted_ratio The minimum ratio of deleted entries.
+     * @return The ids of the lists, ordered by id.
+     */
+    std::vector<list_id_t> get_lists_to_compact(const float min_deleted_ratio) const;
+
+    /**
+     * Returns the location of the entry of the given id.
+     *
+     * @param id The vector id.
+     * @return The list and the index within the list of the entry.
+     * @throws std::invalid_argument If the id is not stored.
+     * @throws std::logic_error If the id directory is disabled.
+     */
+    EntryLocation find_entry(const vector_id_t id) const;
+
+    /**
+     * Returns the vector of the given id.
+     *
+     * @param id The vector id.
+     * @return A pointer to the vector within its list.
+     * @throws std::invalid_argument If the id is not stored.
+     * @throws std::logic_error If the id directory is disabled or the lists store codes.
+     */
+    const vector_el_t *get_vector(const vector_id_t id) const;
+
+    /**
+     * Copies the code of the given id, which is not stored contiguously
+     * if the lists use the fast-scan layout.
+     *
+     * @param id The vector id.
+     * @param code A pointer to code_size bytes the code is copied to.
+     * @throws std::invalid_argument If the id is not stored.
+     * @throws std::logic_error If the id directory is disabled or the lists store raw vectors.
+     */
+    void get_code(const vector_id_t id, uint8_t *code) const;
+
+    /**
+     * Stores the given entries in the given list. Entries whose id is stored
+     * in the list already are updated in place, entries whose id is stored
+     * in another list are deleted there, and the remaining entries are
+     * appended to the list, creating it if it does not exist.
+     *
+     * The upsert is made of several modifications, which concurrent
+     * readers see once all of them are done. If the write-ahead log is
+     * enabled, their records are logged as one operation and made durable
+     * by a single sync before any entry is modified in place, so that
+     * a crash never loses a moved entry.
+     *
+     * @param list_id The id of the list.
+     * @param vectors A pointer to the first vector.
+     * @param ids A pointer to the first id.
+     * @param n_entries The number of entries.
+     * @throws std::invalid_argument If an id is given more than once.
+     * @throws std::logic_error If the id directory is disabled or the lists store codes.
+     * @throws std::runtime_error If the log cannot be written.
+     */
+    void upsert_entries(const list_id_t list_id, const vector_el_t *vectors, const vector_id_t *ids, const len_t n_entries);
+
+    /**
+     * Stores the given codes in the given list, see upsert_entries().
+     *
+     * @param list_id The id of the list.
+     * @param codes A pointer to the first code.
+     * @param ids A pointer to the first id.
+     * @param n_entries The number of entries.
+     * @throws std::invalid_argument If an id is given more than once.
+     * @throws std::logic_error If the id directory is disabled or the lists store raw vectors.
+     * @throws std::runtime_error If the log cannot be written.
+     */
+    void upsert_codes(const list_id_t list_id, const uint8_t *codes, const vector_id_t *ids, const len_t n_entries);
+
+    /**
+     * Marks the entries of the given ids as deleted in whichever list
+     * they are stored, see delete_entries(list_id, ids, n_ids).
+     * The deletions of all lists are logged as one operation.
+     *
+     * @param ids A pointer to the first id to delete.
+     * @param n_ids The number of ids to delete.
+     * @return The number of entries which have been deleted.
+     * @throws std::logic_error If the id directory is disabled.
+     * @throws std::runtime_error If the log cannot be written.
+     */
+    len_t delete_entries(const vector_id_t *ids, const len_t n_ids);
+
     /**
      * Creates a new inverted list
      * and allocates space for the given number of entries.
@@ -542,8 +1843,33 @@ namespace ann_dkvs
      *                            the vector ids.
      * @param list_ids_filename The name of the file containing
      *                         the list ids.
+     * If a scalar quantizer is given, the vectors are encoded before they
+     * are inserted into lists storing its codes. An SQ_8BIT quantizer is
+     * first trained on the range of all vectors in the file.
+     * The lists are flushed once all entries are inserted.
+     *
+     * Unless DYNAMIC_INSERTION is set, the lists are preallocated in a first
+     * pass counting the entries of each list, and the entries are written
+     * in a second pass, both of which read BULK_INSERT_N_RANGES ranges
+     * of the files in parallel.
+     *
      * @param n_entries The number of entries to insert.
+     * @param scalar_quantizer The scalar quantizer of the lists or nullptr.
+     * @throws std::logic_error If the lists store codes other than those
+     *                          of the given scalar quantizer or if the
+     *                          write-ahead log is enabled, since the lists
+     *                          are flushed instead of logging the entries.
+     */
+    void bulk_insert_entries(const std::string &vectors_filename, const std::string &vector_ids_filename, const std::string &list_ids_filename, const len_t n_entries, ScalarQuantizer *scalar_quantizer = nullptr);
+
+    /**
+     * Trains a scalar quantizer on all vectors of the given file.
+     *
+     * @param scalar_quantizer The scalar quantizer.
+     * @param vectors_filename The name of the file containing the vectors.
+     * @param n_entries The number of vectors in the file.
+     * @throws std::runtime_error If the file cannot be read.
      */
-    void bulk_insert_entries(const std::string &vectors_filename, const std::string &vector_ids_filename, const std::string &list_ids_filename, const len_t n_entries);
+    void train_scalar_quantizer(ScalarQuantizer *scalar_quantizer, const std::string &vectors_filename, const len_t n_entries) const;
   };
 }
\ No newline at end of file
@@ -1,15 +1,300 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "StorageLists.hpp"
 #include "StorageIndex.hpp"
+#include "ListPrefetcher.hpp"
+#include "Protocol.hpp"
+
+#ifndef STORAGE_NODE_N_WORKERS
+/**
+ * Number of worker threads searching the requests of a storage node.
+ * Each batch is searched in parallel by OpenMP as well, so a few workers
+ * suffice to keep the cores busy while other requests are received.
+ * The OpenMP threads are split between the workers, see StorageNode.
+ */
+#define STORAGE_NODE_N_WORKERS 2
+#endif
+
+#ifndef STORAGE_NODE_MAX_EVENTS
+/**
+ * Maximum number of events handled per call to epoll_wait().
+ */
+#define STORAGE_NODE_MAX_EVENTS 64
+#endif
+
+#ifndef STORAGE_NODE_MAX_N_RESULTS
+/**
+ * Largest number of results a query may request from a storage node,
+ * as the results of every list probed are kept in a heap of that size.
+ */
+#define STORAGE_NODE_MAX_N_RESULTS 65536
+#endif
 
 namespace ann_dkvs
 {
+  /**
+   * State of a connection of a storage node, which is only accessed
+   * by the thread running the event loop.
+   *
+   * A connection handles one request at a time: while a request is searched
+   * by a worker, no further frames are read from the connection.
+   * A connection sending a frame with an invalid header is closing,
+   * i.e. it is closed after the error response has been sent.
+   */
+  struct Connection
+  {
+    int fd;
+    bool is_listening;
+    FrameHeader header;
+    size_t n_header_bytes_read;
+    std::vector<uint8_t> body;
+    size_t n_body_bytes_read;
+    std::vector<uint8_t> response;
+    size_t n_response_bytes_written;
+    bool is_busy;
+    bool is_closing;
+  };
+
+  /**
+   * A request received by the event loop and searched by a worker.
+   */
+  struct StorageNodeJob
+  {
+    uint64_t connection_id;
+    message_type_t message_type;
+    std::vector<uint8_t> body;
+    std::vector<uint8_t> response;
+  };
+
+  /**
+   * A server searching the lists of a storage node for batches of
+   * pre-assigned queries received over TCP or Unix domain sockets.
+   *
+   * A single thread runs an epoll event loop accepting connections and
+   * receiving frames (see Protocol.hpp) without blocking. Complete requests
+   * are handed to a pool of workers running batch_search_preassigned()
+   * on queries pointing into the received frames. Finished responses are
+   * handed back to the event loop, which is woken up by an eventfd.
+   */
   class StorageNode
   {
   private:
-    const StorageIndex &index;
+    /**
+     * The lists owned by the node.
+     */
+    std::unique_ptr<StorageLists> lists;
+
+    /**
+     * The index searching the lists.
+     */
+    StorageIndex index;
+
+    /**
+     * Prefetches the lists of a batch while the first lists are searched.
+     */
+    std::unique_ptr<ListPrefetcher> prefetcher;
+
+    /**
+     * File descriptors of the epoll instance and of the eventfd
+     * waking up the event loop.
+     */
+    int epoll_fd;
+    int wake_fd;
+
+    /**
+     * Connections and listening sockets by their id, which is also
+     * stored in their epoll events. Unlike file descriptors, ids are never
+     * reused, so a finished job cannot be sent to the wrong connection.
+     */
+    std::unordered_map<uint64_t, Connection> connections;
+    uint64_t next_connection_id;
+
+    /**
+     * Paths of the Unix domain sockets, which are removed on stop().
+     */
+    std::vector<std::string> unix_socket_paths;
+
+    /**
+     * Jobs waiting for a worker and jobs waiting to be sent,
+     * both guarded by jobs_mutex.
+     */
+    std::deque<StorageNodeJob> pending_jobs;
+    std::deque<StorageNodeJob> finished_jobs;
+    std::mutex jobs_mutex;
+    std::condition_variable jobs_available;
+
+    /**
+     * Notified when the node is stopped, see wait().
+     */
+    std::condition_variable stopped;
+
+    /**
+     * Guards the connections, as listening sockets may be added
+     * by other threads while the event loop is running.
+     */
+    std::mutex connections_mutex;
+
+    std::atomic<bool> is_stopping;
+    std::thread event_loop_thread;
+    std::vector<std::thread> worker_threads;
+
+    /**
+     * Number of OpenMP threads searching a batch of each worker.
+     * The workers share the threads OpenMP would use for a single batch,
+     * e.g. OMP_NUM_THREADS, instead of each starting a team of that size.
+     */
+    len_t n_threads_per_worker;
+
+    /**
+     * Receives frames and sends responses until the node is stopped.
+     */
+    void run_event_loop();
+
+    /**
+     * Searches pending jobs until the node is stopped,
+     * with teams of n_threads_per_worker OpenMP threads.
+     */
+    void run_worker();
+
+    /**
+     * Searches the queries of a request and encodes the results
+     * or the error preventing the search as the response.
+     *
+     * @param job The job to handle.
+     */
+    void handle_job(StorageNodeJob &job) const;
+
+    /**
+     * Checks that queries can be searched in the lists of the node.
+     *
+     * @param queries A batch of queries.
+     * @param vector_dim The dimension of the query vectors.
+     * @throws std::invalid_argument If the dimension does not match,
+     *                               a query requests no results or more
+     *                               than STORAGE_NODE_MAX_N_RESULTS
+     *                               or a list does not exist.
+     */
+    void check_queries(const QueryBatch &queries, const len_t vector_dim) const;
+
+    /**
+     * Accepts all pending connections of a listening socket.
+     */
+    void accept_connections(const Connection &listener);
+
+    /**
+     * Receives as much of the current frame of a connection as available
+     * and queues the request once the frame is complete.
+     *
+     * @return False if the connection was closed.
+     */
+    bool receive_frame(const uint64_t connection_id, Connection &connection);
+
+    /**
+     * Sends as much of the response of a connection as possible and
+     * waits for the next frame once the response has been sent.
+     *
+     * @return False if the connection was closed.
+     */
+    bool send_response(const uint64_t connection_id, Connection &connection);
+
+    /**
+     * Hands the responses of finished jobs to their connections.
+     */
+    void send_finished_jobs();
+
+    /**
+     * Registers a socket with the event loop, which takes ownership of it.
+     *
+     * @throws std::runtime_error If the socket cannot be registered.
+     */
+    void add_connection(const int fd, const bool is_listening, const uint32_t events);
+
+    /**
+     * Changes the events the event loop waits for on a connection.
+     */
+    void watch_connection(const uint64_t connection_id, const Connection &connection, const uint32_t events);
+
+    /**
+     * Closes a connection and forgets its state.
+     */
+    void close_connection(const uint64_t connection_id);
+
+    /**
+     * Wakes up the event loop.
+     */
+    void wake_event_loop();
 
   public:
-    StorageNode(const StorageIndex &index);
+    /**
+     * Creates a storage node owning the given lists and starts
+     * its event loop and workers. The node accepts connections
+     * once it listens on a socket. If the lists are spread across NUMA
+     * nodes, they are placed on their nodes first.
+     *
+     * @param lists The lists to search, which must store raw vectors.
+     * @param n_workers The number of worker threads, which search
+     *                  with an equal share of the OpenMP threads.
+     * @throws std::out_of_range If the number of workers is 0.
+     * @throws std::runtime_error If the event loop cannot be created.
+     */
+    StorageNode(std::unique_ptr<StorageLists> lists, const len_t n_workers = STORAGE_NODE_N_WORKERS);
+
+    /**
+     * Stops the node, see stop().
+     */
+    ~StorageNode();
+
+    StorageNode(const StorageNode &) = delete;
+    StorageNode &operator=(const StorageNode &) = delete;
+
+    /**
+     * Accepts connections on a TCP socket.
+     *
+     * @param host The address to listen on, e.g. "127.0.0.1".
+     * @param port The port to listen on, or 0 to pick a free port.
+     * @return The port the node listens on.
+     * @throws std::runtime_error If the socket cannot be created.
+     */
+    uint16_t listen_tcp(const std::string &host, const uint16_t port);
+
+    /**
+     * Accepts connections on a Unix domain socket.
+     *
+     * @param path The path of the socket.
+     * @throws std::runtime_error If the socket cannot be created.
+     */
+    void listen_unix(const std::string &path);
+
+    /**
+     * Blocks until the node is stopped by another thread.
+     */
+    void wait();
+
+    /**
+     * Stops the event loop and the workers and closes all connections.
+     * Requests which are still being searched are dropped.
+     */
+    void stop();
+
+    /**
+     * Returns the lists owned by the node.
+     */
+    const StorageLists *get_lists() const;
+
+    /**
+     * Returns the number of OpenMP threads searching a batch of each worker.
+     */
+    len_t get_n_threads_per_worker() const;
   };
-}
\ No newline at end of file
+}
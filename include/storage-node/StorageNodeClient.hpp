@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Query.hpp"
+
+namespace ann_dkvs
+{
+  /**
+   * A blocking connection to a storage node.
+   *
+   * A request can be sent and its response received separately,
+   * so that requests to several storage nodes are searched in parallel
+   * while their responses are awaited one after another.
+   */
+  class StorageNodeClient
+  {
+  private:
+    /**
+     * File descriptor of the connected socket.
+     */
+    int fd;
+
+    /**
+     * Buffer of the frames sent and received.
+     */
+    std::vector<uint8_t> frame;
+
+  public:
+    /**
+     * Connects to a storage node listening on a TCP socket.
+     *
+     * @param host The host name or address of the node.
+     * @param port The port of the node.
+     * @throws std::runtime_error If the connection fails.
+     */
+    StorageNodeClient(const std::string &host, const uint16_t port);
+
+    /**
+     * Connects to a storage node listening on a Unix domain socket.
+     *
+     * @param socket_path The path of the socket.
+     * @throws std::runtime_error If the connection fails.
+     */
+    StorageNodeClient(const std::string &socket_path);
+
+    ~StorageNodeClient();
+
+    StorageNodeClient(const StorageNodeClient &) = delete;
+    StorageNodeClient &operator=(const StorageNodeClient &) = delete;
+
+    /**
+     * Sends a batch of pre-assigned queries to the node.
+     *
+     * @param queries A batch of queries whose lists to probe are set.
+     * @param vector_dim The dimension of the query vectors.
+     * @throws std::runtime_error If the connection fails.
+     */
+    void send_search_request(const QueryBatch &queries, const len_t vector_dim);
+
+    /**
+     * Waits for the response to the last request sent.
+     *
+     * @return A batch of query results.
+     * @throws std::runtime_error If the connection fails, the response is
+     *                            malformed or the node reports an error.
+     */
+    QueryResultsBatch receive_search_response();
+
+    /**
+     * Searches a batch of pre-assigned queries on the node,
+     * see StorageIndex::batch_search_preassigned().
+     *
+     * @param queries A batch of queries whose lists to probe are set.
+     * @param vector_dim The dimension of the query vectors.
+     * @return A batch of query results.
+     * @throws std::runtime_error If the connection fails or
+     *                            the node reports an error.
+     */
+    QueryResultsBatch batch_search_preassigned(const QueryBatch &queries, const len_t vector_dim);
+  };
+}
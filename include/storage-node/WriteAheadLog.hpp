@@ -0,0 +1,216 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "types.hpp"
+
+#ifndef WAL_GROUP_COMMIT_SIZE
+/**
+ * Number of buffered bytes after which the records appended to
+ * a write-ahead log are written and synced without waiting for sync(),
+ * so that a single fdatasync() commits a whole group of records.
+ */
+#define WAL_GROUP_COMMIT_SIZE (1UL << 20)
+#endif
+
+#define WAL_MAGIC 0x474C4157
+#define WAL_VERSION 1
+
+/**
+ * Flag set in the type of a record which is followed by further records
+ * of the same operation. Such records are only replayed together with
+ * the record ending the operation, so that a torn operation is not
+ * replayed partly.
+ */
+#define WAL_RECORD_CONTINUED (1U << 31)
+
+namespace ann_dkvs
+{
+  /**
+   * Types of the operations recorded in a write-ahead log.
+   */
+  enum wal_record_type_t : uint32_t
+  {
+    WAL_RECORD_CREATE_LIST = 1,
+    WAL_RECORD_RESIZE_LIST = 2,
+    WAL_RECORD_INSERT = 3,
+    WAL_RECORD_UPDATE = 4,
+    WAL_RECORD_DELETE = 5,
+    WAL_RECORD_COMPACT_LIST = 6
+  };
+
+  /**
+   * Header of a record, followed by payload_size bytes of payload,
+   * e.g. the vectors and ids of an insertion. The checksum covers
+   * the rest of the header and the payload, so that a record which
+   * was only partly written before a crash is detected.
+   */
+  struct WalRecordHeader
+  {
+    uint32_t checksum;
+    uint32_t type;
+    int64_t list_id;
+    uint64_t n_entries;
+    uint64_t offset;
+    uint64_t payload_size;
+  };
+
+  /**
+   * Header at the start of a log file. The generation is increased
+   * whenever the log is reset by a checkpoint, so that a log can be
+   * matched with the checkpoint it continues.
+   */
+  struct WalFileHeader
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t generation;
+  };
+
+  /**
+   * An append-only redo log of the modifications of storage lists
+   * since their last checkpoint.
+   *
+   * Appended records are buffered in memory. sync() writes the buffered
+   * records and waits until they are durable. Threads calling sync() while
+   * another thread syncs wait for it and are committed by the next sync
+   * together (group commit), so one fdatasync() covers all their records.
+   *
+   * If records cannot be written, the log fails: the records which were not
+   * written are lost and the file may end with a torn record, after which
+   * no record would be replayed. Every later append() and sync() therefore
+   * throws until the log is reset by a checkpoint.
+   */
+  class WriteAheadLog
+  {
+  private:
+    const std::string filename;
+    int fd;
+    uint64_t generation;
+
+    /**
+     * Records appended but not yet written to the file.
+     */
+    std::vector<uint8_t> buffer;
+
+    /**
+     * Log sequence numbers, i.e. the number of bytes of records appended
+     * since the log was opened, up to which records have been appended
+     * and synced and at which the current generation starts.
+     */
+    uint64_t appended_lsn;
+    uint64_t synced_lsn;
+    uint64_t generation_lsn;
+
+    bool is_syncing;
+
+    /**
+     * Whether records could not be written since the last reset.
+     */
+    bool is_failed;
+
+    std::mutex mutex;
+    std::condition_variable synced;
+
+    /**
+     * Writes the file header of the current generation
+     * to the start of the empty file.
+     */
+    void write_file_header();
+
+    /**
+     * Throws if the log has failed, the mutex has to be held.
+     *
+     * @throws std::runtime_error If the log has failed.
+     */
+    void check_not_failed() const;
+
+  public:
+    /**
+     * Opens a log file, creating an empty log of generation 0
+     * if the file does not exist.
+     *
+     * Records of an existing log are expected to be replayed and the log
+     * to be reset before new records are appended, since appended records
+     * would not be replayed after an incomplete record.
+     *
+     * @param filename The name of the log file.
+     * @throws std::runtime_error If the file cannot be opened or is invalid.
+     */
+    WriteAheadLog(const std::string &filename);
+
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+    /**
+     * Appends a record to the log. The record is durable once
+     * sync() has been called with the returned log sequence number.
+     *
+     * @param header The header of the record, whose checksum and payload
+     *               size are set here.
+     * @param payload The parts of the payload, i.e. pairs of a pointer
+     *                and a size in bytes.
+     * @return The log sequence number of the end of the record.
+     * @throws std::runtime_error If a group commit fails or the log has failed.
+     */
+    uint64_t append(WalRecordHeader header, const std::vector<std::pair<const void *, size_t>> &payload);
+
+    /**
+     * Waits until all records up to the given log sequence number are durable.
+     *
+     * @param lsn The log sequence number returned by append().
+     * @throws std::runtime_error If the records cannot be written or the log has failed.
+     */
+    void sync(const uint64_t lsn);
+
+    /**
+     * Waits until all appended records are durable.
+     *
+     * @throws std::runtime_error If the records cannot be written or the log has failed.
+     */
+    void sync();
+
+    /**
+     * Reads the complete records of the log in order. Reading stops
+     * at the first record which is incomplete or corrupt, i.e. at records
+     * which were not durable when the process stopped. Records flagged
+     * with WAL_RECORD_CONTINUED are applied, without the flag, once the
+     * record ending their operation is read, and are skipped otherwise.
+     *
+     * @param apply The function called with every record and its payload.
+     * @throws std::runtime_error If the file cannot be read.
+     */
+    void replay(const std::function<void(const WalRecordHeader &, const uint8_t *)> &apply);
+
+    /**
+     * Discards all records and starts a new generation of the log,
+     * which recovers a failed log.
+     *
+     * @param new_generation The generation of the emptied log.
+     * @throws std::runtime_error If the file cannot be truncated.
+     */
+    void reset(const uint64_t new_generation);
+
+    /**
+     * Returns the generation of the log.
+     */
+    uint64_t get_generation() const;
+
+    /**
+     * Returns the size of all records appended in this generation in bytes.
+     */
+    uint64_t get_size();
+
+    /**
+     * Returns whether records could not be written since the last reset.
+     */
+    bool has_failed();
+  };
+}
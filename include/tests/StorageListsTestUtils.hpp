@@ -53,6 +53,7 @@ namespace ann_dkvs
   size_t round_up_to_next_power_of_two(size_t value);
   size_t is_power_of_two(size_t value);
   size_t get_vector_size(len_t vector_dim);
+  size_t get_aligned_size(size_t size);
   size_t get_list_size(len_t vector_dim, len_t n_entries);
   size_t get_total_size(size_t used_space);
   void write_to_file(std::string filename, void *data, size_t size);
@@ -0,0 +1,59 @@
+#include <cmath>
+
+#include "CosineSpace.hpp"
+#include "IPSpace.hpp"
+
+namespace ann_dkvs
+{
+  template <distance_func_t inner_product_func>
+  static float CosineDistance(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
+  {
+    float norm_sqr1 = inner_product_func(pVect1v, pVect1v, qty_ptr);
+    float norm_sqr2 = inner_product_func(pVect2v, pVect2v, qty_ptr);
+    float norm_product = std::sqrt(norm_sqr1 * norm_sqr2);
+    if (norm_product == 0)
+    {
+      return 1.0f;
+    }
+    return 1.0f - inner_product_func(pVect1v, pVect2v, qty_ptr) / norm_product;
+  }
+
+  static distance_func_t get_cosine_distance_func(const simd_level_t simd_level)
+  {
+    switch (simd_level)
+    {
+#if USE_SIMD && defined(__x86_64__)
+    case SIMD_AVX512:
+      return CosineDistance<InnerProductAVX512>;
+    case SIMD_AVX2_FMA:
+      return CosineDistance<InnerProductAVX2FMA>;
+    case SIMD_AVX:
+      return CosineDistance<InnerProductAVX>;
+#endif
+    default:
+      return CosineDistance<InnerProduct>;
+    }
+  }
+
+  distance_t get_inverse_norm(const vector_el_t *vector, size_t vector_dim)
+  {
+    static const distance_func_t inner_product_func = get_inner_product_func(get_simd_level());
+    float norm_sqr = inner_product_func(vector, vector, &vector_dim);
+    if (norm_sqr == 0)
+    {
+      return 0;
+    }
+    return 1.0f / std::sqrt(norm_sqr);
+  }
+
+  CosineSpace::CosineSpace(size_t vector_dim)
+      : CosineSpace(vector_dim, ann_dkvs::get_simd_level())
+  {
+  }
+
+  CosineSpace::CosineSpace(size_t vector_dim, simd_level_t simd_level)
+      : Space(vector_dim, simd_level, METRIC_COSINE)
+  {
+    distance_func = get_cosine_distance_func(simd_level);
+  }
+}
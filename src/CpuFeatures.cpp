@@ -0,0 +1,45 @@
+#include "CpuFeatures.hpp"
+
+namespace ann_dkvs
+{
+  static simd_level_t detect_simd_level()
+  {
+#if USE_SIMD && defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+      return SIMD_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c"))
+    {
+      return SIMD_AVX2_FMA;
+    }
+    if (__builtin_cpu_supports("avx"))
+    {
+      return SIMD_AVX;
+    }
+#endif
+    return SIMD_NONE;
+  }
+
+  simd_level_t get_simd_level()
+  {
+    static const simd_level_t simd_level = detect_simd_level();
+    return simd_level;
+  }
+
+  const char *get_simd_level_name(const simd_level_t simd_level)
+  {
+    switch (simd_level)
+    {
+    case SIMD_AVX512:
+      return "AVX-512";
+    case SIMD_AVX2_FMA:
+      return "AVX2+FMA";
+    case SIMD_AVX:
+      return "AVX";
+    default:
+      return "none";
+    }
+  }
+}
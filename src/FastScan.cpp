@@ -0,0 +1,164 @@
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include "FastScan.hpp"
+#include "SimdHelpers.hpp"
+
+namespace ann_dkvs
+{
+  using scan_block_func_t = void (*)(const uint8_t *, const uint8_t *, size_t, uint16_t *);
+
+  size_t get_fast_scan_size(const len_t n_codes, const size_t code_size)
+  {
+    len_t n_blocks = (n_codes + FAST_SCAN_BLOCK_SIZE - 1) / FAST_SCAN_BLOCK_SIZE;
+    return n_blocks * FAST_SCAN_BLOCK_SIZE * code_size;
+  }
+
+  void set_fast_scan_code(uint8_t *blocks, const size_t code_size, const len_t position, const uint8_t *code)
+  {
+    uint8_t *block = &blocks[position / FAST_SCAN_BLOCK_SIZE * FAST_SCAN_BLOCK_SIZE * code_size];
+    len_t position_in_block = position % FAST_SCAN_BLOCK_SIZE;
+    uint8_t shift = position_in_block < 16 ? 0 : 4;
+    for (size_t m = 0; m < 2 * code_size; m++)
+    {
+      uint8_t centroid = (code[m / 2] >> (4 * (m % 2))) & 0x0F;
+      uint8_t *byte = &block[m * 16 + position_in_block % 16];
+      *byte = (uint8_t)((*byte & ~(0x0F << shift)) | (centroid << shift));
+    }
+  }
+
+  void get_fast_scan_code(const uint8_t *blocks, const size_t code_size, const len_t position, uint8_t *code)
+  {
+    const uint8_t *block = &blocks[position / FAST_SCAN_BLOCK_SIZE * FAST_SCAN_BLOCK_SIZE * code_size];
+    len_t position_in_block = position % FAST_SCAN_BLOCK_SIZE;
+    uint8_t shift = position_in_block < 16 ? 0 : 4;
+    for (size_t i = 0; i < code_size; i++)
+    {
+      uint8_t even = (block[2 * i * 16 + position_in_block % 16] >> shift) & 0x0F;
+      uint8_t odd = (block[(2 * i + 1) * 16 + position_in_block % 16] >> shift) & 0x0F;
+      code[i] = (uint8_t)(even | (odd << 4));
+    }
+  }
+
+  static void scan_block_scalar(const uint8_t *lut, const uint8_t *block, size_t code_size, uint16_t *sums)
+  {
+    for (len_t j = 0; j < FAST_SCAN_BLOCK_SIZE; j++)
+    {
+      uint8_t shift = j < 16 ? 0 : 4;
+      uint16_t sum = 0;
+      for (size_t m = 0; m < 2 * code_size; m++)
+      {
+        uint8_t centroid = (block[m * 16 + j % 16] >> shift) & 0x0F;
+        sum += lut[m * FAST_SCAN_N_CENTROIDS + centroid];
+      }
+      sums[j] = sum;
+    }
+  }
+
+#if USE_SIMD && defined(__x86_64__)
+  /**
+   * Adds up the sums of the even and of the odd subvectors, held by the low
+   * and the high lane, and stores them in the order of the codes.
+   */
+  __attribute__((target("avx2"))) static inline void store_sums_avx2(__m256i even_codes, __m256i odd_codes, uint16_t *sums)
+  {
+    __m128i even = _mm_add_epi16(_mm256_castsi256_si128(even_codes), _mm256_extracti128_si256(even_codes, 1));
+    __m128i odd = _mm_add_epi16(_mm256_castsi256_si128(odd_codes), _mm256_extracti128_si256(odd_codes, 1));
+    _mm_storeu_si128((__m128i *)sums, _mm_unpacklo_epi16(even, odd));
+    _mm_storeu_si128((__m128i *)&sums[8], _mm_unpackhi_epi16(even, odd));
+  }
+
+  __attribute__((target("avx2"))) static void scan_block_avx2(const uint8_t *lut, const uint8_t *block, size_t code_size, uint16_t *sums)
+  {
+    const __m256i low_nibbles = _mm256_set1_epi8(0x0F);
+    const __m256i low_bytes = _mm256_set1_epi16(0x00FF);
+    // 16-bit accumulators of the first and last 16 codes, split into even and odd codes
+    __m256i first_even = _mm256_setzero_si256();
+    __m256i first_odd = _mm256_setzero_si256();
+    __m256i last_even = _mm256_setzero_si256();
+    __m256i last_odd = _mm256_setzero_si256();
+    for (size_t i = 0; i < code_size; i++)
+    {
+      // two subvectors per register: the low lane holds subvector 2i, the high lane 2i+1
+      __m256i codes = _mm256_loadu_si256((const __m256i *)&block[i * 32]);
+      __m256i table = _mm256_loadu_si256((const __m256i *)&lut[i * 32]);
+      __m256i first = _mm256_shuffle_epi8(table, _mm256_and_si256(codes, low_nibbles));
+      __m256i last = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(codes, 4), low_nibbles));
+      first_even = _mm256_add_epi16(first_even, _mm256_and_si256(first, low_bytes));
+      first_odd = _mm256_add_epi16(first_odd, _mm256_srli_epi16(first, 8));
+      last_even = _mm256_add_epi16(last_even, _mm256_and_si256(last, low_bytes));
+      last_odd = _mm256_add_epi16(last_odd, _mm256_srli_epi16(last, 8));
+    }
+    store_sums_avx2(first_even, first_odd, sums);
+    store_sums_avx2(last_even, last_odd, &sums[16]);
+  }
+#endif
+
+  static scan_block_func_t get_scan_block_func(const simd_level_t simd_level)
+  {
+    switch (simd_level)
+    {
+#if USE_SIMD && defined(__x86_64__)
+    case SIMD_AVX512:
+    case SIMD_AVX2_FMA:
+      return scan_block_avx2;
+#endif
+    default:
+      return scan_block_scalar;
+    }
+  }
+
+  FastScanTable::FastScanTable(const distance_t *table, const len_t n_subvectors)
+      : code_size((n_subvectors + 1) / 2), lut(2 * code_size * FAST_SCAN_N_CENTROIDS, 0), bias(0), scale(1), n_subvectors(n_subvectors)
+  {
+    if (code_size > FAST_SCAN_MAX_CODE_SIZE)
+    {
+      throw std::invalid_argument("The codes are too large to be scanned with fast-scan");
+    }
+    std::vector<distance_t> minima(n_subvectors);
+    distance_t max_range = 0;
+    for (len_t m = 0; m < n_subvectors; m++)
+    {
+      const distance_t *subvector_table = &table[m * FAST_SCAN_N_CENTROIDS];
+      auto min_max = std::minmax_element(subvector_table, subvector_table + FAST_SCAN_N_CENTROIDS);
+      minima[m] = *min_max.first;
+      bias += minima[m];
+      max_range = std::max(max_range, *min_max.second - *min_max.first);
+    }
+    if (max_range > 0)
+    {
+      scale = 255.0f / max_range;
+    }
+    for (len_t m = 0; m < n_subvectors; m++)
+    {
+      for (len_t c = 0; c < FAST_SCAN_N_CENTROIDS; c++)
+      {
+        distance_t entry = std::round((table[m * FAST_SCAN_N_CENTROIDS + c] - minima[m]) * scale);
+        lut[m * FAST_SCAN_N_CENTROIDS + c] = (uint8_t)std::min(entry, 255.0f);
+      }
+    }
+  }
+
+  void FastScanTable::scan(const uint8_t *blocks, const len_t n_codes, distance_t *distances) const
+  {
+    static const scan_block_func_t scan_block_func = get_scan_block_func(get_simd_level());
+    uint16_t sums[FAST_SCAN_BLOCK_SIZE];
+    distance_t inverse_scale = 1.0f / scale;
+    for (len_t block_start = 0; block_start < n_codes; block_start += FAST_SCAN_BLOCK_SIZE)
+    {
+      scan_block_func(lut.data(), &blocks[block_start * code_size], code_size, sums);
+      len_t block_size = std::min((len_t)FAST_SCAN_BLOCK_SIZE, n_codes - block_start);
+      for (len_t j = 0; j < block_size; j++)
+      {
+        distances[block_start + j] = bias + sums[j] * inverse_scale;
+      }
+    }
+  }
+
+  distance_t FastScanTable::get_max_error() const
+  {
+    return n_subvectors * 0.5f / scale;
+  }
+}
@@ -0,0 +1,197 @@
+#include "IPSpace.hpp"
+#include "SimdHelpers.hpp"
+
+namespace ann_dkvs
+{
+#if USE_SIMD && defined(__x86_64__)
+  __attribute__((target("avx"))) float InnerProductAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
+  {
+    const float *pVect1 = (const float *)pVect1v;
+    const float *pVect2 = (const float *)pVect2v;
+    size_t qty = *((size_t *)qty_ptr);
+    size_t qty8 = qty >> 3 << 3;
+
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t i = 0; i < qty8; i += 8)
+    {
+      sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(pVect1 + i), _mm256_loadu_ps(pVect2 + i)));
+    }
+    float res = horizontal_sum_avx(sum);
+
+    size_t qty_left = qty - qty8;
+    return res + InnerProduct(pVect1 + qty8, pVect2 + qty8, &qty_left);
+  }
+
+  __attribute__((target("avx2,fma"))) float InnerProductAVX2FMA(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
+  {
+    const float *pVect1 = (const float *)pVect1v;
+    const float *pVect2 = (const float *)pVect2v;
+    size_t qty = *((size_t *)qty_ptr);
+    size_t qty16 = qty >> 4 << 4;
+    size_t qty8 = qty >> 3 << 3;
+
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i < qty16; i += 16)
+    {
+      sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1 + i), _mm256_loadu_ps(pVect2 + i), sum0);
+      sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1 + i + 8), _mm256_loadu_ps(pVect2 + i + 8), sum1);
+    }
+    for (; i < qty8; i += 8)
+    {
+      sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1 + i), _mm256_loadu_ps(pVect2 + i), sum0);
+    }
+    float res = horizontal_sum_avx(_mm256_add_ps(sum0, sum1));
+
+    size_t qty_left = qty - qty8;
+    return res + InnerProduct(pVect1 + qty8, pVect2 + qty8, &qty_left);
+  }
+
+  __attribute__((target("avx512f"))) float InnerProductAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
+  {
+    const float *pVect1 = (const float *)pVect1v;
+    const float *pVect2 = (const float *)pVect2v;
+    size_t qty = *((size_t *)qty_ptr);
+    size_t qty32 = qty >> 5 << 5;
+    size_t qty16 = qty >> 4 << 4;
+
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i < qty32; i += 32)
+    {
+      sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(pVect1 + i), _mm512_loadu_ps(pVect2 + i), sum0);
+      sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(pVect1 + i + 16), _mm512_loadu_ps(pVect2 + i + 16), sum1);
+    }
+    for (; i < qty16; i += 16)
+    {
+      sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(pVect1 + i), _mm512_loadu_ps(pVect2 + i), sum0);
+    }
+    if (i < qty)
+    {
+      __mmask16 mask = get_tail_mask16(qty - i);
+      sum1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, pVect1 + i), _mm512_maskz_loadu_ps(mask, pVect2 + i), sum1);
+    }
+    return horizontal_sum_avx512(_mm512_add_ps(sum0, sum1));
+  }
+
+  __attribute__((target("avx2,fma,f16c"))) float InnerProductFp16AVX2FMA(const vector_el_t *query, const uint8_t *code, const distance_t *weights, size_t qty)
+  {
+    const uint16_t *halfs = (const uint16_t *)code;
+    size_t qty8 = qty >> 3 << 3;
+
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t i = 0; i < qty8; i += 8)
+    {
+      sum = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), load_fp16_avx2(halfs + i), sum);
+    }
+    return horizontal_sum_avx(sum) + InnerProductFp16(query + qty8, (const uint8_t *)(halfs + qty8), weights, qty - qty8);
+  }
+
+  __attribute__((target("avx2,fma"))) float InnerProductBf16AVX2FMA(const vector_el_t *query, const uint8_t *code, const distance_t *weights, size_t qty)
+  {
+    const uint16_t *bf16s = (const uint16_t *)code;
+    size_t qty8 = qty >> 3 << 3;
+
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t i = 0; i < qty8; i += 8)
+    {
+      sum = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), load_bf16_avx2(bf16s + i), sum);
+    }
+    return horizontal_sum_avx(sum) + InnerProductBf16(query + qty8, (const uint8_t *)(bf16s + qty8), weights, qty - qty8);
+  }
+
+  __attribute__((target("avx2,fma"))) float InnerProductSQ8AVX2FMA(const vector_el_t *query, const uint8_t *code, const distance_t *weights, size_t qty)
+  {
+    size_t qty8 = qty >> 3 << 3;
+
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t i = 0; i < qty8; i += 8)
+    {
+      sum = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), load_sq8_avx2(code + i), sum);
+    }
+    return horizontal_sum_avx(sum) + InnerProductSQ8(query + qty8, code + qty8, weights, qty - qty8);
+  }
+#endif
+
+  template <distance_func_t inner_product_func>
+  static float InnerProductDistance(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
+  {
+    return 1.0f - inner_product_func(pVect1v, pVect2v, qty_ptr);
+  }
+
+  distance_func_t get_inner_product_func(const simd_level_t simd_level)
+  {
+    switch (simd_level)
+    {
+#if USE_SIMD && defined(__x86_64__)
+    case SIMD_AVX512:
+      return InnerProductAVX512;
+    case SIMD_AVX2_FMA:
+      return InnerProductAVX2FMA;
+    case SIMD_AVX:
+      return InnerProductAVX;
+#endif
+    default:
+      return InnerProduct;
+    }
+  }
+
+  code_distance_func_t get_inner_product_code_func(const sq_type_t sq_type, const simd_level_t simd_level)
+  {
+#if USE_SIMD && defined(__x86_64__)
+    if (simd_level >= SIMD_AVX2_FMA)
+    {
+      switch (sq_type)
+      {
+      case SQ_FP16:
+        return InnerProductFp16AVX2FMA;
+      case SQ_BF16:
+        return InnerProductBf16AVX2FMA;
+      default:
+        return InnerProductSQ8AVX2FMA;
+      }
+    }
+#else
+    (void)simd_level;
+#endif
+    switch (sq_type)
+    {
+    case SQ_FP16:
+      return InnerProductFp16;
+    case SQ_BF16:
+      return InnerProductBf16;
+    default:
+      return InnerProductSQ8;
+    }
+  }
+
+  static distance_func_t get_ip_distance_func(const simd_level_t simd_level)
+  {
+    switch (simd_level)
+    {
+#if USE_SIMD && defined(__x86_64__)
+    case SIMD_AVX512:
+      return InnerProductDistance<InnerProductAVX512>;
+    case SIMD_AVX2_FMA:
+      return InnerProductDistance<InnerProductAVX2FMA>;
+    case SIMD_AVX:
+      return InnerProductDistance<InnerProductAVX>;
+#endif
+    default:
+      return InnerProductDistance<InnerProduct>;
+    }
+  }
+
+  IPSpace::IPSpace(size_t vector_dim)
+      : IPSpace(vector_dim, ann_dkvs::get_simd_level())
+  {
+  }
+
+  IPSpace::IPSpace(size_t vector_dim, simd_level_t simd_level)
+      : Space(vector_dim, simd_level, METRIC_INNER_PRODUCT)
+  {
+    distance_func = get_ip_distance_func(simd_level);
+  }
+}
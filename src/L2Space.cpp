@@ -1,31 +1,187 @@
 #include "L2Space.hpp"
+#include "SimdHelpers.hpp"
 
 namespace ann_dkvs
 {
+#if USE_SIMD && defined(__x86_64__)
+  __attribute__((target("avx"))) float L2SqrAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
+  {
+    const float *pVect1 = (const float *)pVect1v;
+    const float *pVect2 = (const float *)pVect2v;
+    size_t qty = *((size_t *)qty_ptr);
+    size_t qty8 = qty >> 3 << 3;
+
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t i = 0; i < qty8; i += 8)
+    {
+      __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + i), _mm256_loadu_ps(pVect2 + i));
+      sum = _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
+    }
+    float res = horizontal_sum_avx(sum);
 
-  L2Space::L2Space(size_t vector_dim) : vector_dim(vector_dim)
+    size_t qty_left = qty - qty8;
+    return res + L2Sqr(pVect1 + qty8, pVect2 + qty8, &qty_left);
+  }
+
+  __attribute__((target("avx2,fma"))) float L2SqrAVX2FMA(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
   {
-    distance_func = L2Sqr;
+    const float *pVect1 = (const float *)pVect1v;
+    const float *pVect2 = (const float *)pVect2v;
+    size_t qty = *((size_t *)qty_ptr);
+    size_t qty16 = qty >> 4 << 4;
+    size_t qty8 = qty >> 3 << 3;
 
-#ifdef __AVX__
-    if (vector_dim % 16 == 0)
+    // two independent accumulators hide the latency of the fused multiply-add
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i < qty16; i += 16)
     {
-      distance_func = L2SqrSIMD16ExtAVX;
+      __m256 diff0 = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + i), _mm256_loadu_ps(pVect2 + i));
+      __m256 diff1 = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + i + 8), _mm256_loadu_ps(pVect2 + i + 8));
+      sum0 = _mm256_fmadd_ps(diff0, diff0, sum0);
+      sum1 = _mm256_fmadd_ps(diff1, diff1, sum1);
     }
-    else if (vector_dim > 16)
+    for (; i < qty8; i += 8)
+    {
+      __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + i), _mm256_loadu_ps(pVect2 + i));
+      sum0 = _mm256_fmadd_ps(diff, diff, sum0);
+    }
+    float res = horizontal_sum_avx(_mm256_add_ps(sum0, sum1));
+
+    size_t qty_left = qty - qty8;
+    return res + L2Sqr(pVect1 + qty8, pVect2 + qty8, &qty_left);
+  }
+
+  __attribute__((target("avx512f"))) float L2SqrAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
+  {
+    const float *pVect1 = (const float *)pVect1v;
+    const float *pVect2 = (const float *)pVect2v;
+    size_t qty = *((size_t *)qty_ptr);
+    size_t qty32 = qty >> 5 << 5;
+    size_t qty16 = qty >> 4 << 4;
+
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i < qty32; i += 32)
     {
-      distance_func = L2SqrSIMD16ExtResiduals;
+      __m512 diff0 = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + i), _mm512_loadu_ps(pVect2 + i));
+      __m512 diff1 = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + i + 16), _mm512_loadu_ps(pVect2 + i + 16));
+      sum0 = _mm512_fmadd_ps(diff0, diff0, sum0);
+      sum1 = _mm512_fmadd_ps(diff1, diff1, sum1);
     }
+    for (; i < qty16; i += 16)
+    {
+      __m512 diff = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + i), _mm512_loadu_ps(pVect2 + i));
+      sum0 = _mm512_fmadd_ps(diff, diff, sum0);
+    }
+    if (i < qty)
+    {
+      // masked loads read only the remaining elements, so no scalar tail is needed
+      __mmask16 mask = get_tail_mask16(qty - i);
+      __m512 diff = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, pVect1 + i), _mm512_maskz_loadu_ps(mask, pVect2 + i));
+      sum1 = _mm512_fmadd_ps(diff, diff, sum1);
+    }
+    return horizontal_sum_avx512(_mm512_add_ps(sum0, sum1));
+  }
+
+  __attribute__((target("avx2,fma,f16c"))) float L2SqrFp16AVX2FMA(const vector_el_t *query, const uint8_t *code, const distance_t *weights, size_t qty)
+  {
+    const uint16_t *halfs = (const uint16_t *)code;
+    size_t qty8 = qty >> 3 << 3;
+
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t i = 0; i < qty8; i += 8)
+    {
+      __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(query + i), load_fp16_avx2(halfs + i));
+      sum = _mm256_fmadd_ps(diff, diff, sum);
+    }
+    return horizontal_sum_avx(sum) + L2SqrFp16(query + qty8, (const uint8_t *)(halfs + qty8), weights, qty - qty8);
+  }
+
+  __attribute__((target("avx2,fma"))) float L2SqrBf16AVX2FMA(const vector_el_t *query, const uint8_t *code, const distance_t *weights, size_t qty)
+  {
+    const uint16_t *bf16s = (const uint16_t *)code;
+    size_t qty8 = qty >> 3 << 3;
+
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t i = 0; i < qty8; i += 8)
+    {
+      __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(query + i), load_bf16_avx2(bf16s + i));
+      sum = _mm256_fmadd_ps(diff, diff, sum);
+    }
+    return horizontal_sum_avx(sum) + L2SqrBf16(query + qty8, (const uint8_t *)(bf16s + qty8), weights, qty - qty8);
+  }
+
+  __attribute__((target("avx2,fma"))) float L2SqrSQ8AVX2FMA(const vector_el_t *query, const uint8_t *code, const distance_t *weights, size_t qty)
+  {
+    size_t qty8 = qty >> 3 << 3;
+
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t i = 0; i < qty8; i += 8)
+    {
+      __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(query + i), load_sq8_avx2(code + i));
+      sum = _mm256_fmadd_ps(_mm256_mul_ps(diff, diff), _mm256_loadu_ps(weights + i), sum);
+    }
+    return horizontal_sum_avx(sum) + L2SqrSQ8(query + qty8, code + qty8, weights + qty8, qty - qty8);
+  }
+#endif
+
+  static distance_func_t get_l2_distance_func(const simd_level_t simd_level)
+  {
+    switch (simd_level)
+    {
+#if USE_SIMD && defined(__x86_64__)
+    case SIMD_AVX512:
+      return L2SqrAVX512;
+    case SIMD_AVX2_FMA:
+      return L2SqrAVX2FMA;
+    case SIMD_AVX:
+      return L2SqrAVX;
+#endif
+    default:
+      return L2Sqr;
+    }
+  }
+
+  code_distance_func_t get_l2_code_distance_func(const sq_type_t sq_type, const simd_level_t simd_level)
+  {
+#if USE_SIMD && defined(__x86_64__)
+    if (simd_level >= SIMD_AVX2_FMA)
+    {
+      switch (sq_type)
+      {
+      case SQ_FP16:
+        return L2SqrFp16AVX2FMA;
+      case SQ_BF16:
+        return L2SqrBf16AVX2FMA;
+      default:
+        return L2SqrSQ8AVX2FMA;
+      }
+    }
+#else
+    (void)simd_level;
 #endif
+    switch (sq_type)
+    {
+    case SQ_FP16:
+      return L2SqrFp16;
+    case SQ_BF16:
+      return L2SqrBf16;
+    default:
+      return L2SqrSQ8;
+    }
   }
 
-  distance_func_t L2Space::get_distance_func() const
+  L2Space::L2Space(size_t vector_dim)
+      : L2Space(vector_dim, ann_dkvs::get_simd_level())
   {
-    return distance_func;
   }
 
-  len_t L2Space::get_vector_dim() const
+  L2Space::L2Space(size_t vector_dim, simd_level_t simd_level)
+      : Space(vector_dim, simd_level, METRIC_L2)
   {
-    return vector_dim;
+    distance_func = get_l2_distance_func(simd_level);
   }
 }
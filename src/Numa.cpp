@@ -0,0 +1,157 @@
+#include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/mempolicy.h>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "Numa.hpp"
+
+/**
+ * Number of pages passed to a single move_pages() system call.
+ */
+#define MOVE_PAGES_BATCH_SIZE 1024
+
+namespace ann_dkvs
+{
+  static len_t read_n_numa_nodes()
+  {
+    // e.g. "0-1" or "0,2-3", the highest node determines the number of nodes
+    std::ifstream file("/sys/devices/system/node/online");
+    std::string online;
+    if (!file || !std::getline(file, online))
+    {
+      return 1;
+    }
+    size_t start = online.find_last_of(",-");
+    try
+    {
+      return std::stoul(online.substr(start == std::string::npos ? 0 : start + 1)) + 1;
+    }
+    catch (const std::logic_error &)
+    {
+      return 1;
+    }
+  }
+
+  len_t get_n_numa_nodes()
+  {
+    static const len_t n_numa_nodes = read_n_numa_nodes();
+    return n_numa_nodes;
+  }
+
+  int get_current_numa_node()
+  {
+    unsigned cpu;
+    unsigned node;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+    {
+      return 0;
+    }
+    return (int)node;
+  }
+
+  bool get_numa_node_cpus(const int node, cpu_set_t *cpus)
+  {
+    // e.g. "0-3,8-11"
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string cpulist;
+    if (!file || !std::getline(file, cpulist))
+    {
+      return false;
+    }
+    CPU_ZERO(cpus);
+    size_t start = 0;
+    try
+    {
+      while (start < cpulist.size())
+      {
+        size_t end = cpulist.find(',', start);
+        std::string range = cpulist.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        size_t dash = range.find('-');
+        unsigned long first = std::stoul(range.substr(0, dash));
+        unsigned long last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+        for (unsigned long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+        {
+          CPU_SET(cpu, cpus);
+        }
+        if (end == std::string::npos)
+        {
+          break;
+        }
+        start = end + 1;
+      }
+    }
+    catch (const std::logic_error &)
+    {
+      return false;
+    }
+    return CPU_COUNT(cpus) > 0;
+  }
+
+  bool pin_thread_to_numa_node(const int node, cpu_set_t *previous_cpus)
+  {
+    cpu_set_t node_cpus;
+    if (!get_numa_node_cpus(node, &node_cpus) ||
+        sched_getaffinity(0, sizeof(cpu_set_t), previous_cpus) != 0)
+    {
+      return false;
+    }
+    cpu_set_t cpus;
+    CPU_AND(&cpus, &node_cpus, previous_cpus);
+    return CPU_COUNT(&cpus) > 0 && sched_setaffinity(0, sizeof(cpu_set_t), &cpus) == 0;
+  }
+
+  void unpin_thread(const cpu_set_t *previous_cpus)
+  {
+    // a failure only leaves the thread on its node
+    sched_setaffinity(0, sizeof(cpu_set_t), previous_cpus);
+  }
+
+  bool move_pages_to_numa_node(const void *addr, const size_t size, const int node)
+  {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)addr / page_size * page_size;
+    uintptr_t end = (uintptr_t)addr + size;
+    std::vector<void *> pages;
+    std::vector<int> nodes;
+    std::vector<int> status;
+    std::vector<unsigned char> residency(MOVE_PAGES_BATCH_SIZE);
+    for (uintptr_t batch_start = start; batch_start < end; batch_start += MOVE_PAGES_BATCH_SIZE * page_size)
+    {
+      // only resident pages are passed, so that pages of files larger
+      // than memory are neither read nor looked up in vain
+      size_t batch_size = std::min((uintptr_t)MOVE_PAGES_BATCH_SIZE * page_size, end - batch_start);
+      size_t n_batch_pages = (batch_size + page_size - 1) / page_size;
+      if (mincore((void *)batch_start, batch_size, residency.data()) != 0)
+      {
+        return false;
+      }
+      pages.clear();
+      for (size_t i = 0; i < n_batch_pages; i++)
+      {
+        if (residency[i] & 1)
+        {
+          pages.push_back((void *)(batch_start + i * page_size));
+        }
+      }
+      if (pages.empty())
+      {
+        continue;
+      }
+      nodes.assign(pages.size(), node);
+      status.resize(pages.size());
+      // the status of each page tells whether it was moved, which is ignored
+      if (syscall(SYS_move_pages, 0, pages.size(), pages.data(), nodes.data(), status.data(), MPOL_MF_MOVE) < 0)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+}
@@ -0,0 +1,314 @@
+#include <stdexcept>
+#include <random>
+#include <limits>
+#include <fstream>
+#include <cstring>
+
+#include "ProductQuantizer.hpp"
+#include "L2Space.hpp"
+#include "IPSpace.hpp"
+
+namespace ann_dkvs
+{
+  ProductQuantizer::ProductQuantizer(const len_t vector_dim, const len_t n_subvectors, const len_t n_bits)
+      : vector_dim(vector_dim), n_subvectors(n_subvectors), n_bits(n_bits)
+  {
+    init_dimensions();
+  }
+
+  void ProductQuantizer::init_dimensions()
+  {
+    if (n_subvectors == 0 || vector_dim % n_subvectors != 0)
+    {
+      throw std::invalid_argument("Vector dimension must be a multiple of the number of subvectors");
+    }
+    if (n_bits != 4 && n_bits != 8)
+    {
+      throw std::invalid_argument("Subvector codes must have 4 or 8 bits");
+    }
+    n_centroids = (len_t)1 << n_bits;
+    subvector_dim = vector_dim / n_subvectors;
+    codebooks.resize(n_subvectors * n_centroids * subvector_dim);
+    subvector_distance_func = L2Space(subvector_dim).get_distance_func();
+  }
+
+  ProductQuantizer::ProductQuantizer(const std::string &filename)
+  {
+    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+    {
+      throw std::runtime_error("Could not open file " + filename);
+    }
+    file.read((char *)&vector_dim, sizeof(len_t));
+    file.read((char *)&n_subvectors, sizeof(len_t));
+    file.read((char *)&n_bits, sizeof(len_t));
+    if (!file)
+    {
+      throw std::runtime_error("Invalid product quantizer file " + filename);
+    }
+    init_dimensions();
+    if (!file.read((char *)codebooks.data(), codebooks.size() * sizeof(vector_el_t)))
+    {
+      throw std::runtime_error("Error reading product quantizer file " + filename);
+    }
+  }
+
+  void ProductQuantizer::save(const std::string &filename) const
+  {
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+      throw std::runtime_error("Could not open file " + filename);
+    }
+    file.write((const char *)&vector_dim, sizeof(len_t));
+    file.write((const char *)&n_subvectors, sizeof(len_t));
+    file.write((const char *)&n_bits, sizeof(len_t));
+    file.write((const char *)codebooks.data(), codebooks.size() * sizeof(vector_el_t));
+    if (!file)
+    {
+      throw std::runtime_error("Error writing product quantizer file " + filename);
+    }
+  }
+
+  const vector_el_t *ProductQuantizer::get_centroid(const len_t subvector, const len_t centroid) const
+  {
+    return &codebooks[(subvector * n_centroids + centroid) * subvector_dim];
+  }
+
+  len_t ProductQuantizer::get_subvector_code(const uint8_t *code, const len_t subvector) const
+  {
+    if (n_bits == 8)
+    {
+      return code[subvector];
+    }
+    return (code[subvector / 2] >> (4 * (subvector % 2))) & 0x0F;
+  }
+
+  void ProductQuantizer::set_subvector_code(uint8_t *code, const len_t subvector, const len_t centroid) const
+  {
+    if (n_bits == 8)
+    {
+      code[subvector] = (uint8_t)centroid;
+      return;
+    }
+    uint8_t shift = 4 * (subvector % 2);
+    code[subvector / 2] = (uint8_t)((code[subvector / 2] & ~(0x0F << shift)) | (centroid << shift));
+  }
+
+  void ProductQuantizer::train_codebook(const len_t subvector, const vector_el_t *vectors, const len_t n_vectors, const len_t n_iterations)
+  {
+    std::mt19937 rng(PQ_TRAINING_SEED + subvector);
+    std::uniform_int_distribution<len_t> gen_vector_id(0, n_vectors - 1);
+    vector_el_t *centroids = &codebooks[subvector * n_centroids * subvector_dim];
+    auto get_subvector = [&](len_t i)
+    { return &vectors[i * vector_dim + subvector * subvector_dim]; };
+
+    for (len_t c = 0; c < n_centroids; c++)
+    {
+      memcpy(&centroids[c * subvector_dim], get_subvector(gen_vector_id(rng)), subvector_dim * sizeof(vector_el_t));
+    }
+
+    std::vector<len_t> assignments(n_vectors);
+    std::vector<double> sums(n_centroids * subvector_dim);
+    std::vector<len_t> counts(n_centroids);
+    for (len_t iteration = 0; iteration < n_iterations; iteration++)
+    {
+      for (len_t i = 0; i < n_vectors; i++)
+      {
+        distance_t min_distance = std::numeric_limits<distance_t>::max();
+        for (len_t c = 0; c < n_centroids; c++)
+        {
+          distance_t distance = subvector_distance_func(get_subvector(i), &centroids[c * subvector_dim], &subvector_dim);
+          if (distance < min_distance)
+          {
+            min_distance = distance;
+            assignments[i] = c;
+          }
+        }
+      }
+
+      std::fill(sums.begin(), sums.end(), 0);
+      std::fill(counts.begin(), counts.end(), 0);
+      for (len_t i = 0; i < n_vectors; i++)
+      {
+        const vector_el_t *x = get_subvector(i);
+        double *sum = &sums[assignments[i] * subvector_dim];
+        for (len_t j = 0; j < subvector_dim; j++)
+        {
+          sum[j] += x[j];
+        }
+        counts[assignments[i]]++;
+      }
+      for (len_t c = 0; c < n_centroids; c++)
+      {
+        vector_el_t *centroid = &centroids[c * subvector_dim];
+        if (counts[c] == 0)
+        {
+          // re-seed empty clusters with a random training vector
+          memcpy(centroid, get_subvector(gen_vector_id(rng)), subvector_dim * sizeof(vector_el_t));
+          continue;
+        }
+        for (len_t j = 0; j < subvector_dim; j++)
+        {
+          centroid[j] = (vector_el_t)(sums[c * subvector_dim + j] / counts[c]);
+        }
+      }
+    }
+  }
+
+  void ProductQuantizer::train(
+      const vector_el_t *vectors,
+      const len_t n_vectors,
+      const vector_el_t *centroids,
+      const list_id_t *list_ids,
+      const len_t n_iterations)
+  {
+    if (n_vectors == 0)
+    {
+      throw std::invalid_argument("Cannot train a product quantizer without training vectors");
+    }
+    std::vector<vector_el_t> residuals;
+    if (centroids != nullptr && list_ids != nullptr)
+    {
+      residuals.resize(n_vectors * vector_dim);
+      for (len_t i = 0; i < n_vectors; i++)
+      {
+        const vector_el_t *centroid = &centroids[list_ids[i] * vector_dim];
+        for (len_t j = 0; j < vector_dim; j++)
+        {
+          residuals[i * vector_dim + j] = vectors[i * vector_dim + j] - centroid[j];
+        }
+      }
+      vectors = residuals.data();
+    }
+
+#if PMODE != 0
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (len_t subvector = 0; subvector < n_subvectors; subvector++)
+    {
+      train_codebook(subvector, vectors, n_vectors, n_iterations);
+    }
+  }
+
+  void ProductQuantizer::encode(const vector_el_t *vectors, const len_t n_vectors, uint8_t *codes, const vector_el_t *centroid) const
+  {
+    std::vector<vector_el_t> residual(vector_dim);
+    for (len_t i = 0; i < n_vectors; i++)
+    {
+      const vector_el_t *vector = &vectors[i * vector_dim];
+      if (centroid != nullptr)
+      {
+        for (len_t j = 0; j < vector_dim; j++)
+        {
+          residual[j] = vector[j] - centroid[j];
+        }
+        vector = residual.data();
+      }
+      uint8_t *code = &codes[i * get_code_size()];
+      memset(code, 0, get_code_size());
+      for (len_t m = 0; m < n_subvectors; m++)
+      {
+        distance_t min_distance = std::numeric_limits<distance_t>::max();
+        len_t centroid = 0;
+        for (len_t c = 0; c < n_centroids; c++)
+        {
+          distance_t distance = subvector_distance_func(&vector[m * subvector_dim], get_centroid(m, c), &subvector_dim);
+          if (distance < min_distance)
+          {
+            min_distance = distance;
+            centroid = c;
+          }
+        }
+        set_subvector_code(code, m, centroid);
+      }
+    }
+  }
+
+  void ProductQuantizer::decode(const uint8_t *codes, const len_t n_vectors, vector_el_t *vectors, const vector_el_t *centroid) const
+  {
+    for (len_t i = 0; i < n_vectors; i++)
+    {
+      vector_el_t *vector = &vectors[i * vector_dim];
+      const uint8_t *code = &codes[i * get_code_size()];
+      for (len_t m = 0; m < n_subvectors; m++)
+      {
+        memcpy(&vector[m * subvector_dim], get_centroid(m, get_subvector_code(code, m)), subvector_dim * sizeof(vector_el_t));
+      }
+      if (centroid != nullptr)
+      {
+        for (len_t j = 0; j < vector_dim; j++)
+        {
+          vector[j] += centroid[j];
+        }
+      }
+    }
+  }
+
+  void ProductQuantizer::compute_table(const vector_el_t *query, const metric_t metric, distance_t *table) const
+  {
+    distance_func_t table_func;
+    switch (metric)
+    {
+    case METRIC_L2:
+      table_func = subvector_distance_func;
+      break;
+    case METRIC_INNER_PRODUCT:
+      table_func = get_inner_product_func(get_simd_level());
+      break;
+    default:
+      throw std::invalid_argument("Product quantization supports only the L2 and inner product metrics");
+    }
+    for (len_t m = 0; m < n_subvectors; m++)
+    {
+      for (len_t c = 0; c < n_centroids; c++)
+      {
+        table[m * n_centroids + c] = table_func(&query[m * subvector_dim], get_centroid(m, c), &subvector_dim);
+      }
+    }
+  }
+
+  void ProductQuantizer::lookup_codes(const distance_t *table, const uint8_t *codes, const len_t n_codes, distance_t *sums) const
+  {
+    for (len_t i = 0; i < n_codes; i++)
+    {
+      const uint8_t *code = &codes[i * get_code_size()];
+      distance_t sum = 0;
+      for (len_t m = 0; m < n_subvectors; m++)
+      {
+        sum += table[m * n_centroids + get_subvector_code(code, m)];
+      }
+      sums[i] = sum;
+    }
+  }
+
+  len_t ProductQuantizer::get_vector_dim() const
+  {
+    return vector_dim;
+  }
+
+  len_t ProductQuantizer::get_n_subvectors() const
+  {
+    return n_subvectors;
+  }
+
+  len_t ProductQuantizer::get_n_bits() const
+  {
+    return n_bits;
+  }
+
+  len_t ProductQuantizer::get_n_centroids() const
+  {
+    return n_centroids;
+  }
+
+  size_t ProductQuantizer::get_code_size() const
+  {
+    return (n_subvectors * n_bits + 7) / 8;
+  }
+
+  size_t ProductQuantizer::get_table_size() const
+  {
+    return n_subvectors * n_centroids;
+  }
+}
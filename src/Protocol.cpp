@@ -0,0 +1,187 @@
+#include <stdexcept>
+#include <cstring>
+
+#include "Protocol.hpp"
+
+namespace ann_dkvs
+{
+  /**
+   * Resizes a frame to hold a body of the given size and writes its header.
+   *
+   * @return A pointer to the body.
+   */
+  static uint8_t *init_frame(const message_type_t message_type, const size_t body_size, std::vector<uint8_t> &frame)
+  {
+    frame.resize(sizeof(FrameHeader) + body_size);
+    FrameHeader header = {PROTOCOL_MAGIC, message_type, body_size};
+    memcpy(frame.data(), &header, sizeof(FrameHeader));
+    return frame.data() + sizeof(FrameHeader);
+  }
+
+  void write_search_request(const QueryBatch &queries, const len_t vector_dim, std::vector<uint8_t> &frame)
+  {
+    len_t n_probes_total = 0;
+    for (const Query *query : queries)
+    {
+      n_probes_total += query->get_n_probe();
+    }
+    size_t headers_size = sizeof(SearchRequestHeader) + queries.size() * sizeof(QueryHeader);
+    size_t list_ids_size = n_probes_total * sizeof(list_id_t);
+    size_t vectors_size = queries.size() * vector_dim * sizeof(vector_el_t);
+    uint8_t *body = init_frame(MESSAGE_SEARCH_REQUEST, headers_size + list_ids_size + vectors_size, frame);
+
+    SearchRequestHeader request_header = {queries.size(), vector_dim};
+    memcpy(body, &request_header, sizeof(SearchRequestHeader));
+    QueryHeader *query_headers = (QueryHeader *)(body + sizeof(SearchRequestHeader));
+    list_id_t *list_ids = (list_id_t *)(body + headers_size);
+    vector_el_t *vectors = (vector_el_t *)(body + headers_size + list_ids_size);
+    for (len_t i = 0; i < queries.size(); i++)
+    {
+      const Query *query = queries[i];
+      query_headers[i] = {(uint32_t)query->get_n_results(), (uint32_t)query->get_n_probe()};
+      for (len_t j = 0; j < query->get_n_probe(); j++)
+      {
+        *list_ids++ = query->get_list_to_probe(j);
+      }
+      memcpy(&vectors[i * vector_dim], query->get_query_vector(), vector_dim * sizeof(vector_el_t));
+    }
+  }
+
+  QueryBatch read_search_request(uint8_t *body, const size_t body_size, len_t *vector_dim)
+  {
+    if (body_size < sizeof(SearchRequestHeader))
+    {
+      throw std::invalid_argument("Search request is too short");
+    }
+    SearchRequestHeader request_header;
+    memcpy(&request_header, body, sizeof(SearchRequestHeader));
+    size_t remaining_size = body_size - sizeof(SearchRequestHeader);
+    if (request_header.n_queries > remaining_size / sizeof(QueryHeader))
+    {
+      throw std::invalid_argument("Search request is too short");
+    }
+    len_t n_queries = request_header.n_queries;
+    remaining_size -= n_queries * sizeof(QueryHeader);
+    const QueryHeader *query_headers = (const QueryHeader *)(body + sizeof(SearchRequestHeader));
+    len_t n_probes_total = 0;
+    for (len_t i = 0; i < n_queries; i++)
+    {
+      n_probes_total += query_headers[i].n_probes;
+    }
+    if (n_probes_total > remaining_size / sizeof(list_id_t))
+    {
+      throw std::invalid_argument("Search request is too short");
+    }
+    remaining_size -= n_probes_total * sizeof(list_id_t);
+    if (n_queries > 0 && request_header.vector_dim > remaining_size / sizeof(vector_el_t) / n_queries)
+    {
+      throw std::invalid_argument("Search request is too short");
+    }
+    if (remaining_size != n_queries * request_header.vector_dim * sizeof(vector_el_t))
+    {
+      throw std::invalid_argument("Search request has an unexpected size");
+    }
+
+    *vector_dim = request_header.vector_dim;
+    list_id_t *list_ids = (list_id_t *)(body + sizeof(SearchRequestHeader) + n_queries * sizeof(QueryHeader));
+    vector_el_t *vectors = (vector_el_t *)(list_ids + n_probes_total);
+    QueryBatch queries;
+    queries.reserve(n_queries);
+    for (len_t i = 0; i < n_queries; i++)
+    {
+      queries.push_back(new Query(&vectors[i * *vector_dim], list_ids, query_headers[i].n_results, query_headers[i].n_probes));
+      list_ids += query_headers[i].n_probes;
+    }
+    return queries;
+  }
+
+  void write_search_response(const QueryResultsBatch &results, std::vector<uint8_t> &frame)
+  {
+    len_t n_results_total = 0;
+    for (const QueryResults &query_results : results)
+    {
+      n_results_total += query_results.size();
+    }
+    size_t counts_size = results.size() * sizeof(uint64_t);
+    size_t ids_size = n_results_total * sizeof(vector_id_t);
+    size_t distances_size = n_results_total * sizeof(distance_t);
+    uint8_t *body = init_frame(MESSAGE_SEARCH_RESPONSE, sizeof(SearchResponseHeader) + counts_size + ids_size + distances_size, frame);
+
+    SearchResponseHeader response_header = {results.size(), n_results_total};
+    memcpy(body, &response_header, sizeof(SearchResponseHeader));
+    uint64_t *counts = (uint64_t *)(body + sizeof(SearchResponseHeader));
+    vector_id_t *ids = (vector_id_t *)(counts + results.size());
+    distance_t *distances = (distance_t *)(ids + n_results_total);
+    for (const QueryResults &query_results : results)
+    {
+      *counts++ = query_results.size();
+      for (const QueryResult &result : query_results)
+      {
+        *ids++ = result.vector_id;
+        *distances++ = result.distance;
+      }
+    }
+  }
+
+  QueryResultsBatch read_search_response(const uint8_t *body, const size_t body_size)
+  {
+    if (body_size < sizeof(SearchResponseHeader))
+    {
+      throw std::invalid_argument("Search response is too short");
+    }
+    SearchResponseHeader response_header;
+    memcpy(&response_header, body, sizeof(SearchResponseHeader));
+    size_t remaining_size = body_size - sizeof(SearchResponseHeader);
+    size_t result_size = sizeof(vector_id_t) + sizeof(distance_t);
+    if (response_header.n_queries > remaining_size / sizeof(uint64_t) ||
+        response_header.n_results_total != (remaining_size - response_header.n_queries * sizeof(uint64_t)) / result_size ||
+        (remaining_size - response_header.n_queries * sizeof(uint64_t)) % result_size != 0)
+    {
+      throw std::invalid_argument("Search response has an unexpected size");
+    }
+
+    const uint64_t *counts = (const uint64_t *)(body + sizeof(SearchResponseHeader));
+    const vector_id_t *ids = (const vector_id_t *)(counts + response_header.n_queries);
+    const distance_t *distances = (const distance_t *)(ids + response_header.n_results_total);
+    QueryResultsBatch results(response_header.n_queries);
+    len_t n_results_left = response_header.n_results_total;
+    for (QueryResults &query_results : results)
+    {
+      uint64_t count = *counts++;
+      if (count > n_results_left)
+      {
+        throw std::invalid_argument("Search response has an unexpected number of results");
+      }
+      n_results_left -= count;
+      query_results.resize(count);
+      for (QueryResult &result : query_results)
+      {
+        result.vector_id = *ids++;
+        result.distance = *distances++;
+      }
+    }
+    if (n_results_left != 0)
+    {
+      throw std::invalid_argument("Search response has an unexpected number of results");
+    }
+    return results;
+  }
+
+  void write_error(const std::string &message, std::vector<uint8_t> &frame)
+  {
+    uint8_t *body = init_frame(MESSAGE_ERROR, message.size(), frame);
+    memcpy(body, message.data(), message.size());
+  }
+
+  void check_frame_header(const FrameHeader &header)
+  {
+    if (header.magic != PROTOCOL_MAGIC)
+    {
+      throw std::invalid_argument("Frame does not start with the magic number");
+    }
+    if (header.body_size > PROTOCOL_MAX_FRAME_SIZE)
+    {
+      throw std::invalid_argument("Frame is too large");
+    }
+  }
+}
@@ -0,0 +1,252 @@
+#include <stdexcept>
+#include <limits>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "ScalarQuantizer.hpp"
+#include "L2Space.hpp"
+#include "IPSpace.hpp"
+#include "Float16.hpp"
+
+namespace ann_dkvs
+{
+  ScalarQuantizer::ScalarQuantizer(const len_t vector_dim, const sq_type_t sq_type)
+      : vector_dim(vector_dim), sq_type(sq_type)
+  {
+    init();
+  }
+
+  void ScalarQuantizer::init()
+  {
+    if (vector_dim == 0)
+    {
+      throw std::out_of_range("Vector dimension must be greater than 0");
+    }
+    if (sq_type != SQ_8BIT && sq_type != SQ_FP16 && sq_type != SQ_BF16)
+    {
+      throw std::invalid_argument("Unknown scalar quantizer type");
+    }
+    if (sq_type == SQ_8BIT)
+    {
+      min_values.assign(vector_dim, std::numeric_limits<vector_el_t>::infinity());
+      max_values.assign(vector_dim, -std::numeric_limits<vector_el_t>::infinity());
+      steps.assign(vector_dim, 0);
+      l2_weights.assign(vector_dim, 0);
+    }
+    l2_func = get_l2_code_distance_func(sq_type, get_simd_level());
+    inner_product_func = get_inner_product_code_func(sq_type, get_simd_level());
+  }
+
+  ScalarQuantizer::ScalarQuantizer(const std::string &filename)
+  {
+    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+    {
+      throw std::runtime_error("Could not open file " + filename);
+    }
+    len_t type;
+    file.read((char *)&vector_dim, sizeof(len_t));
+    file.read((char *)&type, sizeof(len_t));
+    if (!file)
+    {
+      throw std::runtime_error("Invalid scalar quantizer file " + filename);
+    }
+    sq_type = (sq_type_t)type;
+    init();
+    if (sq_type == SQ_8BIT)
+    {
+      file.read((char *)min_values.data(), vector_dim * sizeof(vector_el_t));
+      file.read((char *)max_values.data(), vector_dim * sizeof(vector_el_t));
+      if (!file)
+      {
+        throw std::runtime_error("Error reading scalar quantizer file " + filename);
+      }
+      update_steps();
+    }
+  }
+
+  void ScalarQuantizer::save(const std::string &filename) const
+  {
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+      throw std::runtime_error("Could not open file " + filename);
+    }
+    len_t type = (len_t)sq_type;
+    file.write((const char *)&vector_dim, sizeof(len_t));
+    file.write((const char *)&type, sizeof(len_t));
+    file.write((const char *)min_values.data(), min_values.size() * sizeof(vector_el_t));
+    file.write((const char *)max_values.data(), max_values.size() * sizeof(vector_el_t));
+    if (!file)
+    {
+      throw std::runtime_error("Error writing scalar quantizer file " + filename);
+    }
+  }
+
+  void ScalarQuantizer::update_steps()
+  {
+    for (len_t j = 0; j < vector_dim; j++)
+    {
+      steps[j] = max_values[j] > min_values[j] ? (max_values[j] - min_values[j]) / 255.0f : 0;
+      l2_weights[j] = steps[j] * steps[j];
+    }
+  }
+
+  void ScalarQuantizer::train(const vector_el_t *vectors, const len_t n_vectors)
+  {
+    if (sq_type != SQ_8BIT || n_vectors == 0)
+    {
+      return;
+    }
+    for (len_t i = 0; i < n_vectors; i++)
+    {
+      const vector_el_t *vector = &vectors[i * vector_dim];
+      for (len_t j = 0; j < vector_dim; j++)
+      {
+        min_values[j] = std::min(min_values[j], vector[j]);
+        max_values[j] = std::max(max_values[j], vector[j]);
+      }
+    }
+    update_steps();
+  }
+
+  bool ScalarQuantizer::is_trained() const
+  {
+    return sq_type != SQ_8BIT || min_values[0] <= max_values[0];
+  }
+
+  void ScalarQuantizer::encode(const vector_el_t *vectors, const len_t n_vectors, uint8_t *codes) const
+  {
+    if (!is_trained())
+    {
+      throw std::logic_error("The scalar quantizer must be trained before encoding");
+    }
+    for (len_t i = 0; i < n_vectors; i++)
+    {
+      const vector_el_t *vector = &vectors[i * vector_dim];
+      uint8_t *code = &codes[i * get_code_size()];
+      uint16_t *code16 = (uint16_t *)code;
+      for (len_t j = 0; j < vector_dim; j++)
+      {
+        switch (sq_type)
+        {
+        case SQ_FP16:
+          code16[j] = float_to_fp16(vector[j]);
+          break;
+        case SQ_BF16:
+          code16[j] = float_to_bf16(vector[j]);
+          break;
+        default:
+        {
+          float level = steps[j] > 0 ? std::round((vector[j] - min_values[j]) / steps[j]) : 0;
+          code[j] = (uint8_t)std::min(std::max(level, 0.0f), 255.0f);
+        }
+        }
+      }
+    }
+  }
+
+  void ScalarQuantizer::decode(const uint8_t *codes, const len_t n_vectors, vector_el_t *vectors) const
+  {
+    for (len_t i = 0; i < n_vectors; i++)
+    {
+      vector_el_t *vector = &vectors[i * vector_dim];
+      const uint8_t *code = &codes[i * get_code_size()];
+      const uint16_t *code16 = (const uint16_t *)code;
+      for (len_t j = 0; j < vector_dim; j++)
+      {
+        switch (sq_type)
+        {
+        case SQ_FP16:
+          vector[j] = fp16_to_float(code16[j]);
+          break;
+        case SQ_BF16:
+          vector[j] = bf16_to_float(code16[j]);
+          break;
+        default:
+          vector[j] = min_values[j] + code[j] * steps[j];
+        }
+      }
+    }
+  }
+
+  distance_t ScalarQuantizer::prepare_query(const vector_el_t *query, const metric_t metric, vector_el_t *prepared_query) const
+  {
+    if (metric != METRIC_L2 && metric != METRIC_INNER_PRODUCT)
+    {
+      throw std::invalid_argument("Scalar quantization supports only the L2 and inner product metrics");
+    }
+    if (sq_type != SQ_8BIT)
+    {
+      memcpy(prepared_query, query, vector_dim * sizeof(vector_el_t));
+      return 0;
+    }
+    // an element is decoded as min + code * step
+    distance_t query_term = 0;
+    for (len_t j = 0; j < vector_dim; j++)
+    {
+      if (metric == METRIC_L2)
+      {
+        // (q - min - code * step)^2 = step^2 * ((q - min) / step - code)^2
+        if (steps[j] > 0)
+        {
+          prepared_query[j] = (query[j] - min_values[j]) / steps[j];
+        }
+        else
+        {
+          prepared_query[j] = 0;
+          query_term += (query[j] - min_values[j]) * (query[j] - min_values[j]);
+        }
+      }
+      else
+      {
+        // q * (min + code * step) = q * min + (q * step) * code
+        prepared_query[j] = query[j] * steps[j];
+        query_term += query[j] * min_values[j];
+      }
+    }
+    return query_term;
+  }
+
+  void ScalarQuantizer::compute_distances(
+      const vector_el_t *prepared_query,
+      const distance_t query_term,
+      const metric_t metric,
+      const uint8_t *codes,
+      const len_t n_codes,
+      distance_t *distances) const
+  {
+    size_t code_size = get_code_size();
+    if (metric == METRIC_L2)
+    {
+      for (len_t i = 0; i < n_codes; i++)
+      {
+        distances[i] = query_term + l2_func(prepared_query, &codes[i * code_size], l2_weights.data(), vector_dim);
+      }
+    }
+    else
+    {
+      for (len_t i = 0; i < n_codes; i++)
+      {
+        distances[i] = 1.0f - (query_term + inner_product_func(prepared_query, &codes[i * code_size], nullptr, vector_dim));
+      }
+    }
+  }
+
+  len_t ScalarQuantizer::get_vector_dim() const
+  {
+    return vector_dim;
+  }
+
+  sq_type_t ScalarQuantizer::get_sq_type() const
+  {
+    return sq_type;
+  }
+
+  size_t ScalarQuantizer::get_code_size() const
+  {
+    return sq_type == SQ_8BIT ? vector_dim : vector_dim * sizeof(uint16_t);
+  }
+}
@@ -0,0 +1,196 @@
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Socket.hpp"
+
+namespace ann_dkvs
+{
+  static std::string get_error_message(const std::string &message)
+  {
+    return message + ": " + strerror(errno);
+  }
+
+  /**
+   * Resolves a host and port and creates a socket bound or connected to
+   * the first address which works.
+   */
+  static int open_tcp_socket(const std::string &host, const uint16_t port, const bool listening)
+  {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    struct addrinfo *addresses;
+    int status = getaddrinfo(host.empty() ? nullptr : host.c_str(), std::to_string(port).c_str(), &hints, &addresses);
+    if (status != 0)
+    {
+      throw std::runtime_error("Could not resolve " + host + ": " + gai_strerror(status));
+    }
+    int fd = -1;
+    for (struct addrinfo *address = addresses; address != nullptr; address = address->ai_next)
+    {
+      fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+      if (fd == -1)
+      {
+        continue;
+      }
+      int enable = 1;
+      if (listening)
+      {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+        if (bind(fd, address->ai_addr, address->ai_addrlen) == 0 && listen(fd, SOCKET_LISTEN_BACKLOG) == 0)
+        {
+          break;
+        }
+      }
+      else if (connect(fd, address->ai_addr, address->ai_addrlen) == 0)
+      {
+        // requests are small and latency bound, so do not wait to fill packets
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        break;
+      }
+      close(fd);
+      fd = -1;
+    }
+    freeaddrinfo(addresses);
+    if (fd == -1)
+    {
+      throw std::runtime_error(get_error_message((listening ? "Could not listen on " : "Could not connect to ") + host + ":" + std::to_string(port)));
+    }
+    return fd;
+  }
+
+  static struct sockaddr_un get_unix_address(const std::string &path)
+  {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+      throw std::runtime_error("Socket path is too long: " + path);
+    }
+    memcpy(address.sun_path, path.c_str(), path.size());
+    return address;
+  }
+
+  int listen_tcp_socket(const std::string &host, const uint16_t port)
+  {
+    return open_tcp_socket(host, port, true);
+  }
+
+  int listen_unix_socket(const std::string &path)
+  {
+    struct sockaddr_un address = get_unix_address(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+      throw std::runtime_error(get_error_message("Could not create socket"));
+    }
+    unlink(path.c_str());
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SOCKET_LISTEN_BACKLOG) != 0)
+    {
+      std::string message = get_error_message("Could not listen on " + path);
+      close(fd);
+      throw std::runtime_error(message);
+    }
+    return fd;
+  }
+
+  int connect_tcp_socket(const std::string &host, const uint16_t port)
+  {
+    return open_tcp_socket(host, port, false);
+  }
+
+  int connect_unix_socket(const std::string &path)
+  {
+    struct sockaddr_un address = get_unix_address(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+      throw std::runtime_error(get_error_message("Could not create socket"));
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+      std::string message = get_error_message("Could not connect to " + path);
+      close(fd);
+      throw std::runtime_error(message);
+    }
+    return fd;
+  }
+
+  uint16_t get_socket_port(const int fd)
+  {
+    struct sockaddr_storage address;
+    socklen_t address_size = sizeof(address);
+    if (getsockname(fd, (struct sockaddr *)&address, &address_size) != 0)
+    {
+      throw std::runtime_error(get_error_message("Could not get socket address"));
+    }
+    if (address.ss_family == AF_INET6)
+    {
+      return ntohs(((struct sockaddr_in6 *)&address)->sin6_port);
+    }
+    return ntohs(((struct sockaddr_in *)&address)->sin_port);
+  }
+
+  void set_socket_nonblocking(const int fd)
+  {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+      throw std::runtime_error(get_error_message("Could not make socket non-blocking"));
+    }
+  }
+
+  void send_all(const int fd, const void *data, const size_t size)
+  {
+    const uint8_t *bytes = (const uint8_t *)data;
+    size_t n_sent = 0;
+    while (n_sent < size)
+    {
+      ssize_t n = send(fd, bytes + n_sent, size - n_sent, MSG_NOSIGNAL);
+      if (n == -1 && errno == EINTR)
+      {
+        continue;
+      }
+      if (n == -1)
+      {
+        throw std::runtime_error(get_error_message("Could not send"));
+      }
+      n_sent += n;
+    }
+  }
+
+  void receive_all(const int fd, void *data, const size_t size)
+  {
+    uint8_t *bytes = (uint8_t *)data;
+    size_t n_received = 0;
+    while (n_received < size)
+    {
+      ssize_t n = recv(fd, bytes + n_received, size - n_received, 0);
+      if (n == -1 && errno == EINTR)
+      {
+        continue;
+      }
+      if (n == -1)
+      {
+        throw std::runtime_error(get_error_message("Could not receive"));
+      }
+      if (n == 0)
+      {
+        throw std::runtime_error("Connection closed by peer");
+      }
+      n_received += n;
+    }
+  }
+}
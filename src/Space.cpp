@@ -0,0 +1,54 @@
+#include <stdexcept>
+#include <string>
+
+#include "Space.hpp"
+#include "L2Space.hpp"
+#include "IPSpace.hpp"
+#include "CosineSpace.hpp"
+
+namespace ann_dkvs
+{
+  Space::Space(size_t vector_dim, simd_level_t simd_level, metric_t metric)
+      : vector_dim(vector_dim), simd_level(simd_level), metric(metric), distance_func(nullptr)
+  {
+    if (simd_level > ann_dkvs::get_simd_level())
+    {
+      throw std::invalid_argument(std::string("SIMD level not supported: ") + get_simd_level_name(simd_level));
+    }
+  }
+
+  Space Space::create(metric_t metric, size_t vector_dim)
+  {
+    switch (metric)
+    {
+    case METRIC_L2:
+      return L2Space(vector_dim);
+    case METRIC_INNER_PRODUCT:
+      return IPSpace(vector_dim);
+    case METRIC_COSINE:
+      return CosineSpace(vector_dim);
+    default:
+      throw std::invalid_argument("Unknown metric");
+    }
+  }
+
+  distance_func_t Space::get_distance_func() const
+  {
+    return distance_func;
+  }
+
+  size_t Space::get_vector_dim() const
+  {
+    return vector_dim;
+  }
+
+  simd_level_t Space::get_simd_level() const
+  {
+    return simd_level;
+  }
+
+  metric_t Space::get_metric() const
+  {
+    return metric;
+  }
+}
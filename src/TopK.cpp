@@ -0,0 +1,84 @@
+#include "TopK.hpp"
+#include "SimdHelpers.hpp"
+
+namespace ann_dkvs
+{
+  using filter_func_t = len_t (*)(const distance_t *, len_t, distance_t, uint32_t *);
+
+  static len_t filter_distances_scalar(const distance_t *distances, len_t n_distances, distance_t threshold, uint32_t *indices)
+  {
+    len_t n_selected = 0;
+    for (len_t i = 0; i < n_distances; i++)
+    {
+      // branchless: the index is always written but only kept if selected
+      indices[n_selected] = (uint32_t)i;
+      n_selected += distances[i] <= threshold;
+    }
+    return n_selected;
+  }
+
+#if USE_SIMD && defined(__x86_64__)
+  __attribute__((target("avx"))) static len_t filter_distances_avx(const distance_t *distances, len_t n_distances, distance_t threshold, uint32_t *indices)
+  {
+    len_t n_distances8 = n_distances >> 3 << 3;
+    __m256 thresholds = _mm256_set1_ps(threshold);
+    len_t n_selected = 0;
+    for (len_t i = 0; i < n_distances8; i += 8)
+    {
+      __m256 selected = _mm256_cmp_ps(_mm256_loadu_ps(&distances[i]), thresholds, _CMP_LE_OQ);
+      uint32_t mask = (uint32_t)_mm256_movemask_ps(selected);
+      while (mask != 0)
+      {
+        indices[n_selected++] = (uint32_t)(i + __builtin_ctz(mask));
+        mask &= mask - 1;
+      }
+    }
+    len_t n_selected_left = filter_distances_scalar(&distances[n_distances8], n_distances - n_distances8, threshold, &indices[n_selected]);
+    for (len_t i = n_selected; i < n_selected + n_selected_left; i++)
+    {
+      indices[i] += n_distances8;
+    }
+    return n_selected + n_selected_left;
+  }
+
+  __attribute__((target("avx512f"))) static len_t filter_distances_avx512(const distance_t *distances, len_t n_distances, distance_t threshold, uint32_t *indices)
+  {
+    __m512 thresholds = _mm512_set1_ps(threshold);
+    len_t n_selected = 0;
+    for (len_t i = 0; i < n_distances; i += 16)
+    {
+      __mmask16 load_mask = n_distances - i < 16 ? get_tail_mask16(n_distances - i) : (__mmask16)0xFFFF;
+      __m512 candidates = _mm512_maskz_loadu_ps(load_mask, &distances[i]);
+      uint32_t mask = _mm512_mask_cmp_ps_mask(load_mask, candidates, thresholds, _CMP_LE_OQ);
+      while (mask != 0)
+      {
+        indices[n_selected++] = (uint32_t)(i + __builtin_ctz(mask));
+        mask &= mask - 1;
+      }
+    }
+    return n_selected;
+  }
+#endif
+
+  static filter_func_t get_filter_func(const simd_level_t simd_level)
+  {
+    switch (simd_level)
+    {
+#if USE_SIMD && defined(__x86_64__)
+    case SIMD_AVX512:
+      return filter_distances_avx512;
+    case SIMD_AVX2_FMA:
+    case SIMD_AVX:
+      return filter_distances_avx;
+#endif
+    default:
+      return filter_distances_scalar;
+    }
+  }
+
+  len_t filter_distances(const distance_t *distances, len_t n_distances, distance_t threshold, uint32_t *indices)
+  {
+    static const filter_func_t filter_func = get_filter_func(get_simd_level());
+    return filter_func(distances, n_distances, threshold, indices);
+  }
+}
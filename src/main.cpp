@@ -1,15 +1,59 @@
 #include <iostream>
 #include <iomanip>
-
-#define UNUSED(x) (void)(x)
+#include <string>
+#include <memory>
+#include <stdexcept>
 
 #include "StorageLists.hpp"
+#include "StorageNode.hpp"
 
 using namespace ann_dkvs;
 
+/**
+ * Serves a lists file as a storage node, on a TCP port if the last argument
+ * is a number and on a Unix domain socket otherwise. The lists file is
+ * either opened from its metadata or first loaded from the given files.
+ */
 int main(int argc, char const *argv[])
 {
-	UNUSED(argc);
-	UNUSED(argv);
+	if (argc != 3 && argc != 8)
+	{
+		std::cerr << "usage: " << argv[0] << " <lists file> <port | socket path>" << std::endl;
+		std::cerr << "       " << argv[0] << " <vector dim> <n entries> <vectors file> <vector ids file> <list ids file> <lists file> <port | socket path>" << std::endl;
+		return 1;
+	}
+	try
+	{
+		std::string address = argv[argc - 1];
+		std::unique_ptr<StorageLists> lists;
+		if (argc == 3)
+		{
+			lists.reset(new StorageLists(argv[1], OPEN_MODE_READ_ONLY));
+		}
+		else
+		{
+			len_t vector_dim = std::stoul(argv[1]);
+			len_t n_entries = std::stoul(argv[2]);
+			lists.reset(new StorageLists(vector_dim, argv[6]));
+			lists->bulk_insert_entries(argv[3], argv[4], argv[5], n_entries);
+		}
+		StorageNode node(std::move(lists));
+		if (address.find_first_not_of("0123456789") == std::string::npos)
+		{
+			uint16_t port = node.listen_tcp("0.0.0.0", (uint16_t)std::stoul(address));
+			std::cout << "listening on port " << port << std::endl;
+		}
+		else
+		{
+			node.listen_unix(address);
+			std::cout << "listening on " << address << std::endl;
+		}
+		node.wait();
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
 	return 0;
 }
@@ -1,18 +1,44 @@
 #include <vector>
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <cstring>
+#include <stdexcept>
+#include <random>
+#include <limits>
 
-#include "../include/L2Space.hpp"
+#include "../include/Space.hpp"
+#include "../include/CosineSpace.hpp"
 #include "../include/root-node/RootIndex.hpp"
 
 namespace ann_dkvs
 {
-  RootIndex::RootIndex(len_t vector_dim, vector_el_t *centroids, len_t n_centroids)
-      : vector_dim(vector_dim), centroids(centroids), n_centroids(n_centroids)
+  RootIndex::RootIndex(len_t vector_dim, vector_el_t *centroids, len_t n_centroids, metric_t metric)
+      : vector_dim(vector_dim), centroids(centroids), n_centroids(n_centroids), metric(metric),
+        n_groups(0), n_groups_to_probe(0)
   {
     this->centroids = (vector_el_t *)malloc(n_centroids * vector_dim * sizeof(vector_el_t));
     memcpy(this->centroids, centroids, n_centroids * vector_dim * sizeof(vector_el_t));
+    metric_t centroids_metric = metric;
+    if (metric == METRIC_COSINE)
+    {
+      normalize_centroids();
+      centroids_metric = METRIC_INNER_PRODUCT;
+    }
+    distance_func = Space::create(centroids_metric, vector_dim).get_distance_func();
+  }
+
+  void RootIndex::normalize_centroids()
+  {
+    for (len_t i = 0; i < n_centroids; i++)
+    {
+      vector_el_t *centroid = &centroids[i * vector_dim];
+      distance_t inverse_norm = get_inverse_norm(centroid, vector_dim);
+      for (len_t j = 0; j < vector_dim; j++)
+      {
+        centroid[j] *= inverse_norm;
+      }
+    }
   }
 
   RootIndex::~RootIndex()
@@ -20,46 +46,214 @@ namespace ann_dkvs
     free(centroids);
   }
 
-  void RootIndex::add_candidate(const Query *query, const CentroidsResult &result, centroids_heap_t &candidates)
+  void RootIndex::allocate_list_ids(Query *query, centroids_heap_t *nearest_centroids)
   {
-    if (candidates.size() < query->get_n_probe())
+    std::vector<CentroidsResult> sorted_centroids = nearest_centroids->extract_sorted();
+    for (size_t i = 0; i < sorted_centroids.size(); i++)
     {
-      candidates.push(result);
+      query->set_list_to_probe(i, sorted_centroids[i].list_id);
     }
-    else if (result < candidates.top())
+  }
+
+  void RootIndex::push_centroids(const vector_el_t *vector, const vector_el_t *vectors, const len_t n_vectors,
+                                 const list_id_t *list_ids, centroids_heap_t &candidates) const
+  {
+    distance_t distances[TOP_K_BLOCK_SIZE];
+    for (len_t block_start = 0; block_start < n_vectors; block_start += TOP_K_BLOCK_SIZE)
     {
-      candidates.pop();
-      candidates.push(result);
+      len_t block_size = std::min((len_t)TOP_K_BLOCK_SIZE, n_vectors - block_start);
+      for (len_t j = 0; j < block_size; j++)
+      {
+        const vector_el_t *centroid = &vectors[(block_start + j) * vector_dim];
+        distances[j] = distance_func(centroid, vector, &vector_dim);
+      }
+      candidates.push_batch(distances, block_size, [list_ids, block_start](len_t j)
+                            { return list_ids != nullptr ? list_ids[block_start + j] : (list_id_t)(block_start + j); });
     }
   }
 
-  void RootIndex::allocate_list_ids(Query *query, centroids_heap_t *nearest_centroids)
+  void RootIndex::find_nearest_centroids(const vector_el_t *vector, centroids_heap_t &candidates) const
   {
-    for (size_t query_id = 0; query_id < query->get_n_probe(); query_id++)
+    if (n_groups == 0)
+    {
+      push_centroids(vector, centroids, n_centroids, nullptr, candidates);
+      return;
+    }
+    centroids_heap_t nearest_groups(n_groups_to_probe);
+    push_centroids(vector, group_centroids.data(), n_groups, nullptr, nearest_groups);
+    std::vector<CentroidsResult> groups = nearest_groups.extract_sorted();
+    len_t n_grouped_centroids = 0;
+    for (const CentroidsResult &group : groups)
+    {
+      n_grouped_centroids += group_offsets[group.list_id + 1] - group_offsets[group.list_id];
+    }
+    if (n_grouped_centroids < candidates.get_k())
     {
-      size_t insertion_index = query->get_n_probe() - query_id - 1;
-      list_id_t list_id = nearest_centroids->top().list_id;
-      query->set_list_to_probe(insertion_index, list_id);
-      nearest_centroids->pop();
+      // the probed groups cannot fill the heap, so no centroid is skipped
+      push_centroids(vector, centroids, n_centroids, nullptr, candidates);
+      return;
+    }
+    for (const CentroidsResult &group : groups)
+    {
+      len_t offset = group_offsets[group.list_id];
+      push_centroids(vector, &grouped_centroids[offset * vector_dim], group_offsets[group.list_id + 1] - offset,
+                     &grouped_list_ids[offset], candidates);
     }
   }
 
-  void RootIndex::preassign_query(Query *query)
+  void RootIndex::train_groups(const len_t n_groups, const len_t n_iterations, len_t *groups)
   {
-    centroids_heap_t candidates;
-    distance_func_t distance_func = L2Space(vector_dim).get_distance_func();
+    std::mt19937 rng(CENTROID_GROUPS_TRAINING_SEED);
+    std::uniform_int_distribution<len_t> gen_centroid_id(0, n_centroids - 1);
+
+    // the groups start at distinct centroids
+    std::vector<len_t> centroid_ids(n_centroids);
+    for (len_t i = 0; i < n_centroids; i++)
+    {
+      centroid_ids[i] = i;
+    }
+    std::shuffle(centroid_ids.begin(), centroid_ids.end(), rng);
+    for (len_t g = 0; g < n_groups; g++)
+    {
+      memcpy(&group_centroids[g * vector_dim], &centroids[centroid_ids[g] * vector_dim], vector_dim * sizeof(vector_el_t));
+    }
+
+    std::vector<double> sums(n_groups * vector_dim);
+    std::vector<len_t> counts(n_groups);
+    for (len_t iteration = 0; iteration < n_iterations; iteration++)
+    {
+#if PMODE != 0
+#pragma omp parallel for schedule(runtime)
+#endif
+      for (len_t i = 0; i < n_centroids; i++)
+      {
+        distance_t min_distance = std::numeric_limits<distance_t>::max();
+        for (len_t g = 0; g < n_groups; g++)
+        {
+          distance_t distance = distance_func(&group_centroids[g * vector_dim], &centroids[i * vector_dim], &vector_dim);
+          if (distance < min_distance)
+          {
+            min_distance = distance;
+            groups[i] = g;
+          }
+        }
+      }
+      if (iteration + 1 == n_iterations)
+      {
+        break;
+      }
+
+      std::fill(sums.begin(), sums.end(), 0);
+      std::fill(counts.begin(), counts.end(), 0);
+      for (len_t i = 0; i < n_centroids; i++)
+      {
+        const vector_el_t *x = &centroids[i * vector_dim];
+        double *sum = &sums[groups[i] * vector_dim];
+        for (len_t j = 0; j < vector_dim; j++)
+        {
+          sum[j] += x[j];
+        }
+        counts[groups[i]]++;
+      }
+      for (len_t g = 0; g < n_groups; g++)
+      {
+        vector_el_t *group_centroid = &group_centroids[g * vector_dim];
+        if (counts[g] == 0)
+        {
+          // re-seed empty groups with a random centroid
+          memcpy(group_centroid, &centroids[gen_centroid_id(rng) * vector_dim], vector_dim * sizeof(vector_el_t));
+          continue;
+        }
+        for (len_t j = 0; j < vector_dim; j++)
+        {
+          group_centroid[j] = (vector_el_t)(sums[g * vector_dim + j] / counts[g]);
+        }
+      }
+      if (metric != METRIC_L2)
+      {
+        // groups are compared by inner product, which would favor long group centroids
+        for (len_t g = 0; g < n_groups; g++)
+        {
+          vector_el_t *group_centroid = &group_centroids[g * vector_dim];
+          distance_t inverse_norm = get_inverse_norm(group_centroid, vector_dim);
+          for (len_t j = 0; j < vector_dim; j++)
+          {
+            group_centroid[j] *= inverse_norm;
+          }
+        }
+      }
+    }
+  }
+
+  void RootIndex::build_centroid_groups(const len_t n_groups, const len_t n_groups_to_probe, const len_t n_iterations)
+  {
+    if (n_groups > n_centroids)
+    {
+      throw std::invalid_argument("The number of groups must not exceed the number of centroids");
+    }
+    if (n_groups != 0 && (n_groups_to_probe == 0 || n_groups_to_probe > n_groups))
+    {
+      throw std::invalid_argument("The number of groups to probe must be between 1 and the number of groups");
+    }
+    this->n_groups = 0;
+    this->n_groups_to_probe = 0;
+    group_centroids.clear();
+    grouped_centroids.clear();
+    grouped_list_ids.clear();
+    group_offsets.clear();
+    if (n_groups == 0)
+    {
+      return;
+    }
+
+    group_centroids.resize(n_groups * vector_dim);
+    std::vector<len_t> groups(n_centroids);
+    train_groups(n_groups, std::max(n_iterations, (len_t)1), groups.data());
 
-    for (list_id_t list_id = 0; list_id < (list_id_t)n_centroids; list_id++)
+    // counting sort of the centroids by group
+    group_offsets.assign(n_groups + 1, 0);
+    for (len_t i = 0; i < n_centroids; i++)
     {
-      vector_el_t *centroid = &centroids[list_id * vector_dim];
-      float distance = distance_func(centroid, query->get_query_vector(), &vector_dim);
-      const CentroidsResult result = {.distance = distance, .list_id = list_id};
-      add_candidate(query, result, candidates);
+      group_offsets[groups[i] + 1]++;
     }
+    for (len_t g = 0; g < n_groups; g++)
+    {
+      group_offsets[g + 1] += group_offsets[g];
+    }
+    grouped_centroids.resize(n_centroids * vector_dim);
+    grouped_list_ids.resize(n_centroids);
+    std::vector<len_t> next_offsets(group_offsets.begin(), group_offsets.end() - 1);
+    for (len_t i = 0; i < n_centroids; i++)
+    {
+      len_t offset = next_offsets[groups[i]]++;
+      memcpy(&grouped_centroids[offset * vector_dim], &centroids[i * vector_dim], vector_dim * sizeof(vector_el_t));
+      grouped_list_ids[offset] = (list_id_t)i;
+    }
+    this->n_groups = n_groups;
+    this->n_groups_to_probe = n_groups_to_probe;
+  }
+
+  void RootIndex::set_n_groups_to_probe(const len_t n_groups_to_probe)
+  {
+    if (n_groups == 0)
+    {
+      throw std::logic_error("The centroids are not grouped");
+    }
+    if (n_groups_to_probe == 0 || n_groups_to_probe > n_groups)
+    {
+      throw std::invalid_argument("The number of groups to probe must be between 1 and the number of groups");
+    }
+    this->n_groups_to_probe = n_groups_to_probe;
+  }
+
+  void RootIndex::preassign_query(Query *query)
+  {
+    centroids_heap_t candidates(query->get_n_probe());
+    find_nearest_centroids(query->get_query_vector(), candidates);
     allocate_list_ids(query, &candidates);
   }
 
-  void RootIndex::batch_preassign_queries(QueryBatch queries)
+  void RootIndex::batch_preassign_queries(QueryBatch queries, const std::function<void(const Query *)> &on_assigned)
   {
 #if PMODE != 0
 #pragma omp parallel for schedule(runtime)
@@ -67,6 +261,54 @@ namespace ann_dkvs
     for (len_t i = 0; i < queries.size(); i++)
     {
       preassign_query(queries[i]);
+      if (on_assigned)
+      {
+        on_assigned(queries[i]);
+      }
+    }
+  }
+
+  void RootIndex::batch_assign_vectors(const vector_el_t *vectors, const len_t n_vectors, list_id_t *list_ids) const
+  {
+    if (n_centroids == 0 && n_vectors != 0)
+    {
+      throw std::logic_error("Vectors cannot be assigned without centroids");
     }
+#if PMODE != 0
+#pragma omp parallel for schedule(runtime)
+#endif
+    for (len_t i = 0; i < n_vectors; i++)
+    {
+      centroids_heap_t candidates(1);
+      find_nearest_centroids(&vectors[i * vector_dim], candidates);
+      list_ids[i] = candidates.extract_sorted()[0].list_id;
+    }
+  }
+
+  std::vector<list_id_t> RootIndex::add(const vector_el_t *vectors, const len_t n_vectors) const
+  {
+    std::vector<list_id_t> list_ids(n_vectors);
+    batch_assign_vectors(vectors, n_vectors, list_ids.data());
+    return list_ids;
+  }
+
+  len_t RootIndex::get_vector_dim() const
+  {
+    return vector_dim;
+  }
+
+  len_t RootIndex::get_n_centroids() const
+  {
+    return n_centroids;
+  }
+
+  len_t RootIndex::get_n_groups() const
+  {
+    return n_groups;
+  }
+
+  len_t RootIndex::get_n_groups_to_probe() const
+  {
+    return n_groups_to_probe;
   }
 }
@@ -1,6 +1,208 @@
+#include <stdexcept>
+#include <algorithm>
+
 #include "RootNode.hpp"
 
 namespace ann_dkvs
 {
-  RootNode::RootNode(const RootIndex &index) : index(index) {}
-}
\ No newline at end of file
+  RootNode::RootNode(RootIndex &index) : index(index) {}
+
+  len_t RootNode::add_shard(const StorageNodeAddress &address)
+  {
+    shards.push_back({address, nullptr});
+    return shards.size() - 1;
+  }
+
+  void RootNode::assign_list(const list_id_t list_id, const len_t shard_id)
+  {
+    if (shard_id >= shards.size())
+    {
+      throw std::out_of_range("Shard not found");
+    }
+    shard_by_list[list_id] = shard_id;
+  }
+
+  len_t RootNode::get_n_shards() const
+  {
+    return shards.size();
+  }
+
+  StorageNodeClient &RootNode::get_client(const len_t shard_id)
+  {
+    Shard &shard = shards[shard_id];
+    if (shard.client == nullptr)
+    {
+      const StorageNodeAddress &address = shard.address;
+      shard.client.reset(address.socket_path.empty() ? new StorageNodeClient(address.host, address.port) : new StorageNodeClient(address.socket_path));
+    }
+    return *shard.client;
+  }
+
+  std::vector<ShardBatch> RootNode::split_by_shard(const QueryBatch &queries) const
+  {
+    std::vector<ShardBatch> shard_batches(shards.size());
+    std::vector<std::vector<len_t>> n_probes(shards.size());
+    for (len_t i = 0; i < queries.size(); i++)
+    {
+      const Query *query = queries[i];
+      for (len_t j = 0; j < query->get_n_probe(); j++)
+      {
+        list_id_t list_id = query->get_list_to_probe(j);
+        auto it = shard_by_list.find(list_id);
+        if (it == shard_by_list.end())
+        {
+          throw std::invalid_argument("List " + std::to_string(list_id) + " is not assigned to a shard");
+        }
+        ShardBatch &shard_batch = shard_batches[it->second];
+        if (shard_batch.query_ids.empty() || shard_batch.query_ids.back() != i)
+        {
+          shard_batch.query_ids.push_back(i);
+          n_probes[it->second].push_back(0);
+        }
+        shard_batch.lists_to_probe.push_back(list_id);
+        n_probes[it->second].back()++;
+      }
+    }
+
+    // the lists to probe are complete, so the queries can point into them
+    for (len_t s = 0; s < shards.size(); s++)
+    {
+      ShardBatch &shard_batch = shard_batches[s];
+      list_id_t *lists_to_probe = shard_batch.lists_to_probe.data();
+      for (len_t k = 0; k < shard_batch.query_ids.size(); k++)
+      {
+        const Query *query = queries[shard_batch.query_ids[k]];
+        shard_batch.queries.emplace_back(new Query(query->get_query_vector(), lists_to_probe, query->get_n_results(), n_probes[s][k]));
+        lists_to_probe += n_probes[s][k];
+      }
+    }
+    return shard_batches;
+  }
+
+  QueryResultsBatch RootNode::merge_shard_results(
+      const QueryBatch &queries,
+      const std::vector<ShardBatch> &shard_batches,
+      const std::vector<QueryResultsBatch> &shard_results) const
+  {
+    // the results of each shard for each query
+    std::vector<std::vector<const QueryResults *>> partial_results(queries.size());
+    for (len_t s = 0; s < shard_batches.size(); s++)
+    {
+      for (len_t k = 0; k < shard_batches[s].query_ids.size(); k++)
+      {
+        partial_results[shard_batches[s].query_ids[k]].push_back(&shard_results[s][k]);
+      }
+    }
+
+    QueryResultsBatch results(queries.size());
+    for (len_t i = 0; i < queries.size(); i++)
+    {
+      // heap of the heads of the partial results, i.e. pairs of
+      // the index of the partial results and the position within them
+      typedef std::pair<len_t, len_t> head_t;
+      const std::vector<const QueryResults *> &partials = partial_results[i];
+      auto is_farther = [&partials](const head_t &a, const head_t &b)
+      {
+        return (*partials[b.first])[b.second] < (*partials[a.first])[a.second];
+      };
+      std::vector<head_t> heads;
+      for (len_t p = 0; p < partials.size(); p++)
+      {
+        if (!partials[p]->empty())
+        {
+          heads.push_back({p, 0});
+        }
+      }
+      std::make_heap(heads.begin(), heads.end(), is_farther);
+      len_t n_results = queries[i]->get_n_results();
+      results[i].reserve(n_results);
+      while (!heads.empty() && results[i].size() < n_results)
+      {
+        std::pop_heap(heads.begin(), heads.end(), is_farther);
+        head_t &head = heads.back();
+        results[i].push_back((*partials[head.first])[head.second]);
+        if (++head.second < partials[head.first]->size())
+        {
+          std::push_heap(heads.begin(), heads.end(), is_farther);
+        }
+        else
+        {
+          heads.pop_back();
+        }
+      }
+    }
+    return results;
+  }
+
+  QueryResultsBatch RootNode::batch_search_preassigned(const QueryBatch &queries)
+  {
+    std::vector<ShardBatch> shard_batches = split_by_shard(queries);
+    std::vector<QueryBatch> shard_queries(shards.size());
+    std::vector<QueryResultsBatch> shard_results(shards.size());
+    std::vector<bool> is_sent(shards.size(), false);
+    std::string error;
+
+    for (len_t s = 0; s < shards.size(); s++)
+    {
+      if (shard_batches[s].queries.empty())
+      {
+        continue;
+      }
+      for (const std::unique_ptr<Query> &query : shard_batches[s].queries)
+      {
+        shard_queries[s].push_back(query.get());
+      }
+      try
+      {
+        get_client(s).send_search_request(shard_queries[s], index.get_vector_dim());
+        is_sent[s] = true;
+      }
+      catch (const std::runtime_error &e)
+      {
+        shards[s].client.reset();
+        error = e.what();
+        break;
+      }
+    }
+
+    // every response is received, even after an error,
+    // so that no connection is left with a pending response
+    for (len_t s = 0; s < shards.size(); s++)
+    {
+      if (!is_sent[s])
+      {
+        continue;
+      }
+      try
+      {
+        shard_results[s] = shards[s].client->receive_search_response();
+      }
+      catch (const std::runtime_error &e)
+      {
+        shards[s].client.reset();
+        if (error.empty())
+        {
+          error = e.what();
+        }
+      }
+    }
+    if (!error.empty())
+    {
+      throw std::runtime_error(error);
+    }
+    return merge_shard_results(queries, shard_batches, shard_results);
+  }
+
+  QueryResultsBatch RootNode::batch_search(const QueryBatch &queries)
+  {
+    for (const Query *query : queries)
+    {
+      if (query->get_n_probe() > index.get_n_centroids())
+      {
+        throw std::invalid_argument("Cannot probe more lists than the root index has centroids");
+      }
+    }
+    index.batch_preassign_queries(queries);
+    return batch_search_preassigned(queries);
+  }
+}
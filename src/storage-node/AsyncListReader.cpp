@@ -0,0 +1,353 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <exception>
+
+#include "AsyncListReader.hpp"
+
+namespace ann_dkvs
+{
+  static int io_uring_setup(const unsigned entries, io_uring_params *params)
+  {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+  }
+
+  static int io_uring_enter(const int ring_fd, const unsigned to_submit, const unsigned min_complete, const unsigned flags)
+  {
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0);
+  }
+
+  static size_t align_down(const size_t value)
+  {
+    return value / ASYNC_READ_ALIGNMENT * ASYNC_READ_ALIGNMENT;
+  }
+
+  static size_t align_up(const size_t value)
+  {
+    return align_down(value + ASYNC_READ_ALIGNMENT - 1);
+  }
+
+  AsyncListReader::AsyncListReader(
+      const std::string &filename,
+      const len_t queue_depth,
+      const size_t max_read_size,
+      const bool use_io_uring)
+      : filename(filename), queue_depth(queue_depth), max_read_size(max_read_size), fd(-1), is_direct(true), ring_fd(-1),
+        sq_ring(nullptr), cq_ring(nullptr), sqes(nullptr), sq_ring_size(0), cq_ring_size(0), sqes_size(0)
+  {
+    if (queue_depth == 0)
+    {
+      throw std::invalid_argument("queue_depth must be greater than 0");
+    }
+    if (max_read_size % ASYNC_READ_ALIGNMENT != 0)
+    {
+      throw std::invalid_argument("max_read_size must be a multiple of ASYNC_READ_ALIGNMENT");
+    }
+    fd = open(filename.c_str(), O_RDONLY | O_DIRECT);
+    if (fd < 0 && errno == EINVAL)
+    {
+      // the file system does not support O_DIRECT
+      is_direct = false;
+      fd = open(filename.c_str(), O_RDONLY);
+    }
+    if (fd < 0)
+    {
+      throw std::runtime_error("Could not open file " + filename);
+    }
+    if (!use_io_uring || !setup_ring())
+    {
+      release_ring();
+    }
+  }
+
+  AsyncListReader::~AsyncListReader()
+  {
+    release_ring();
+    close(fd);
+  }
+
+  bool AsyncListReader::setup_ring()
+  {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd = io_uring_setup(queue_depth, &params);
+    if (ring_fd < 0)
+    {
+      return false;
+    }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED)
+    {
+      sq_ring = nullptr;
+      return false;
+    }
+    cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED)
+    {
+      cq_ring = nullptr;
+      return false;
+    }
+    void *sqes_ptr = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes_ptr == MAP_FAILED)
+    {
+      return false;
+    }
+    sqes = (io_uring_sqe *)sqes_ptr;
+
+    uint8_t *sq = (uint8_t *)sq_ring;
+    sq_head = (unsigned *)(sq + params.sq_off.head);
+    sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    sq_array = (unsigned *)(sq + params.sq_off.array);
+    uint8_t *cq = (uint8_t *)cq_ring;
+    cq_head = (unsigned *)(cq + params.cq_off.head);
+    cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  void AsyncListReader::release_ring()
+  {
+    if (sqes != nullptr)
+    {
+      munmap(sqes, sqes_size);
+      sqes = nullptr;
+    }
+    if (cq_ring != nullptr)
+    {
+      munmap(cq_ring, cq_ring_size);
+      cq_ring = nullptr;
+    }
+    if (sq_ring != nullptr)
+    {
+      munmap(sq_ring, sq_ring_size);
+      sq_ring = nullptr;
+    }
+    if (ring_fd >= 0)
+    {
+      close(ring_fd);
+      ring_fd = -1;
+    }
+  }
+
+  AsyncListReader::PendingRead AsyncListReader::prepare_read(const list_id_t list_id, const ListLayout &layout) const
+  {
+    PendingRead read;
+    read.aligned_offset = align_down(layout.offset);
+    read.aligned_size = align_up(layout.offset + layout.size) - read.aligned_offset;
+    read.required_size = layout.offset + layout.size - read.aligned_offset;
+    read.n_bytes_read = 0;
+    void *buffer = aligned_alloc(ASYNC_READ_ALIGNMENT, read.aligned_size);
+    if (buffer == nullptr)
+    {
+      throw std::bad_alloc();
+    }
+    read.list.list_id = list_id;
+    read.list.layout = layout;
+    read.list.buffer = std::shared_ptr<uint8_t>((uint8_t *)buffer, free);
+    read.list.data = (uint8_t *)buffer + (layout.offset - read.aligned_offset);
+    return read;
+  }
+
+  size_t AsyncListReader::get_read_size(const PendingRead &read) const
+  {
+    size_t n_bytes_left = read.aligned_size - read.n_bytes_read;
+    return max_read_size != 0 && max_read_size < n_bytes_left ? max_read_size : n_bytes_left;
+  }
+
+  void AsyncListReader::queue_read(PendingRead *read)
+  {
+    unsigned tail = *sq_tail;
+    unsigned index = tail & *sq_mask;
+    io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(io_uring_sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->off = read->aligned_offset + read->n_bytes_read;
+    sqe->addr = (uint64_t)(read->list.buffer.get() + read->n_bytes_read);
+    sqe->len = (uint32_t)get_read_size(*read);
+    sqe->user_data = (uint64_t)read;
+    sq_array[index] = index;
+    // the kernel must see the entry before the new tail
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+  }
+
+  void AsyncListReader::submit_and_wait(const unsigned n_submissions, const unsigned n_completions)
+  {
+    unsigned n_submitted = 0;
+    do
+    {
+      int result = io_uring_enter(ring_fd, n_submissions - n_submitted, n_completions, IORING_ENTER_GETEVENTS);
+      if (result < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        throw std::runtime_error("Could not read lists from file " + filename);
+      }
+      n_submitted += result;
+    } while (n_submitted < n_submissions);
+  }
+
+  bool AsyncListReader::complete_read(PendingRead *read, const int result) const
+  {
+    if (result == -EINTR || result == -EAGAIN)
+    {
+      return false;
+    }
+    if (result < 0)
+    {
+      throw std::runtime_error("Could not read lists from file " + filename + ": " + strerror(-result));
+    }
+    if (result == 0 && read->n_bytes_read < read->required_size)
+    {
+      throw std::runtime_error("Unexpected end of file " + filename);
+    }
+    read->n_bytes_read += result;
+    // reads of whole blocks may end early at the end of the file
+    return read->n_bytes_read >= read->required_size;
+  }
+
+  void AsyncListReader::read_lists_async(
+      const std::vector<std::pair<list_id_t, ListLayout>> &lists,
+      const std::function<void(const ListBuffer &)> &on_read)
+  {
+    std::vector<PendingRead> reads(lists.size());
+    len_t n_queued = 0;
+    len_t n_in_flight = 0;
+    // the buffers of reads in flight must not be freed, so all reads
+    // are waited for before an error is thrown
+    std::exception_ptr error;
+    while (n_in_flight > 0 || (error == nullptr && n_queued < lists.size()))
+    {
+      unsigned n_submissions = 0;
+      while (error == nullptr && n_queued < lists.size() && n_in_flight < queue_depth)
+      {
+        try
+        {
+          reads[n_queued] = prepare_read(lists[n_queued].first, lists[n_queued].second);
+        }
+        catch (const std::bad_alloc &)
+        {
+          error = std::current_exception();
+          break;
+        }
+        queue_read(&reads[n_queued]);
+        n_queued++;
+        n_in_flight++;
+        n_submissions++;
+      }
+      if (n_in_flight == 0)
+      {
+        continue;
+      }
+      submit_and_wait(n_submissions, 1);
+
+      unsigned head = *cq_head;
+      unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+      unsigned n_requeued = 0;
+      std::vector<PendingRead *> completed_reads;
+      for (; head != tail; head++)
+      {
+        const io_uring_cqe &cqe = cqes[head & *cq_mask];
+        PendingRead *read = (PendingRead *)cqe.user_data;
+        try
+        {
+          if (!complete_read(read, cqe.res))
+          {
+            queue_read(read);
+            n_requeued++;
+            continue;
+          }
+          completed_reads.push_back(read);
+        }
+        catch (const std::runtime_error &)
+        {
+          n_in_flight--;
+          error = std::current_exception();
+        }
+      }
+      __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+      if (n_requeued > 0)
+      {
+        submit_and_wait(n_requeued, 0);
+      }
+
+      for (PendingRead *read : completed_reads)
+      {
+        n_in_flight--;
+        try
+        {
+          if (error == nullptr)
+          {
+            on_read(read->list);
+          }
+        }
+        catch (...)
+        {
+          error = std::current_exception();
+        }
+        // the buffer is released once on_read no longer holds a copy
+        read->list.buffer.reset();
+      }
+    }
+    if (error != nullptr)
+    {
+      std::rethrow_exception(error);
+    }
+  }
+
+  void AsyncListReader::read_lists_sync(
+      const std::vector<std::pair<list_id_t, ListLayout>> &lists,
+      const std::function<void(const ListBuffer &)> &on_read) const
+  {
+    for (const auto &list : lists)
+    {
+      PendingRead read = prepare_read(list.first, list.second);
+      bool is_complete = false;
+      while (!is_complete)
+      {
+        ssize_t result = pread(fd, read.list.buffer.get() + read.n_bytes_read, get_read_size(read), read.aligned_offset + read.n_bytes_read);
+        is_complete = complete_read(&read, result < 0 ? -errno : (int)result);
+      }
+      on_read(read.list);
+    }
+  }
+
+  void AsyncListReader::read_lists(
+      const std::vector<std::pair<list_id_t, ListLayout>> &lists,
+      const std::function<void(const ListBuffer &)> &on_read)
+  {
+    std::lock_guard<std::mutex> lock(read_mutex);
+    if (is_async())
+    {
+      read_lists_async(lists, on_read);
+    }
+    else
+    {
+      read_lists_sync(lists, on_read);
+    }
+  }
+
+  bool AsyncListReader::is_async() const
+  {
+    return ring_fd >= 0;
+  }
+
+  bool AsyncListReader::is_direct_io() const
+  {
+    return is_direct;
+  }
+}
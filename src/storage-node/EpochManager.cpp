@@ -0,0 +1,144 @@
+#include <thread>
+#include <limits>
+
+#include "EpochManager.hpp"
+
+namespace ann_dkvs
+{
+  EpochManager::Guard::Guard() : manager(nullptr), slot(0) {}
+
+  EpochManager::Guard::Guard(EpochManager *manager, const len_t slot) : manager(manager), slot(slot) {}
+
+  EpochManager::Guard::Guard(Guard &&other) : manager(other.manager), slot(other.slot)
+  {
+    other.manager = nullptr;
+  }
+
+  EpochManager::Guard &EpochManager::Guard::operator=(Guard &&other)
+  {
+    if (this != &other)
+    {
+      if (manager != nullptr)
+      {
+        manager->unpin(slot);
+      }
+      manager = other.manager;
+      slot = other.slot;
+      other.manager = nullptr;
+    }
+    return *this;
+  }
+
+  EpochManager::Guard::~Guard()
+  {
+    if (manager != nullptr)
+    {
+      manager->unpin(slot);
+    }
+  }
+
+  EpochManager::EpochManager() : global_epoch(1), reader_slots(new ReaderSlot[EPOCH_MAX_READERS])
+  {
+    for (len_t i = 0; i < EPOCH_MAX_READERS; i++)
+    {
+      reader_slots[i].epoch = 0;
+    }
+  }
+
+  EpochManager::~EpochManager()
+  {
+    for (RetiredItem &item : retired_items)
+    {
+      item.reclaim();
+    }
+  }
+
+  EpochManager::Guard EpochManager::pin()
+  {
+    // threads start looking at different slots so that they rarely compete for one
+    len_t start = std::hash<std::thread::id>()(std::this_thread::get_id()) % EPOCH_MAX_READERS;
+    while (true)
+    {
+      for (len_t i = 0; i < EPOCH_MAX_READERS; i++)
+      {
+        len_t slot = (start + i) % EPOCH_MAX_READERS;
+        uint64_t epoch = global_epoch.load();
+        uint64_t unused = 0;
+        if (!reader_slots[slot].epoch.compare_exchange_strong(unused, epoch))
+        {
+          continue;
+        }
+        // the writer may have advanced the epoch and looked for pinned readers
+        // before the slot was claimed, so the epoch is only pinned once it is current
+        uint64_t current_epoch;
+        while ((current_epoch = global_epoch.load()) != epoch)
+        {
+          epoch = current_epoch;
+          reader_slots[slot].epoch.store(epoch);
+        }
+        return Guard(this, slot);
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  void EpochManager::unpin(const len_t slot)
+  {
+    reader_slots[slot].epoch.store(0);
+  }
+
+  void EpochManager::retire(std::function<void()> reclaim)
+  {
+    retired_items.push_back({global_epoch.load(), reclaim});
+  }
+
+  void EpochManager::advance()
+  {
+    global_epoch.fetch_add(1);
+  }
+
+  len_t EpochManager::reclaim()
+  {
+    if (retired_items.empty())
+    {
+      return 0;
+    }
+    uint64_t oldest_epoch = std::numeric_limits<uint64_t>::max();
+    for (len_t i = 0; i < EPOCH_MAX_READERS; i++)
+    {
+      uint64_t epoch = reader_slots[i].epoch.load();
+      if (epoch != 0 && epoch < oldest_epoch)
+      {
+        oldest_epoch = epoch;
+      }
+    }
+    // items are retired in order of their epochs
+    len_t n_reclaimed = 0;
+    while (!retired_items.empty() && retired_items.front().epoch < oldest_epoch)
+    {
+      std::function<void()> reclaim_item = retired_items.front().reclaim;
+      retired_items.pop_front();
+      reclaim_item();
+      n_reclaimed++;
+    }
+    return n_reclaimed;
+  }
+
+  len_t EpochManager::get_n_retired() const
+  {
+    return retired_items.size();
+  }
+
+  len_t EpochManager::get_n_pinned() const
+  {
+    len_t n_pinned = 0;
+    for (len_t i = 0; i < EPOCH_MAX_READERS; i++)
+    {
+      if (reader_slots[i].epoch.load() != 0)
+      {
+        n_pinned++;
+      }
+    }
+    return n_pinned;
+  }
+}
@@ -0,0 +1,282 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <vector>
+
+#include "IdDirectory.hpp"
+
+namespace ann_dkvs
+{
+  IdDirectory::IdDirectory(const std::string &filename)
+      : filename(filename), fd(-1), base_ptr(nullptr), mapped_size(0), header(nullptr), slots(nullptr)
+  {
+    fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+      throw std::runtime_error("Could not open file " + filename);
+    }
+    try
+    {
+      struct stat file_stat;
+      if (fstat(fd, &file_stat) != 0)
+      {
+        throw std::runtime_error("Could not open file " + filename);
+      }
+      Header file_header;
+      bool is_valid = (size_t)file_stat.st_size >= sizeof(Header) &&
+                      pread(fd, &file_header, sizeof(Header), 0) == sizeof(Header) &&
+                      file_header.magic == ID_DIRECTORY_MAGIC &&
+                      file_header.version == ID_DIRECTORY_VERSION &&
+                      file_header.capacity >= MIN_CAPACITY &&
+                      (file_header.capacity & (file_header.capacity - 1)) == 0 &&
+                      2 * file_header.n_ids <= file_header.capacity &&
+                      (size_t)file_stat.st_size == sizeof(Header) + file_header.capacity * sizeof(Slot);
+      if (is_valid)
+      {
+        map_file(file_header.capacity);
+      }
+      else
+      {
+        // the file is only a cache of the lists, so an invalid file is replaced
+        reset(MIN_CAPACITY);
+      }
+    }
+    catch (const std::runtime_error &)
+    {
+      unmap_file();
+      close(fd);
+      throw;
+    }
+  }
+
+  IdDirectory::~IdDirectory()
+  {
+    unmap_file();
+    close(fd);
+  }
+
+  void IdDirectory::map_file(const len_t capacity)
+  {
+    unmap_file();
+    size_t size = sizeof(Header) + capacity * sizeof(Slot);
+    if (ftruncate(fd, size) != 0)
+    {
+      throw std::runtime_error("Could not resize file " + filename);
+    }
+    void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED)
+    {
+      throw std::runtime_error("Could not mmap file " + filename);
+    }
+    base_ptr = (uint8_t *)ptr;
+    mapped_size = size;
+    header = (Header *)base_ptr;
+    slots = (Slot *)(base_ptr + sizeof(Header));
+  }
+
+  void IdDirectory::unmap_file()
+  {
+    if (base_ptr != nullptr)
+    {
+      munmap(base_ptr, mapped_size);
+      base_ptr = nullptr;
+      mapped_size = 0;
+      header = nullptr;
+      slots = nullptr;
+    }
+  }
+
+  void IdDirectory::reset(const len_t capacity)
+  {
+    map_file(capacity);
+    header->magic = ID_DIRECTORY_MAGIC;
+    header->version = ID_DIRECTORY_VERSION;
+    header->capacity = capacity;
+    header->n_ids = 0;
+    header->token = 0;
+    for (len_t i = 0; i < capacity; i++)
+    {
+      slots[i].location.offset = EMPTY_OFFSET;
+    }
+  }
+
+  len_t IdDirectory::get_home_slot(const vector_id_t id) const
+  {
+    // ids are often consecutive, so they are scattered by a multiplicative hash
+    // whose high bits are taken, since they depend on all bits of the id
+    int shift = 64 - __builtin_ctzl(header->capacity);
+    return ((uint64_t)id * 0x9E3779B97F4A7C15UL) >> shift;
+  }
+
+  len_t IdDirectory::find_slot(const vector_id_t id) const
+  {
+    len_t mask = header->capacity - 1;
+    len_t index = get_home_slot(id);
+    while (slots[index].location.offset != EMPTY_OFFSET && slots[index].id != id)
+    {
+      index = (index + 1) & mask;
+    }
+    return index;
+  }
+
+  void IdDirectory::remove_slot(len_t index)
+  {
+    len_t mask = header->capacity - 1;
+    len_t next = index;
+    while (true)
+    {
+      next = (next + 1) & mask;
+      if (slots[next].location.offset == EMPTY_OFFSET)
+      {
+        break;
+      }
+      // an id stays if its home slot lies cyclically after the emptied slot
+      len_t home = get_home_slot(slots[next].id);
+      bool stays = index <= next ? index < home && home <= next : index < home || home <= next;
+      if (!stays)
+      {
+        slots[index] = slots[next];
+        index = next;
+      }
+    }
+    slots[index].location.offset = EMPTY_OFFSET;
+    header->n_ids--;
+  }
+
+  void IdDirectory::rehash(const len_t capacity)
+  {
+    std::vector<Slot> used_slots;
+    used_slots.reserve(header->n_ids);
+    for (len_t i = 0; i < header->capacity; i++)
+    {
+      if (slots[i].location.offset != EMPTY_OFFSET)
+      {
+        used_slots.push_back(slots[i]);
+      }
+    }
+    reset(capacity);
+    for (const Slot &slot : used_slots)
+    {
+      slots[find_slot(slot.id)] = slot;
+    }
+    header->n_ids = used_slots.size();
+  }
+
+  void IdDirectory::mark_modified()
+  {
+    if (header->token == 0)
+    {
+      return;
+    }
+    // the header is written first, so that a partly written table is never trusted
+    header->token = 0;
+    if (msync(base_ptr, sizeof(Header), MS_SYNC) != 0)
+    {
+      throw std::runtime_error("Could not write file " + filename);
+    }
+  }
+
+  bool IdDirectory::find(const vector_id_t id, EntryLocation &location) const
+  {
+    const Slot &slot = slots[find_slot(id)];
+    if (slot.location.offset == EMPTY_OFFSET)
+    {
+      return false;
+    }
+    location = slot.location;
+    return true;
+  }
+
+  void IdDirectory::set(const vector_id_t id, const EntryLocation &location)
+  {
+    len_t index = find_slot(id);
+    bool is_used = slots[index].location.offset != EMPTY_OFFSET;
+    if (is_used && slots[index].location.list_id == location.list_id && slots[index].location.offset == location.offset)
+    {
+      return;
+    }
+    mark_modified();
+    if (!is_used && 2 * (header->n_ids + 1) > header->capacity)
+    {
+      rehash(2 * header->capacity);
+      index = find_slot(id);
+    }
+    slots[index].id = id;
+    slots[index].location = location;
+    if (!is_used)
+    {
+      header->n_ids++;
+    }
+  }
+
+  bool IdDirectory::remove(const vector_id_t id)
+  {
+    len_t index = find_slot(id);
+    if (slots[index].location.offset == EMPTY_OFFSET)
+    {
+      return false;
+    }
+    mark_modified();
+    remove_slot(index);
+    return true;
+  }
+
+  bool IdDirectory::remove(const vector_id_t id, const EntryLocation &location)
+  {
+    len_t index = find_slot(id);
+    if (slots[index].location.offset == EMPTY_OFFSET ||
+        slots[index].location.list_id != location.list_id ||
+        slots[index].location.offset != location.offset)
+    {
+      return false;
+    }
+    mark_modified();
+    remove_slot(index);
+    return true;
+  }
+
+  void IdDirectory::clear(const len_t n_ids)
+  {
+    mark_modified();
+    len_t capacity = MIN_CAPACITY;
+    while (capacity < 2 * n_ids)
+    {
+      capacity *= 2;
+    }
+    reset(capacity);
+  }
+
+  len_t IdDirectory::get_length() const
+  {
+    return header->n_ids;
+  }
+
+  uint64_t IdDirectory::get_token() const
+  {
+    return header->token;
+  }
+
+  void IdDirectory::sync(const uint64_t token)
+  {
+    if (token == 0)
+    {
+      throw std::invalid_argument("The token of a synced directory must not be 0");
+    }
+    if (msync(base_ptr, mapped_size, MS_SYNC) != 0)
+    {
+      throw std::runtime_error("Could not write file " + filename);
+    }
+    header->token = token;
+    if (msync(base_ptr, sizeof(Header), MS_SYNC) != 0)
+    {
+      throw std::runtime_error("Could not write file " + filename);
+    }
+  }
+
+  std::string IdDirectory::get_filename() const
+  {
+    return filename;
+  }
+}
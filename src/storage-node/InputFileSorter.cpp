@@ -0,0 +1,395 @@
+#include <string.h>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include "InputFileSorter.hpp"
+
+namespace ann_dkvs
+{
+  InputFileSorter::InputFileSorter(const len_t vector_dim, const std::string &tmp_dir, const size_t memory_budget, const len_t max_n_open_files)
+      : vector_dim(vector_dim), tmp_dir(tmp_dir), memory_budget(memory_budget), max_n_open_files(max_n_open_files)
+  {
+    if (vector_dim == 0)
+    {
+      throw std::invalid_argument("vector_dim must be greater than 0");
+    }
+    if (max_n_open_files < 2)
+    {
+      throw std::invalid_argument("max_n_open_files must be at least 2");
+    }
+  }
+
+  size_t InputFileSorter::get_entry_size() const
+  {
+    return sizeof(list_id_t) + sizeof(vector_id_t) + vector_dim * sizeof(vector_el_t);
+  }
+
+  len_t InputFileSorter::get_max_n_entries_in_memory() const
+  {
+    // half of the budget holds a bucket or the bucket buffers, the other half read input
+    return std::max((len_t)1, (len_t)(memory_budget / get_entry_size() / 2));
+  }
+
+  std::string InputFileSorter::get_bucket_filename(const len_t bucket) const
+  {
+    return tmp_dir + "/" + SORT_BUCKET_FILENAME + std::to_string(bucket) + SORT_BUCKET_FILE_EXT;
+  }
+
+  std::string InputFileSorter::get_part_filename(const len_t depth, const len_t part) const
+  {
+    return tmp_dir + "/" + SORT_PART_FILENAME + std::to_string(depth) + "_" + std::to_string(part) + SORT_BUCKET_FILE_EXT;
+  }
+
+  void InputFileSorter::check_file_size(const std::string &filename, const size_t entry_size, const len_t n_entries) const
+  {
+    std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+      throw std::runtime_error("Could not open file " + filename);
+    }
+    if ((size_t)file.tellg() != entry_size * n_entries)
+    {
+      throw std::runtime_error("Number of entries in file " + filename + " does not match n_entries");
+    }
+  }
+
+  InputFileSorter::list_id_counts_map_t InputFileSorter::count_entries(const std::string &list_ids_filename, const len_t n_entries) const
+  {
+    std::ifstream list_ids_file(list_ids_filename, std::ios::in | std::ios::binary);
+    std::vector<list_id_t> list_ids(std::min(n_entries, get_max_n_entries_in_memory()));
+    list_id_counts_map_t list_counts;
+    len_t n_entries_read = 0;
+    while (n_entries_read < n_entries)
+    {
+      len_t n_entries_to_read = std::min((len_t)list_ids.size(), n_entries - n_entries_read);
+      if (!list_ids_file.read((char *)list_ids.data(), n_entries_to_read * sizeof(list_id_t)))
+      {
+        throw std::runtime_error("Error reading list ids file");
+      }
+      for (len_t i = 0; i < n_entries_to_read; i++)
+      {
+        list_counts[list_ids[i]]++;
+      }
+      n_entries_read += n_entries_to_read;
+    }
+    return list_counts;
+  }
+
+  std::vector<len_t> InputFileSorter::plan_buckets(const list_id_counts_map_t &list_counts, list_positions_map_t &list_positions) const
+  {
+    const len_t max_bucket_size = get_max_n_entries_in_memory();
+    std::vector<len_t> bucket_sizes;
+    for (const auto &entry : list_counts)
+    {
+      if (bucket_sizes.empty() || bucket_sizes.back() + entry.second > max_bucket_size)
+      {
+        bucket_sizes.push_back(0);
+      }
+      list_positions[entry.first] = {bucket_sizes.size() - 1, bucket_sizes.back()};
+      bucket_sizes.back() += entry.second;
+    }
+    return bucket_sizes;
+  }
+
+  void InputFileSorter::partition_input_entries(
+      const std::string &vectors_filename,
+      const std::string &ids_filename,
+      const std::string &list_ids_filename,
+      const len_t n_entries,
+      const list_positions_map_t &list_positions,
+      const std::vector<len_t> &bucket_sizes) const
+  {
+    std::ifstream vectors_file(vectors_filename, std::ios::in | std::ios::binary);
+    std::ifstream ids_file(ids_filename, std::ios::in | std::ios::binary);
+    std::ifstream list_ids_file(list_ids_filename, std::ios::in | std::ios::binary);
+
+    const size_t entry_size = get_entry_size();
+    const size_t vector_size = vector_dim * sizeof(vector_el_t);
+    std::vector<vector_el_t> vectors;
+    std::vector<vector_id_t> ids;
+    std::vector<list_id_t> list_ids;
+
+    auto read_entries = [&](uint8_t *entries, const len_t n_entries_to_read)
+    {
+      vectors.resize(n_entries_to_read * vector_dim);
+      ids.resize(n_entries_to_read);
+      list_ids.resize(n_entries_to_read);
+      if (!vectors_file.read((char *)vectors.data(), n_entries_to_read * vector_size))
+      {
+        throw std::runtime_error("Error reading vectors file");
+      }
+      if (!ids_file.read((char *)ids.data(), n_entries_to_read * sizeof(vector_id_t)))
+      {
+        throw std::runtime_error("Error reading ids file");
+      }
+      if (!list_ids_file.read((char *)list_ids.data(), n_entries_to_read * sizeof(list_id_t)))
+      {
+        throw std::runtime_error("Error reading list ids file");
+      }
+      for (len_t i = 0; i < n_entries_to_read; i++)
+      {
+        uint8_t *entry = &entries[i * entry_size];
+        memcpy(entry, &list_ids[i], sizeof(list_id_t));
+        memcpy(entry + sizeof(list_id_t), &ids[i], sizeof(vector_id_t));
+        memcpy(entry + sizeof(list_id_t) + sizeof(vector_id_t), &vectors[i * vector_dim], vector_size);
+      }
+    };
+    partition_entries(read_entries, n_entries, list_positions, bucket_sizes, 0, bucket_sizes.size(), 0);
+  }
+
+  void InputFileSorter::partition_entries(
+      const entry_reader_t &read_entries,
+      const len_t n_entries,
+      const list_positions_map_t &list_positions,
+      const std::vector<len_t> &bucket_sizes,
+      const len_t first_bucket,
+      const len_t end_bucket,
+      const len_t depth) const
+  {
+    // every file of this pass holds the entries of n_buckets_per_file
+    // consecutive buckets, so that at most max_n_open_files are written
+    const len_t n_buckets = end_bucket - first_bucket;
+    len_t n_buckets_per_file = 1;
+    while ((n_buckets + n_buckets_per_file - 1) / n_buckets_per_file > max_n_open_files)
+    {
+      n_buckets_per_file *= max_n_open_files;
+    }
+    const len_t n_files = (n_buckets + n_buckets_per_file - 1) / n_buckets_per_file;
+    const bool is_last_pass = n_buckets_per_file == 1;
+    auto get_filename = [&](const len_t file)
+    {
+      return is_last_pass ? get_bucket_filename(first_bucket + file) : get_part_filename(depth, file);
+    };
+
+    const size_t entry_size = get_entry_size();
+    const len_t buffer_size = std::min(n_entries, get_max_n_entries_in_memory());
+    const size_t file_buffer_size = std::max((len_t)1, buffer_size / std::max(n_files, (len_t)1)) * entry_size;
+
+    try
+    {
+      std::vector<uint8_t> entries(buffer_size * entry_size);
+      std::vector<std::vector<uint8_t>> file_buffers(n_files);
+      std::vector<std::ofstream> files(n_files);
+      for (len_t file = 0; file < n_files; file++)
+      {
+        files[file].open(get_filename(file), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!files[file].is_open())
+        {
+          throw std::runtime_error("Could not open file " + get_filename(file));
+        }
+      }
+
+      auto flush_file = [&](const len_t file)
+      {
+        std::vector<uint8_t> &buffer = file_buffers[file];
+        if (!files[file].write((const char *)buffer.data(), buffer.size()))
+        {
+          throw std::runtime_error("Could not write file " + get_filename(file));
+        }
+        buffer.clear();
+      };
+
+      len_t n_entries_read = 0;
+      while (n_entries_read < n_entries)
+      {
+        len_t n_entries_to_read = std::min(buffer_size, n_entries - n_entries_read);
+        read_entries(entries.data(), n_entries_to_read);
+        for (len_t i = 0; i < n_entries_to_read; i++)
+        {
+          const uint8_t *entry = &entries[i * entry_size];
+          list_id_t list_id;
+          memcpy(&list_id, entry, sizeof(list_id_t));
+          len_t file = (list_positions.at(list_id).bucket - first_bucket) / n_buckets_per_file;
+          std::vector<uint8_t> &buffer = file_buffers[file];
+          if (buffer.capacity() == 0)
+          {
+            buffer.reserve(file_buffer_size);
+          }
+          buffer.insert(buffer.end(), entry, entry + entry_size);
+          if (buffer.size() >= file_buffer_size)
+          {
+            flush_file(file);
+          }
+        }
+        n_entries_read += n_entries_to_read;
+      }
+      for (len_t file = 0; file < n_files; file++)
+      {
+        flush_file(file);
+        files[file].close();
+        if (files[file].fail())
+        {
+          throw std::runtime_error("Could not write file " + get_filename(file));
+        }
+      }
+      if (is_last_pass)
+      {
+        return;
+      }
+
+      for (len_t file = 0; file < n_files; file++)
+      {
+        len_t file_first_bucket = first_bucket + file * n_buckets_per_file;
+        len_t file_end_bucket = std::min(file_first_bucket + n_buckets_per_file, end_bucket);
+        len_t n_file_entries = 0;
+        for (len_t bucket = file_first_bucket; bucket < file_end_bucket; bucket++)
+        {
+          n_file_entries += bucket_sizes[bucket];
+        }
+        std::ifstream part_file(get_filename(file), std::ios::in | std::ios::binary);
+        if (!part_file.is_open())
+        {
+          throw std::runtime_error("Could not open file " + get_filename(file));
+        }
+        auto read_part_entries = [&](uint8_t *part_entries, const len_t n_entries_to_read)
+        {
+          if (!part_file.read((char *)part_entries, n_entries_to_read * entry_size))
+          {
+            throw std::runtime_error("Error reading file " + get_filename(file));
+          }
+        };
+        partition_entries(read_part_entries, n_file_entries, list_positions, bucket_sizes, file_first_bucket, file_end_bucket, depth + 1);
+        part_file.close();
+        remove(get_filename(file).c_str());
+      }
+    }
+    catch (const std::runtime_error &)
+    {
+      // the bucket files are removed by sort()
+      if (!is_last_pass)
+      {
+        for (len_t file = 0; file < n_files; file++)
+        {
+          remove(get_filename(file).c_str());
+        }
+      }
+      throw;
+    }
+  }
+
+  void InputFileSorter::write_bucket(
+      const len_t bucket,
+      const len_t n_bucket_entries,
+      list_positions_map_t &list_positions,
+      std::ofstream &vectors_file,
+      std::ofstream &ids_file,
+      std::ofstream &list_ids_file) const
+  {
+    std::ifstream bucket_file(get_bucket_filename(bucket), std::ios::in | std::ios::binary);
+    if (!bucket_file.is_open())
+    {
+      throw std::runtime_error("Could not open file " + get_bucket_filename(bucket));
+    }
+
+    const size_t entry_size = get_entry_size();
+    const size_t vector_size = vector_dim * sizeof(vector_el_t);
+    const len_t max_n_entries = get_max_n_entries_in_memory();
+    // a bucket larger than the memory budget holds a single list,
+    // whose entries are already in order and can be streamed
+    const bool is_streamed = n_bucket_entries > max_n_entries;
+    const len_t buffer_size = std::min(n_bucket_entries, max_n_entries);
+
+    std::vector<vector_el_t> sorted_vectors(buffer_size * vector_dim);
+    std::vector<vector_id_t> sorted_ids(buffer_size);
+    std::vector<list_id_t> sorted_list_ids(buffer_size);
+    std::vector<uint8_t> buffer(buffer_size * entry_size);
+
+    auto write_sorted = [&](const len_t n_entries)
+    {
+      if (!vectors_file.write((const char *)sorted_vectors.data(), n_entries * vector_size) ||
+          !ids_file.write((const char *)sorted_ids.data(), n_entries * sizeof(vector_id_t)) ||
+          !list_ids_file.write((const char *)sorted_list_ids.data(), n_entries * sizeof(list_id_t)))
+      {
+        throw std::runtime_error("Could not write sorted files");
+      }
+    };
+
+    len_t n_entries_read = 0;
+    while (n_entries_read < n_bucket_entries)
+    {
+      len_t n_entries_to_read = std::min(buffer_size, n_bucket_entries - n_entries_read);
+      if (!bucket_file.read((char *)buffer.data(), n_entries_to_read * entry_size))
+      {
+        throw std::runtime_error("Error reading file " + get_bucket_filename(bucket));
+      }
+      for (len_t i = 0; i < n_entries_to_read; i++)
+      {
+        const uint8_t *entry = &buffer[i * entry_size];
+        list_id_t list_id;
+        memcpy(&list_id, entry, sizeof(list_id_t));
+        len_t offset = is_streamed ? i : list_positions.at(list_id).offset++;
+        sorted_list_ids[offset] = list_id;
+        memcpy(&sorted_ids[offset], entry + sizeof(list_id_t), sizeof(vector_id_t));
+        memcpy(&sorted_vectors[offset * vector_dim], entry + sizeof(list_id_t) + sizeof(vector_id_t), vector_size);
+      }
+      if (is_streamed)
+      {
+        write_sorted(n_entries_to_read);
+      }
+      n_entries_read += n_entries_to_read;
+    }
+    if (!is_streamed)
+    {
+      write_sorted(n_bucket_entries);
+    }
+  }
+
+  void InputFileSorter::remove_bucket_files(const len_t n_buckets) const
+  {
+    for (len_t bucket = 0; bucket < n_buckets; bucket++)
+    {
+      remove(get_bucket_filename(bucket).c_str());
+    }
+  }
+
+  void InputFileSorter::sort(
+      const std::string &vectors_filename,
+      const std::string &ids_filename,
+      const std::string &list_ids_filename,
+      const len_t n_entries,
+      const std::string &sorted_vectors_filename,
+      const std::string &sorted_ids_filename,
+      const std::string &sorted_list_ids_filename) const
+  {
+    check_file_size(vectors_filename, vector_dim * sizeof(vector_el_t), n_entries);
+    check_file_size(ids_filename, sizeof(vector_id_t), n_entries);
+    check_file_size(list_ids_filename, sizeof(list_id_t), n_entries);
+
+    list_positions_map_t list_positions;
+    std::vector<len_t> bucket_sizes = plan_buckets(count_entries(list_ids_filename, n_entries), list_positions);
+    const len_t n_buckets = bucket_sizes.size();
+
+    std::ofstream vectors_file(sorted_vectors_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    std::ofstream ids_file(sorted_ids_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    std::ofstream list_ids_file(sorted_list_ids_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!vectors_file.is_open() || !ids_file.is_open() || !list_ids_file.is_open())
+    {
+      throw std::runtime_error("Could not open sorted files");
+    }
+
+    try
+    {
+      partition_input_entries(vectors_filename, ids_filename, list_ids_filename, n_entries, list_positions, bucket_sizes);
+      for (len_t bucket = 0; bucket < n_buckets; bucket++)
+      {
+        write_bucket(bucket, bucket_sizes[bucket], list_positions, vectors_file, ids_file, list_ids_file);
+        remove(get_bucket_filename(bucket).c_str());
+      }
+    }
+    catch (const std::runtime_error &)
+    {
+      remove_bucket_files(n_buckets);
+      throw;
+    }
+
+    vectors_file.close();
+    ids_file.close();
+    list_ids_file.close();
+    if (vectors_file.fail() || ids_file.fail() || list_ids_file.fail())
+    {
+      throw std::runtime_error("Could not write sorted files");
+    }
+  }
+}
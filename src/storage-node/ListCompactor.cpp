@@ -0,0 +1,103 @@
+#include <iostream>
+#include <chrono>
+#include <stdexcept>
+
+#include "ListCompactor.hpp"
+
+namespace ann_dkvs
+{
+  ListCompactor::ListCompactor(StorageLists *lists, std::mutex &write_mutex, const float min_deleted_ratio, const len_t interval_ms)
+      : lists(lists), write_mutex(write_mutex), min_deleted_ratio(min_deleted_ratio), interval_ms(interval_ms),
+        n_passes_requested(0), n_passes_done(0), n_lists_compacted(0), is_stopping(false)
+  {
+    compaction_thread = std::thread(&ListCompactor::run, this);
+  }
+
+  ListCompactor::~ListCompactor()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      is_stopping = true;
+    }
+    pass_requested.notify_all();
+    pass_done.notify_all();
+    compaction_thread.join();
+  }
+
+  void ListCompactor::compact_lists()
+  {
+    std::vector<list_id_t> list_ids;
+    {
+      std::lock_guard<std::mutex> write_lock(write_mutex);
+      list_ids = lists->get_lists_to_compact(min_deleted_ratio);
+    }
+    for (list_id_t list_id : list_ids)
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (is_stopping)
+        {
+          return;
+        }
+      }
+      // the lock is taken per list, so that writers wait for one list at most
+      std::lock_guard<std::mutex> write_lock(write_mutex);
+      try
+      {
+        if (lists->compact_list(list_id) != 0)
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          n_lists_compacted++;
+        }
+      }
+      catch (const std::exception &e)
+      {
+        std::cerr << "Could not compact list " << list_id << " of " << lists->get_filename() << ": " << e.what() << std::endl;
+      }
+    }
+  }
+
+  void ListCompactor::run()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      pass_requested.wait_for(lock, std::chrono::milliseconds(interval_ms), [this]
+                              { return is_stopping || n_passes_requested != n_passes_done; });
+      if (is_stopping)
+      {
+        return;
+      }
+      // the pass covers every request made before it started
+      len_t n_passes = n_passes_requested;
+      lock.unlock();
+      compact_lists();
+      lock.lock();
+      n_passes_done = n_passes;
+      pass_done.notify_all();
+    }
+  }
+
+  void ListCompactor::compact()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      n_passes_requested++;
+    }
+    pass_requested.notify_one();
+  }
+
+  void ListCompactor::wait()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    len_t n_passes = n_passes_requested;
+    pass_done.wait(lock, [this, n_passes]
+                   { return is_stopping || n_passes_done >= n_passes; });
+  }
+
+  len_t ListCompactor::get_n_lists_compacted()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return n_lists_compacted;
+  }
+}
@@ -0,0 +1,110 @@
+#include <stdexcept>
+
+#include "ListPrefetcher.hpp"
+
+namespace ann_dkvs
+{
+  ListPrefetcher::ListPrefetcher(const StorageLists *lists)
+      : lists(lists), n_lists_prefetched(0), is_prefetching(false), is_stopping(false)
+  {
+    prefetch_thread = std::thread(&ListPrefetcher::run, this);
+  }
+
+  ListPrefetcher::~ListPrefetcher()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      is_stopping = true;
+    }
+    lists_available.notify_all();
+    prefetch_thread.join();
+  }
+
+  void ListPrefetcher::add_probe(const list_id_t list_id)
+  {
+    auto it = pending_n_probes.find(list_id);
+    if (it == pending_n_probes.end())
+    {
+      pending_n_probes[list_id] = 1;
+      pending_lists.insert({1, list_id});
+      return;
+    }
+    pending_lists.erase({it->second, list_id});
+    it->second++;
+    pending_lists.insert({it->second, list_id});
+  }
+
+  void ListPrefetcher::prefetch(const Query *query)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (len_t i = 0; i < query->get_n_probe(); i++)
+      {
+        add_probe(query->get_list_to_probe(i));
+      }
+    }
+    lists_available.notify_one();
+  }
+
+  void ListPrefetcher::prefetch(const QueryBatch &queries)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (const Query *query : queries)
+      {
+        for (len_t i = 0; i < query->get_n_probe(); i++)
+        {
+          add_probe(query->get_list_to_probe(i));
+        }
+      }
+    }
+    lists_available.notify_one();
+  }
+
+  void ListPrefetcher::run()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      lists_available.wait(lock, [this]
+                           { return is_stopping || !pending_lists.empty(); });
+      if (is_stopping)
+      {
+        return;
+      }
+      list_id_t list_id = pending_lists.begin()->list_id;
+      pending_lists.erase(pending_lists.begin());
+      pending_n_probes.erase(list_id);
+      is_prefetching = true;
+      lock.unlock();
+      try
+      {
+        lists->prefetch_list(list_id);
+      }
+      catch (const std::invalid_argument &)
+      {
+        // lists which do not exist are not searched either
+      }
+      lock.lock();
+      is_prefetching = false;
+      n_lists_prefetched++;
+      if (pending_lists.empty())
+      {
+        lists_prefetched.notify_all();
+      }
+    }
+  }
+
+  void ListPrefetcher::wait()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    lists_prefetched.wait(lock, [this]
+                          { return is_stopping || (pending_lists.empty() && !is_prefetching); });
+  }
+
+  len_t ListPrefetcher::get_n_lists_prefetched()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return n_lists_prefetched;
+  }
+}
@@ -1,65 +1,317 @@
+#include <algorithm>
+#include <stdexcept>
+#include <memory>
+#include <atomic>
+#include <limits>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "StorageIndex.hpp"
-#include "L2Space.hpp"
+#include "Numa.hpp"
+#include "IPSpace.hpp"
+#include "CosineSpace.hpp"
 
 namespace ann_dkvs
 {
+  static_assert(TOP_K_BLOCK_SIZE % FAST_SCAN_BLOCK_SIZE == 0, "Blocks of distances must consist of whole fast-scan blocks");
 
   QueryResults StorageIndex::extract_results(heap_t &candidates) const
   {
-    len_t n_results = candidates.size();
-    QueryResults results(n_results);
-    for (size_t i = 0; i < n_results; i++)
+    return candidates.extract_sorted();
+  }
+
+  ListData StorageIndex::get_list_data(const list_id_t list_id) const
+  {
+    return lists->get_list_data(list_id);
+  }
+
+  ListData StorageIndex::get_list_data(const ListBuffer &list_buffer) const
+  {
+    ListData list;
+    list.codes = list_buffer.data;
+    list.ids = (const vector_id_t *)(list_buffer.data + list_buffer.layout.ids_offset);
+    list.inverse_norms = metric == METRIC_COSINE ? (const distance_t *)(list_buffer.data + list_buffer.layout.inverse_norms_offset) : nullptr;
+    list.tombstones = (const uint64_t *)(list_buffer.data + list_buffer.layout.tombstones_offset);
+    list.length = list_buffer.layout.length;
+    return list;
+  }
+
+  void StorageIndex::mask_deleted_entries(
+      const ListData &list,
+      const size_t block_start,
+      const size_t block_size,
+      distance_t *distances) const
+  {
+    size_t first_word = block_start / 64;
+    size_t last_word = (block_start + block_size - 1) / 64;
+    uint64_t any_deleted = 0;
+    for (size_t w = first_word; w <= last_word; w++)
     {
-      results[n_results - i - 1] = candidates.top();
-      candidates.pop();
+      any_deleted |= list.tombstones[w];
+    }
+    if (any_deleted == 0)
+    {
+      return;
+    }
+    for (size_t w = first_word; w <= last_word; w++)
+    {
+      for (uint64_t word = list.tombstones[w]; word != 0; word &= word - 1)
+      {
+        size_t position = w * 64 + __builtin_ctzll(word);
+        if (position >= block_start && position < block_start + block_size)
+        {
+          distances[position - block_start] = std::numeric_limits<distance_t>::quiet_NaN();
+        }
+      }
     }
-    return results;
   }
 
-  void StorageIndex::add_candidate(const Query *query, const QueryResult &result, heap_t &candidates) const
+  void StorageIndex::search_preassigned_list(
+      const Query *query,
+      const list_id_t list_id,
+      const ListData &list,
+      heap_t &candidates) const
   {
-    if (candidates.size() < query->get_n_results())
+    if (quantizer != nullptr)
     {
-      candidates.push(result);
+      search_preassigned_quantized_list(query, list_id, list, candidates);
+      return;
     }
-    else if (result < candidates.top())
+    if (scalar_quantizer != nullptr)
     {
-      candidates.pop();
-      candidates.push(result);
+      search_preassigned_scalar_quantized_list(query, list_id, list, candidates);
+      return;
+    }
+    const vector_el_t *vectors = (const vector_el_t *)list.codes;
+    const vector_id_t *ids = list.ids;
+    size_t list_size = list.length;
+    size_t vector_dim = lists->get_vector_dim();
+    const distance_t *inverse_norms = list.inverse_norms;
+    distance_t query_inverse_norm = metric == METRIC_COSINE ? get_inverse_norm(query->get_query_vector(), vector_dim) : 0;
+
+    distance_t distances[TOP_K_BLOCK_SIZE];
+    for (size_t block_start = 0; block_start < list_size; block_start += TOP_K_BLOCK_SIZE)
+    {
+      size_t block_size = std::min((size_t)TOP_K_BLOCK_SIZE, list_size - block_start);
+      const vector_el_t *block = &vectors[block_start * vector_dim];
+      if (metric == METRIC_COSINE)
+      {
+        for (size_t j = 0; j < block_size; j++)
+        {
+          float inner_product = inner_product_func(&block[j * vector_dim], query->get_query_vector(), &vector_dim);
+          distances[j] = 1.0f - inner_product * inverse_norms[block_start + j] * query_inverse_norm;
+        }
+      }
+      else
+      {
+        for (size_t j = 0; j < block_size; j++)
+        {
+          distances[j] = distance_func(&block[j * vector_dim], query->get_query_vector(), &vector_dim);
+        }
+      }
+      mask_deleted_entries(list, block_start, block_size, distances);
+      const vector_id_t *block_ids = &ids[block_start];
+      candidates.push_batch(distances, block_size, [block_ids](len_t j)
+                            { return block_ids[j]; });
     }
   }
 
-  void StorageIndex::search_preassigned_list(
+  void StorageIndex::search_preassigned_quantized_list(
       const Query *query,
       const list_id_t list_id,
+      const ListData &list,
       heap_t &candidates) const
   {
-    const vector_el_t *vectors = lists->get_vectors(list_id);
-    const vector_id_t *ids = lists->get_ids(list_id);
-    size_t list_size = lists->get_list_length(list_id);
+    const uint8_t *codes = list.codes;
+    const vector_id_t *ids = list.ids;
+    size_t list_size = list.length;
     size_t vector_dim = lists->get_vector_dim();
-    for (size_t j = 0; j < list_size; j++)
+    size_t code_size = quantizer->get_code_size();
+    const vector_el_t *query_vector = query->get_query_vector();
+    const vector_el_t *centroid = &centroids[list_id * vector_dim];
+
+    // L2: ||q - c - r||^2 is looked up for the residual q - c of the query,
+    // inner product: <q, c + r> = <q, c> + <q, r>
+    std::vector<distance_t> table(quantizer->get_table_size());
+    distance_t list_term = 0;
+    if (metric == METRIC_L2)
+    {
+      std::vector<vector_el_t> query_residual(vector_dim);
+      for (size_t j = 0; j < vector_dim; j++)
+      {
+        query_residual[j] = query_vector[j] - centroid[j];
+      }
+      quantizer->compute_table(query_residual.data(), metric, table.data());
+    }
+    else
+    {
+      quantizer->compute_table(query_vector, metric, table.data());
+      list_term = inner_product_func(query_vector, centroid, &vector_dim);
+    }
+
+    // fast-scan lists are looked up in a table quantized to 8 bits held in registers
+    bool fast_scan = lists->get_code_layout() == CODE_LAYOUT_FAST_SCAN;
+    std::unique_ptr<FastScanTable> fast_scan_table;
+    if (fast_scan)
+    {
+      fast_scan_table.reset(new FastScanTable(table.data(), quantizer->get_n_subvectors()));
+    }
+
+    len_t n_rerank = raw_lists != nullptr ? PQ_RERANK_FACTOR * query->get_n_results() : 0;
+    // during re-ranking, the ids of the approximate candidates are their positions in the list
+    heap_t approximate_candidates(n_rerank);
+    distance_t distances[TOP_K_BLOCK_SIZE];
+    for (size_t block_start = 0; block_start < list_size; block_start += TOP_K_BLOCK_SIZE)
+    {
+      size_t block_size = std::min((size_t)TOP_K_BLOCK_SIZE, list_size - block_start);
+      if (fast_scan)
+      {
+        fast_scan_table->scan(&codes[block_start * code_size], block_size, distances);
+      }
+      else
+      {
+        quantizer->lookup_codes(table.data(), &codes[block_start * code_size], block_size, distances);
+      }
+      if (metric == METRIC_INNER_PRODUCT)
+      {
+        for (size_t j = 0; j < block_size; j++)
+        {
+          distances[j] = 1.0f - (list_term + distances[j]);
+        }
+      }
+      mask_deleted_entries(list, block_start, block_size, distances);
+      if (raw_lists != nullptr)
+      {
+        approximate_candidates.push_batch(distances, block_size, [block_start](len_t j)
+                                          { return (vector_id_t)(block_start + j); });
+      }
+      else
+      {
+        const vector_id_t *block_ids = &ids[block_start];
+        candidates.push_batch(distances, block_size, [block_ids](len_t j)
+                              { return block_ids[j]; });
+      }
+    }
+
+    if (raw_lists == nullptr)
+    {
+      return;
+    }
+    ListData raw_list = raw_lists->get_list_data(list_id);
+    if (raw_list.length != list_size)
+    {
+      throw std::logic_error("The raw lists do not match the quantized lists");
+    }
+    const vector_el_t *vectors = (const vector_el_t *)raw_list.codes;
+    for (const QueryResult &approximate_candidate : approximate_candidates.extract_sorted())
     {
-      const vector_el_t *vector = &vectors[j * vector_dim];
-      float distance = distance_func(vector, query->get_query_vector(), &vector_dim);
-      const vector_id_t vector_id = ids[j];
-      QueryResult result = {distance, vector_id};
-      add_candidate(query, result, candidates);
+      len_t position = (len_t)approximate_candidate.vector_id;
+      distance_t distance = distance_func(&vectors[position * vector_dim], query_vector, &vector_dim);
+      candidates.push({distance, ids[position]});
+    }
+  }
+
+  void StorageIndex::search_preassigned_scalar_quantized_list(
+      const Query *query,
+      const list_id_t list_id,
+      const ListData &list,
+      heap_t &candidates) const
+  {
+    (void)list_id;
+    const uint8_t *codes = list.codes;
+    const vector_id_t *ids = list.ids;
+    size_t list_size = list.length;
+    size_t code_size = lists->get_code_size();
+    std::vector<vector_el_t> prepared_query(lists->get_vector_dim());
+    distance_t query_term = scalar_quantizer->prepare_query(query->get_query_vector(), metric, prepared_query.data());
+
+    distance_t distances[TOP_K_BLOCK_SIZE];
+    for (size_t block_start = 0; block_start < list_size; block_start += TOP_K_BLOCK_SIZE)
+    {
+      size_t block_size = std::min((size_t)TOP_K_BLOCK_SIZE, list_size - block_start);
+      scalar_quantizer->compute_distances(prepared_query.data(), query_term, metric, &codes[block_start * code_size], block_size, distances);
+      mask_deleted_entries(list, block_start, block_size, distances);
+      const vector_id_t *block_ids = &ids[block_start];
+      candidates.push_batch(distances, block_size, [block_ids](len_t j)
+                            { return block_ids[j]; });
     }
   }
 
   StorageIndex::StorageIndex(const StorageLists *lists)
-      : lists(lists), distance_func(L2Space(lists->get_vector_dim()).get_distance_func())
+      : lists(lists),
+        metric(lists->get_metric()),
+        distance_func(Space::create(lists->get_metric(), lists->get_vector_dim()).get_distance_func()),
+        inner_product_func(get_inner_product_func(get_simd_level())),
+        quantizer(nullptr),
+        centroids(nullptr),
+        raw_lists(nullptr),
+        scalar_quantizer(nullptr)
   {
+    if (lists->get_code_size() != 0)
+    {
+      throw std::invalid_argument("Lists storing codes require a quantizer");
+    }
+  }
+
+  StorageIndex::StorageIndex(
+      const StorageLists *lists,
+      const ProductQuantizer *quantizer,
+      const vector_el_t *centroids,
+      const StorageLists *raw_lists)
+      : lists(lists),
+        metric(lists->get_metric()),
+        distance_func(Space::create(lists->get_metric(), lists->get_vector_dim()).get_distance_func()),
+        inner_product_func(get_inner_product_func(get_simd_level())),
+        quantizer(quantizer),
+        centroids(centroids),
+        raw_lists(raw_lists),
+        scalar_quantizer(nullptr)
+  {
+    if (lists->get_code_size() != quantizer->get_code_size() || lists->get_vector_dim() != quantizer->get_vector_dim())
+    {
+      throw std::invalid_argument("The lists do not store codes of the quantizer");
+    }
+    if (lists->get_code_layout() == CODE_LAYOUT_FAST_SCAN && quantizer->get_n_bits() != 4)
+    {
+      throw std::invalid_argument("Lists in the fast-scan layout require a quantizer with 4-bit codes");
+    }
+    if (raw_lists != nullptr && (raw_lists->get_code_size() != 0 || raw_lists->get_vector_dim() != lists->get_vector_dim() || raw_lists->get_metric() != metric))
+    {
+      throw std::invalid_argument("The raw lists do not store vectors matching the quantized lists");
+    }
+  }
+
+  StorageIndex::StorageIndex(const StorageLists *lists, const ScalarQuantizer *scalar_quantizer)
+      : lists(lists),
+        metric(lists->get_metric()),
+        distance_func(Space::create(lists->get_metric(), lists->get_vector_dim()).get_distance_func()),
+        inner_product_func(get_inner_product_func(get_simd_level())),
+        quantizer(nullptr),
+        centroids(nullptr),
+        raw_lists(nullptr),
+        scalar_quantizer(scalar_quantizer)
+  {
+    if (lists->get_code_size() != scalar_quantizer->get_code_size() || lists->get_vector_dim() != scalar_quantizer->get_vector_dim() || lists->get_code_layout() != CODE_LAYOUT_PACKED)
+    {
+      throw std::invalid_argument("The lists do not store codes of the scalar quantizer");
+    }
+    if (!scalar_quantizer->is_trained())
+    {
+      throw std::invalid_argument("The scalar quantizer must be trained");
+    }
   }
 
   QueryResults StorageIndex::search_preassigned(const Query *query) const
   {
-    heap_t candidates;
+    EpochManager::Guard guard = lists->pin();
+    EpochManager::Guard raw_guard = raw_lists != nullptr ? raw_lists->pin() : EpochManager::Guard();
+    heap_t candidates(query->get_n_results());
     for (len_t i = 0; i < query->get_n_probe(); i++)
     {
       list_id_t list_id = query->get_list_to_probe(i);
-      search_preassigned_list(query, list_id, candidates);
+      search_preassigned_list(query, list_id, get_list_data(list_id), candidates);
     }
     return extract_results(candidates);
   }
@@ -78,8 +330,317 @@ namespace ann_dkvs
     return work_items;
   }
 
+  ListWorkItemsMap StorageIndex::get_work_items_by_list(const QueryListPairs &work_items) const
+  {
+    ListWorkItemsMap work_items_by_list;
+    for (len_t i = 0; i < work_items.size(); i++)
+    {
+      work_items_by_list[work_items[i].second].push_back(i);
+    }
+    return work_items_by_list;
+  }
+
+  QueryResultsBatch StorageIndex::merge_work_item_results(
+      const QueryBatch &queries,
+      const std::vector<QueryResults> &work_item_results) const
+  {
+    std::vector<len_t> first_work_items(queries.size() + 1);
+    for (len_t i = 0; i < queries.size(); i++)
+    {
+      first_work_items[i + 1] = first_work_items[i] + queries[i]->get_n_probe();
+    }
+
+    QueryResultsBatch results(queries.size());
+#if PMODE != 0
+#pragma omp parallel for schedule(runtime)
+#endif
+    for (len_t i = 0; i < queries.size(); i++)
+    {
+      heap_t candidates(queries[i]->get_n_results());
+      for (len_t j = first_work_items[i]; j < first_work_items[i + 1]; j++)
+      {
+        for (const QueryResult &result : work_item_results[j])
+        {
+          candidates.push(result);
+        }
+      }
+      results[i] = extract_results(candidates);
+    }
+    return results;
+  }
+
+  distance_t StorageIndex::get_query_term(const Query *query) const
+  {
+    if (metric != METRIC_COSINE)
+    {
+      return 0;
+    }
+    return get_inverse_norm(query->get_query_vector(), lists->get_vector_dim());
+  }
+
+  void StorageIndex::search_preassigned_list_batched(
+      const QueryBatch &queries,
+      const std::vector<distance_t> &query_terms,
+      const list_id_t list_id,
+      const ListData &list,
+      const std::vector<len_t> &query_ids,
+      std::vector<heap_t> &candidates) const
+  {
+    if (quantizer != nullptr)
+    {
+      // the codes are small enough to be scanned once per query
+      for (len_t i = 0; i < query_ids.size(); i++)
+      {
+        search_preassigned_list(queries[query_ids[i]], list_id, list, candidates[i]);
+      }
+      return;
+    }
+    if (scalar_quantizer != nullptr)
+    {
+      search_preassigned_scalar_quantized_list_batched(queries, list_id, list, query_ids, candidates);
+      return;
+    }
+    const vector_el_t *vectors = (const vector_el_t *)list.codes;
+    const vector_id_t *ids = list.ids;
+    const distance_t *inverse_norms = list.inverse_norms;
+    size_t list_size = list.length;
+    size_t vector_dim = lists->get_vector_dim();
+
+    // every distance is computed like in search_preassigned_list(),
+    // so that the results are the same in every parallel mode
+    distance_t distances[BATCHED_SCAN_BLOCK_SIZE];
+    for (size_t block_start = 0; block_start < list_size; block_start += BATCHED_SCAN_BLOCK_SIZE)
+    {
+      size_t block_size = std::min((size_t)BATCHED_SCAN_BLOCK_SIZE, list_size - block_start);
+      const vector_el_t *block = &vectors[block_start * vector_dim];
+      const vector_id_t *block_ids = &ids[block_start];
+      for (size_t i = 0; i < query_ids.size(); i++)
+      {
+        const vector_el_t *query_vector = queries[query_ids[i]]->get_query_vector();
+        if (metric == METRIC_COSINE)
+        {
+          distance_t query_inverse_norm = query_terms[query_ids[i]];
+          for (size_t j = 0; j < block_size; j++)
+          {
+            float inner_product = inner_product_func(&block[j * vector_dim], query_vector, &vector_dim);
+            distances[j] = 1.0f - inner_product * inverse_norms[block_start + j] * query_inverse_norm;
+          }
+        }
+        else
+        {
+          for (size_t j = 0; j < block_size; j++)
+          {
+            distances[j] = distance_func(&block[j * vector_dim], query_vector, &vector_dim);
+          }
+        }
+        mask_deleted_entries(list, block_start, block_size, distances);
+        candidates[i].push_batch(distances, block_size, [block_ids](len_t j)
+                                 { return block_ids[j]; });
+      }
+    }
+  }
+
+  void StorageIndex::search_preassigned_scalar_quantized_list_batched(
+      const QueryBatch &queries,
+      const list_id_t list_id,
+      const ListData &list,
+      const std::vector<len_t> &query_ids,
+      std::vector<heap_t> &candidates) const
+  {
+    (void)list_id;
+    const uint8_t *codes = list.codes;
+    const vector_id_t *ids = list.ids;
+    size_t list_size = list.length;
+    size_t code_size = lists->get_code_size();
+    size_t vector_dim = lists->get_vector_dim();
+    std::vector<vector_el_t> prepared_queries(query_ids.size() * vector_dim);
+    std::vector<distance_t> query_terms(query_ids.size());
+    for (size_t i = 0; i < query_ids.size(); i++)
+    {
+      query_terms[i] = scalar_quantizer->prepare_query(queries[query_ids[i]]->get_query_vector(), metric, &prepared_queries[i * vector_dim]);
+    }
+
+    distance_t distances[BATCHED_SCAN_BLOCK_SIZE];
+    for (size_t block_start = 0; block_start < list_size; block_start += BATCHED_SCAN_BLOCK_SIZE)
+    {
+      size_t block_size = std::min((size_t)BATCHED_SCAN_BLOCK_SIZE, list_size - block_start);
+      const vector_id_t *block_ids = &ids[block_start];
+      for (size_t i = 0; i < query_ids.size(); i++)
+      {
+        scalar_quantizer->compute_distances(&prepared_queries[i * vector_dim], query_terms[i], metric, &codes[block_start * code_size], block_size, distances);
+        mask_deleted_entries(list, block_start, block_size, distances);
+        candidates[i].push_batch(distances, block_size, [block_ids](len_t j)
+                                 { return block_ids[j]; });
+      }
+    }
+  }
+
+  void StorageIndex::search_work_items_of_list(
+      const QueryBatch &queries,
+      const std::vector<distance_t> &query_terms,
+      const list_id_t list_id,
+      const ListData &list,
+      const QueryListPairs &work_items,
+      const std::vector<len_t> &work_item_ids,
+      std::vector<QueryResults> &work_item_results) const
+  {
+#if PMODE == 3
+    std::vector<len_t> query_ids(work_item_ids.size());
+    for (len_t j = 0; j < work_item_ids.size(); j++)
+    {
+      query_ids[j] = work_items[work_item_ids[j]].first;
+    }
+    std::vector<heap_t> local_candidates;
+    local_candidates.reserve(query_ids.size());
+    for (len_t query_id : query_ids)
+    {
+      local_candidates.emplace_back(queries[query_id]->get_n_results());
+    }
+    search_preassigned_list_batched(queries, query_terms, list_id, list, query_ids, local_candidates);
+    for (len_t j = 0; j < work_item_ids.size(); j++)
+    {
+      work_item_results[work_item_ids[j]] = extract_results(local_candidates[j]);
+    }
+#else
+    // the distances are computed like in the other parallel modes,
+    // so that the results do not depend on how the lists are accessed
+    (void)query_terms;
+    for (len_t work_item_id : work_item_ids)
+    {
+      const Query *query = queries[work_items[work_item_id].first];
+      heap_t local_candidates(query->get_n_results());
+      search_preassigned_list(query, list_id, list, local_candidates);
+      work_item_results[work_item_id] = extract_results(local_candidates);
+    }
+#endif
+  }
+
+  bool StorageIndex::is_numa_aware() const
+  {
+    return lists->get_mapping_policy().n_numa_nodes > 1;
+  }
+
+  void StorageIndex::search_items_on_numa_nodes(
+      const std::vector<list_id_t> &item_list_ids,
+      const std::function<void(const len_t)> &search_item) const
+  {
+    len_t n_nodes = lists->get_mapping_policy().n_numa_nodes;
+    std::vector<std::vector<len_t>> node_items(n_nodes);
+    for (len_t i = 0; i < item_list_ids.size(); i++)
+    {
+      node_items[lists->get_list_numa_node(item_list_ids[i])].push_back(i);
+    }
+    // the index of the next item of each node to be searched
+    std::unique_ptr<std::atomic<len_t>[]> next_items(new std::atomic<len_t>[n_nodes]());
+#if PMODE != 0
+#pragma omp parallel
+#endif
+    {
+      len_t node = get_current_numa_node() % n_nodes;
+      bool is_pinned = false;
+      cpu_set_t previous_cpus;
+#if defined(_OPENMP) && PMODE != 0
+      // threads bound to places by OpenMP stay where they are, the others
+      // are spread across the nodes and pinned to theirs while searching
+      if (omp_get_proc_bind() == omp_proc_bind_false)
+      {
+        is_pinned = pin_thread_to_numa_node(omp_get_thread_num() % n_nodes, &previous_cpus);
+        if (is_pinned)
+        {
+          node = omp_get_thread_num() % n_nodes;
+        }
+      }
+#endif
+      for (len_t j = 0; j < n_nodes; j++)
+      {
+        // the items of the other nodes are only searched once those of the own node are done
+        len_t other_node = (node + j) % n_nodes;
+        for (len_t k = next_items[other_node]++; k < node_items[other_node].size(); k = next_items[other_node]++)
+        {
+          search_item(node_items[other_node][k]);
+        }
+      }
+      if (is_pinned)
+      {
+        unpin_thread(&previous_cpus);
+      }
+    }
+  }
+
+  QueryResultsBatch StorageIndex::batch_search_preassigned_async(const QueryBatch &queries) const
+  {
+    std::vector<distance_t> query_terms(queries.size());
+#if PMODE == 3
+    for (len_t i = 0; i < queries.size(); i++)
+    {
+      query_terms[i] = get_query_term(queries[i]);
+    }
+#endif
+    QueryListPairs work_items = get_work_items(queries);
+    std::vector<QueryResults> work_item_results(work_items.size());
+    ListWorkItemsMap work_items_by_list = get_work_items_by_list(work_items);
+    std::vector<std::pair<list_id_t, ListLayout>> lists_to_read;
+    for (const auto &entry : work_items_by_list)
+    {
+      lists_to_read.push_back({entry.first, lists->get_list_layout(entry.first)});
+    }
+
+    auto search_list = [&](const ListBuffer &list_buffer)
+    {
+      search_work_items_of_list(queries, query_terms, list_buffer.list_id, get_list_data(list_buffer),
+                                work_items, work_items_by_list.at(list_buffer.list_id), work_item_results);
+    };
+#if PMODE == 0
+    async_reader->read_lists(lists_to_read, search_list);
+#else
+    // one thread reads the lists while the others search the lists read so far;
+    // exceptions cannot leave the parallel region, so they are rethrown after it
+    std::string error;
+#pragma omp parallel
+#pragma omp single
+    {
+      try
+      {
+        async_reader->read_lists(lists_to_read, [&](const ListBuffer &list_buffer)
+                          {
+#pragma omp task firstprivate(list_buffer)
+                            {
+                              try
+                              {
+                                search_list(list_buffer);
+                              }
+                              catch (const std::exception &e)
+                              {
+#pragma omp critical
+                                error = e.what();
+                              }
+                            } });
+      }
+      catch (const std::exception &e)
+      {
+#pragma omp critical
+        error = e.what();
+      }
+#pragma omp taskwait
+    }
+    if (!error.empty())
+    {
+      throw std::runtime_error(error);
+    }
+#endif
+    return merge_work_item_results(queries, work_item_results);
+  }
+
   QueryResultsBatch StorageIndex::batch_search_preassigned(const QueryBatch &queries) const
   {
+    // the threads searching the batch read the lists within the pinned epoch,
+    // so that lists reallocated by a concurrent writer stay valid until they are done
+    EpochManager::Guard guard = lists->pin();
+    EpochManager::Guard raw_guard = raw_lists != nullptr ? raw_lists->pin() : EpochManager::Guard();
+    if (async_reader != nullptr)
+    {
+      return batch_search_preassigned_async(queries);
+    }
     QueryResultsBatch results(queries.size());
 
 #if PMODE == 0 || PMODE == 1
@@ -91,34 +652,95 @@ namespace ann_dkvs
       results[i] = search_preassigned(queries[i]);
     }
 #elif PMODE == 2
-    std::vector<heap_t> candidate_lists(queries.size());
-
     QueryListPairs work_items = get_work_items(queries);
+    std::vector<QueryResults> work_item_results(work_items.size());
 
-#pragma omp parallel for schedule(runtime)
-    for (len_t i = 0; i < work_items.size(); i++)
+    auto search_work_item = [&](const len_t i)
     {
-      len_t query_index = work_items[i].first;
-      const Query *query = queries[query_index];
+      const Query *query = queries[work_items[i].first];
       list_id_t list_id = work_items[i].second;
-      heap_t local_candidates;
-      search_preassigned_list(query, list_id, local_candidates);
-#pragma omp critical
+      heap_t local_candidates(query->get_n_results());
+      search_preassigned_list(query, list_id, get_list_data(list_id), local_candidates);
+      work_item_results[i] = extract_results(local_candidates);
+    };
+    if (is_numa_aware())
+    {
+      std::vector<list_id_t> item_list_ids(work_items.size());
+      for (len_t i = 0; i < work_items.size(); i++)
       {
-        while (local_candidates.size() > 0)
-        {
-          QueryResult result = local_candidates.top();
-          local_candidates.pop();
-          add_candidate(query, result, candidate_lists[query_index]);
-        }
+        item_list_ids[i] = work_items[i].second;
       }
+      search_items_on_numa_nodes(item_list_ids, search_work_item);
     }
-#pragma omp single
-    for (len_t j = 0; j < queries.size(); j++)
+    else
     {
-      results[j] = extract_results(candidate_lists[j]);
+#pragma omp parallel for schedule(runtime)
+      for (len_t i = 0; i < work_items.size(); i++)
+      {
+        search_work_item(i);
+      }
+    }
+    results = merge_work_item_results(queries, work_item_results);
+#elif PMODE == 3
+    std::vector<distance_t> query_terms(queries.size());
+#pragma omp parallel for schedule(runtime)
+    for (len_t i = 0; i < queries.size(); i++)
+    {
+      query_terms[i] = get_query_term(queries[i]);
+    }
+
+    QueryListPairs work_items = get_work_items(queries);
+    std::vector<QueryResults> work_item_results(work_items.size());
+    ListWorkItemsMap work_items_by_list = get_work_items_by_list(work_items);
+    std::vector<ListWorkItemsMap::const_iterator> lists_to_scan;
+    for (auto it = work_items_by_list.cbegin(); it != work_items_by_list.cend(); it++)
+    {
+      lists_to_scan.push_back(it);
+    }
+
+    auto search_list = [&](const len_t i)
+    {
+      list_id_t list_id = lists_to_scan[i]->first;
+      search_work_items_of_list(queries, query_terms, list_id, get_list_data(list_id), work_items, lists_to_scan[i]->second, work_item_results);
+    };
+    if (is_numa_aware())
+    {
+      std::vector<list_id_t> item_list_ids(lists_to_scan.size());
+      for (len_t i = 0; i < lists_to_scan.size(); i++)
+      {
+        item_list_ids[i] = lists_to_scan[i]->first;
+      }
+      search_items_on_numa_nodes(item_list_ids, search_list);
     }
+    else
+    {
+#pragma omp parallel for schedule(runtime)
+      for (len_t i = 0; i < lists_to_scan.size(); i++)
+      {
+        search_list(i);
+      }
+    }
+    results = merge_work_item_results(queries, work_item_results);
 #endif
     return results;
   }
-}
\ No newline at end of file
+
+  void StorageIndex::enable_async_reads(const len_t queue_depth)
+  {
+    if (queue_depth == 0)
+    {
+      throw std::invalid_argument("queue_depth must be greater than 0");
+    }
+    async_reader.reset(new AsyncListReader(lists->get_filename(), queue_depth));
+  }
+
+  void StorageIndex::disable_async_reads()
+  {
+    async_reader.reset();
+  }
+
+  const AsyncListReader *StorageIndex::get_async_reader() const
+  {
+    return async_reader.get();
+  }
+}
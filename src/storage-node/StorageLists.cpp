@@ -3,31 +3,127 @@
 #include <string>
 #include <iostream>
 #include <unistd.h>
+#include <fcntl.h>
 #include <fstream>
+#include <algorithm>
+#include <unordered_set>
+#include <random>
 
 #include "StorageLists.hpp"
+#include "CosineSpace.hpp"
+#include "Numa.hpp"
 
 namespace ann_dkvs
 {
+  static_assert(LIST_ALIGNMENT > 0 && (LIST_ALIGNMENT & (LIST_ALIGNMENT - 1)) == 0, "LIST_ALIGNMENT must be a power of two");
+
   void StorageLists::mmap_region()
   {
-    FILE *f = fopen(filename.c_str(), "r+");
-    if (f == nullptr)
+    open_file();
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t new_mapped_size = (total_size + page_size - 1) / page_size * page_size;
+    if (new_mapped_size > reserved_size)
     {
-      throw std::runtime_error("Could not open file " + filename);
+      size_t new_reserved_size = std::max((size_t)REGION_RESERVATION_SIZE, reserved_size);
+      while (new_reserved_size < new_mapped_size)
+      {
+        new_reserved_size *= 2;
+      }
+      if (base_ptr != nullptr && concurrent_reads != nullptr)
+      {
+        // concurrent readers may still read the old mapping of the file,
+        // so it is kept until every list is published within the new one
+        uint8_t *old_base_ptr = base_ptr;
+        size_t old_reserved_size = reserved_size;
+        concurrent_reads->epoch_manager.retire([old_base_ptr, old_reserved_size]
+                                               { munmap(old_base_ptr, old_reserved_size); });
+        for (const auto &entry : id_to_list_map)
+        {
+          mark_list_modified(entry.first);
+        }
+        base_ptr = nullptr;
+        mapped_size = 0;
+      }
+      else if (base_ptr != nullptr)
+      {
+        munmap(base_ptr, reserved_size);
+        base_ptr = nullptr;
+        mapped_size = 0;
+      }
+      reserve_region(new_reserved_size);
+    }
+    if (new_mapped_size <= mapped_size)
+    {
+      return;
     }
-    base_ptr = (uint8_t *)mmap(
-        nullptr,
-        total_size,
-        PROT_READ | PROT_WRITE,
-        MAP_SHARED,
-        fileno(f),
-        0);
-    if (base_ptr == MAP_FAILED)
+    bool is_writable = open_mode == OPEN_MODE_READ_WRITE;
+    void *ptr = mmap(
+        base_ptr + mapped_size,
+        new_mapped_size - mapped_size,
+        is_writable ? PROT_READ | PROT_WRITE : PROT_READ,
+        MAP_SHARED | MAP_FIXED,
+        fd,
+        mapped_size);
+    if (ptr == MAP_FAILED)
     {
       throw std::runtime_error("Could not mmap file " + filename);
     }
-    fclose(f);
+    advise_huge_pages(mapped_size, new_mapped_size - mapped_size);
+    mapped_size = new_mapped_size;
+  }
+
+  void StorageLists::reserve_region(const size_t size)
+  {
+    // one huge page more is reserved to align the base pointer to a huge page
+    void *ptr = mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED)
+    {
+      throw std::runtime_error("Could not reserve memory for file " + filename);
+    }
+    uint8_t *aligned_ptr = (uint8_t *)(((uintptr_t)ptr + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+    size_t head_size = aligned_ptr - (uint8_t *)ptr;
+    if (head_size != 0)
+    {
+      munmap(ptr, head_size);
+    }
+    munmap(aligned_ptr + size, HUGE_PAGE_SIZE - head_size);
+    base_ptr = aligned_ptr;
+    reserved_size = size;
+  }
+
+  MappingPolicy StorageLists::get_default_mapping_policy()
+  {
+    MappingPolicy policy;
+    policy.use_huge_pages = USE_HUGE_PAGES != 0;
+    policy.n_numa_nodes = N_NUMA_NODES != 0 ? N_NUMA_NODES : get_n_numa_nodes();
+    policy.numa_chunk_size = NUMA_CHUNK_SIZE;
+    return policy;
+  }
+
+  void StorageLists::advise_huge_pages(const size_t offset, const size_t size) const
+  {
+    if (size == 0)
+    {
+      return;
+    }
+    // only a hint, e.g. file systems without huge pages reject it
+    madvise(base_ptr + offset, size, mapping_policy.use_huge_pages ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+  }
+
+  void StorageLists::unmap_region()
+  {
+    if (base_ptr != nullptr)
+    {
+      munmap(base_ptr, reserved_size);
+      base_ptr = nullptr;
+      reserved_size = 0;
+      mapped_size = 0;
+    }
+    if (fd != -1)
+    {
+      close(fd);
+      fd = -1;
+    }
   }
 
   vector_el_t *StorageLists::get_vectors_by_list(const InvertedList *list) const
@@ -35,11 +131,27 @@ namespace ann_dkvs
     return (vector_el_t *)(base_ptr + list->offset);
   }
 
+  uint8_t *StorageLists::get_codes_by_list(const InvertedList *list) const
+  {
+    return base_ptr + list->offset;
+  }
+
   vector_id_t *StorageLists::get_ids_by_list(const InvertedList *list) const
   {
-    vector_el_t *vector_ptr = get_vectors_by_list(list);
-    vector_id_t *id_ptr = (vector_id_t *)((size_t)vector_ptr + vector_size * list->allocated_entries);
-    return id_ptr;
+    uint8_t *vector_ptr = get_codes_by_list(list);
+    return (vector_id_t *)(vector_ptr + get_aligned_size(get_vectors_size(list->allocated_entries)));
+  }
+
+  distance_t *StorageLists::get_inverse_norms_by_list(const InvertedList *list) const
+  {
+    uint8_t *id_ptr = (uint8_t *)get_ids_by_list(list);
+    return (distance_t *)(id_ptr + get_aligned_size(get_ids_size(list->allocated_entries)));
+  }
+
+  uint64_t *StorageLists::get_tombstones_by_list(const InvertedList *list) const
+  {
+    uint8_t *inverse_norms_ptr = (uint8_t *)get_inverse_norms_by_list(list);
+    return (uint64_t *)(inverse_norms_ptr + get_aligned_size(get_inverse_norms_size(list->allocated_entries)));
   }
 
   size_t StorageLists::get_vectors_size(const len_t n_entries) const
@@ -57,36 +169,79 @@ namespace ann_dkvs
     return n_entries * sizeof(list_id_t);
   }
 
+  size_t StorageLists::get_inverse_norms_size(const len_t n_entries) const
+  {
+    if (metric != METRIC_COSINE)
+    {
+      return 0;
+    }
+    return n_entries * sizeof(distance_t);
+  }
+
+  size_t StorageLists::get_tombstones_size(const len_t n_entries) const
+  {
+    return (n_entries + 63) / 64 * sizeof(uint64_t);
+  }
+
+  void StorageLists::clear_tombstones(const InvertedList *list, const len_t start) const
+  {
+    uint64_t *tombstones = get_tombstones_by_list(list);
+    size_t first_word = start / 64;
+    if (start % 64 != 0)
+    {
+      tombstones[first_word] &= (1UL << (start % 64)) - 1;
+      first_word++;
+    }
+    size_t n_words = get_tombstones_size(list->allocated_entries) / sizeof(uint64_t);
+    if (first_word < n_words)
+    {
+      memset(&tombstones[first_word], 0, (n_words - first_word) * sizeof(uint64_t));
+    }
+  }
+
+  len_t StorageLists::count_deleted_entries(const InvertedList *list) const
+  {
+    // the tombstones of unused entries are cleared, so whole words are counted
+    const uint64_t *tombstones = get_tombstones_by_list(list);
+    len_t n_deleted = 0;
+    for (size_t i = 0; i < get_tombstones_size(list->used_entries) / sizeof(uint64_t); i++)
+    {
+      n_deleted += __builtin_popcountll(tombstones[i]);
+    }
+    return n_deleted;
+  }
+
   size_t StorageLists::get_total_list_size(const InvertedList *list) const
   {
     len_t n_entries = list->allocated_entries;
-    return get_vectors_size(n_entries) + get_ids_size(n_entries);
+    return get_aligned_size(get_vectors_size(n_entries)) + get_aligned_size(get_ids_size(n_entries)) + get_aligned_size(get_inverse_norms_size(n_entries)) + get_aligned_size(get_tombstones_size(n_entries));
+  }
+
+  size_t StorageLists::get_aligned_size(const size_t size) const
+  {
+    return (size + list_alignment - 1) & ~(list_alignment - 1);
   }
 
   size_t StorageLists::get_free_space() const
   {
     size_t free_space = 0;
-    for (auto slot : free_slots)
+    for (const auto &slot : free_slots)
     {
-      free_space += slot.size;
+      free_space += slot.second;
     }
     return free_space;
   }
 
   size_t StorageLists::get_largest_continuous_free_space() const
   {
-    size_t max_free_space = 0;
-    for (auto slot : free_slots)
+    if (free_slots_by_size.empty())
     {
-      if (slot.size > max_free_space)
-      {
-        max_free_space = slot.size;
-      }
+      return 0;
     }
-    return max_free_space;
+    return free_slots_by_size.rbegin()->first;
   }
 
-  StorageLists::StorageLists(const len_t vector_dim, const std::string &filename) : filename(filename), vector_dim(vector_dim), vector_size(vector_dim * sizeof(vector_el_t)), total_size(0)
+  StorageLists::StorageLists(const len_t vector_dim, const std::string &filename, const metric_t metric) : filename(filename), vector_dim(vector_dim), vector_size(vector_dim * sizeof(vector_el_t)), code_size(0), code_layout(CODE_LAYOUT_PACKED), metric(metric), list_alignment(LIST_ALIGNMENT), open_mode(OPEN_MODE_READ_WRITE), total_size(0), base_ptr(nullptr), reserved_size(0), mapped_size(0), mapping_policy(get_default_mapping_policy()), fd(-1), log_generation(0), id_directory_token(0), n_nested_operations(0)
   {
     if (vector_dim == 0)
     {
@@ -94,397 +249,1758 @@ namespace ann_dkvs
     }
   }
 
-  StorageLists::~StorageLists()
+  StorageLists::StorageLists(const len_t vector_dim, const size_t code_size, const std::string &filename, const metric_t metric, const code_layout_t code_layout) : filename(filename), vector_dim(vector_dim), vector_size(code_size), code_size(code_size), code_layout(code_layout), metric(metric), list_alignment(LIST_ALIGNMENT), open_mode(OPEN_MODE_READ_WRITE), total_size(0), base_ptr(nullptr), reserved_size(0), mapped_size(0), mapping_policy(get_default_mapping_policy()), fd(-1), log_generation(0), id_directory_token(0), n_nested_operations(0)
   {
-    if (base_ptr != nullptr)
+    if (vector_dim == 0)
+    {
+      throw std::out_of_range("Vector dimension must be greater than 0");
+    }
+    if (code_size == 0)
+    {
+      throw std::out_of_range("Code size must be greater than 0");
+    }
+    if (code_layout == CODE_LAYOUT_FAST_SCAN && code_size > FAST_SCAN_MAX_CODE_SIZE)
     {
-      munmap(base_ptr, total_size);
+      throw std::out_of_range("Code size is too large for the fast-scan layout");
+    }
+    if (metric == METRIC_COSINE)
+    {
+      throw std::invalid_argument("Codes cannot be stored for the cosine metric, normalize the vectors and use the inner product metric instead");
     }
   }
 
-  len_t StorageLists::get_length() const
-  {
-    return id_to_list_map.size();
-  }
+  StorageLists::StorageLists(const std::string &filename, const open_mode_t open_mode)
+      : StorageLists(filename, open_mode, read_metadata(filename)) {}
 
-  size_t StorageLists::get_total_size() const
+  StorageLists::StorageLists(const std::string &filename, const open_mode_t open_mode, const Metadata &metadata)
+      : filename(filename),
+        vector_dim(metadata.header.vector_dim),
+        vector_size(metadata.header.code_size != 0 ? metadata.header.code_size : metadata.header.vector_dim * sizeof(vector_el_t)),
+        code_size(metadata.header.code_size),
+        code_layout((code_layout_t)metadata.header.code_layout),
+        metric((metric_t)metadata.header.metric),
+        list_alignment(metadata.header.list_alignment),
+        open_mode(open_mode),
+        total_size(metadata.header.total_size),
+        base_ptr(nullptr),
+        reserved_size(0),
+        mapped_size(0),
+        mapping_policy(get_default_mapping_policy()),
+        fd(-1),
+        log_generation(metadata.header.log_generation),
+        id_directory_token(metadata.header.id_directory_token),
+        n_nested_operations(0)
   {
-    return total_size;
+    for (const auto &entry : metadata.lists)
+    {
+      id_to_list_map[entry.first] = entry.second;
+    }
+    for (const Slot &slot : metadata.free_slots)
+    {
+      add_free_slot(slot.offset, slot.size);
+    }
+    check_metadata();
+    if (total_size != 0)
+    {
+      mmap_region();
+    }
+    try
+    {
+      recover_from_log();
+    }
+    catch (const std::runtime_error &)
+    {
+      unmap_region();
+      throw;
+    }
   }
 
-  size_t StorageLists::get_vector_size() const
+  StorageLists::~StorageLists()
   {
-    return vector_size;
+    if (open_mode == OPEN_MODE_READ_WRITE)
+    {
+      try
+      {
+        flush();
+      }
+      catch (const std::runtime_error &e)
+      {
+        std::cerr << "Could not flush " << filename << ": " << e.what() << std::endl;
+      }
+    }
+    release_published_lists();
+    unmap_region();
   }
 
-  len_t StorageLists::get_vector_dim() const
+  StorageLists::Metadata StorageLists::read_metadata(const std::string &filename)
   {
-    return vector_dim;
+    std::string metadata_filename = filename + METADATA_FILE_EXT;
+    std::ifstream file(metadata_filename, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+    {
+      throw std::runtime_error("Could not open file " + metadata_filename);
+    }
+    Metadata metadata;
+    if (!file.read((char *)&metadata.header, sizeof(MetadataHeader)) ||
+        metadata.header.magic != METADATA_MAGIC ||
+        metadata.header.version != METADATA_VERSION)
+    {
+      throw std::runtime_error("Invalid metadata file " + metadata_filename);
+    }
+    // sizes are checked before allocating so that a corrupt file cannot exhaust memory
+    file.seekg(0, std::ios::end);
+    size_t file_size = file.tellg();
+    size_t list_entry_size = sizeof(list_id_t) + sizeof(InvertedList);
+    if (metadata.header.n_lists > file_size / list_entry_size ||
+        metadata.header.n_free_slots > file_size / sizeof(Slot) ||
+        file_size != sizeof(MetadataHeader) + metadata.header.n_lists * list_entry_size + metadata.header.n_free_slots * sizeof(Slot))
+    {
+      throw std::runtime_error("Invalid metadata file " + metadata_filename);
+    }
+    file.seekg(sizeof(MetadataHeader));
+    metadata.lists.resize(metadata.header.n_lists);
+    for (auto &entry : metadata.lists)
+    {
+      file.read((char *)&entry.first, sizeof(list_id_t));
+      file.read((char *)&entry.second, sizeof(InvertedList));
+    }
+    metadata.free_slots.resize(metadata.header.n_free_slots);
+    file.read((char *)metadata.free_slots.data(), metadata.header.n_free_slots * sizeof(Slot));
+    if (!file)
+    {
+      throw std::runtime_error("Error reading metadata file " + metadata_filename);
+    }
+    return metadata;
   }
 
-  std::string StorageLists::get_filename() const
+  void StorageLists::check_metadata() const
   {
-    return filename;
+    if (vector_dim == 0 || (code_size == 0 && code_layout != CODE_LAYOUT_PACKED) ||
+        (code_layout == CODE_LAYOUT_FAST_SCAN && code_size > FAST_SCAN_MAX_CODE_SIZE) ||
+        (code_layout != CODE_LAYOUT_PACKED && code_layout != CODE_LAYOUT_FAST_SCAN) ||
+        (metric != METRIC_L2 && metric != METRIC_INNER_PRODUCT && metric != METRIC_COSINE) ||
+        list_alignment == 0 || (list_alignment & (list_alignment - 1)) != 0 || total_size % list_alignment != 0)
+    {
+      throw std::runtime_error("Invalid metadata file " + get_metadata_filename());
+    }
+    for (const auto &entry : id_to_list_map)
+    {
+      const InvertedList *list = &entry.second;
+      if (list->used_entries > list->allocated_entries ||
+          list->allocated_entries != get_n_entries_to_allocate(list->allocated_entries) ||
+          list->offset > total_size || get_total_list_size(list) > total_size - list->offset ||
+          list->offset % list_alignment != 0)
+      {
+        throw std::runtime_error("Invalid list in metadata file " + get_metadata_filename());
+      }
+    }
+    for (const auto &slot : free_slots)
+    {
+      if (slot.first > total_size || slot.second > total_size - slot.first)
+      {
+        throw std::runtime_error("Invalid slot in metadata file " + get_metadata_filename());
+      }
+    }
+    if (total_size != 0)
+    {
+      std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
+      if (!file.is_open() || (size_t)file.tellg() < total_size)
+      {
+        throw std::runtime_error("The file " + filename + " is smaller than its metadata");
+      }
+    }
   }
 
-  bool StorageLists::has_free_slot_at_end() const
+  void StorageLists::write_metadata() const
   {
-    if (free_slots.size() == 0)
-      return false;
-    Slot last_slot = free_slots.back();
-    return last_slot.offset + last_slot.size == total_size;
+    MetadataHeader header;
+    header.magic = METADATA_MAGIC;
+    header.version = METADATA_VERSION;
+    header.vector_dim = vector_dim;
+    header.code_size = code_size;
+    header.code_layout = code_layout;
+    header.metric = metric;
+    header.total_size = total_size;
+    header.n_lists = id_to_list_map.size();
+    // retired slots are free once the lists are opened again
+    header.n_free_slots = free_slots.size() + retired_slots.size();
+    header.log_generation = log_generation;
+    header.list_alignment = list_alignment;
+    header.id_directory_token = id_directory_token;
+
+    std::string metadata_filename = get_metadata_filename();
+    std::string tmp_filename = metadata_filename + ".tmp";
+    FILE *f = fopen(tmp_filename.c_str(), "w");
+    if (f == nullptr)
+    {
+      throw std::runtime_error("Could not create file " + tmp_filename);
+    }
+    bool is_written = fwrite(&header, sizeof(MetadataHeader), 1, f) == 1;
+    for (const auto &entry : id_to_list_map)
+    {
+      is_written = is_written &&
+                   fwrite(&entry.first, sizeof(list_id_t), 1, f) == 1 &&
+                   fwrite(&entry.second, sizeof(InvertedList), 1, f) == 1;
+    }
+    for (const offset_size_map_t *slots : {&free_slots, &retired_slots})
+    {
+      for (const auto &entry : *slots)
+      {
+        Slot slot = {entry.first, entry.second};
+        is_written = is_written && fwrite(&slot, sizeof(Slot), 1, f) == 1;
+      }
+    }
+    is_written = is_written && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    is_written = fclose(f) == 0 && is_written;
+    if (!is_written || rename(tmp_filename.c_str(), metadata_filename.c_str()) != 0)
+    {
+      throw std::runtime_error("Could not write file " + metadata_filename);
+    }
   }
 
-  void StorageLists::ensure_file_created_and_region_unmapped() const
+  void StorageLists::flush()
   {
-    if (total_size == 0)
+    check_writable();
+    if (base_ptr != nullptr && msync(base_ptr, total_size, MS_SYNC) != 0)
+    {
+      throw std::runtime_error("Could not write file " + filename);
+    }
+    for (const Slot &slot : deferred_free_slots)
     {
-      FILE *f = fopen(filename.c_str(), "r+");
-      if (f == nullptr)
+      if (concurrent_reads != nullptr)
       {
-        f = fopen(filename.c_str(), "w+");
-        if (f == nullptr)
-        {
-          throw std::runtime_error("Could not create file " + filename);
-        }
+        retire_slot(slot);
+      }
+      else
+      {
+        free_slot(&slot);
+      }
+    }
+    deferred_free_slots.clear();
+    // the id directory is matched with the metadata by a new random token,
+    // so that a directory modified afterwards or of other lists is rebuilt
+    if (id_directory != nullptr)
+    {
+      std::random_device random_device;
+      id_directory_token = 0;
+      while (id_directory_token == 0)
+      {
+        id_directory_token = (uint64_t)random_device() << 32 | random_device();
       }
-      fclose(f);
+      id_directory->sync(id_directory_token);
+    }
+    // a log of the previous generation is ignored once the metadata is written
+    log_generation++;
+    write_metadata();
+    if (wal != nullptr)
+    {
+      wal->reset(log_generation);
     }
     else
     {
-      munmap(base_ptr, total_size);
+      remove(get_log_filename().c_str());
     }
   }
 
-  void StorageLists::resize_file(const size_t size)
+  void StorageLists::enable_write_ahead_log()
   {
-    FILE *f = fopen(filename.c_str(), "r+");
-    if (f == nullptr)
+    check_writable();
+    if (wal != nullptr)
     {
-      throw std::runtime_error("Could not open file " + filename);
+      return;
     }
-    if (ftruncate(fileno(f), size) == -1)
+    flush();
+    wal.reset(new WriteAheadLog(get_log_filename()));
+    wal->reset(log_generation);
+  }
+
+  void StorageLists::sync_write_ahead_log()
+  {
+    if (wal == nullptr)
     {
-      throw std::runtime_error("Could not resize file " + filename);
+      throw std::logic_error("The write-ahead log is disabled");
     }
-    fclose(f);
+    wal->sync();
   }
 
-  void StorageLists::resize_region(const size_t new_size)
+  bool StorageLists::is_write_ahead_log_enabled() const
   {
-    if (new_size < total_size)
+    return wal != nullptr;
+  }
+
+  bool StorageLists::is_logging() const
+  {
+    return wal != nullptr && n_nested_operations == 1;
+  }
+
+  uint64_t StorageLists::log_operation(
+      const wal_record_type_t type,
+      const list_id_t list_id,
+      const len_t n_entries,
+      const size_t offset,
+      const void *data,
+      const vector_id_t *ids,
+      const bool is_continued) const
+  {
+    // the id directory file no longer matches lists modified without it
+    if (id_directory == nullptr)
     {
-      throw std::runtime_error("Cannot shrink region");
+      id_directory_token = 0;
     }
-    if (new_size == total_size)
+    if (!is_logging())
     {
-      return;
+      return 0;
     }
-    ensure_file_created_and_region_unmapped();
-    size_t size_to_grow = new_size - total_size;
-    if (has_free_slot_at_end())
+    WalRecordHeader record;
+    record.type = is_continued ? type | WAL_RECORD_CONTINUED : type;
+    record.list_id = list_id;
+    record.n_entries = n_entries;
+    record.offset = offset;
+    std::vector<std::pair<const void *, size_t>> payload;
+    if (data != nullptr)
+    {
+      payload.push_back({data, get_vectors_size(n_entries)});
+    }
+    if (ids != nullptr)
+    {
+      payload.push_back({ids, get_ids_size(n_entries)});
+    }
+    return wal->append(record, payload);
+  }
+
+  void StorageLists::checkpoint_if_necessary()
+  {
+    if (is_logging() && wal->get_size() >= WAL_CHECKPOINT_SIZE)
+    {
+      flush();
+    }
+  }
+
+  void StorageLists::release_slot(const Slot *slot)
+  {
+    if (wal != nullptr)
+    {
+      deferred_free_slots.push_back(*slot);
+    }
+    else if (concurrent_reads != nullptr)
     {
-      free_slots.back().size += size_to_grow;
+      unpublished_free_slots.push_back(*slot);
     }
     else
     {
-      Slot new_slot;
-      new_slot.offset = total_size;
-      new_slot.size = size_to_grow;
-      free_slots.push_back(new_slot);
+      free_slot(slot);
     }
-    total_size = new_size;
-    resize_file(total_size);
-    mmap_region();
   }
 
-  bool StorageLists::does_list_need_reallocation(const InvertedList *list, const len_t n_entries) const
+  void StorageLists::retire_slot(const Slot &slot)
   {
-    return n_entries <= list->allocated_entries / 2 || n_entries > list->allocated_entries;
+    retired_slots[slot.offset] = slot.size;
+    concurrent_reads->epoch_manager.retire([this, slot]
+                                           {
+                                             retired_slots.erase(slot.offset);
+                                             free_slot(&slot); });
   }
 
-  void StorageLists::copy_shared_data(const InvertedList *dst, const InvertedList *src) const
+  void StorageLists::enable_concurrent_reads()
   {
-    len_t n_entries_to_copy = std::min(dst->used_entries, src->used_entries);
-    if (n_entries_to_copy == 0)
+    if (concurrent_reads != nullptr)
     {
       return;
     }
-    memcpy(get_vectors_by_list(dst), get_vectors_by_list(src), get_vectors_size(n_entries_to_copy));
-    memcpy(get_ids_by_list(dst), get_ids_by_list(src), get_ids_size(n_entries_to_copy));
+    concurrent_reads.reset(new ConcurrentReadState());
+    concurrent_reads->published_lists = create_published_list_table(id_to_list_map.size());
+    for (const auto &entry : id_to_list_map)
+    {
+      publish_list(entry.first, new ListVersion(make_list_version(&entry.second)));
+    }
   }
 
-  StorageLists::Slot StorageLists::list_to_slot(const InvertedList *list)
+  bool StorageLists::is_concurrent_reads_enabled() const
   {
-    Slot slot;
-    slot.offset = list->offset;
-    slot.size = get_total_list_size(list);
-    return slot;
+    return concurrent_reads != nullptr;
+  }
+
+  void StorageLists::enable_id_directory()
+  {
+    check_writable();
+    if (id_directory != nullptr)
+    {
+      return;
+    }
+    id_directory.reset(new IdDirectory(get_id_directory_filename()));
+    if (id_directory_token == 0 || id_directory->get_token() != id_directory_token)
+    {
+      rebuild_id_directory();
+    }
+  }
+
+  bool StorageLists::is_id_directory_enabled() const
+  {
+    return id_directory != nullptr;
+  }
+
+  void StorageLists::check_id_directory_enabled() const
+  {
+    if (id_directory == nullptr)
+    {
+      throw std::logic_error("The id directory is disabled");
+    }
+  }
+
+  void StorageLists::rebuild_id_directory()
+  {
+    len_t n_entries = 0;
+    for (const auto &entry : id_to_list_map)
+    {
+      n_entries += entry.second.used_entries - count_deleted_entries(&entry.second);
+    }
+    id_directory->clear(n_entries);
+    for (const auto &entry : id_to_list_map)
+    {
+      const InvertedList *list = &entry.second;
+      const vector_id_t *ids = get_ids_by_list(list);
+      const uint64_t *tombstones = get_tombstones_by_list(list);
+      for (len_t i = 0; i < list->used_entries; i++)
+      {
+        if ((tombstones[i / 64] >> (i % 64) & 1) == 0)
+        {
+          id_directory->set(ids[i], {entry.first, i});
+        }
+      }
+    }
+  }
+
+  void StorageLists::unindex_entries(const list_id_t list_id, const len_t start, const len_t end) const
+  {
+    if (id_directory == nullptr)
+    {
+      return;
+    }
+    list_id_list_map_t::const_iterator list_it = id_to_list_map.find(list_id);
+    if (list_it == id_to_list_map.end() || end > list_it->second.used_entries)
+    {
+      return;
+    }
+    // the ids of unused entries are never located, so their stale ids are not removed
+    const vector_id_t *ids = get_ids_by_list(&list_it->second);
+    for (len_t i = start; i < end; i++)
+    {
+      id_directory->remove(ids[i], {list_id, i});
+    }
+  }
+
+  void StorageLists::index_entries(const list_id_t list_id, const vector_id_t *ids, const len_t n_entries, const size_t offset) const
+  {
+    if (id_directory == nullptr)
+    {
+      return;
+    }
+    for (len_t i = 0; i < n_entries; i++)
+    {
+      id_directory->set(ids[i], {list_id, offset + i});
+    }
+  }
+
+  EpochManager::Guard StorageLists::pin() const
+  {
+    if (concurrent_reads == nullptr)
+    {
+      return EpochManager::Guard();
+    }
+    return concurrent_reads->epoch_manager.pin();
+  }
+
+  StorageLists::PublishedListTable *StorageLists::create_published_list_table(const len_t n_lists)
+  {
+    PublishedListTable *table = new PublishedListTable;
+    table->capacity = 16;
+    while (table->capacity < 2 * n_lists)
+    {
+      table->capacity *= 2;
+    }
+    table->n_used = 0;
+    table->entries.reset(new PublishedListEntry[table->capacity]);
+    for (len_t i = 0; i < table->capacity; i++)
+    {
+      table->entries[i].is_used = false;
+      table->entries[i].version = nullptr;
+    }
+    return table;
+  }
+
+  len_t StorageLists::find_published_list(const PublishedListTable *table, const list_id_t list_id)
+  {
+    // list ids are often consecutive, so they are scattered by a multiplicative hash
+    len_t mask = table->capacity - 1;
+    len_t index = ((uint64_t)list_id * 0x9E3779B97F4A7C15UL) >> 32 & mask;
+    while (table->entries[index].is_used.load() && table->entries[index].list_id != list_id)
+    {
+      index = (index + 1) & mask;
+    }
+    return index;
+  }
+
+  const StorageLists::ListVersion *StorageLists::publish_list(const list_id_t list_id, const ListVersion *version)
+  {
+    PublishedListTable *table = concurrent_reads->published_lists.load();
+    len_t index = find_published_list(table, list_id);
+    if (table->entries[index].is_used.load())
+    {
+      return table->entries[index].version.exchange(version);
+    }
+    if (2 * (table->n_used + 1) > table->capacity)
+    {
+      PublishedListTable *larger_table = create_published_list_table(table->n_used + 1);
+      for (len_t i = 0; i < table->capacity; i++)
+      {
+        const PublishedListEntry &entry = table->entries[i];
+        if (entry.is_used.load())
+        {
+          PublishedListEntry &larger_entry = larger_table->entries[find_published_list(larger_table, entry.list_id)];
+          larger_entry.list_id = entry.list_id;
+          larger_entry.version = entry.version.load();
+          larger_entry.is_used = true;
+          larger_table->n_used++;
+        }
+      }
+      concurrent_reads->published_lists = larger_table;
+      concurrent_reads->epoch_manager.retire([table]
+                                             { delete table; });
+      table = larger_table;
+      index = find_published_list(table, list_id);
+    }
+    PublishedListEntry &entry = table->entries[index];
+    entry.list_id = list_id;
+    entry.version = version;
+    entry.is_used = true;
+    table->n_used++;
+    return nullptr;
+  }
+
+  void StorageLists::mark_list_modified(const list_id_t list_id)
+  {
+    if (concurrent_reads != nullptr)
+    {
+      modified_lists.push_back(list_id);
+    }
+  }
+
+  void StorageLists::publish_modified_lists()
+  {
+    if (concurrent_reads == nullptr || n_nested_operations != 1)
+    {
+      return;
+    }
+    std::sort(modified_lists.begin(), modified_lists.end());
+    modified_lists.erase(std::unique(modified_lists.begin(), modified_lists.end()), modified_lists.end());
+    for (list_id_t list_id : modified_lists)
+    {
+      list_id_list_map_t::const_iterator list_it = id_to_list_map.find(list_id);
+      const ListVersion *version = list_it != id_to_list_map.end() ? new ListVersion(make_list_version(&list_it->second)) : nullptr;
+      const ListVersion *old_version = publish_list(list_id, version);
+      if (old_version != nullptr)
+      {
+        concurrent_reads->epoch_manager.retire([old_version]
+                                               { delete old_version; });
+      }
+    }
+    modified_lists.clear();
+    for (const Slot &slot : unpublished_free_slots)
+    {
+      retire_slot(slot);
+    }
+    unpublished_free_slots.clear();
+    concurrent_reads->epoch_manager.advance();
+    concurrent_reads->epoch_manager.reclaim();
+  }
+
+  void StorageLists::release_published_lists()
+  {
+    if (concurrent_reads == nullptr)
+    {
+      return;
+    }
+    PublishedListTable *table = concurrent_reads->published_lists.exchange(nullptr);
+    for (len_t i = 0; i < table->capacity; i++)
+    {
+      delete table->entries[i].version.load();
+    }
+    delete table;
+    // the retired slots are freed while the free slots still exist
+    concurrent_reads.reset();
+    for (const Slot &slot : unpublished_free_slots)
+    {
+      free_slot(&slot);
+    }
+    unpublished_free_slots.clear();
+    modified_lists.clear();
+  }
+
+  void StorageLists::recover_from_log()
+  {
+    std::string log_filename = get_log_filename();
+    std::ifstream log_file(log_filename, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!log_file.is_open())
+    {
+      return;
+    }
+    if (open_mode != OPEN_MODE_READ_WRITE)
+    {
+      // the log is only read, since read-only lists cannot be checkpointed
+      WalFileHeader header;
+      size_t log_size = log_file.tellg();
+      log_file.seekg(0);
+      if (log_file.read((char *)&header, sizeof(WalFileHeader)) &&
+          header.generation == log_generation &&
+          log_size > sizeof(WalFileHeader))
+      {
+        throw std::runtime_error("The lists must be opened read-write to replay the log file " + log_filename);
+      }
+      return;
+    }
+    log_file.close();
+    wal.reset(new WriteAheadLog(log_filename));
+    if (wal->get_generation() == log_generation)
+    {
+      NestedOperation replay(*this);
+      try
+      {
+        wal->replay([this](const WalRecordHeader &record, const uint8_t *payload)
+                    { apply_log_record(record, payload); });
+      }
+      catch (const std::logic_error &e)
+      {
+        throw std::runtime_error("Could not replay log file " + log_filename + ": " + e.what());
+      }
+    }
+    flush();
+  }
+
+  void StorageLists::apply_log_record(const WalRecordHeader &record, const uint8_t *payload)
+  {
+    bool has_entries = record.type == WAL_RECORD_INSERT || record.type == WAL_RECORD_UPDATE;
+    bool has_ids = has_entries || record.type == WAL_RECORD_DELETE;
+    size_t vectors_size = has_entries ? get_vectors_size(record.n_entries) : 0;
+    if (record.payload_size != vectors_size + (has_ids ? get_ids_size(record.n_entries) : 0))
+    {
+      throw std::runtime_error("Invalid record in log file " + get_log_filename());
+    }
+    const vector_id_t *ids = (const vector_id_t *)(payload + vectors_size);
+    switch (record.type)
+    {
+    case WAL_RECORD_CREATE_LIST:
+      create_list(record.list_id, record.n_entries);
+      break;
+    case WAL_RECORD_RESIZE_LIST:
+      resize_list(record.list_id, record.n_entries);
+      break;
+    case WAL_RECORD_INSERT:
+      if (code_size != 0)
+      {
+        insert_codes(record.list_id, payload, ids, record.n_entries);
+      }
+      else
+      {
+        insert_entries(record.list_id, (const vector_el_t *)payload, ids, record.n_entries);
+      }
+      break;
+    case WAL_RECORD_UPDATE:
+      if (code_size != 0)
+      {
+        update_codes(record.list_id, payload, ids, record.n_entries, record.offset);
+      }
+      else
+      {
+        update_entries(record.list_id, (const vector_el_t *)payload, ids, record.n_entries, record.offset);
+      }
+      break;
+    case WAL_RECORD_DELETE:
+      delete_entries(record.list_id, ids, record.n_entries);
+      break;
+    case WAL_RECORD_COMPACT_LIST:
+      compact_list(record.list_id);
+      break;
+    default:
+      throw std::runtime_error("Invalid record in log file " + get_log_filename());
+    }
+  }
+
+  void StorageLists::check_writable() const
+  {
+    if (open_mode != OPEN_MODE_READ_WRITE)
+    {
+      throw std::logic_error("The lists are opened read-only");
+    }
+  }
+
+  len_t StorageLists::get_length() const
+  {
+    return id_to_list_map.size();
+  }
+
+  size_t StorageLists::get_total_size() const
+  {
+    return total_size;
+  }
+
+  size_t StorageLists::get_vector_size() const
+  {
+    return vector_size;
+  }
+
+  len_t StorageLists::get_vector_dim() const
+  {
+    return vector_dim;
+  }
+
+  size_t StorageLists::get_code_size() const
+  {
+    return code_size;
+  }
+
+  code_layout_t StorageLists::get_code_layout() const
+  {
+    return code_layout;
+  }
+
+  std::string StorageLists::get_filename() const
+  {
+    return filename;
+  }
+
+  metric_t StorageLists::get_metric() const
+  {
+    return metric;
+  }
+
+  std::string StorageLists::get_metadata_filename() const
+  {
+    return filename + METADATA_FILE_EXT;
+  }
+
+  std::string StorageLists::get_log_filename() const
+  {
+    return filename + LOG_FILE_EXT;
+  }
+
+  std::string StorageLists::get_id_directory_filename() const
+  {
+    return filename + ID_DIRECTORY_FILE_EXT;
+  }
+
+  open_mode_t StorageLists::get_open_mode() const
+  {
+    return open_mode;
+  }
+
+  bool StorageLists::has_free_slot_at_end() const
+  {
+    if (free_slots.empty())
+      return false;
+    auto last_slot = free_slots.rbegin();
+    return last_slot->first + last_slot->second == total_size;
+  }
+
+  void StorageLists::open_file()
+  {
+    if (fd != -1)
+    {
+      return;
+    }
+    fd = open(filename.c_str(), open_mode == OPEN_MODE_READ_WRITE ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd == -1)
+    {
+      throw std::runtime_error("Could not open file " + filename);
+    }
+  }
+
+  void StorageLists::resize_file(const size_t size)
+  {
+    if (ftruncate(fd, size) == -1)
+    {
+      throw std::runtime_error("Could not resize file " + filename);
+    }
+  }
+
+  void StorageLists::resize_region(const size_t new_size)
+  {
+    if (new_size < total_size)
+    {
+      throw std::runtime_error("Cannot shrink region");
+    }
+    if (new_size == total_size)
+    {
+      return;
+    }
+    open_file();
+    size_t size_to_grow = new_size - total_size;
+    if (has_free_slot_at_end())
+    {
+      slot_it_t last_slot_it = prev(free_slots.end());
+      size_t offset = last_slot_it->first;
+      size_t size = last_slot_it->second + size_to_grow;
+      remove_free_slot(last_slot_it);
+      add_free_slot(offset, size);
+    }
+    else
+    {
+      add_free_slot(total_size, size_to_grow);
+    }
+    total_size = new_size;
+    resize_file(total_size);
+    mmap_region();
+  }
+
+  len_t StorageLists::get_n_entries_to_allocate(const len_t n_entries) const
+  {
+    len_t min_list_length = (len_t)(MIN_N_ENTRIES_PER_LIST);
+    if (code_layout == CODE_LAYOUT_FAST_SCAN)
+    {
+      min_list_length = std::max(min_list_length, (len_t)FAST_SCAN_BLOCK_SIZE);
+    }
+    return round_up_to_next_power_of_two(std::max(n_entries, min_list_length));
+  }
+
+  bool StorageLists::does_list_need_reallocation(const InvertedList *list, const len_t n_entries) const
+  {
+    return get_n_entries_to_allocate(n_entries) != list->allocated_entries;
+  }
+
+  void StorageLists::copy_shared_data(const InvertedList *dst, const InvertedList *src) const
+  {
+    len_t n_entries_to_copy = std::min(dst->used_entries, src->used_entries);
+    if (n_entries_to_copy == 0)
+    {
+      return;
+    }
+    // fast-scan lists consist of whole blocks, which are copied as is
+    size_t vectors_size = code_layout == CODE_LAYOUT_FAST_SCAN ? get_fast_scan_size(n_entries_to_copy, code_size) : get_vectors_size(n_entries_to_copy);
+    size_t ids_size = get_ids_size(n_entries_to_copy);
+    size_t inverse_norms_size = get_inverse_norms_size(n_entries_to_copy);
+    size_t tombstones_size = get_tombstones_size(n_entries_to_copy);
+    bool do_lists_overlap = dst->offset < src->offset + get_total_list_size(src) && src->offset < dst->offset + get_total_list_size(dst);
+    if (!do_lists_overlap)
+    {
+      memcpy(get_vectors_by_list(dst), get_vectors_by_list(src), vectors_size);
+      memcpy(get_ids_by_list(dst), get_ids_by_list(src), ids_size);
+      memcpy(get_inverse_norms_by_list(dst), get_inverse_norms_by_list(src), inverse_norms_size);
+      memcpy(get_tombstones_by_list(dst), get_tombstones_by_list(src), tombstones_size);
+      return;
+    }
+    // the blocks of the destination may cover other blocks of the source,
+    // so the smaller blocks are saved before the vectors are moved
+    std::vector<uint8_t> ids(ids_size);
+    std::vector<uint8_t> inverse_norms(inverse_norms_size);
+    std::vector<uint8_t> tombstones(tombstones_size);
+    memcpy(ids.data(), get_ids_by_list(src), ids_size);
+    memcpy(inverse_norms.data(), get_inverse_norms_by_list(src), inverse_norms_size);
+    memcpy(tombstones.data(), get_tombstones_by_list(src), tombstones_size);
+    memmove(get_vectors_by_list(dst), get_vectors_by_list(src), vectors_size);
+    memcpy(get_ids_by_list(dst), ids.data(), ids_size);
+    memcpy(get_inverse_norms_by_list(dst), inverse_norms.data(), inverse_norms_size);
+    memcpy(get_tombstones_by_list(dst), tombstones.data(), tombstones_size);
+  }
+
+  void StorageLists::move_shared_data_in_place(const InvertedList *dst, const InvertedList *src) const
+  {
+    len_t n_entries_to_move = std::min(dst->used_entries, src->used_entries);
+    size_t ids_size = get_ids_size(n_entries_to_move);
+    size_t inverse_norms_size = get_inverse_norms_size(n_entries_to_move);
+    size_t tombstones_size = get_tombstones_size(n_entries_to_move);
+    // move the rightmost region first so that it is not overwritten
+    if (dst->allocated_entries > src->allocated_entries)
+    {
+      memmove(get_tombstones_by_list(dst), get_tombstones_by_list(src), tombstones_size);
+      memmove(get_inverse_norms_by_list(dst), get_inverse_norms_by_list(src), inverse_norms_size);
+      memmove(get_ids_by_list(dst), get_ids_by_list(src), ids_size);
+    }
+    else
+    {
+      memmove(get_ids_by_list(dst), get_ids_by_list(src), ids_size);
+      memmove(get_inverse_norms_by_list(dst), get_inverse_norms_by_list(src), inverse_norms_size);
+      memmove(get_tombstones_by_list(dst), get_tombstones_by_list(src), tombstones_size);
+    }
+  }
+
+  StorageLists::Slot StorageLists::list_to_slot(const InvertedList *list)
+  {
+    Slot slot;
+    slot.offset = list->offset;
+    slot.size = get_total_list_size(list);
+    return slot;
+  }
+
+  void StorageLists::resize_list(const list_id_t list_id, const len_t n_entries)
+  {
+    NestedOperation operation(*this);
+    check_writable();
+    list_id_list_map_t::iterator list_it = id_to_list_map.find(list_id);
+    if (list_it == id_to_list_map.end())
+    {
+      throw std::invalid_argument("List not found");
+    }
+    if (n_entries == 0)
+    {
+      throw std::out_of_range("Cannot resize list to 0 entries");
+    }
+    InvertedList *list = &list_it->second;
+    if (n_entries < list->used_entries)
+    {
+      unindex_entries(list_id, n_entries, list->used_entries);
+    }
+    if (!does_list_need_reallocation(list, n_entries))
+    {
+      if (n_entries < list->used_entries)
+      {
+        clear_tombstones(list, n_entries);
+      }
+      list->used_entries = n_entries;
+    }
+    else
+    {
+      Slot slot = list_to_slot(list);
+      release_slot(&slot);
+      InvertedList new_list;
+      new_list = alloc_list(n_entries);
+      if (new_list.offset == list->offset)
+      {
+        move_shared_data_in_place(&new_list, list);
+      }
+      else
+      {
+        copy_shared_data(&new_list, list);
+      }
+      // the tombstones are copied in whole words, which may cover unused entries
+      clear_tombstones(&new_list, std::min(new_list.used_entries, list->used_entries));
+      id_to_list_map[list_id] = new_list;
+    }
+    mark_list_modified(list_id);
+    log_operation(WAL_RECORD_RESIZE_LIST, list_id, n_entries, 0, nullptr, nullptr);
+    checkpoint_if_necessary();
+    publish_modified_lists();
+  }
+
+  StorageLists::InvertedList StorageLists::alloc_list(const len_t n_entries)
+  {
+    InvertedList list;
+    list.used_entries = n_entries;
+    list.allocated_entries = get_n_entries_to_allocate(n_entries);
+    size_t list_size = get_total_list_size(&list);
+    list.offset = alloc_slot(list_size);
+    return list;
+  }
+
+  StorageLists::slot_it_t StorageLists::find_large_enough_slot(const size_t size)
+  {
+    auto by_size_it = free_slots_by_size.lower_bound({size, 0});
+    if (by_size_it == free_slots_by_size.end())
+    {
+      return free_slots.end();
+    }
+    return free_slots.find(by_size_it->second);
+  }
+
+  void StorageLists::add_free_slot(const size_t offset, const size_t size)
+  {
+    free_slots[offset] = size;
+    free_slots_by_size.insert({size, offset});
+  }
+
+  void StorageLists::remove_free_slot(const slot_it_t slot_it)
+  {
+    free_slots_by_size.erase({slot_it->second, slot_it->first});
+    free_slots.erase(slot_it);
+  }
+
+  void StorageLists::grow_region_until_enough_space(size_t size)
+  {
+    // the region is a multiple of the list alignment, so that every slot is aligned
+    size_t new_size = total_size == 0 ? get_aligned_size(MIN_TOTAL_SIZE_BYTES) : total_size;
+    if (has_free_slot_at_end())
+    {
+      size_t free_size_at_end = free_slots.rbegin()->second;
+      if (free_size_at_end >= size)
+      {
+        return;
+      }
+      size -= free_size_at_end;
+    }
+    while (new_size - total_size < size)
+    {
+      new_size *= 2;
+    }
+    resize_region(new_size);
+  }
+
+  size_t StorageLists::alloc_slot(const size_t size)
+  {
+    auto slot_it = find_large_enough_slot(size);
+    if (slot_it == free_slots.end())
+    {
+      grow_region_until_enough_space(size);
+      slot_it = find_large_enough_slot(size);
+    }
+    size_t offset = slot_it->first;
+    size_t size_left = slot_it->second - size;
+    remove_free_slot(slot_it);
+    if (size_left > 0)
+    {
+      add_free_slot(offset + size, size_left);
+    }
+    return offset;
+  }
+
+  void StorageLists::free_slot(const Slot *slot)
+  {
+    size_t offset = slot->offset;
+    size_t size = slot->size;
+    slot_it_t slot_right_it = free_slots.upper_bound(offset);
+    if (slot_right_it != free_slots.end() && offset + size == slot_right_it->first)
+    {
+      size += slot_right_it->second;
+      remove_free_slot(slot_right_it++);
+    }
+    if (slot_right_it != free_slots.begin())
+    {
+      slot_it_t slot_left_it = prev(slot_right_it);
+      if (slot_left_it->first + slot_left_it->second == offset)
+      {
+        offset = slot_left_it->first;
+        size += slot_left_it->second;
+        remove_free_slot(slot_left_it);
+      }
+    }
+    add_free_slot(offset, size);
+  }
+
+  StorageLists::ListVersion StorageLists::make_list_version(const InvertedList *list) const
+  {
+    ListVersion version;
+    version.data.codes = get_codes_by_list(list);
+    version.data.ids = get_ids_by_list(list);
+    version.data.inverse_norms = metric == METRIC_COSINE ? get_inverse_norms_by_list(list) : nullptr;
+    version.data.tombstones = get_tombstones_by_list(list);
+    version.data.length = list->used_entries;
+    version.layout.offset = list->offset;
+    version.layout.size = get_total_list_size(list);
+    version.layout.ids_offset = get_aligned_size(get_vectors_size(list->allocated_entries));
+    version.layout.inverse_norms_offset = version.layout.ids_offset + get_aligned_size(get_ids_size(list->allocated_entries));
+    version.layout.tombstones_offset = version.layout.inverse_norms_offset + get_aligned_size(get_inverse_norms_size(list->allocated_entries));
+    version.layout.length = list->used_entries;
+    return version;
+  }
+
+  StorageLists::ListVersion StorageLists::get_list_version(const list_id_t list_id) const
+  {
+    if (concurrent_reads == nullptr)
+    {
+      list_id_list_map_t::const_iterator list_it = id_to_list_map.find(list_id);
+      if (list_it == id_to_list_map.end())
+      {
+        throw std::invalid_argument("List not found");
+      }
+      return make_list_version(&list_it->second);
+    }
+    // the version is copied while it is pinned, since the writer may retire it
+    EpochManager::Guard guard = concurrent_reads->epoch_manager.pin();
+    const PublishedListTable *table = concurrent_reads->published_lists.load();
+    const PublishedListEntry &entry = table->entries[find_published_list(table, list_id)];
+    const ListVersion *version = entry.is_used.load() ? entry.version.load() : nullptr;
+    if (version == nullptr)
+    {
+      throw std::invalid_argument("List not found");
+    }
+    return *version;
+  }
+
+  const vector_el_t *StorageLists::get_vectors(const list_id_t list_id) const
+  {
+    if (code_size != 0)
+    {
+      throw std::logic_error("The lists store codes instead of vectors");
+    }
+    return (const vector_el_t *)get_list_version(list_id).data.codes;
+  }
+
+  const uint8_t *StorageLists::get_codes(const list_id_t list_id) const
+  {
+    if (code_size == 0)
+    {
+      throw std::logic_error("The lists store vectors instead of codes");
+    }
+    return get_list_version(list_id).data.codes;
+  }
+
+  const vector_id_t *StorageLists::get_ids(const list_id_t list_id) const
+  {
+    return get_list_version(list_id).data.ids;
+  }
+
+  const distance_t *StorageLists::get_inverse_norms(const list_id_t list_id) const
+  {
+    if (metric != METRIC_COSINE)
+    {
+      throw std::logic_error("Inverse norms are only stored for the cosine metric");
+    }
+    return get_list_version(list_id).data.inverse_norms;
+  }
+
+  ListData StorageLists::get_list_data(const list_id_t list_id) const
+  {
+    return get_list_version(list_id).data;
+  }
+
+  ListLayout StorageLists::get_list_layout(const list_id_t list_id) const
+  {
+    return get_list_version(list_id).layout;
+  }
+
+  void StorageLists::prefetch_list(const list_id_t list_id) const
+  {
+    ListVersion version = get_list_version(list_id);
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)version.data.codes / page_size * page_size;
+    uintptr_t end = (uintptr_t)version.data.codes + version.layout.size;
+    // only a hint, so failures are ignored, e.g. if the list has been moved since
+    madvise((void *)start, end - start, MADV_WILLNEED);
+  }
+
+  void StorageLists::set_mapping_policy(const MappingPolicy &policy)
+  {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    if (policy.numa_chunk_size % page_size != 0)
+    {
+      throw std::invalid_argument("The NUMA chunk size must be a multiple of the page size");
+    }
+    mapping_policy = policy;
+    if (mapping_policy.n_numa_nodes == 0)
+    {
+      mapping_policy.n_numa_nodes = get_n_numa_nodes();
+    }
+    if (mapping_policy.numa_chunk_size == 0)
+    {
+      mapping_policy.numa_chunk_size = NUMA_CHUNK_SIZE;
+    }
+    advise_huge_pages(0, mapped_size);
+  }
+
+  MappingPolicy StorageLists::get_mapping_policy() const
+  {
+    return mapping_policy;
+  }
+
+  int StorageLists::get_list_numa_node(const list_id_t list_id) const
+  {
+    ListLayout layout = get_list_version(list_id).layout;
+    size_t chunk = (layout.offset + layout.size / 2) / mapping_policy.numa_chunk_size;
+    return (int)(chunk % mapping_policy.n_numa_nodes);
+  }
+
+  bool StorageLists::place_lists_on_numa_nodes() const
+  {
+    if (mapping_policy.n_numa_nodes <= 1)
+    {
+      return true;
+    }
+    bool is_placed = true;
+    size_t chunk_size = mapping_policy.numa_chunk_size;
+    for (size_t offset = 0; offset < mapped_size; offset += chunk_size)
+    {
+      int node = (int)(offset / chunk_size % mapping_policy.n_numa_nodes);
+      is_placed &= move_pages_to_numa_node(base_ptr + offset, std::min(chunk_size, mapped_size - offset), node);
+    }
+    return is_placed;
+  }
+
+  len_t StorageLists::get_list_length(const list_id_t list_id) const
+  {
+    return get_list_version(list_id).data.length;
+  }
+
+  size_t StorageLists::round_up_to_next_power_of_two(const size_t n) const
+  {
+    size_t power = n;
+    power--;
+    power |= power >> 1;
+    power |= power >> 2;
+    power |= power >> 4;
+    power |= power >> 8;
+    power |= power >> 16;
+    power |= power >> 32;
+    power++;
+    return power;
+  }
+
+  void StorageLists::create_list(
+      const list_id_t list_id,
+      const len_t n_entries)
+  {
+    NestedOperation operation(*this);
+    check_writable();
+    if (id_to_list_map.find(list_id) != id_to_list_map.end())
+    {
+      throw std::invalid_argument("List already exists");
+    }
+    if (n_entries == 0)
+    {
+      throw std::out_of_range("List must have at least one entry");
+    }
+    InvertedList list = alloc_list(n_entries);
+    clear_tombstones(&list, 0);
+    id_to_list_map[list_id] = list;
+    mark_list_modified(list_id);
+    log_operation(WAL_RECORD_CREATE_LIST, list_id, n_entries, 0, nullptr, nullptr);
+    checkpoint_if_necessary();
+    publish_modified_lists();
+  }
+
+  const StorageLists::InvertedList *StorageLists::find_writable_list(
+      const list_id_t list_id,
+      const len_t n_entries,
+      const size_t offset) const
+  {
+    check_writable();
+    list_id_list_map_t::const_iterator list_it = id_to_list_map.find(list_id);
+    if (list_it == id_to_list_map.end())
+    {
+      throw std::invalid_argument("List not found");
+    }
+    const InvertedList *list = &list_it->second;
+    if (offset + n_entries > list->used_entries)
+    {
+      throw std::out_of_range("updating more entries than list has");
+    }
+    return list;
+  }
+
+  void StorageLists::log_update_ahead(
+      const list_id_t list_id,
+      const void *data,
+      const vector_id_t *ids,
+      const len_t n_entries,
+      const size_t offset) const
+  {
+    // the update is checked first, since a logged record is always replayed
+    find_writable_list(list_id, n_entries, offset);
+    uint64_t lsn = log_operation(WAL_RECORD_UPDATE, list_id, n_entries, offset, data, ids);
+    if (lsn != 0)
+    {
+      wal->sync(lsn);
+    }
+  }
+
+  const StorageLists::InvertedList *StorageLists::copy_entries(
+      const list_id_t list_id,
+      const void *data,
+      const vector_id_t *ids,
+      const len_t n_entries,
+      const size_t offset) const
+  {
+    const InvertedList *list = find_writable_list(list_id, n_entries, offset);
+    uint8_t *list_data = get_codes_by_list(list);
+    vector_id_t *list_ids = get_ids_by_list(list);
+    if (code_layout == CODE_LAYOUT_FAST_SCAN)
+    {
+      for (len_t i = 0; i < n_entries; i++)
+      {
+        set_fast_scan_code(list_data, code_size, offset + i, (const uint8_t *)data + i * code_size);
+      }
+    }
+    else
+    {
+      memcpy(list_data + offset * vector_size, data, get_vectors_size(n_entries));
+    }
+    memcpy(list_ids + offset, ids, get_ids_size(n_entries));
+    // entries which are written again are no longer deleted; tombstones are
+    // only written if set, since bulk_write_entries() fills lists in parallel
+    uint64_t *tombstones = get_tombstones_by_list(list);
+    for (size_t i = offset; i < offset + n_entries; i++)
+    {
+      uint64_t bit = 1UL << (i % 64);
+      if ((tombstones[i / 64] & bit) != 0)
+      {
+        tombstones[i / 64] &= ~bit;
+      }
+    }
+    return list;
+  }
+
+  void StorageLists::update_codes(
+      const list_id_t list_id,
+      const uint8_t *codes,
+      const vector_id_t *ids,
+      const len_t n_entries,
+      const size_t offset) const
+  {
+    NestedOperation operation(*this);
+    if (code_size == 0)
+    {
+      throw std::logic_error("The lists store vectors instead of codes");
+    }
+    log_update_ahead(list_id, codes, ids, n_entries, offset);
+    unindex_entries(list_id, offset, offset + n_entries);
+    copy_entries(list_id, codes, ids, n_entries, offset);
+    index_entries(list_id, ids, n_entries, offset);
+  }
+
+  void StorageLists::update_entries(
+      const list_id_t list_id,
+      const vector_el_t *vectors,
+      const vector_id_t *ids,
+      const len_t n_entries,
+      const size_t offset) const
+  {
+    NestedOperation operation(*this);
+    if (code_size != 0)
+    {
+      throw std::logic_error("The lists store codes instead of vectors");
+    }
+    log_update_ahead(list_id, vectors, ids, n_entries, offset);
+    unindex_entries(list_id, offset, offset + n_entries);
+    const InvertedList *list = copy_entries(list_id, vectors, ids, n_entries, offset);
+    set_inverse_norms(list, vectors, n_entries, offset);
+    index_entries(list_id, ids, n_entries, offset);
+  }
+
+  void StorageLists::set_inverse_norms(
+      const InvertedList *list,
+      const vector_el_t *vectors,
+      const len_t n_entries,
+      const size_t offset) const
+  {
+    if (metric != METRIC_COSINE)
+    {
+      return;
+    }
+    distance_t *list_inverse_norms = get_inverse_norms_by_list(list);
+    for (len_t i = 0; i < n_entries; i++)
+    {
+      list_inverse_norms[offset + i] = get_inverse_norm(vectors + i * vector_dim, vector_dim);
+    }
+  }
+
+  len_t StorageLists::append_entries(const list_id_t list_id, const len_t n_entries)
+  {
+    list_id_list_map_t::iterator list_it = id_to_list_map.find(list_id);
+    if (list_it == id_to_list_map.end())
+    {
+      create_list(list_id, n_entries);
+      return 0;
+    }
+    len_t n_entries_before = list_it->second.used_entries;
+    resize_list(list_id, n_entries_before + n_entries);
+    return n_entries_before;
+  }
+
+  void StorageLists::insert_entries(
+      const list_id_t list_id,
+      const vector_el_t *vectors,
+      const vector_id_t *ids,
+      const len_t n_entries)
+  {
+    NestedOperation operation(*this);
+    if (code_size != 0)
+    {
+      throw std::logic_error("The lists store codes instead of vectors");
+    }
+    len_t n_entries_before = append_entries(list_id, n_entries);
+    update_entries(list_id, vectors, ids, n_entries, n_entries_before);
+    log_operation(WAL_RECORD_INSERT, list_id, n_entries, n_entries_before, vectors, ids);
+    checkpoint_if_necessary();
+    publish_modified_lists();
+  }
+
+  void StorageLists::insert_codes(
+      const list_id_t list_id,
+      const uint8_t *codes,
+      const vector_id_t *ids,
+      const len_t n_entries)
+  {
+    NestedOperation operation(*this);
+    if (code_size == 0)
+    {
+      throw std::logic_error("The lists store vectors instead of codes");
+    }
+    len_t n_entries_before = append_entries(list_id, n_entries);
+    update_codes(list_id, codes, ids, n_entries, n_entries_before);
+    log_operation(WAL_RECORD_INSERT, list_id, n_entries, n_entries_before, codes, ids);
+    checkpoint_if_necessary();
+    publish_modified_lists();
   }
 
-  void StorageLists::resize_list(const list_id_t list_id, const len_t n_entries)
+  void StorageLists::batch_insert_entries(
+      const list_id_t *list_ids,
+      const vector_el_t *vectors,
+      const vector_id_t *ids,
+      const len_t n_entries)
   {
-    list_id_list_map_t::iterator list_it = id_to_list_map.find(list_id);
-    if (list_it == id_to_list_map.end())
+    // the lists are logged and published once all of them are inserted into
+    NestedOperation operation(*this);
+    check_writable();
+    if (code_size != 0)
     {
-      throw std::invalid_argument("List not found");
+      throw std::logic_error("The lists store codes instead of vectors");
     }
-    if (n_entries == 0)
+    // the entries are grouped by a counting sort, where the counts
+    // of the lists become the offsets of their first entries
+    std::map<list_id_t, len_t> list_offsets;
+    for (len_t i = 0; i < n_entries; i++)
     {
-      throw std::out_of_range("Cannot resize list to 0 entries");
+      list_offsets[list_ids[i]]++;
     }
-    InvertedList *list = &list_it->second;
-    if (!does_list_need_reallocation(list, n_entries))
+    len_t n_entries_before = 0;
+    for (auto &entry : list_offsets)
     {
-      list->used_entries = n_entries;
-      return;
+      len_t n_list_entries = entry.second;
+      entry.second = n_entries_before;
+      n_entries_before += n_list_entries;
     }
-    Slot slot = list_to_slot(list);
-    free_slot(&slot);
-    InvertedList new_list;
-    new_list = alloc_list(n_entries);
-    if (new_list.offset == list->offset)
+    std::map<list_id_t, len_t> list_ends = list_offsets;
+    std::vector<vector_el_t> grouped_vectors(n_entries * vector_dim);
+    std::vector<vector_id_t> grouped_ids(n_entries);
+    for (len_t i = 0; i < n_entries; i++)
     {
-      memmove(get_ids_by_list(&new_list), get_ids_by_list(list), get_ids_size(list->used_entries));
+      len_t position = list_ends[list_ids[i]]++;
+      memcpy(&grouped_vectors[position * vector_dim], &vectors[i * vector_dim], vector_size);
+      grouped_ids[position] = ids[i];
     }
-    else
+    for (const auto &entry : list_offsets)
     {
-      copy_shared_data(&new_list, list);
+      len_t start = entry.second;
+      len_t n_list_entries = list_ends[entry.first] - start;
+      len_t n_entries_before = append_entries(entry.first, n_list_entries);
+      update_entries(entry.first, &grouped_vectors[start * vector_dim], &grouped_ids[start], n_list_entries, n_entries_before);
+      log_operation(WAL_RECORD_INSERT, entry.first, n_list_entries, n_entries_before, &grouped_vectors[start * vector_dim], &grouped_ids[start]);
     }
-    id_to_list_map[list_id] = new_list;
-  }
-
-  StorageLists::InvertedList StorageLists::alloc_list(const len_t n_entries)
-  {
-    InvertedList list;
-    list.used_entries = n_entries;
-    const len_t min_list_length = (len_t)(MIN_N_ENTRIES_PER_LIST);
-    len_t allocated_entries = std::max(n_entries, min_list_length);
-    list.allocated_entries = round_up_to_next_power_of_two(allocated_entries);
-    size_t list_size = get_total_list_size(&list);
-    list.offset = alloc_slot(list_size);
-    return list;
+    checkpoint_if_necessary();
+    publish_modified_lists();
   }
 
-  StorageLists::slot_it_t StorageLists::find_large_enough_slot_index(const size_t size)
+  len_t StorageLists::delete_entries(const list_id_t list_id, const vector_id_t *ids, const len_t n_ids)
   {
-    for (auto it = free_slots.begin(); it != free_slots.end(); it++)
+    NestedOperation operation(*this);
+    check_writable();
+    list_id_list_map_t::const_iterator list_it = id_to_list_map.find(list_id);
+    if (list_it == id_to_list_map.end())
+    {
+      throw std::invalid_argument("List not found");
+    }
+    // the tombstones are set in place, so the deletion is durable before any of them is set
+    uint64_t lsn = log_operation(WAL_RECORD_DELETE, list_id, n_ids, 0, nullptr, ids);
+    if (lsn != 0)
+    {
+      wal->sync(lsn);
+    }
+    const InvertedList *list = &list_it->second;
+    uint64_t *tombstones = get_tombstones_by_list(list);
+    len_t n_deleted = 0;
+    if (id_directory != nullptr)
+    {
+      // deleted entries are not located, so no entry is deleted twice
+      for (len_t i = 0; i < n_ids; i++)
+      {
+        EntryLocation location;
+        if (id_directory->find(ids[i], location) && location.list_id == list_id)
+        {
+          tombstones[location.offset / 64] |= 1UL << (location.offset % 64);
+          id_directory->remove(ids[i]);
+          n_deleted++;
+        }
+      }
+    }
+    else
     {
-      if (it->size >= size)
+      std::unordered_set<vector_id_t> ids_to_delete(ids, ids + n_ids);
+      const vector_id_t *list_ids = get_ids_by_list(list);
+      for (len_t i = 0; i < list->used_entries; i++)
       {
-        return it;
+        uint64_t bit = 1UL << (i % 64);
+        if ((tombstones[i / 64] & bit) == 0 && ids_to_delete.count(list_ids[i]) != 0)
+        {
+          tombstones[i / 64] |= bit;
+          n_deleted++;
+        }
       }
     }
-    return free_slots.end();
+    // the published version of the list stays valid, since only its tombstones are modified
+    checkpoint_if_necessary();
+    return n_deleted;
   }
 
-  void StorageLists::grow_region_until_enough_space(size_t size)
+  len_t StorageLists::get_n_deleted_entries(const list_id_t list_id) const
   {
-    size_t new_size = total_size == 0 ? MIN_TOTAL_SIZE_BYTES : total_size;
-    if (has_free_slot_at_end())
-    {
-      size -= free_slots.back().size;
-    }
-    while (new_size - total_size < size)
+    ListData list = get_list_data(list_id);
+    len_t n_deleted = 0;
+    for (size_t i = 0; i < get_tombstones_size(list.length) / sizeof(uint64_t); i++)
     {
-      new_size *= 2;
+      n_deleted += __builtin_popcountll(list.tombstones[i]);
     }
-    resize_region(new_size);
+    return n_deleted;
   }
 
-  size_t StorageLists::alloc_slot(const size_t size)
+  len_t StorageLists::compact_list(const list_id_t list_id)
   {
-    auto slot_it = find_large_enough_slot_index(size);
-    if (slot_it == free_slots.end())
+    NestedOperation operation(*this);
+    check_writable();
+    list_id_list_map_t::iterator list_it = id_to_list_map.find(list_id);
+    if (list_it == id_to_list_map.end())
     {
-      grow_region_until_enough_space(size);
-      slot_it = find_large_enough_slot_index(size);
+      throw std::invalid_argument("List not found");
     }
-    Slot *slot = &(*slot_it);
-    size_t offset = slot->offset;
-    if (slot->size == size)
+    len_t n_deleted = count_deleted_entries(&list_it->second);
+    if (n_deleted == 0)
     {
-      free_slots.erase(slot_it);
+      return 0;
     }
-    else
+    InvertedList old_list = list_it->second;
+    // the old slot is released once the entries are copied, so that the lists never overlap
+    InvertedList new_list = alloc_list(old_list.used_entries - n_deleted);
+    clear_tombstones(&new_list, 0);
+    const uint64_t *tombstones = get_tombstones_by_list(&old_list);
+    auto is_deleted = [tombstones](len_t i)
+    { return (tombstones[i / 64] >> (i % 64) & 1) != 0; };
+    std::vector<uint8_t> code(code_size);
+    len_t n_copied = 0;
+    for (len_t start = 0; start < old_list.used_entries;)
     {
-      slot->offset += size;
-      slot->size -= size;
+      if (is_deleted(start))
+      {
+        start++;
+        continue;
+      }
+      len_t end = start + 1;
+      while (end < old_list.used_entries && !is_deleted(end))
+      {
+        end++;
+      }
+      // the remaining entries are copied in runs of consecutive entries
+      len_t n_entries = end - start;
+      if (code_layout == CODE_LAYOUT_FAST_SCAN)
+      {
+        for (len_t i = 0; i < n_entries; i++)
+        {
+          get_fast_scan_code(get_codes_by_list(&old_list), code_size, start + i, code.data());
+          set_fast_scan_code(get_codes_by_list(&new_list), code_size, n_copied + i, code.data());
+        }
+      }
+      else
+      {
+        memcpy(get_codes_by_list(&new_list) + n_copied * vector_size, get_codes_by_list(&old_list) + start * vector_size, get_vectors_size(n_entries));
+      }
+      memcpy(get_ids_by_list(&new_list) + n_copied, get_ids_by_list(&old_list) + start, get_ids_size(n_entries));
+      memcpy(get_inverse_norms_by_list(&new_list) + n_copied, get_inverse_norms_by_list(&old_list) + start, get_inverse_norms_size(n_entries));
+      if (id_directory != nullptr)
+      {
+        const vector_id_t *old_ids = get_ids_by_list(&old_list);
+        for (len_t i = 0; i < n_entries; i++)
+        {
+          EntryLocation location;
+          if (id_directory->find(old_ids[start + i], location) && location.list_id == list_id && location.offset == start + i)
+          {
+            id_directory->set(old_ids[start + i], {list_id, n_copied + i});
+          }
+        }
+      }
+      n_copied += n_entries;
+      start = end;
     }
-    return offset;
+    list_it->second = new_list;
+    Slot slot = list_to_slot(&old_list);
+    release_slot(&slot);
+    mark_list_modified(list_id);
+    log_operation(WAL_RECORD_COMPACT_LIST, list_id, 0, 0, nullptr, nullptr);
+    checkpoint_if_necessary();
+    publish_modified_lists();
+    return n_deleted;
   }
 
-  StorageLists::slot_it_t StorageLists::find_next_slot_to_right(const Slot *slot)
+  std::vector<list_id_t> StorageLists::get_lists_to_compact(const float min_deleted_ratio) const
   {
-    for (auto it = free_slots.begin(); it != free_slots.end(); it++)
+    std::vector<list_id_t> list_ids;
+    for (const auto &entry : id_to_list_map)
     {
-      if (it->offset > slot->offset)
+      len_t n_deleted = count_deleted_entries(&entry.second);
+      if (n_deleted != 0 && n_deleted >= min_deleted_ratio * entry.second.used_entries)
       {
-        return it;
+        list_ids.push_back(entry.first);
       }
     }
-    return free_slots.end();
+    std::sort(list_ids.begin(), list_ids.end());
+    return list_ids;
   }
 
-  StorageLists::slot_it_t StorageLists::find_next_slot_to_left(
-      const slot_it_t next_slot_right)
+  EntryLocation StorageLists::find_entry(const vector_id_t id) const
   {
-    if (next_slot_right == free_slots.begin())
+    check_id_directory_enabled();
+    EntryLocation location;
+    if (!id_directory->find(id, location))
     {
-      return free_slots.end();
+      throw std::invalid_argument("Vector id not found");
     }
-    return prev(next_slot_right);
+    return location;
   }
 
-  bool StorageLists::are_slots_adjacent(
-      const Slot *slot_left, const Slot *slot_right) const
+  const vector_el_t *StorageLists::get_vector(const vector_id_t id) const
   {
-    if (slot_left == nullptr || slot_right == nullptr)
-    {
-      return false;
-    }
-    return slot_left->offset + slot_left->size == slot_right->offset;
+    EntryLocation location = find_entry(id);
+    return get_vectors(location.list_id) + location.offset * vector_dim;
   }
 
-  StorageLists::Slot *StorageLists::to_slot(const slot_it_t it) const
+  void StorageLists::get_code(const vector_id_t id, uint8_t *code) const
   {
-    if (it == free_slots.end())
+    if (code_size == 0)
+    {
+      throw std::logic_error("The lists store vectors instead of codes");
+    }
+    EntryLocation location = find_entry(id);
+    const uint8_t *codes = get_codes(location.list_id);
+    if (code_layout == CODE_LAYOUT_FAST_SCAN)
+    {
+      get_fast_scan_code(codes, code_size, location.offset, code);
+    }
+    else
     {
-      return nullptr;
+      memcpy(code, codes + location.offset * code_size, code_size);
     }
-    return &(*it);
   }
 
-  void StorageLists::free_slot(const Slot *slot)
+  void StorageLists::upsert(const list_id_t list_id, const uint8_t *data, const vector_id_t *ids, const len_t n_entries)
   {
-    slot_it_t slot_right_it = find_next_slot_to_right(slot);
-    slot_it_t slot_left_it = find_next_slot_to_left(slot_right_it);
-    Slot *slot_right = to_slot(slot_right_it);
-    Slot *slot_left = to_slot(slot_left_it);
-    bool has_adjacent_slot_left = are_slots_adjacent(slot_left, slot);
-    bool has_adjacent_slot_right = are_slots_adjacent(slot, slot_right);
-    if (has_adjacent_slot_left && has_adjacent_slot_right)
+    // the modifications are logged as one operation and published once all of them are done
+    NestedOperation operation(*this);
+    check_writable();
+    check_id_directory_enabled();
+    if (std::unordered_set<vector_id_t>(ids, ids + n_entries).size() != n_entries)
     {
-      slot_left->size += slot->size + slot_right->size;
-      free_slots.erase(slot_right_it);
+      throw std::invalid_argument("Vector ids must be unique");
     }
-    else if (has_adjacent_slot_left && !has_adjacent_slot_right)
+    std::vector<uint8_t> new_data;
+    std::vector<vector_id_t> new_ids;
+    std::map<list_id_t, std::vector<vector_id_t>> ids_to_delete;
+    std::vector<std::pair<len_t, len_t>> updates;
+    for (len_t i = 0; i < n_entries; i++)
     {
-      slot_left->size += slot->size;
+      const uint8_t *entry = data + i * vector_size;
+      EntryLocation location;
+      bool is_stored = id_directory->find(ids[i], location);
+      if (is_stored && location.list_id == list_id)
+      {
+        updates.push_back({i, location.offset});
+        continue;
+      }
+      if (is_stored)
+      {
+        ids_to_delete[location.list_id].push_back(ids[i]);
+      }
+      new_data.insert(new_data.end(), entry, entry + vector_size);
+      new_ids.push_back(ids[i]);
     }
-    else if (!has_adjacent_slot_left && has_adjacent_slot_right)
+    // the updates and the tombstones are written in place, so every record is made durable
+    // first, as one operation, since replaying only the deletions of a torn upsert
+    // would lose the moved entries
+    size_t n_records = updates.size() + ids_to_delete.size() + (new_ids.empty() ? 0 : 1);
+    size_t n_logged = 0;
+    uint64_t lsn = 0;
+    for (const auto &update : updates)
     {
-      slot_right->offset -= slot->size;
-      slot_right->size += slot->size;
+      lsn = log_operation(WAL_RECORD_UPDATE, list_id, 1, update.second, data + update.first * vector_size, &ids[update.first], ++n_logged < n_records);
     }
-    else
+    for (const auto &entry : ids_to_delete)
     {
-      free_slots.insert(slot_right_it, *slot);
+      lsn = log_operation(WAL_RECORD_DELETE, entry.first, entry.second.size(), 0, nullptr, entry.second.data(), ++n_logged < n_records);
     }
-  }
-
-  const vector_el_t *StorageLists::get_vectors(const list_id_t list_id) const
-  {
-    list_id_list_map_t::const_iterator list_it = id_to_list_map.find(list_id);
-    if (list_it == id_to_list_map.end())
+    if (!new_ids.empty())
     {
-      throw std::invalid_argument("List not found");
+      list_id_list_map_t::const_iterator list_it = id_to_list_map.find(list_id);
+      len_t n_entries_before = list_it != id_to_list_map.end() ? list_it->second.used_entries : 0;
+      lsn = log_operation(WAL_RECORD_INSERT, list_id, new_ids.size(), n_entries_before, new_data.data(), new_ids.data());
     }
-    return get_vectors_by_list(&list_it->second);
-  }
-
-  const vector_id_t *StorageLists::get_ids(const list_id_t list_id) const
-  {
-    list_id_list_map_t::const_iterator list_it = id_to_list_map.find(list_id);
-    if (list_it == id_to_list_map.end())
+    if (lsn != 0)
     {
-      throw std::invalid_argument("List not found");
+      wal->sync(lsn);
     }
-    return get_ids_by_list(&list_it->second);
-  }
-
-  len_t StorageLists::get_list_length(const list_id_t list_id) const
-  {
-    list_id_list_map_t::const_iterator list_it = id_to_list_map.find(list_id);
-    if (list_it == id_to_list_map.end())
+    for (const auto &update : updates)
     {
-      throw std::invalid_argument("List not found");
+      const uint8_t *entry = data + update.first * vector_size;
+      if (code_size != 0)
+      {
+        update_codes(list_id, entry, &ids[update.first], 1, update.second);
+      }
+      else
+      {
+        update_entries(list_id, (const vector_el_t *)entry, &ids[update.first], 1, update.second);
+      }
+    }
+    // the old entries are deleted first, since their ids are located at the new entries afterwards
+    for (const auto &entry : ids_to_delete)
+    {
+      delete_entries(entry.first, entry.second.data(), entry.second.size());
+    }
+    if (!new_ids.empty())
+    {
+      if (code_size != 0)
+      {
+        insert_codes(list_id, new_data.data(), new_ids.data(), new_ids.size());
+      }
+      else
+      {
+        insert_entries(list_id, (const vector_el_t *)new_data.data(), new_ids.data(), new_ids.size());
+      }
     }
-    return list_it->second.used_entries;
+    checkpoint_if_necessary();
+    publish_modified_lists();
   }
 
-  size_t StorageLists::round_up_to_next_power_of_two(const size_t n) const
+  void StorageLists::upsert_entries(const list_id_t list_id, const vector_el_t *vectors, const vector_id_t *ids, const len_t n_entries)
   {
-    size_t power = n;
-    power--;
-    power |= power >> 1;
-    power |= power >> 2;
-    power |= power >> 4;
-    power |= power >> 8;
-    power |= power >> 16;
-    power |= power >> 32;
-    power++;
-    return power;
+    if (code_size != 0)
+    {
+      throw std::logic_error("The lists store codes instead of vectors");
+    }
+    upsert(list_id, (const uint8_t *)vectors, ids, n_entries);
   }
 
-  void StorageLists::create_list(
-      const list_id_t list_id,
-      const len_t n_entries)
+  void StorageLists::upsert_codes(const list_id_t list_id, const uint8_t *codes, const vector_id_t *ids, const len_t n_entries)
   {
-    if (id_to_list_map.find(list_id) != id_to_list_map.end())
-    {
-      throw std::invalid_argument("List already exists");
-    }
-    if (n_entries == 0)
+    if (code_size == 0)
     {
-      throw std::out_of_range("List must have at least one entry");
+      throw std::logic_error("The lists store vectors instead of codes");
     }
-    InvertedList list = alloc_list(n_entries);
-    id_to_list_map[list_id] = list;
+    upsert(list_id, codes, ids, n_entries);
   }
 
-  void StorageLists::update_entries(
-      const list_id_t list_id,
-      const vector_el_t *vectors,
-      const vector_id_t *ids,
-      const len_t n_entries,
-      const size_t offset) const
+  len_t StorageLists::delete_entries(const vector_id_t *ids, const len_t n_ids)
   {
-    list_id_list_map_t::const_iterator list_it = id_to_list_map.find(list_id);
-    if (list_it == id_to_list_map.end())
+    check_id_directory_enabled();
+    std::map<list_id_t, std::vector<vector_id_t>> ids_by_list;
+    for (len_t i = 0; i < n_ids; i++)
     {
-      throw std::invalid_argument("List not found");
+      EntryLocation location;
+      if (id_directory->find(ids[i], location))
+      {
+        ids_by_list[location.list_id].push_back(ids[i]);
+      }
     }
-    const InvertedList *list = &list_it->second;
-    if (offset + n_entries > list->used_entries)
+    // the deletions are logged as one operation and synced once
+    NestedOperation operation(*this);
+    check_writable();
+    size_t n_logged = 0;
+    uint64_t lsn = 0;
+    for (const auto &entry : ids_by_list)
     {
-      throw std::out_of_range("updating more entries than list has");
+      lsn = log_operation(WAL_RECORD_DELETE, entry.first, entry.second.size(), 0, nullptr, entry.second.data(), ++n_logged < ids_by_list.size());
     }
-    vector_el_t *list_vectors = get_vectors_by_list(list);
-    vector_id_t *list_ids = get_ids_by_list(list);
-    memcpy(list_vectors + offset * vector_dim, vectors, get_vectors_size(n_entries));
-    memcpy(list_ids + offset, ids, get_ids_size(n_entries));
-  }
-
-  void StorageLists::insert_entries(
-      const list_id_t list_id,
-      const vector_el_t *vectors,
-      const vector_id_t *ids,
-      const len_t n_entries)
-  {
-    list_id_list_map_t::iterator list_it = id_to_list_map.find(list_id);
-    InvertedList *list;
-    if (list_it == id_to_list_map.end())
+    if (lsn != 0)
     {
-      create_list(list_id, n_entries);
-      list = &id_to_list_map[list_id];
+      wal->sync(lsn);
     }
-    else
+    len_t n_deleted = 0;
+    for (const auto &entry : ids_by_list)
     {
-      list = &list_it->second;
+      n_deleted += delete_entries(entry.first, entry.second.data(), entry.second.size());
     }
-    resize_list(list_id, list->used_entries + n_entries);
-    update_entries(list_id, vectors, ids, n_entries, list->used_entries - n_entries);
+    checkpoint_if_necessary();
+    return n_deleted;
   }
 
   void StorageLists::reserve_space(const len_t n_entries)
@@ -507,32 +2023,197 @@ namespace ann_dkvs
     return filestream;
   }
 
-  void StorageLists::bulk_create_lists(
-      list_id_counts_map_t &lists_counts,
+  len_t StorageLists::get_range_start(const len_t range, const len_t n_ranges, const len_t n_entries) const
+  {
+    return (size_t)n_entries * range / n_ranges;
+  }
+
+  std::vector<StorageLists::list_id_counts_map_t> StorageLists::bulk_create_lists(
       const std::string &list_ids_filename,
       const len_t n_entries)
   {
     std::ifstream list_ids_file = open_filestream(list_ids_filename);
-    list_id_t list_id;
-    len_t n_entries_read = 0;
-    while (list_ids_file.read((char *)&list_id, sizeof(list_id_t)))
+    list_ids_file.seekg(0, std::ios::end);
+    if ((size_t)list_ids_file.tellg() != get_list_ids_size(n_entries))
     {
-      lists_counts[list_id]++;
-      n_entries_read++;
+      throw std::runtime_error("Number of entries in list ids file does not match n_entries");
     }
     list_ids_file.close();
-    if (list_ids_file.bad())
+
+    const len_t n_ranges = std::min(n_entries, (len_t)(BULK_INSERT_N_RANGES));
+    std::vector<list_id_counts_map_t> range_counts(n_ranges);
+    std::string error;
+#if PMODE != 0
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (len_t range = 0; range < n_ranges; range++)
     {
-      throw std::runtime_error("Error reading list ids file");
+      // exceptions cannot leave a parallel region, so they are rethrown after it
+      try
+      {
+        len_t start = get_range_start(range, n_ranges, n_entries);
+        len_t end = get_range_start(range + 1, n_ranges, n_entries);
+        std::ifstream range_file = open_filestream(list_ids_filename);
+        range_file.seekg(get_list_ids_size(start));
+        std::vector<list_id_t> list_ids(std::min(end - start, (len_t)(MAX_BUFFER_SIZE)));
+        list_id_counts_map_t &counts = range_counts[range];
+        while (start < end)
+        {
+          len_t n_entries_to_read = std::min((len_t)list_ids.size(), end - start);
+          if (!range_file.read((char *)list_ids.data(), get_list_ids_size(n_entries_to_read)))
+          {
+            throw std::runtime_error("Error reading list ids file");
+          }
+          for (len_t i = 0; i < n_entries_to_read; i++)
+          {
+            counts[list_ids[i]]++;
+          }
+          start += n_entries_to_read;
+        }
+      }
+      catch (const std::exception &e)
+      {
+#if PMODE != 0
+#pragma omp critical
+#endif
+        error = e.what();
+      }
     }
-    if (n_entries_read != n_entries)
+    if (!error.empty())
     {
-      throw std::runtime_error("Number of entries in list ids file does not match n_entries");
+      throw std::runtime_error(error);
+    }
+
+    // the counts of each range become the offsets of its first entries
+    list_id_counts_map_t list_lengths;
+    for (list_id_counts_map_t &counts : range_counts)
+    {
+      for (auto &entry : counts)
+      {
+        len_t &list_length = list_lengths[entry.first];
+        len_t n_range_entries = entry.second;
+        entry.second = list_length;
+        list_length += n_range_entries;
+      }
+    }
+    // the lists are padded to the list alignment, so their sizes
+    // are reserved at once instead of growing the region while creating them
+    size_t size_to_reserve = 0;
+    for (const auto &entry : list_lengths)
+    {
+      InvertedList list;
+      list.allocated_entries = get_n_entries_to_allocate(entry.second);
+      size_to_reserve += get_total_list_size(&list);
+    }
+    grow_region_until_enough_space(size_to_reserve);
+    for (const auto &entry : list_lengths)
+    {
+      create_list(entry.first, entry.second);
+    }
+    return range_counts;
+  }
+
+  void StorageLists::bulk_write_entries(
+      const std::string &vectors_filename,
+      const std::string &ids_filename,
+      const std::string &list_ids_filename,
+      const len_t n_entries,
+      const ScalarQuantizer *scalar_quantizer,
+      std::vector<list_id_counts_map_t> &range_offsets) const
+  {
+    const len_t n_ranges = range_offsets.size();
+    std::string error;
+#if PMODE != 0
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (len_t range = 0; range < n_ranges; range++)
+    {
+      try
+      {
+        len_t start = get_range_start(range, n_ranges, n_entries);
+        len_t end = get_range_start(range + 1, n_ranges, n_entries);
+        std::ifstream vectors_file = open_filestream(vectors_filename);
+        std::ifstream ids_file = open_filestream(ids_filename);
+        std::ifstream list_ids_file = open_filestream(list_ids_filename);
+        vectors_file.seekg((size_t)start * vector_dim * sizeof(vector_el_t));
+        ids_file.seekg(get_ids_size(start));
+        list_ids_file.seekg(get_list_ids_size(start));
+
+        const len_t buffer_size = std::min(end - start, (len_t)(MAX_BUFFER_SIZE));
+        std::vector<vector_el_t> vectors(buffer_size * vector_dim);
+        std::vector<uint8_t> codes(scalar_quantizer != nullptr ? get_vectors_size(buffer_size) : 0);
+        std::vector<vector_id_t> vector_ids(buffer_size);
+        std::vector<list_id_t> list_ids(buffer_size);
+        list_id_counts_map_t &offsets = range_offsets[range];
+        while (start < end)
+        {
+          len_t n_entries_to_read = std::min(buffer_size, end - start);
+          if (!vectors_file.read((char *)vectors.data(), n_entries_to_read * vector_dim * sizeof(vector_el_t)))
+          {
+            throw std::runtime_error("Error reading vectors file");
+          }
+          if (!ids_file.read((char *)vector_ids.data(), get_ids_size(n_entries_to_read)))
+          {
+            throw std::runtime_error("Error reading ids file");
+          }
+          if (!list_ids_file.read((char *)list_ids.data(), get_list_ids_size(n_entries_to_read)))
+          {
+            throw std::runtime_error("Error reading list ids file");
+          }
+          if (scalar_quantizer != nullptr)
+          {
+            scalar_quantizer->encode(vectors.data(), n_entries_to_read, codes.data());
+          }
+          for (len_t i = 0; i < n_entries_to_read; i++)
+          {
+            // the offsets of the ranges are disjoint, so no entry is written twice
+            len_t offset = offsets[list_ids[i]]++;
+            if (scalar_quantizer != nullptr)
+            {
+              copy_entries(list_ids[i], &codes[i * code_size], &vector_ids[i], 1, offset);
+            }
+            else
+            {
+              const vector_el_t *vector = &vectors[i * vector_dim];
+              const InvertedList *list = copy_entries(list_ids[i], vector, &vector_ids[i], 1, offset);
+              set_inverse_norms(list, vector, 1, offset);
+            }
+          }
+          start += n_entries_to_read;
+        }
+      }
+      catch (const std::exception &e)
+      {
+#if PMODE != 0
+#pragma omp critical
+#endif
+        error = e.what();
+      }
+    }
+    if (!error.empty())
+    {
+      throw std::runtime_error(error);
     }
+  }
 
-    for (auto list_it : lists_counts)
+  void StorageLists::train_scalar_quantizer(
+      ScalarQuantizer *scalar_quantizer,
+      const std::string &vectors_filename,
+      const len_t n_entries) const
+  {
+    std::ifstream vectors_file = open_filestream(vectors_filename);
+    const len_t buffer_size = std::min(n_entries, (len_t)(MAX_BUFFER_SIZE));
+    std::vector<vector_el_t> vectors(buffer_size * vector_dim);
+    len_t n_entries_read = 0;
+    while (n_entries_read < n_entries)
     {
-      create_list(list_it.first, list_it.second);
+      len_t n_entries_to_read = std::min(buffer_size, n_entries - n_entries_read);
+      if (!vectors_file.read((char *)vectors.data(), n_entries_to_read * vector_dim * sizeof(vector_el_t)))
+      {
+        throw std::runtime_error("Error reading vectors file");
+      }
+      scalar_quantizer->train(vectors.data(), n_entries_to_read);
+      n_entries_read += n_entries_to_read;
     }
   }
 
@@ -540,19 +2221,43 @@ namespace ann_dkvs
       const std::string &vectors_filename,
       const std::string &ids_filename,
       const std::string &list_ids_filename,
-      const len_t n_entries)
+      const len_t n_entries,
+      ScalarQuantizer *scalar_quantizer)
   {
+    // the lists are published once all entries are written
+    NestedOperation operation(*this);
+    check_writable();
     if (total_size != 0)
     {
       throw std::runtime_error("bulk_insert_entries() can only be called on an empty inverted lists object");
     }
+    if (scalar_quantizer == nullptr && code_size != 0)
+    {
+      throw std::logic_error("bulk_insert_entries() can only insert raw vectors unless a scalar quantizer is given");
+    }
+    if (scalar_quantizer != nullptr && (code_size != scalar_quantizer->get_code_size() || vector_dim != scalar_quantizer->get_vector_dim() || code_layout != CODE_LAYOUT_PACKED))
+    {
+      throw std::logic_error("The lists do not store codes of the scalar quantizer");
+    }
+    if (wal != nullptr)
+    {
+      throw std::logic_error("bulk_insert_entries() cannot be called while the write-ahead log is enabled");
+    }
+    if (scalar_quantizer != nullptr && scalar_quantizer->get_sq_type() == SQ_8BIT)
+    {
+      train_scalar_quantizer(scalar_quantizer, vectors_filename, n_entries);
+    }
 
 #if DYNAMIC_INSERTION == 0
     reserve_space(n_entries);
-    list_id_counts_map_t entries_left;
-    bulk_create_lists(entries_left, list_ids_filename, n_entries);
-#endif
-
+    std::vector<list_id_counts_map_t> range_offsets = bulk_create_lists(list_ids_filename, n_entries);
+    bulk_write_entries(vectors_filename, ids_filename, list_ids_filename, n_entries, scalar_quantizer, range_offsets);
+    // the entries are written in parallel, so they are indexed afterwards
+    if (id_directory != nullptr)
+    {
+      rebuild_id_directory();
+    }
+#else
     std::ifstream vectors_file = open_filestream(vectors_filename);
     std::ifstream ids_file = open_filestream(ids_filename);
     std::ifstream list_ids_file = open_filestream(list_ids_filename);
@@ -560,7 +2265,8 @@ namespace ann_dkvs
     const len_t max_buffer_size = (len_t)(MAX_BUFFER_SIZE);
     const len_t buffer_size = std::min(n_entries, max_buffer_size);
 
-    vector_el_t *vectors = (vector_el_t *)malloc(get_vectors_size(buffer_size));
+    vector_el_t *vectors = (vector_el_t *)malloc(buffer_size * vector_dim * sizeof(vector_el_t));
+    uint8_t *codes = scalar_quantizer != nullptr ? (uint8_t *)malloc(get_vectors_size(buffer_size)) : nullptr;
     vector_id_t *vector_ids = (vector_id_t *)malloc(get_ids_size(buffer_size));
     list_id_t *list_ids = (list_id_t *)malloc(get_list_ids_size(buffer_size));
 
@@ -570,10 +2276,14 @@ namespace ann_dkvs
     {
       len_t n_entries_to_read = std::min(buffer_size, n_entries - n_entries_read);
 
-      if (!vectors_file.read((char *)vectors, get_vectors_size(n_entries_to_read)))
+      if (!vectors_file.read((char *)vectors, n_entries_to_read * vector_dim * sizeof(vector_el_t)))
       {
         throw std::runtime_error("Error reading vectors file");
       }
+      if (scalar_quantizer != nullptr)
+      {
+        scalar_quantizer->encode(vectors, n_entries_to_read, codes);
+      }
       if (!ids_file.read((char *)vector_ids, get_ids_size(n_entries_to_read)))
       {
         throw std::runtime_error("Error reading ids file");
@@ -585,24 +2295,21 @@ namespace ann_dkvs
 
       for (len_t i = 0; i < n_entries_to_read; i++)
       {
-        vector_el_t *vector = &vectors[i * vector_dim];
-        vector_id_t *vector_id = &vector_ids[i];
-        list_id_t list_id = list_ids[i];
-
-#if DYNAMIC_INSERTION == 1
-        insert_entries(list_id, vector, vector_id, 1);
-#else
-        len_t list_length = get_list_length(list_id);
-        len_t cur_list_offset = list_length - entries_left[list_id];
-        update_entries(list_id, vector, vector_id, 1, cur_list_offset);
-        entries_left[list_id]--;
-#endif
+        if (scalar_quantizer != nullptr)
+        {
+          insert_codes(list_ids[i], &codes[i * code_size], &vector_ids[i], 1);
+        }
+        else
+        {
+          insert_entries(list_ids[i], &vectors[i * vector_dim], &vector_ids[i], 1);
+        }
       }
 
       n_entries_read += n_entries_to_read;
     }
 
     free(vectors);
+    free(codes);
     free(vector_ids);
     free(list_ids);
 
@@ -614,5 +2321,8 @@ namespace ann_dkvs
     vectors_file.close();
     ids_file.close();
     list_ids_file.close();
+#endif
+    flush();
+    publish_modified_lists();
   }
 }
\ No newline at end of file
@@ -1,6 +1,512 @@
+#include <algorithm>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "StorageNode.hpp"
+#include "Socket.hpp"
+
+/**
+ * Id of the eventfd in the epoll events, the ids of connections start after it.
+ */
+#define WAKE_CONNECTION_ID 0
 
 namespace ann_dkvs
 {
-  StorageNode::StorageNode(const StorageIndex &index) : index(index) {}
-}
\ No newline at end of file
+  StorageNode::StorageNode(std::unique_ptr<StorageLists> lists, const len_t n_workers)
+      : lists(std::move(lists)), index(this->lists.get()), prefetcher(new ListPrefetcher(this->lists.get())), epoll_fd(-1), wake_fd(-1), next_connection_id(WAKE_CONNECTION_ID + 1), is_stopping(false)
+  {
+    if (n_workers == 0)
+    {
+      throw std::out_of_range("A storage node needs at least one worker");
+    }
+#ifdef _OPENMP
+    // concurrent batches would otherwise each start a team of all threads
+    n_threads_per_worker = std::max((len_t)1, (len_t)omp_get_max_threads() / n_workers);
+#else
+    n_threads_per_worker = 1;
+#endif
+    if (!this->lists->place_lists_on_numa_nodes())
+    {
+      // the lists are still searched, only from remote memory
+      std::cerr << "Could not move the pages of " << this->lists->get_filename() << " to their NUMA nodes" << std::endl;
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = WAKE_CONNECTION_ID;
+    if (epoll_fd == -1 || wake_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) == -1)
+    {
+      std::string message = std::string("Could not create the event loop: ") + strerror(errno);
+      if (epoll_fd != -1)
+      {
+        close(epoll_fd);
+      }
+      if (wake_fd != -1)
+      {
+        close(wake_fd);
+      }
+      throw std::runtime_error(message);
+    }
+    event_loop_thread = std::thread(&StorageNode::run_event_loop, this);
+    for (len_t i = 0; i < n_workers; i++)
+    {
+      worker_threads.emplace_back(&StorageNode::run_worker, this);
+    }
+  }
+
+  StorageNode::~StorageNode()
+  {
+    stop();
+  }
+
+  uint16_t StorageNode::listen_tcp(const std::string &host, const uint16_t port)
+  {
+    int fd = listen_tcp_socket(host, port);
+    uint16_t bound_port;
+    try
+    {
+      set_socket_nonblocking(fd);
+      bound_port = get_socket_port(fd);
+    }
+    catch (const std::runtime_error &)
+    {
+      close(fd);
+      throw;
+    }
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    add_connection(fd, true, EPOLLIN);
+    return bound_port;
+  }
+
+  void StorageNode::listen_unix(const std::string &path)
+  {
+    int fd = listen_unix_socket(path);
+    try
+    {
+      set_socket_nonblocking(fd);
+    }
+    catch (const std::runtime_error &)
+    {
+      close(fd);
+      throw;
+    }
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    add_connection(fd, true, EPOLLIN);
+    unix_socket_paths.push_back(path);
+  }
+
+  void StorageNode::wait()
+  {
+    std::unique_lock<std::mutex> lock(jobs_mutex);
+    stopped.wait(lock, [this]
+                 { return (bool)is_stopping; });
+  }
+
+  void StorageNode::stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(jobs_mutex);
+      is_stopping = true;
+    }
+    jobs_available.notify_all();
+    stopped.notify_all();
+    if (event_loop_thread.joinable())
+    {
+      wake_event_loop();
+      event_loop_thread.join();
+    }
+    for (std::thread &worker_thread : worker_threads)
+    {
+      if (worker_thread.joinable())
+      {
+        worker_thread.join();
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    for (const auto &entry : connections)
+    {
+      close(entry.second.fd);
+    }
+    connections.clear();
+    for (const std::string &path : unix_socket_paths)
+    {
+      unlink(path.c_str());
+    }
+    unix_socket_paths.clear();
+    if (epoll_fd != -1)
+    {
+      close(epoll_fd);
+      epoll_fd = -1;
+    }
+    if (wake_fd != -1)
+    {
+      close(wake_fd);
+      wake_fd = -1;
+    }
+  }
+
+  const StorageLists *StorageNode::get_lists() const
+  {
+    return lists.get();
+  }
+
+  len_t StorageNode::get_n_threads_per_worker() const
+  {
+    return n_threads_per_worker;
+  }
+
+  void StorageNode::run_event_loop()
+  {
+    struct epoll_event events[STORAGE_NODE_MAX_EVENTS];
+    while (!is_stopping)
+    {
+      int n_events = epoll_wait(epoll_fd, events, STORAGE_NODE_MAX_EVENTS, -1);
+      if (n_events == -1)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        break;
+      }
+      std::lock_guard<std::mutex> lock(connections_mutex);
+      for (int i = 0; i < n_events && !is_stopping; i++)
+      {
+        uint64_t connection_id = events[i].data.u64;
+        if (connection_id == WAKE_CONNECTION_ID)
+        {
+          uint64_t n_wake_ups;
+          ssize_t n_read = read(wake_fd, &n_wake_ups, sizeof(n_wake_ups));
+          (void)n_read;
+          send_finished_jobs();
+          continue;
+        }
+        auto it = connections.find(connection_id);
+        if (it == connections.end())
+        {
+          // closed while handling an earlier event
+          continue;
+        }
+        Connection &connection = it->second;
+        if (connection.is_listening)
+        {
+          accept_connections(connection);
+          continue;
+        }
+        bool is_open = (events[i].events & (EPOLLERR | EPOLLHUP)) == 0;
+        if (is_open && (events[i].events & EPOLLIN))
+        {
+          is_open = receive_frame(connection_id, connection);
+        }
+        if (is_open && (events[i].events & EPOLLOUT))
+        {
+          is_open = send_response(connection_id, connection);
+        }
+        if (!is_open)
+        {
+          close_connection(connection_id);
+        }
+      }
+    }
+  }
+
+  void StorageNode::run_worker()
+  {
+#ifdef _OPENMP
+    omp_set_num_threads(n_threads_per_worker);
+#endif
+    while (true)
+    {
+      StorageNodeJob job;
+      {
+        std::unique_lock<std::mutex> lock(jobs_mutex);
+        jobs_available.wait(lock, [this]
+                            { return is_stopping || !pending_jobs.empty(); });
+        if (is_stopping)
+        {
+          return;
+        }
+        job = std::move(pending_jobs.front());
+        pending_jobs.pop_front();
+      }
+      handle_job(job);
+      {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        finished_jobs.push_back(std::move(job));
+      }
+      wake_event_loop();
+    }
+  }
+
+  void StorageNode::handle_job(StorageNodeJob &job) const
+  {
+    try
+    {
+      if (job.message_type != MESSAGE_SEARCH_REQUEST)
+      {
+        throw std::invalid_argument("Unexpected message type " + std::to_string(job.message_type));
+      }
+      len_t vector_dim;
+      QueryBatch queries = read_search_request(job.body.data(), job.body.size(), &vector_dim);
+      std::vector<std::unique_ptr<Query>> owned_queries(queries.begin(), queries.end());
+      // exceptions must not be thrown within the parallel search
+      check_queries(queries, vector_dim);
+      prefetcher->prefetch(queries);
+      QueryResultsBatch results = index.batch_search_preassigned(queries);
+      write_search_response(results, job.response);
+    }
+    catch (const std::exception &e)
+    {
+      write_error(e.what(), job.response);
+    }
+  }
+
+  void StorageNode::check_queries(const QueryBatch &queries, const len_t vector_dim) const
+  {
+    if (vector_dim != lists->get_vector_dim())
+    {
+      throw std::invalid_argument("The dimension of the queries does not match the dimension of the lists");
+    }
+    for (const Query *query : queries)
+    {
+      if (query->get_n_results() == 0 || query->get_n_results() > STORAGE_NODE_MAX_N_RESULTS)
+      {
+        throw std::invalid_argument("Invalid number of results " + std::to_string(query->get_n_results()));
+      }
+      for (len_t i = 0; i < query->get_n_probe(); i++)
+      {
+        // throws if the list does not exist
+        lists->get_list_length(query->get_list_to_probe(i));
+      }
+    }
+  }
+
+  void StorageNode::accept_connections(const Connection &listener)
+  {
+    while (true)
+    {
+      int fd = accept4(listener.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd == -1)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        // no more pending connections, or retried on the next event
+        return;
+      }
+      // fails harmlessly for Unix domain sockets
+      int enable = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+      try
+      {
+        add_connection(fd, false, EPOLLIN);
+      }
+      catch (const std::runtime_error &)
+      {
+        // the connection has been closed
+      }
+    }
+  }
+
+  bool StorageNode::receive_frame(const uint64_t connection_id, Connection &connection)
+  {
+    while (true)
+    {
+      bool is_reading_header = connection.n_header_bytes_read < sizeof(FrameHeader);
+      uint8_t *buffer;
+      size_t n_bytes_left;
+      if (is_reading_header)
+      {
+        buffer = (uint8_t *)&connection.header + connection.n_header_bytes_read;
+        n_bytes_left = sizeof(FrameHeader) - connection.n_header_bytes_read;
+      }
+      else
+      {
+        buffer = connection.body.data() + connection.n_body_bytes_read;
+        n_bytes_left = connection.body.size() - connection.n_body_bytes_read;
+      }
+
+      if (n_bytes_left == 0)
+      {
+        // the frame is complete, stop reading until the response has been sent
+        connection.n_header_bytes_read = 0;
+        connection.is_busy = true;
+        watch_connection(connection_id, connection, 0);
+        StorageNodeJob job;
+        job.connection_id = connection_id;
+        job.message_type = (message_type_t)connection.header.message_type;
+        job.body = std::move(connection.body);
+        connection.body.clear();
+        {
+          std::lock_guard<std::mutex> lock(jobs_mutex);
+          pending_jobs.push_back(std::move(job));
+        }
+        jobs_available.notify_one();
+        return true;
+      }
+
+      ssize_t n_received = recv(connection.fd, buffer, n_bytes_left, 0);
+      if (n_received == -1 && errno == EINTR)
+      {
+        continue;
+      }
+      if (n_received == -1)
+      {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+      }
+      if (n_received == 0)
+      {
+        return false;
+      }
+      if (!is_reading_header)
+      {
+        connection.n_body_bytes_read += n_received;
+        continue;
+      }
+      connection.n_header_bytes_read += n_received;
+      if (connection.n_header_bytes_read < sizeof(FrameHeader))
+      {
+        continue;
+      }
+      try
+      {
+        check_frame_header(connection.header);
+      }
+      catch (const std::invalid_argument &e)
+      {
+        // the following frames cannot be found anymore
+        connection.is_busy = true;
+        connection.is_closing = true;
+        write_error(e.what(), connection.response);
+        connection.n_response_bytes_written = 0;
+        return send_response(connection_id, connection);
+      }
+      connection.body.resize(connection.header.body_size);
+      connection.n_body_bytes_read = 0;
+    }
+  }
+
+  bool StorageNode::send_response(const uint64_t connection_id, Connection &connection)
+  {
+    while (connection.n_response_bytes_written < connection.response.size())
+    {
+      ssize_t n_sent = send(
+          connection.fd,
+          connection.response.data() + connection.n_response_bytes_written,
+          connection.response.size() - connection.n_response_bytes_written,
+          MSG_NOSIGNAL);
+      if (n_sent == -1 && errno == EINTR)
+      {
+        continue;
+      }
+      if (n_sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      {
+        watch_connection(connection_id, connection, EPOLLOUT);
+        return true;
+      }
+      if (n_sent == -1)
+      {
+        return false;
+      }
+      connection.n_response_bytes_written += n_sent;
+    }
+    if (connection.is_closing)
+    {
+      return false;
+    }
+    connection.response.clear();
+    connection.n_response_bytes_written = 0;
+    connection.is_busy = false;
+    watch_connection(connection_id, connection, EPOLLIN);
+    return true;
+  }
+
+  void StorageNode::send_finished_jobs()
+  {
+    std::deque<StorageNodeJob> jobs;
+    {
+      std::lock_guard<std::mutex> lock(jobs_mutex);
+      jobs.swap(finished_jobs);
+    }
+    for (StorageNodeJob &job : jobs)
+    {
+      auto it = connections.find(job.connection_id);
+      if (it == connections.end())
+      {
+        // the client has disconnected in the meantime
+        continue;
+      }
+      Connection &connection = it->second;
+      connection.response = std::move(job.response);
+      connection.n_response_bytes_written = 0;
+      if (!send_response(job.connection_id, connection))
+      {
+        close_connection(job.connection_id);
+      }
+    }
+  }
+
+  void StorageNode::add_connection(const int fd, const bool is_listening, const uint32_t events)
+  {
+    uint64_t connection_id = next_connection_id++;
+    Connection &connection = connections[connection_id];
+    connection.fd = fd;
+    connection.is_listening = is_listening;
+    connection.n_header_bytes_read = 0;
+    connection.n_body_bytes_read = 0;
+    connection.n_response_bytes_written = 0;
+    connection.is_busy = false;
+    connection.is_closing = false;
+    struct epoll_event event;
+    event.events = events;
+    event.data.u64 = connection_id;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+      std::string message = std::string("Could not register socket: ") + strerror(errno);
+      close_connection(connection_id);
+      throw std::runtime_error(message);
+    }
+  }
+
+  void StorageNode::watch_connection(const uint64_t connection_id, const Connection &connection, const uint32_t events)
+  {
+    struct epoll_event event;
+    event.events = events;
+    event.data.u64 = connection_id;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+  }
+
+  void StorageNode::close_connection(const uint64_t connection_id)
+  {
+    auto it = connections.find(connection_id);
+    if (it != connections.end())
+    {
+      close(it->second.fd);
+      connections.erase(it);
+    }
+  }
+
+  void StorageNode::wake_event_loop()
+  {
+    // only fails if the counter overflows, which takes 2^64 - 1 wake ups
+    uint64_t n_wake_ups = 1;
+    ssize_t n_written = write(wake_fd, &n_wake_ups, sizeof(n_wake_ups));
+    (void)n_written;
+  }
+}
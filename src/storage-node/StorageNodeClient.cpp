@@ -0,0 +1,65 @@
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include "StorageNodeClient.hpp"
+#include "Protocol.hpp"
+#include "Socket.hpp"
+
+namespace ann_dkvs
+{
+  StorageNodeClient::StorageNodeClient(const std::string &host, const uint16_t port)
+      : fd(connect_tcp_socket(host, port)) {}
+
+  StorageNodeClient::StorageNodeClient(const std::string &socket_path)
+      : fd(connect_unix_socket(socket_path)) {}
+
+  StorageNodeClient::~StorageNodeClient()
+  {
+    close(fd);
+  }
+
+  void StorageNodeClient::send_search_request(const QueryBatch &queries, const len_t vector_dim)
+  {
+    write_search_request(queries, vector_dim, frame);
+    send_all(fd, frame.data(), frame.size());
+  }
+
+  QueryResultsBatch StorageNodeClient::receive_search_response()
+  {
+    FrameHeader header;
+    receive_all(fd, &header, sizeof(FrameHeader));
+    try
+    {
+      check_frame_header(header);
+    }
+    catch (const std::invalid_argument &e)
+    {
+      throw std::runtime_error(std::string("Invalid response: ") + e.what());
+    }
+    frame.resize(header.body_size);
+    receive_all(fd, frame.data(), frame.size());
+    if (header.message_type == MESSAGE_ERROR)
+    {
+      throw std::runtime_error("Storage node error: " + std::string(frame.begin(), frame.end()));
+    }
+    if (header.message_type != MESSAGE_SEARCH_RESPONSE)
+    {
+      throw std::runtime_error("Unexpected message type " + std::to_string(header.message_type));
+    }
+    try
+    {
+      return read_search_response(frame.data(), frame.size());
+    }
+    catch (const std::invalid_argument &e)
+    {
+      throw std::runtime_error(std::string("Invalid response: ") + e.what());
+    }
+  }
+
+  QueryResultsBatch StorageNodeClient::batch_search_preassigned(const QueryBatch &queries, const len_t vector_dim)
+  {
+    send_search_request(queries, vector_dim);
+    return receive_search_response();
+  }
+}
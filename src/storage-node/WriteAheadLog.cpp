@@ -0,0 +1,302 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <array>
+#include <stdexcept>
+#include <fstream>
+
+#include "WriteAheadLog.hpp"
+
+namespace ann_dkvs
+{
+  /**
+   * Computes the CRC-32 checksum (IEEE 802.3) of the given bytes,
+   * continuing the checksum of preceding bytes.
+   */
+  static uint32_t crc32(uint32_t crc, const uint8_t *data, const size_t size)
+  {
+    static const std::array<uint32_t, 256> table = []
+    {
+      std::array<uint32_t, 256> table;
+      for (uint32_t i = 0; i < 256; i++)
+      {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+        {
+          c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        table[i] = c;
+      }
+      return table;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+    {
+      crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+  }
+
+  /**
+   * Computes the checksum of a record, i.e. of its header
+   * without the checksum and of its payload.
+   */
+  static uint32_t get_record_checksum(const WalRecordHeader &header, const std::vector<std::pair<const void *, size_t>> &payload)
+  {
+    const size_t checksum_size = sizeof(header.checksum);
+    uint32_t crc = crc32(0, (const uint8_t *)&header + checksum_size, sizeof(WalRecordHeader) - checksum_size);
+    for (const auto &part : payload)
+    {
+      crc = crc32(crc, (const uint8_t *)part.first, part.second);
+    }
+    return crc;
+  }
+
+  static bool write_all(const int fd, const uint8_t *data, size_t size)
+  {
+    while (size > 0)
+    {
+      ssize_t n_written = write(fd, data, size);
+      if (n_written < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        return false;
+      }
+      data += n_written;
+      size -= n_written;
+    }
+    return true;
+  }
+
+  WriteAheadLog::WriteAheadLog(const std::string &filename)
+      : filename(filename), generation(0), appended_lsn(0), synced_lsn(0), generation_lsn(0), is_syncing(false), is_failed(false)
+  {
+    fd = open(filename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+    {
+      throw std::runtime_error("Could not open file " + filename);
+    }
+    try
+    {
+      struct stat file_stat;
+      if (fstat(fd, &file_stat) != 0)
+      {
+        throw std::runtime_error("Could not open file " + filename);
+      }
+      if (file_stat.st_size == 0)
+      {
+        write_file_header();
+        return;
+      }
+      WalFileHeader header;
+      if ((size_t)file_stat.st_size < sizeof(WalFileHeader) ||
+          pread(fd, &header, sizeof(WalFileHeader), 0) != sizeof(WalFileHeader) ||
+          header.magic != WAL_MAGIC ||
+          header.version != WAL_VERSION)
+      {
+        throw std::runtime_error("Invalid log file " + filename);
+      }
+      generation = header.generation;
+      appended_lsn = file_stat.st_size - sizeof(WalFileHeader);
+      synced_lsn = appended_lsn;
+    }
+    catch (const std::runtime_error &)
+    {
+      close(fd);
+      throw;
+    }
+  }
+
+  WriteAheadLog::~WriteAheadLog()
+  {
+    close(fd);
+  }
+
+  void WriteAheadLog::write_file_header()
+  {
+    WalFileHeader header;
+    header.magic = WAL_MAGIC;
+    header.version = WAL_VERSION;
+    header.generation = generation;
+    if (!write_all(fd, (const uint8_t *)&header, sizeof(WalFileHeader)) || fdatasync(fd) != 0)
+    {
+      throw std::runtime_error("Could not write file " + filename);
+    }
+  }
+
+  void WriteAheadLog::check_not_failed() const
+  {
+    if (is_failed)
+    {
+      throw std::runtime_error("Log file " + filename + " has failed and has to be reset by a checkpoint");
+    }
+  }
+
+  uint64_t WriteAheadLog::append(WalRecordHeader header, const std::vector<std::pair<const void *, size_t>> &payload)
+  {
+    header.payload_size = 0;
+    for (const auto &part : payload)
+    {
+      header.payload_size += part.second;
+    }
+    header.checksum = get_record_checksum(header, payload);
+
+    uint64_t lsn;
+    bool is_group_full;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      check_not_failed();
+      const uint8_t *header_bytes = (const uint8_t *)&header;
+      buffer.insert(buffer.end(), header_bytes, header_bytes + sizeof(WalRecordHeader));
+      for (const auto &part : payload)
+      {
+        const uint8_t *part_bytes = (const uint8_t *)part.first;
+        buffer.insert(buffer.end(), part_bytes, part_bytes + part.second);
+      }
+      appended_lsn += sizeof(WalRecordHeader) + header.payload_size;
+      lsn = appended_lsn;
+      is_group_full = buffer.size() >= WAL_GROUP_COMMIT_SIZE;
+    }
+    if (is_group_full)
+    {
+      sync(lsn);
+    }
+    return lsn;
+  }
+
+  void WriteAheadLog::sync(const uint64_t lsn)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (synced_lsn < lsn)
+    {
+      check_not_failed();
+      if (is_syncing)
+      {
+        // the records are committed by the running or the next sync
+        synced.wait(lock);
+        continue;
+      }
+      is_syncing = true;
+      std::vector<uint8_t> group;
+      group.swap(buffer);
+      uint64_t group_lsn = appended_lsn;
+      lock.unlock();
+      bool is_written = write_all(fd, group.data(), group.size()) && fdatasync(fd) == 0;
+      lock.lock();
+      is_syncing = false;
+      if (is_written)
+      {
+        synced_lsn = group_lsn;
+      }
+      else
+      {
+        // the group is lost and later records would follow a torn record,
+        // so no record may be reported durable until the log is reset
+        is_failed = true;
+      }
+      synced.notify_all();
+      if (!is_written)
+      {
+        throw std::runtime_error("Could not write file " + filename);
+      }
+    }
+  }
+
+  void WriteAheadLog::sync()
+  {
+    uint64_t lsn;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      lsn = appended_lsn;
+    }
+    sync(lsn);
+  }
+
+  void WriteAheadLog::replay(const std::function<void(const WalRecordHeader &, const uint8_t *)> &apply)
+  {
+    sync();
+    std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+      throw std::runtime_error("Could not open file " + filename);
+    }
+    size_t file_size = file.tellg();
+    size_t position = sizeof(WalFileHeader);
+    file.seekg(position);
+    std::vector<uint8_t> payload;
+    WalRecordHeader header;
+    // the records of the operation which is not ended yet
+    std::vector<std::pair<WalRecordHeader, std::vector<uint8_t>>> continued_records;
+    while (file.read((char *)&header, sizeof(WalRecordHeader)))
+    {
+      position += sizeof(WalRecordHeader);
+      // the size is checked first so that a torn header cannot exhaust memory
+      if (header.payload_size > file_size - position)
+      {
+        break;
+      }
+      payload.resize(header.payload_size);
+      if (!file.read((char *)payload.data(), header.payload_size) ||
+          header.checksum != get_record_checksum(header, {{payload.data(), payload.size()}}))
+      {
+        break;
+      }
+      position += header.payload_size;
+      if (header.type & WAL_RECORD_CONTINUED)
+      {
+        header.type &= ~WAL_RECORD_CONTINUED;
+        continued_records.push_back({header, payload});
+        continue;
+      }
+      for (const auto &record : continued_records)
+      {
+        apply(record.first, record.second.data());
+      }
+      continued_records.clear();
+      apply(header, payload.data());
+    }
+    if (file.bad())
+    {
+      throw std::runtime_error("Error reading log file " + filename);
+    }
+  }
+
+  void WriteAheadLog::reset(const uint64_t new_generation)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    synced.wait(lock, [this]
+                { return !is_syncing; });
+    // the discarded records are covered by the checkpoint
+    buffer.clear();
+    is_failed = false;
+    synced_lsn = appended_lsn;
+    generation_lsn = appended_lsn;
+    generation = new_generation;
+    if (ftruncate(fd, 0) != 0)
+    {
+      throw std::runtime_error("Could not truncate file " + filename);
+    }
+    write_file_header();
+  }
+
+  uint64_t WriteAheadLog::get_generation() const
+  {
+    return generation;
+  }
+
+  uint64_t WriteAheadLog::get_size()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return appended_lsn - generation_lsn;
+  }
+
+  bool WriteAheadLog::has_failed()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return is_failed;
+  }
+}
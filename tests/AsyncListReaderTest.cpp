@@ -0,0 +1,173 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <cstring>
+#include <random>
+#include <set>
+#include <stdexcept>
+
+#include "../lib/catch.hpp"
+
+#include "../include/tests/StorageListsTestUtils.hpp"
+#include "../include/storage-node/AsyncListReader.hpp"
+
+using namespace ann_dkvs;
+
+/**
+ * Returns whether the kernel sets up io_uring instances.
+ */
+static bool is_io_uring_available()
+{
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int ring_fd = (int)syscall(__NR_io_uring_setup, 1, &params);
+  if (ring_fd < 0)
+  {
+    return false;
+  }
+  close(ring_fd);
+  return true;
+}
+
+/**
+ * Returns whether the file system of a file supports O_DIRECT.
+ */
+static bool is_direct_io_supported(const std::string &filename)
+{
+  int fd = open(filename.c_str(), O_RDONLY | O_DIRECT);
+  if (fd < 0)
+  {
+    return false;
+  }
+  close(fd);
+  return true;
+}
+
+SCENARIO("AsyncListReader: lists are read from the lists file", "[AsyncListReader][test]")
+{
+  GIVEN("lists of random vectors of different lengths written back to the lists file")
+  {
+    len_t vector_dim = 16;
+    len_t n_lists = 16;
+    std::mt19937 rng(17);
+    std::uniform_real_distribution<vector_el_t> gen_component(-1, 1);
+    std::string file = join(TMP_DIR, "async_" + get_lists_filename());
+    remove(file.c_str());
+    StorageLists lists(vector_dim, file);
+    vector_id_t next_id = 0;
+    std::vector<std::pair<list_id_t, ListLayout>> lists_to_read;
+    for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+    {
+      // lists of a few entries up to lists spanning several blocks
+      len_t list_length = 1 + list_id * 40;
+      std::vector<vector_el_t> vectors(list_length * vector_dim);
+      std::vector<vector_id_t> ids(list_length);
+      for (vector_el_t &element : vectors)
+      {
+        element = gen_component(rng);
+      }
+      for (vector_id_t &id : ids)
+      {
+        id = next_id++;
+      }
+      lists.insert_entries(list_id, vectors.data(), ids.data(), list_length);
+    }
+    lists.flush();
+    for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+    {
+      lists_to_read.push_back({list_id, lists.get_list_layout(list_id)});
+    }
+
+    auto require_list_read = [&](const ListBuffer &list)
+    {
+      const ListLayout &layout = list.layout;
+      REQUIRE(layout.offset == lists.get_list_layout(list.list_id).offset);
+      REQUIRE(memcmp(list.data, lists.get_vectors(list.list_id), layout.length * vector_dim * sizeof(vector_el_t)) == 0);
+      REQUIRE(memcmp(list.data + layout.ids_offset, lists.get_ids(list.list_id), layout.length * sizeof(vector_id_t)) == 0);
+    };
+
+    WHEN("a reader is created for the lists file")
+    {
+      AsyncListReader reader(file);
+
+      THEN("the lists are read with io_uring and O_DIRECT where the kernel and file system support them")
+      {
+        REQUIRE(reader.is_async() == is_io_uring_available());
+        REQUIRE(reader.is_direct_io() == is_direct_io_supported(file));
+      }
+    }
+    WHEN("the lists are read with io_uring or pread(), at most a block per read or at once, and the reader is reused")
+    {
+      bool use_io_uring = GENERATE(true, false);
+      size_t max_read_size = GENERATE(0, ASYNC_READ_ALIGNMENT);
+      len_t queue_depth = GENERATE(1, 4);
+      AsyncListReader reader(file, queue_depth, max_read_size, use_io_uring);
+      std::vector<std::multiset<list_id_t>> lists_read(2);
+      for (std::multiset<list_id_t> &list_ids : lists_read)
+      {
+        reader.read_lists(lists_to_read, [&](const ListBuffer &list)
+                          {
+                            require_list_read(list);
+                            list_ids.insert(list.list_id);
+                          });
+      }
+
+      THEN("every list is read once per call and equals the list in the mapped region")
+      {
+        REQUIRE(reader.is_async() == (use_io_uring && is_io_uring_available()));
+        for (const std::multiset<list_id_t> &list_ids : lists_read)
+        {
+          REQUIRE(list_ids.size() == n_lists);
+          REQUIRE(std::set<list_id_t>(list_ids.begin(), list_ids.end()).size() == n_lists);
+        }
+      }
+    }
+    WHEN("a list extends beyond the end of the file")
+    {
+      bool use_io_uring = GENERATE(true, false);
+      size_t max_read_size = GENERATE(0, ASYNC_READ_ALIGNMENT);
+      AsyncListReader reader(file, 4, max_read_size, use_io_uring);
+      std::vector<std::pair<list_id_t, ListLayout>> lists_beyond_end = lists_to_read;
+      ListLayout &layout = lists_beyond_end.back().second;
+      layout.offset = lists.get_total_size() + 2 * ASYNC_READ_ALIGNMENT;
+
+      THEN("reading the lists fails and the reader still reads the lists afterwards")
+      {
+        REQUIRE_THROWS_AS(reader.read_lists(lists_beyond_end, [](const ListBuffer &) {}), std::runtime_error);
+        len_t n_lists_read = 0;
+        reader.read_lists(lists_to_read, [&](const ListBuffer &list)
+                          {
+                            require_list_read(list);
+                            n_lists_read++;
+                          });
+        REQUIRE(n_lists_read == n_lists);
+      }
+    }
+    WHEN("processing a list read fails")
+    {
+      bool use_io_uring = GENERATE(true, false);
+      AsyncListReader reader(file, 4, 0, use_io_uring);
+
+      THEN("the error is rethrown once the reads in flight are done")
+      {
+        REQUIRE_THROWS_WITH(reader.read_lists(lists_to_read, [](const ListBuffer &list)
+                                              {
+                                                if (list.list_id == 3)
+                                                {
+                                                  throw std::logic_error("list 3");
+                                                } }),
+                            "list 3");
+      }
+    }
+    WHEN("the reader is created with an invalid configuration")
+    {
+      THEN("it throws")
+      {
+        REQUIRE_THROWS_AS(AsyncListReader(file, 0), std::invalid_argument);
+        REQUIRE_THROWS_AS(AsyncListReader(file, 4, ASYNC_READ_ALIGNMENT + 1), std::invalid_argument);
+        REQUIRE_THROWS_AS(AsyncListReader(join(TMP_DIR, "missing_" + get_lists_filename())), std::runtime_error);
+      }
+    }
+  }
+}
@@ -0,0 +1,99 @@
+#include <thread>
+#include <atomic>
+#include <vector>
+
+#include "../lib/catch.hpp"
+
+#include "../include/storage-node/EpochManager.hpp"
+
+using namespace ann_dkvs;
+
+SCENARIO("EpochManager: retired items are reclaimed once no reader can see them", "[EpochManager][test]")
+{
+  GIVEN("an epoch manager")
+  {
+    EpochManager epoch_manager;
+    len_t n_reclaimed = 0;
+    auto retire_item = [&]
+    {
+      epoch_manager.retire([&n_reclaimed]
+                           { n_reclaimed++; });
+      epoch_manager.advance();
+    };
+
+    WHEN("an item is retired while no reader is pinned")
+    {
+      retire_item();
+
+      THEN("it is reclaimed right away")
+      {
+        REQUIRE(epoch_manager.reclaim() == 1);
+        REQUIRE(n_reclaimed == 1);
+        REQUIRE(epoch_manager.get_n_retired() == 0);
+      }
+    }
+    WHEN("items are retired before and after a reader is pinned")
+    {
+      retire_item();
+      EpochManager::Guard guard = epoch_manager.pin();
+      retire_item();
+      retire_item();
+
+      THEN("only the items retired before the reader was pinned are reclaimed")
+      {
+        REQUIRE(epoch_manager.get_n_pinned() == 1);
+        REQUIRE(epoch_manager.reclaim() == 1);
+        REQUIRE(epoch_manager.get_n_retired() == 2);
+      }
+      AND_WHEN("the reader is unpinned")
+      {
+        guard = EpochManager::Guard();
+
+        THEN("the remaining items are reclaimed")
+        {
+          REQUIRE(epoch_manager.get_n_pinned() == 0);
+          REQUIRE(epoch_manager.reclaim() == 3);
+          REQUIRE(n_reclaimed == 3);
+        }
+      }
+    }
+    WHEN("more readers than reader slots pin and unpin the epoch concurrently")
+    {
+      std::atomic<len_t> n_pins(0);
+      std::vector<std::thread> readers;
+      for (len_t r = 0; r < 2 * EPOCH_MAX_READERS; r++)
+      {
+        readers.emplace_back([&]
+                             {
+                               for (len_t i = 0; i < 10; i++)
+                               {
+                                 EpochManager::Guard guard = epoch_manager.pin();
+                                 n_pins++;
+                               } });
+      }
+      for (std::thread &reader : readers)
+      {
+        reader.join();
+      }
+
+      THEN("every reader is pinned eventually and every slot is released")
+      {
+        REQUIRE(n_pins == 20 * EPOCH_MAX_READERS);
+        REQUIRE(epoch_manager.get_n_pinned() == 0);
+      }
+    }
+    WHEN("the epoch manager is destroyed")
+    {
+      {
+        EpochManager other_epoch_manager;
+        other_epoch_manager.retire([&n_reclaimed]
+                                   { n_reclaimed++; });
+      }
+
+      THEN("its retired items are reclaimed")
+      {
+        REQUIRE(n_reclaimed == 1);
+      }
+    }
+  }
+}
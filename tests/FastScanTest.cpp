@@ -0,0 +1,82 @@
+#include <random>
+#include <vector>
+
+#include "../lib/catch.hpp"
+
+#include "../include/FastScan.hpp"
+
+using namespace ann_dkvs;
+
+SCENARIO("FastScanTable: codes in the fast-scan layout are looked up in a quantized table", "[FastScan][test]")
+{
+  GIVEN("a random table and random 4-bit codes")
+  {
+    len_t n_subvectors = GENERATE(1, 2, 7, 8, 64);
+    len_t n_codes = GENERATE(1, 31, 32, 33, 100);
+    size_t code_size = (n_subvectors + 1) / 2;
+    std::mt19937 rng(n_subvectors * 1000 + n_codes);
+    std::uniform_real_distribution<distance_t> gen_entry(-10, 10);
+    std::uniform_int_distribution<int> gen_centroid(0, FAST_SCAN_N_CENTROIDS - 1);
+    std::vector<distance_t> table(n_subvectors * FAST_SCAN_N_CENTROIDS);
+    for (distance_t &entry : table)
+    {
+      entry = gen_entry(rng);
+    }
+    std::vector<uint8_t> codes(n_codes * code_size, 0);
+    std::vector<distance_t> expected(n_codes, 0);
+    for (len_t i = 0; i < n_codes; i++)
+    {
+      for (len_t m = 0; m < n_subvectors; m++)
+      {
+        int centroid = gen_centroid(rng);
+        codes[i * code_size + m / 2] |= (uint8_t)(centroid << (4 * (m % 2)));
+        expected[i] += table[m * FAST_SCAN_N_CENTROIDS + centroid];
+      }
+    }
+
+    WHEN("the codes are interleaved into fast-scan blocks")
+    {
+      std::vector<uint8_t> blocks(get_fast_scan_size(n_codes, code_size), 0xFF);
+      for (len_t i = 0; i < n_codes; i++)
+      {
+        set_fast_scan_code(blocks.data(), code_size, i, &codes[i * code_size]);
+      }
+
+      THEN("the blocks take up whole blocks")
+      {
+        REQUIRE(blocks.size() % (FAST_SCAN_BLOCK_SIZE * code_size) == 0);
+        REQUIRE(blocks.size() >= n_codes * code_size);
+      }
+
+      THEN("the codes can be read back")
+      {
+        std::vector<uint8_t> code(code_size);
+        for (len_t i = 0; i < n_codes; i++)
+        {
+          get_fast_scan_code(blocks.data(), code_size, i, code.data());
+          for (size_t j = 0; j < code_size; j++)
+          {
+            REQUIRE(code[j] == codes[i * code_size + j]);
+          }
+        }
+      }
+
+      AND_WHEN("the blocks are scanned with a quantized table")
+      {
+        FastScanTable fast_scan_table(table.data(), n_subvectors);
+        std::vector<distance_t> distances(n_codes);
+        fast_scan_table.scan(blocks.data(), n_codes, distances.data());
+
+        THEN("the approximate sums are within the quantization error of the exact sums")
+        {
+          distance_t max_error = fast_scan_table.get_max_error();
+          REQUIRE(max_error > 0);
+          for (len_t i = 0; i < n_codes; i++)
+          {
+            REQUIRE(distances[i] == Approx(expected[i]).margin(max_error + 1e-3));
+          }
+        }
+      }
+    }
+  }
+}
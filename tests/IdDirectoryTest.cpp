@@ -0,0 +1,110 @@
+#include <random>
+#include <unordered_map>
+#include <fstream>
+
+#include "../lib/catch.hpp"
+
+#include "../include/tests/StorageListsTestUtils.hpp"
+#include "../include/storage-node/IdDirectory.hpp"
+
+using namespace ann_dkvs;
+
+SCENARIO("IdDirectory: vector ids are mapped to the locations of their entries", "[IdDirectory][test]")
+{
+  GIVEN("an empty directory")
+  {
+    std::string file = join(TMP_DIR, "directory" + get_lists_filename() + ID_DIRECTORY_FILE_EXT);
+    remove(file.c_str());
+    IdDirectory *directory = new IdDirectory(file);
+
+    WHEN("ids are set and removed at random")
+    {
+      // the ids are drawn from a small range so that ids are set and removed repeatedly
+      std::mt19937 rng(42);
+      std::uniform_int_distribution<vector_id_t> gen_id(-1000, 5000);
+      std::unordered_map<vector_id_t, EntryLocation> expected;
+      for (len_t i = 0; i < 50000; i++)
+      {
+        vector_id_t id = gen_id(rng);
+        if (i % 3 == 0)
+        {
+          REQUIRE(directory->remove(id) == (expected.erase(id) == 1));
+        }
+        else
+        {
+          EntryLocation location = {(list_id_t)(i % 7), i};
+          directory->set(id, location);
+          expected[id] = location;
+        }
+      }
+
+      THEN("every id is found at its last location and no other id is found")
+      {
+        REQUIRE(directory->get_length() == expected.size());
+        for (vector_id_t id = -1000; id <= 5000; id++)
+        {
+          EntryLocation location;
+          auto expected_it = expected.find(id);
+          REQUIRE(directory->find(id, location) == (expected_it != expected.end()));
+          if (expected_it != expected.end())
+          {
+            REQUIRE(location.list_id == expected_it->second.list_id);
+            REQUIRE(location.offset == expected_it->second.offset);
+          }
+        }
+      }
+    }
+    WHEN("an id is removed at a location it is not stored at")
+    {
+      directory->set(1, {2, 3});
+
+      THEN("it is only removed at its own location")
+      {
+        REQUIRE(!directory->remove(1, {2, 4}));
+        REQUIRE(!directory->remove(1, {3, 3}));
+        REQUIRE(directory->remove(1, {2, 3}));
+        REQUIRE(directory->get_length() == 0);
+      }
+    }
+    WHEN("the directory is synced and opened again")
+    {
+      for (vector_id_t id = 0; id < 100; id++)
+      {
+        directory->set(id, {id % 3, (len_t)id});
+      }
+      directory->sync(17);
+      delete directory;
+      directory = new IdDirectory(file);
+
+      THEN("it keeps its ids and its token until it is modified")
+      {
+        REQUIRE(directory->get_token() == 17);
+        REQUIRE(directory->get_length() == 100);
+        EntryLocation location;
+        REQUIRE(directory->find(50, location));
+        REQUIRE(location.list_id == 2);
+        REQUIRE(location.offset == 50);
+        directory->remove(50);
+        REQUIRE(directory->get_token() == 0);
+        delete directory;
+        directory = new IdDirectory(file);
+        REQUIRE(directory->get_token() == 0);
+      }
+    }
+    WHEN("the file is not a valid directory")
+    {
+      delete directory;
+      std::ofstream(file, std::ios::binary | std::ios::trunc) << "not a directory";
+      directory = new IdDirectory(file);
+
+      THEN("it is replaced by an empty directory")
+      {
+        REQUIRE(directory->get_length() == 0);
+        REQUIRE(directory->get_token() == 0);
+        directory->set(1, {0, 0});
+        REQUIRE(directory->get_length() == 1);
+      }
+    }
+    delete directory;
+  }
+}
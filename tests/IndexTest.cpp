@@ -1,6 +1,9 @@
 #include <sys/mman.h>
+#include <unistd.h>
 #include <unordered_set>
+#include <algorithm>
 #include <cmath>
+#include <random>
 
 #include "../lib/catch.hpp"
 
@@ -106,6 +109,539 @@ SCENARIO("search_preassigned(): use index to find top k ANN of a query vector",
   }
 }
 
+SCENARIO("search_preassigned(): use index to find top k ANN with the inner product and cosine metrics", "[StorageIndex][search_preassigned][test][hard-coded][metric]")
+{
+  GIVEN("a list of 2D vectors, corresponding vector ids and list ids")
+  {
+    len_t vector_dim = 2;
+    len_t list1_length = 2;
+    vector_el_t vectors_list1[] = {1, 0, 0, 1};
+    vector_id_t ids_list1[] = {1, 2};
+
+    len_t list2_length = 3;
+    vector_el_t vectors_list2[] = {2, 2, -1, 0, 10, -1};
+    vector_id_t ids_list2[] = {3, 4, 5};
+
+    vector_el_t query_vector[] = {1, 0.5};
+    len_t n_results = 4;
+    list_id_t list_ids_to_probe[] = {1, 2};
+    len_t n_probes = 2;
+    Query query = Query(query_vector, list_ids_to_probe, n_results, n_probes);
+
+    WHEN("the vectors are stored and searched with the inner product metric")
+    {
+      std::string file = join(TMP_DIR, get_lists_filename());
+      remove(file.c_str());
+      StorageLists lists(vector_dim, file, METRIC_INNER_PRODUCT);
+      lists.insert_entries(1, vectors_list1, ids_list1, list1_length);
+      lists.insert_entries(2, vectors_list2, ids_list2, list2_length);
+      StorageIndex index(&lists);
+      QueryResults results = index.search_preassigned(&query);
+
+      THEN("the results are ordered by decreasing inner product")
+      {
+        REQUIRE(results.size() == n_results);
+        CHECK(results[0].vector_id == 5);
+        CHECK(results[0].distance == Approx(1 - 9.5));
+        CHECK(results[1].vector_id == 3);
+        CHECK(results[1].distance == Approx(1 - 3));
+        CHECK(results[2].vector_id == 1);
+        CHECK(results[2].distance == Approx(1 - 1));
+        CHECK(results[3].vector_id == 2);
+        CHECK(results[3].distance == Approx(1 - 0.5));
+      }
+    }
+
+    WHEN("the vectors are stored and searched with the cosine metric")
+    {
+      std::string file = join(TMP_DIR, get_lists_filename());
+      remove(file.c_str());
+      StorageLists lists(vector_dim, file, METRIC_COSINE);
+      lists.insert_entries(1, vectors_list1, ids_list1, list1_length);
+      lists.insert_entries(2, vectors_list2, ids_list2, list2_length);
+      StorageIndex index(&lists);
+      QueryResults results = index.search_preassigned(&query);
+
+      THEN("the results are ordered by decreasing cosine similarity")
+      {
+        float query_norm = std::sqrt(1.25);
+        REQUIRE(results.size() == n_results);
+        CHECK(results[0].vector_id == 3);
+        CHECK(results[0].distance == Approx(1 - 3 / (std::sqrt(8) * query_norm)));
+        CHECK(results[1].vector_id == 1);
+        CHECK(results[1].distance == Approx(1 - 1 / query_norm));
+        CHECK(results[2].vector_id == 5);
+        CHECK(results[2].distance == Approx(1 - 9.5 / (std::sqrt(101) * query_norm)));
+        CHECK(results[3].vector_id == 2);
+        CHECK(results[3].distance == Approx(1 - 0.5 / query_norm));
+      }
+    }
+  }
+}
+
+SCENARIO("preassign_query(): the nearest centroids depend on the metric", "[RootIndex][preassign_query][test][hard-coded][metric]")
+{
+  GIVEN("2D centroids and a query vector")
+  {
+    len_t vector_dim = 2;
+    vector_el_t centroids[] = {1, 0, 100, 100, -1, 0};
+    len_t n_centroids = 3;
+    vector_el_t query_vector[] = {1, 0.9};
+
+    WHEN("the nearest centroid is searched with the L2 metric")
+    {
+      RootIndex root_index(vector_dim, centroids, n_centroids, METRIC_L2);
+      Query query(query_vector, 1, 1);
+      root_index.preassign_query(&query);
+
+      THEN("the closest centroid is selected")
+      {
+        REQUIRE(query.get_list_to_probe(0) == 0);
+      }
+    }
+
+    WHEN("the nearest centroid is searched with the cosine metric")
+    {
+      RootIndex root_index(vector_dim, centroids, n_centroids, METRIC_COSINE);
+      Query query(query_vector, 1, 1);
+      root_index.preassign_query(&query);
+
+      THEN("the centroid with the most similar direction is selected")
+      {
+        REQUIRE(query.get_list_to_probe(0) == 1);
+      }
+    }
+  }
+}
+
+SCENARIO("add(): vectors are inserted into the lists of their nearest centroids", "[RootIndex][add][test][random]")
+{
+  GIVEN("a root index and lists of which one holds entries already")
+  {
+    len_t vector_dim = 8;
+    len_t n_lists = 16;
+    len_t n_vectors = 500;
+    len_t n_old_entries = 5;
+    list_id_t old_list_id = 3;
+    metric_t metric = GENERATE(METRIC_L2, METRIC_COSINE);
+    std::mt19937 rng(metric + 11);
+    std::uniform_int_distribution<int> gen_component(-8, 8);
+    std::vector<vector_el_t> centroids(n_lists * vector_dim);
+    std::vector<vector_el_t> vectors(n_vectors * vector_dim);
+    std::vector<vector_id_t> ids(n_vectors);
+    for (vector_el_t &element : centroids)
+    {
+      element = (vector_el_t)gen_component(rng);
+    }
+    for (vector_el_t &element : vectors)
+    {
+      element = (vector_el_t)gen_component(rng);
+    }
+    for (len_t i = 0; i < n_vectors; i++)
+    {
+      ids[i] = 1000 + i;
+    }
+    std::string file = join(TMP_DIR, get_lists_filename());
+    remove(file.c_str());
+    StorageLists lists(vector_dim, file, metric);
+    lists.insert_entries(old_list_id, vectors.data(), ids.data(), n_old_entries);
+    RootIndex root_index(vector_dim, centroids.data(), n_lists, metric);
+
+    WHEN("a batch of vectors is added and inserted into the lists it is assigned to")
+    {
+      std::vector<list_id_t> list_ids = root_index.add(vectors.data(), n_vectors);
+      lists.batch_insert_entries(list_ids.data(), vectors.data(), ids.data(), n_vectors);
+
+      THEN("every vector is appended to the list a query for it would probe first, in the order of the batch")
+      {
+        std::unordered_map<list_id_t, std::vector<vector_id_t>> expected_ids;
+        expected_ids[old_list_id].assign(ids.begin(), ids.begin() + n_old_entries);
+        for (len_t i = 0; i < n_vectors; i++)
+        {
+          Query query(&vectors[i * vector_dim], 1, 1);
+          root_index.preassign_query(&query);
+          REQUIRE(list_ids[i] == query.get_list_to_probe(0));
+          expected_ids[query.get_list_to_probe(0)].push_back(ids[i]);
+        }
+        len_t n_entries = 0;
+        for (const auto &entry : expected_ids)
+        {
+          REQUIRE(lists.get_list_length(entry.first) == entry.second.size());
+          are_ids_equal(lists.get_ids(entry.first), entry.second.data(), entry.second.size());
+          n_entries += entry.second.size();
+        }
+        REQUIRE(lists.get_length() == expected_ids.size());
+        REQUIRE(n_entries == n_vectors + n_old_entries);
+        const vector_id_t *old_list_ids = lists.get_ids(old_list_id);
+        const vector_el_t *old_list_vectors = lists.get_vectors(old_list_id);
+        for (len_t j = 0; j < lists.get_list_length(old_list_id); j++)
+        {
+          are_vectors_equal(&old_list_vectors[j * vector_dim], &vectors[(old_list_ids[j] - 1000) * vector_dim], vector_dim, 1);
+        }
+      }
+    }
+    WHEN("a batch of vectors is inserted into lists read concurrently")
+    {
+      lists.enable_concurrent_reads();
+      std::vector<list_id_t> list_ids = root_index.add(vectors.data(), n_vectors);
+      lists.batch_insert_entries(list_ids.data(), vectors.data(), ids.data(), n_vectors);
+
+      THEN("the published lists hold the whole batch")
+      {
+        std::unordered_set<list_id_t> inserted_lists(list_ids.begin(), list_ids.end());
+        inserted_lists.insert(old_list_id);
+        len_t n_entries = 0;
+        for (list_id_t list_id : inserted_lists)
+        {
+          n_entries += lists.get_list_layout(list_id).length;
+        }
+        REQUIRE(n_entries == n_vectors + n_old_entries);
+      }
+    }
+  }
+}
+
+SCENARIO("build_centroid_groups(): grouped centroids are preassigned with high recall", "[RootIndex][preassign_query][centroid_groups][test][random]")
+{
+  GIVEN("clustered centroids, queries drawn from the same clusters and a root index comparing every centroid")
+  {
+    len_t vector_dim = 16;
+    len_t n_centroids = 2048;
+    len_t n_clusters = 32;
+    len_t n_queries = 200;
+    len_t n_probe = 16;
+    len_t n_groups = 64;
+    metric_t metric = GENERATE(METRIC_L2, METRIC_COSINE);
+    std::mt19937 rng(metric + 7);
+    std::normal_distribution<vector_el_t> gen_center(0, 10);
+    std::normal_distribution<vector_el_t> gen_noise(0, 10);
+    std::uniform_int_distribution<len_t> gen_cluster(0, n_clusters - 1);
+    std::vector<vector_el_t> centers(n_clusters * vector_dim);
+    for (vector_el_t &element : centers)
+    {
+      element = gen_center(rng);
+    }
+    auto gen_clustered_vectors = [&](len_t n_vectors)
+    {
+      std::vector<vector_el_t> vectors(n_vectors * vector_dim);
+      for (len_t i = 0; i < n_vectors; i++)
+      {
+        len_t cluster = gen_cluster(rng);
+        for (len_t j = 0; j < vector_dim; j++)
+        {
+          vectors[i * vector_dim + j] = centers[cluster * vector_dim + j] + gen_noise(rng);
+        }
+      }
+      return vectors;
+    };
+    std::vector<vector_el_t> centroids = gen_clustered_vectors(n_centroids);
+    std::vector<vector_el_t> query_vectors = gen_clustered_vectors(n_queries);
+    RootIndex exact_index(vector_dim, centroids.data(), n_centroids, metric);
+    RootIndex grouped_index(vector_dim, centroids.data(), n_centroids, metric);
+    auto get_lists_to_probe = [&](RootIndex &index, len_t i, len_t n_probe)
+    {
+      Query query(&query_vectors[i * vector_dim], 1, n_probe);
+      index.preassign_query(&query);
+      std::vector<list_id_t> list_ids(n_probe);
+      for (len_t j = 0; j < n_probe; j++)
+      {
+        list_ids[j] = query.get_list_to_probe(j);
+      }
+      return list_ids;
+    };
+
+    WHEN("the centroids are grouped and a fraction of the groups is probed")
+    {
+      grouped_index.build_centroid_groups(n_groups, 8);
+
+      THEN("most of the nearest centroids are found and more are found if more groups are probed")
+      {
+        REQUIRE(grouped_index.get_n_groups() == n_groups);
+        REQUIRE(grouped_index.get_n_groups_to_probe() == 8);
+        auto get_recall = [&]()
+        {
+          len_t n_found = 0;
+          for (len_t i = 0; i < n_queries; i++)
+          {
+            std::vector<list_id_t> expected = get_lists_to_probe(exact_index, i, n_probe);
+            std::vector<list_id_t> actual = get_lists_to_probe(grouped_index, i, n_probe);
+            std::unordered_set<list_id_t> expected_set(expected.begin(), expected.end());
+            for (list_id_t list_id : actual)
+            {
+              n_found += expected_set.count(list_id);
+            }
+          }
+          return (float)n_found / (n_queries * n_probe);
+        };
+        float recall = get_recall();
+        grouped_index.set_n_groups_to_probe(16);
+        float recall_more_groups = get_recall();
+        WARN("recall := " << recall);
+        WARN("recall_more_groups := " << recall_more_groups);
+        REQUIRE(recall >= 0.85f);
+        REQUIRE(recall_more_groups > recall);
+      }
+    }
+    WHEN("every group is probed or the probed groups hold too few centroids")
+    {
+      grouped_index.build_centroid_groups(n_groups, 1);
+      std::vector<len_t> n_groups_to_probe = {n_groups, 1};
+      std::vector<len_t> n_probes = {n_probe, n_centroids};
+
+      THEN("the nearest centroids are found in the order of the exact search")
+      {
+        for (len_t k = 0; k < n_probes.size(); k++)
+        {
+          grouped_index.set_n_groups_to_probe(n_groups_to_probe[k]);
+          for (len_t i = 0; i < n_queries; i += 10)
+          {
+            REQUIRE(get_lists_to_probe(grouped_index, i, n_probes[k]) == get_lists_to_probe(exact_index, i, n_probes[k]));
+          }
+        }
+      }
+    }
+    WHEN("the groups are removed")
+    {
+      grouped_index.build_centroid_groups(n_groups, 1);
+      grouped_index.build_centroid_groups(0, 0);
+
+      THEN("every centroid is compared again")
+      {
+        REQUIRE(grouped_index.get_n_groups() == 0);
+        for (len_t i = 0; i < n_queries; i += 10)
+        {
+          REQUIRE(get_lists_to_probe(grouped_index, i, n_probe) == get_lists_to_probe(exact_index, i, n_probe));
+        }
+      }
+    }
+    WHEN("the number of groups or groups to probe is out of range")
+    {
+      THEN("the groups are rejected")
+      {
+        REQUIRE_THROWS_AS(grouped_index.build_centroid_groups(n_centroids + 1, 1), std::invalid_argument);
+        REQUIRE_THROWS_AS(grouped_index.build_centroid_groups(n_groups, 0), std::invalid_argument);
+        REQUIRE_THROWS_AS(grouped_index.build_centroid_groups(n_groups, n_groups + 1), std::invalid_argument);
+        REQUIRE_THROWS_AS(grouped_index.set_n_groups_to_probe(1), std::logic_error);
+        grouped_index.build_centroid_groups(n_groups, 1);
+        REQUIRE_THROWS_AS(grouped_index.set_n_groups_to_probe(n_groups + 1), std::invalid_argument);
+      }
+    }
+  }
+}
+
+SCENARIO("batch_search_preassigned(): batched search returns the same results as searching each query", "[StorageIndex][batch_search_preassigned][test][random]")
+{
+  GIVEN("lists of random vectors")
+  {
+    len_t vector_dim = 19;
+    len_t n_lists = 8;
+    len_t n_queries = 40;
+    len_t n_results = 10;
+    len_t n_probes = 3;
+    metric_t metric = GENERATE(METRIC_L2, METRIC_INNER_PRODUCT, METRIC_COSINE);
+    std::mt19937 rng(metric);
+    std::uniform_real_distribution<vector_el_t> gen_component(-1, 1);
+    std::string file = join(TMP_DIR, get_lists_filename());
+    remove(file.c_str());
+    StorageLists lists(vector_dim, file, metric);
+    vector_id_t next_id = 0;
+    for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+    {
+      // some lists span several scan blocks, some are shorter than n_results
+      len_t list_length = list_id * 150 + 5;
+      std::vector<vector_el_t> vectors(list_length * vector_dim);
+      std::vector<vector_id_t> ids(list_length);
+      for (len_t i = 0; i < vectors.size(); i++)
+      {
+        vectors[i] = gen_component(rng);
+      }
+      for (len_t i = 0; i < list_length; i++)
+      {
+        ids[i] = next_id++;
+      }
+      lists.insert_entries(list_id, vectors.data(), ids.data(), list_length);
+    }
+    StorageIndex index(&lists);
+
+    AND_GIVEN("a batch of queries probing overlapping lists")
+    {
+      std::vector<vector_el_t> query_vectors(n_queries * vector_dim);
+      std::vector<list_id_t> lists_to_probe(n_queries * n_probes);
+      for (len_t i = 0; i < query_vectors.size(); i++)
+      {
+        query_vectors[i] = gen_component(rng);
+      }
+      QueryBatch queries;
+      for (len_t i = 0; i < n_queries; i++)
+      {
+        for (len_t j = 0; j < n_probes; j++)
+        {
+          lists_to_probe[i * n_probes + j] = (i + j * 3) % n_lists;
+        }
+        queries.push_back(new Query(&query_vectors[i * vector_dim], &lists_to_probe[i * n_probes], n_results, n_probes));
+      }
+
+      WHEN("the batch is searched")
+      {
+        QueryResultsBatch results = index.batch_search_preassigned(queries);
+
+        THEN("the results of every query equal the results of searching the query on its own")
+        {
+          REQUIRE(results.size() == n_queries);
+          for (len_t i = 0; i < n_queries; i++)
+          {
+            QueryResults expected = index.search_preassigned(queries[i]);
+            REQUIRE(results[i].size() == expected.size());
+            for (len_t j = 0; j < expected.size(); j++)
+            {
+              CHECK(results[i][j].vector_id == expected[j].vector_id);
+              CHECK(results[i][j].distance == Approx(expected[j].distance).margin(1e-4));
+            }
+          }
+        }
+        THEN("every query finds the nearest neighbors among the entries of its probed lists")
+        {
+          distance_func_t distance_func = Space::create(metric, vector_dim).get_distance_func();
+          size_t dim = vector_dim;
+          len_t n_found = 0;
+          for (len_t i = 0; i < n_queries; i++)
+          {
+            std::vector<std::pair<distance_t, vector_id_t>> neighbors;
+            for (len_t p = 0; p < n_probes; p++)
+            {
+              list_id_t list_id = queries[i]->get_list_to_probe(p);
+              const vector_el_t *list_vectors = lists.get_vectors(list_id);
+              const vector_id_t *list_ids = lists.get_ids(list_id);
+              for (len_t j = 0; j < lists.get_list_length(list_id); j++)
+              {
+                neighbors.push_back({distance_func(&list_vectors[j * vector_dim], queries[i]->get_query_vector(), &dim), list_ids[j]});
+              }
+            }
+            std::sort(neighbors.begin(), neighbors.end());
+            std::unordered_set<vector_id_t> nearest_ids;
+            for (len_t j = 0; j < n_results; j++)
+            {
+              nearest_ids.insert(neighbors[j].second);
+            }
+            REQUIRE(results[i].size() == n_results);
+            for (len_t j = 0; j < n_results; j++)
+            {
+              n_found += nearest_ids.count(results[i][j].vector_id);
+              CHECK(results[i][j].distance == Approx(neighbors[j].first).margin(1e-4));
+            }
+          }
+          // neighbors at almost the same distance may be swapped by rounding errors
+          REQUIRE((float)n_found / (n_queries * n_results) >= 0.99f);
+        }
+      }
+      WHEN("the lists are written back and the batch is searched with asynchronous reads of the lists")
+      {
+        lists.flush();
+        len_t queue_depth = GENERATE(1, 3, ASYNC_READ_QUEUE_DEPTH);
+        index.enable_async_reads(queue_depth);
+        const AsyncListReader *reader = index.get_async_reader();
+        QueryResultsBatch first_results = index.batch_search_preassigned(queries);
+        QueryResultsBatch results = index.batch_search_preassigned(queries);
+        const AsyncListReader *reused_reader = index.get_async_reader();
+        index.disable_async_reads();
+
+        THEN("one reader is created and reused by every batch until async reads are disabled")
+        {
+          REQUIRE(reader != nullptr);
+          REQUIRE(reused_reader == reader);
+          REQUIRE(index.get_async_reader() == nullptr);
+          REQUIRE(first_results.size() == results.size());
+          for (len_t i = 0; i < n_queries; i++)
+          {
+            REQUIRE(first_results[i].size() == results[i].size());
+            for (len_t j = 0; j < results[i].size(); j++)
+            {
+              CHECK(first_results[i][j].vector_id == results[i][j].vector_id);
+            }
+          }
+        }
+        THEN("the results of every query equal the results of searching the mapped lists")
+        {
+          REQUIRE(results.size() == n_queries);
+          for (len_t i = 0; i < n_queries; i++)
+          {
+            QueryResults expected = index.search_preassigned(queries[i]);
+            REQUIRE(results[i].size() == expected.size());
+            for (len_t j = 0; j < expected.size(); j++)
+            {
+              CHECK(results[i][j].vector_id == expected[j].vector_id);
+              CHECK(results[i][j].distance == Approx(expected[j].distance).margin(1e-4));
+            }
+          }
+        }
+      }
+      WHEN("the lists are backed by huge pages, spread across NUMA nodes and the batch is searched")
+      {
+        // nodes which do not exist are only placed on by the kernel,
+        // but the lists are still searched by node; chunks of a page
+        // spread even the small lists of the test across the nodes
+        len_t n_numa_nodes = GENERATE(2, 3);
+        lists.set_mapping_policy({true, n_numa_nodes, (size_t)sysconf(_SC_PAGESIZE)});
+        lists.place_lists_on_numa_nodes();
+        QueryResultsBatch results = index.batch_search_preassigned(queries);
+        lists.set_mapping_policy({false, 1, 0});
+
+        THEN("the results of every query equal the results of searching the query on its own")
+        {
+          REQUIRE(results.size() == n_queries);
+          for (len_t i = 0; i < n_queries; i++)
+          {
+            QueryResults expected = index.search_preassigned(queries[i]);
+            REQUIRE(results[i].size() == expected.size());
+            for (len_t j = 0; j < expected.size(); j++)
+            {
+              CHECK(results[i][j].vector_id == expected[j].vector_id);
+              CHECK(results[i][j].distance == Approx(expected[j].distance).margin(1e-4));
+            }
+          }
+        }
+      }
+      WHEN("every other entry is deleted and the batch is searched")
+      {
+        std::vector<vector_id_t> ids_to_delete;
+        for (vector_id_t id = 0; id < next_id; id += 2)
+        {
+          ids_to_delete.push_back(id);
+        }
+        for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+        {
+          lists.delete_entries(list_id, ids_to_delete.data(), ids_to_delete.size());
+        }
+        QueryResultsBatch results = index.batch_search_preassigned(queries);
+
+        THEN("the results equal the results of searching the lists once the deleted entries are removed")
+        {
+          for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+          {
+            lists.compact_list(list_id);
+          }
+          REQUIRE(results.size() == n_queries);
+          for (len_t i = 0; i < n_queries; i++)
+          {
+            QueryResults expected = index.search_preassigned(queries[i]);
+            REQUIRE(results[i].size() == expected.size());
+            for (len_t j = 0; j < expected.size(); j++)
+            {
+              CHECK(results[i][j].vector_id % 2 == 1);
+              CHECK(results[i][j].vector_id == expected[j].vector_id);
+              CHECK(results[i][j].distance == Approx(expected[j].distance).margin(1e-4));
+            }
+          }
+        }
+      }
+      for (Query *query : queries)
+      {
+        delete query;
+      }
+    }
+  }
+}
+
 auto setup_indices_and_run = [](len_t n_probes,
                                 len_t n_lists,
                                 len_t n_entries,
@@ -0,0 +1,123 @@
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <fstream>
+
+#include "../lib/catch.hpp"
+
+#include "../include/tests/StorageListsTestUtils.hpp"
+#include "../include/storage-node/InputFileSorter.hpp"
+
+using namespace ann_dkvs;
+
+template <typename T>
+static std::vector<T> read_file(const std::string &filename)
+{
+  std::vector<T> values(get_file_size(filename) / sizeof(T));
+  std::ifstream file(filename, std::ios::in | std::ios::binary);
+  REQUIRE(file.read((char *)values.data(), values.size() * sizeof(T)));
+  return values;
+}
+
+SCENARIO("InputFileSorter: input files are sorted by list id with a bounded memory budget", "[InputFileSorter][test]")
+{
+  GIVEN("input files of entries whose lists have very different lengths")
+  {
+    len_t vector_dim = 8;
+    len_t n_lists = 20;
+    std::mt19937 rng(7);
+    std::vector<list_id_t> list_ids;
+    for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+    {
+      // list 3 is larger than most of the memory budgets below
+      len_t list_length = list_id == 3 ? 2000 : rng() % 50;
+      list_ids.insert(list_ids.end(), list_length, list_id * 13 - 40);
+    }
+    std::shuffle(list_ids.begin(), list_ids.end(), rng);
+    len_t n_entries = list_ids.size();
+    std::vector<vector_id_t> ids(n_entries);
+    std::iota(ids.begin(), ids.end(), 0);
+    std::vector<vector_el_t> vectors(n_entries * vector_dim);
+    std::uniform_real_distribution<vector_el_t> gen_component(-1, 1);
+    for (vector_el_t &element : vectors)
+    {
+      element = gen_component(rng);
+    }
+
+    std::string vectors_filepath = join(TMP_DIR, get_vectors_filename());
+    std::string vector_ids_filepath = join(TMP_DIR, get_vector_ids_filename());
+    std::string list_ids_filepath = join(TMP_DIR, get_list_ids_filename(n_lists));
+    write_to_file(vectors_filepath, vectors.data(), vectors.size() * sizeof(vector_el_t));
+    write_to_file(vector_ids_filepath, ids.data(), ids.size() * sizeof(vector_id_t));
+    write_to_file(list_ids_filepath, list_ids.data(), list_ids.size() * sizeof(list_id_t));
+
+    std::string sorted_vectors_filepath = join(TMP_DIR, get_vectors_filename(true, n_lists));
+    std::string sorted_vector_ids_filepath = join(TMP_DIR, get_vector_ids_filename(true, n_lists));
+    std::string sorted_list_ids_filepath = join(TMP_DIR, get_list_ids_filename(n_lists, true));
+
+    WHEN("the files are sorted")
+    {
+      size_t entry_size = 2 * sizeof(int64_t) + vector_dim * sizeof(vector_el_t);
+      size_t memory_budget = GENERATE_COPY(entry_size, 200 * entry_size, (size_t)SORT_MEMORY_BUDGET);
+      // with the smallest budget, every list is a bucket of its own, so that
+      // small limits of open files partition the entries in several passes
+      len_t max_n_open_files = GENERATE(2, 3, SORT_MAX_N_OPEN_FILES);
+      InputFileSorter sorter(vector_dim, TMP_DIR, memory_budget, max_n_open_files);
+      sorter.sort(vectors_filepath, vector_ids_filepath, list_ids_filepath, n_entries,
+                  sorted_vectors_filepath, sorted_vector_ids_filepath, sorted_list_ids_filepath);
+
+      THEN("the entries are ordered by list id and keep their order within every list")
+      {
+        std::vector<len_t> order(n_entries);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&list_ids](len_t a, len_t b)
+                         { return list_ids[a] < list_ids[b]; });
+
+        std::vector<vector_el_t> sorted_vectors = read_file<vector_el_t>(sorted_vectors_filepath);
+        std::vector<vector_id_t> sorted_ids = read_file<vector_id_t>(sorted_vector_ids_filepath);
+        std::vector<list_id_t> sorted_list_ids = read_file<list_id_t>(sorted_list_ids_filepath);
+        REQUIRE(sorted_vectors.size() == vectors.size());
+        REQUIRE(sorted_ids.size() == n_entries);
+        REQUIRE(sorted_list_ids.size() == n_entries);
+        for (len_t i = 0; i < n_entries; i++)
+        {
+          REQUIRE(sorted_list_ids[i] == list_ids[order[i]]);
+          REQUIRE(sorted_ids[i] == ids[order[i]]);
+          are_vectors_equal(&sorted_vectors[i * vector_dim], &vectors[order[i] * vector_dim], vector_dim, 1);
+        }
+      }
+      THEN("no bucket or part files are left behind")
+      {
+        REQUIRE_FALSE(file_exists(join(TMP_DIR, std::string(SORT_BUCKET_FILENAME) + "0" + SORT_BUCKET_FILE_EXT)));
+        REQUIRE_FALSE(file_exists(join(TMP_DIR, std::string(SORT_PART_FILENAME) + "0_0" + SORT_BUCKET_FILE_EXT)));
+        REQUIRE_FALSE(file_exists(join(TMP_DIR, std::string(SORT_PART_FILENAME) + "1_0" + SORT_BUCKET_FILE_EXT)));
+      }
+      THEN("the sorted files can be bulk inserted into lists")
+      {
+        StorageLists lists = get_inverted_lists_object(vector_dim);
+        lists.bulk_insert_entries(sorted_vectors_filepath, sorted_vector_ids_filepath, sorted_list_ids_filepath, n_entries);
+        for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+        {
+          list_id_t stored_list_id = list_id * 13 - 40;
+          len_t list_length = std::count(list_ids.begin(), list_ids.end(), stored_list_id);
+          if (list_length > 0)
+          {
+            REQUIRE(lists.get_list_length(stored_list_id) == list_length);
+          }
+        }
+      }
+    }
+    WHEN("the number of entries does not match the files")
+    {
+      InputFileSorter sorter(vector_dim, TMP_DIR);
+      THEN("sorting throws")
+      {
+        REQUIRE_THROWS_AS(InputFileSorter(vector_dim, TMP_DIR, SORT_MEMORY_BUDGET, 1), std::invalid_argument);
+        REQUIRE_THROWS_AS(sorter.sort(vectors_filepath, vector_ids_filepath, list_ids_filepath, n_entries + 1,
+                                      sorted_vectors_filepath, sorted_vector_ids_filepath, sorted_list_ids_filepath),
+                          std::runtime_error);
+      }
+    }
+  }
+}
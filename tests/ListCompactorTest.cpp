@@ -0,0 +1,97 @@
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+#include "../lib/catch.hpp"
+
+#include "../include/tests/StorageListsTestUtils.hpp"
+#include "../include/storage-node/ListCompactor.hpp"
+
+using namespace ann_dkvs;
+
+SCENARIO("ListCompactor: lists with many deleted entries are compacted in the background", "[ListCompactor][test]")
+{
+  GIVEN("lists which can be read concurrently and a compactor")
+  {
+    len_t vector_dim = 4;
+    len_t n_lists = 8;
+    len_t list_length = 100;
+    std::string file = join(TMP_DIR, "compact_" + get_lists_filename());
+    remove(file.c_str());
+    StorageLists lists(vector_dim, file);
+    std::vector<vector_el_t> vectors(list_length * vector_dim, 1.0f);
+    std::vector<vector_id_t> ids(list_length);
+    for (len_t i = 0; i < list_length; i++)
+    {
+      ids[i] = i;
+    }
+    for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+    {
+      lists.insert_entries(list_id, vectors.data(), ids.data(), list_length);
+    }
+    lists.enable_concurrent_reads();
+    std::mutex write_mutex;
+    // the interval is long enough that only requested passes run during the test
+    ListCompactor compactor(&lists, write_mutex, 0.5f, 60000);
+
+    WHEN("most entries of the even lists and few entries of the odd lists are deleted")
+    {
+      {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+        {
+          len_t n_to_delete = list_id % 2 == 0 ? 60 : 10;
+          lists.delete_entries(list_id, ids.data(), n_to_delete);
+        }
+      }
+      size_t free_space_before = lists.get_free_space();
+      compactor.compact();
+      compactor.wait();
+
+      THEN("only the even lists are compacted and their slots are freed")
+      {
+        REQUIRE(compactor.get_n_lists_compacted() == n_lists / 2);
+        for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+        {
+          if (list_id % 2 == 0)
+          {
+            REQUIRE(lists.get_list_length(list_id) == 40);
+            REQUIRE(lists.get_n_deleted_entries(list_id) == 0);
+            REQUIRE(lists.get_ids(list_id)[0] == 60);
+          }
+          else
+          {
+            REQUIRE(lists.get_list_length(list_id) == list_length);
+            REQUIRE(lists.get_n_deleted_entries(list_id) == 10);
+          }
+        }
+        REQUIRE(lists.get_free_space() > free_space_before);
+      }
+    }
+    WHEN("entries are inserted and deleted while the compactor runs")
+    {
+      for (len_t round = 0; round < 20; round++)
+      {
+        {
+          std::lock_guard<std::mutex> lock(write_mutex);
+          list_id_t list_id = round % n_lists;
+          lists.insert_entries(list_id, vectors.data(), ids.data(), list_length);
+          lists.delete_entries(list_id, ids.data(), list_length);
+        }
+        compactor.compact();
+      }
+      compactor.wait();
+
+      THEN("every list holding deleted entries is compacted")
+      {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        REQUIRE(lists.get_lists_to_compact(0.5f).empty());
+        for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+        {
+          REQUIRE(lists.get_list_length(list_id) == 0);
+        }
+      }
+    }
+  }
+}
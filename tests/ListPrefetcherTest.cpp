@@ -0,0 +1,112 @@
+#include <random>
+#include <vector>
+#include <atomic>
+
+#include "../lib/catch.hpp"
+
+#include "../include/tests/StorageListsTestUtils.hpp"
+#include "../include/storage-node/ListPrefetcher.hpp"
+#include "../include/storage-node/StorageIndex.hpp"
+#include "../include/root-node/RootIndex.hpp"
+
+using namespace ann_dkvs;
+
+SCENARIO("ListPrefetcher: the lists of queries are prefetched while the queries are assigned", "[ListPrefetcher][test]")
+{
+  GIVEN("lists of random vectors, their centroids and a batch of queries")
+  {
+    len_t vector_dim = 16;
+    len_t n_lists = 32;
+    len_t n_queries = 100;
+    len_t n_probes = 4;
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<vector_el_t> gen_component(-1, 1);
+    std::string file = join(TMP_DIR, "prefetch_" + get_lists_filename());
+    remove(file.c_str());
+    StorageLists lists(vector_dim, file);
+    std::vector<vector_el_t> centroids(n_lists * vector_dim);
+    vector_id_t next_id = 0;
+    for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+    {
+      len_t list_length = 200;
+      std::vector<vector_el_t> vectors(list_length * vector_dim);
+      std::vector<vector_id_t> ids(list_length);
+      for (vector_el_t &element : vectors)
+      {
+        element = gen_component(rng);
+      }
+      for (vector_id_t &id : ids)
+      {
+        id = next_id++;
+      }
+      lists.insert_entries(list_id, vectors.data(), ids.data(), list_length);
+      for (len_t j = 0; j < vector_dim; j++)
+      {
+        centroids[list_id * vector_dim + j] = vectors[j];
+      }
+    }
+    RootIndex root_index(vector_dim, centroids.data(), n_lists);
+    StorageIndex storage_index(&lists);
+
+    std::vector<vector_el_t> query_vectors(n_queries * vector_dim);
+    for (vector_el_t &element : query_vectors)
+    {
+      element = gen_component(rng);
+    }
+    std::vector<list_id_t> lists_to_probe(n_queries * n_probes);
+    QueryBatch queries;
+    for (len_t i = 0; i < n_queries; i++)
+    {
+      queries.push_back(new Query(&query_vectors[i * vector_dim], &lists_to_probe[i * n_probes], 10, n_probes));
+    }
+
+    WHEN("the lists are prefetched as the queries are assigned")
+    {
+      ListPrefetcher prefetcher(&lists);
+      std::atomic<len_t> n_assigned(0);
+      root_index.batch_preassign_queries(queries, [&prefetcher, &n_assigned](const Query *query)
+                                         { prefetcher.prefetch(query); n_assigned++; });
+      QueryResultsBatch results = storage_index.batch_search_preassigned(queries);
+      prefetcher.wait();
+
+      THEN("every query is passed on once and every probed list is advised")
+      {
+        std::set<list_id_t> probed_lists(lists_to_probe.begin(), lists_to_probe.end());
+        REQUIRE(n_assigned == n_queries);
+        REQUIRE(prefetcher.get_n_lists_prefetched() >= probed_lists.size());
+        REQUIRE(prefetcher.get_n_lists_prefetched() <= n_queries * n_probes);
+      }
+      THEN("the results equal the results without prefetching")
+      {
+        QueryResultsBatch expected = storage_index.batch_search_preassigned(queries);
+        REQUIRE(results.size() == expected.size());
+        for (len_t i = 0; i < n_queries; i++)
+        {
+          REQUIRE(results[i].size() == expected[i].size());
+          for (len_t j = 0; j < expected[i].size(); j++)
+          {
+            REQUIRE(results[i][j].vector_id == expected[i][j].vector_id);
+          }
+        }
+      }
+    }
+    WHEN("a batch probing lists which do not exist is prefetched")
+    {
+      root_index.batch_preassign_queries(queries);
+      lists_to_probe[0] = n_lists + 5;
+      ListPrefetcher prefetcher(&lists);
+      prefetcher.prefetch(queries);
+      prefetcher.wait();
+
+      THEN("the missing lists are skipped and the batch is coalesced by list")
+      {
+        std::set<list_id_t> probed_lists(lists_to_probe.begin(), lists_to_probe.end());
+        REQUIRE(prefetcher.get_n_lists_prefetched() == probed_lists.size());
+      }
+    }
+    for (Query *query : queries)
+    {
+      delete query;
+    }
+  }
+}
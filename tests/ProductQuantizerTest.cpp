@@ -0,0 +1,370 @@
+#include <random>
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+
+#include "../lib/catch.hpp"
+
+#include "../include/tests/StorageListsTestUtils.hpp"
+#include "../include/ProductQuantizer.hpp"
+#include "../include/storage-node/StorageIndex.hpp"
+#include "../include/root-node/RootIndex.hpp"
+#include "../include/L2Space.hpp"
+#include "../include/IPSpace.hpp"
+
+using namespace ann_dkvs;
+
+auto gen_clustered_vectors = [](len_t n_vectors, len_t vector_dim, len_t n_clusters, std::mt19937 &rng)
+{
+  std::normal_distribution<vector_el_t> gen_center(0, 10);
+  std::normal_distribution<vector_el_t> gen_offset(0, 1);
+  std::vector<vector_el_t> centers(n_clusters * vector_dim);
+  for (vector_el_t &el : centers)
+  {
+    el = gen_center(rng);
+  }
+  std::vector<vector_el_t> vectors(n_vectors * vector_dim);
+  for (len_t i = 0; i < n_vectors; i++)
+  {
+    len_t cluster = rng() % n_clusters;
+    for (len_t j = 0; j < vector_dim; j++)
+    {
+      vectors[i * vector_dim + j] = centers[cluster * vector_dim + j] + gen_offset(rng);
+    }
+  }
+  return vectors;
+};
+
+SCENARIO("ProductQuantizer: vectors can be encoded and compared with ADC", "[ProductQuantizer][test]")
+{
+  GIVEN("a product quantizer trained on clustered vectors")
+  {
+    len_t vector_dim = 16;
+    len_t n_subvectors = 8;
+    len_t n_vectors = 2000;
+    std::mt19937 rng(7);
+    std::vector<vector_el_t> vectors = gen_clustered_vectors(n_vectors, vector_dim, 20, rng);
+    ProductQuantizer quantizer(vector_dim, n_subvectors);
+    quantizer.train(vectors.data(), n_vectors, nullptr, nullptr, 10);
+
+    THEN("the quantizer rejects a dimension which is not a multiple of the number of subvectors")
+    {
+      REQUIRE_THROWS_AS(ProductQuantizer(10, 3), std::invalid_argument);
+    }
+
+    WHEN("the vectors are encoded and decoded")
+    {
+      std::vector<uint8_t> codes(n_vectors * quantizer.get_code_size());
+      std::vector<vector_el_t> decoded(n_vectors * vector_dim);
+      quantizer.encode(vectors.data(), n_vectors, codes.data());
+      quantizer.decode(codes.data(), n_vectors, decoded.data());
+
+      THEN("the reconstruction error is small compared to the spread of the vectors")
+      {
+        double error = 0;
+        double spread = 0;
+        for (len_t i = 0; i < n_vectors * vector_dim; i++)
+        {
+          error += (vectors[i] - decoded[i]) * (vectors[i] - decoded[i]);
+          spread += vectors[i] * vectors[i];
+        }
+        REQUIRE(error < 0.01 * spread);
+      }
+
+      THEN("the ADC distances equal the distances to the decoded vectors")
+      {
+        const vector_el_t *query = &vectors[0];
+        std::vector<distance_t> l2_table(quantizer.get_table_size());
+        std::vector<distance_t> ip_table(quantizer.get_table_size());
+        quantizer.compute_table(query, METRIC_L2, l2_table.data());
+        quantizer.compute_table(query, METRIC_INNER_PRODUCT, ip_table.data());
+        std::vector<distance_t> l2_distances(n_vectors);
+        std::vector<distance_t> inner_products(n_vectors);
+        quantizer.lookup_codes(l2_table.data(), codes.data(), n_vectors, l2_distances.data());
+        quantizer.lookup_codes(ip_table.data(), codes.data(), n_vectors, inner_products.data());
+        for (len_t i = 0; i < n_vectors; i++)
+        {
+          const vector_el_t *decoded_vector = &decoded[i * vector_dim];
+          REQUIRE(l2_distances[i] == Approx(L2Sqr(query, decoded_vector, &vector_dim)).epsilon(1e-3).margin(1e-3));
+          REQUIRE(inner_products[i] == Approx(InnerProduct(query, decoded_vector, &vector_dim)).epsilon(1e-3).margin(1e-3));
+        }
+      }
+
+      AND_WHEN("the quantizer is saved and loaded")
+      {
+        std::string file = join(TMP_DIR, "pq.bin");
+        quantizer.save(file);
+        ProductQuantizer loaded_quantizer(file);
+        std::vector<uint8_t> loaded_codes(codes.size());
+        loaded_quantizer.encode(vectors.data(), n_vectors, loaded_codes.data());
+
+        THEN("the loaded quantizer produces the same codes")
+        {
+          REQUIRE(loaded_quantizer.get_code_size() == quantizer.get_code_size());
+          REQUIRE(loaded_codes == codes);
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("StorageIndex: product-quantized lists can be searched", "[StorageIndex][ProductQuantizer][test]")
+{
+  GIVEN("clustered vectors assigned to lists and stored both raw and product-quantized")
+  {
+    len_t vector_dim = 16;
+    len_t n_subvectors = 8;
+    len_t n_vectors = 4000;
+    len_t n_lists = 4;
+    len_t n_queries = 20;
+    len_t n_results = 10;
+    metric_t metric = GENERATE(METRIC_L2, METRIC_INNER_PRODUCT);
+    std::mt19937 rng(11);
+    std::vector<vector_el_t> vectors = gen_clustered_vectors(n_vectors + n_queries, vector_dim, 50, rng);
+    std::vector<vector_el_t> centroids(vectors.begin(), vectors.begin() + n_lists * vector_dim);
+
+    RootIndex root_index(vector_dim, centroids.data(), n_lists, METRIC_L2);
+    std::vector<list_id_t> list_ids(n_vectors);
+    for (len_t i = 0; i < n_vectors; i++)
+    {
+      Query query(&vectors[i * vector_dim], 1, 1);
+      root_index.preassign_query(&query);
+      list_ids[i] = query.get_list_to_probe(0);
+    }
+
+    ProductQuantizer quantizer(vector_dim, n_subvectors);
+    quantizer.train(vectors.data(), n_vectors, centroids.data(), list_ids.data(), 10);
+
+    std::string raw_file = join(TMP_DIR, "raw_" + get_lists_filename());
+    std::string pq_file = join(TMP_DIR, "pq_" + get_lists_filename());
+    remove(raw_file.c_str());
+    remove(pq_file.c_str());
+    StorageLists raw_lists(vector_dim, raw_file, metric);
+    StorageLists pq_lists(vector_dim, quantizer.get_code_size(), pq_file, metric);
+    std::vector<uint8_t> code(quantizer.get_code_size());
+    for (len_t i = 0; i < n_vectors; i++)
+    {
+      const vector_el_t *vector = &vectors[i * vector_dim];
+      vector_id_t id = (vector_id_t)i;
+      quantizer.encode(vector, 1, code.data(), &centroids[list_ids[i] * vector_dim]);
+      raw_lists.insert_entries(list_ids[i], vector, &id, 1);
+      pq_lists.insert_codes(list_ids[i], code.data(), &id, 1);
+    }
+
+    THEN("the quantized lists take up a fraction of the space of the raw lists")
+    {
+      REQUIRE(pq_lists.get_total_size() * 4 <= raw_lists.get_total_size());
+    }
+
+    THEN("the lists only give access to what they store")
+    {
+      REQUIRE_THROWS_AS(pq_lists.get_vectors(list_ids[0]), std::logic_error);
+      REQUIRE_THROWS_AS(raw_lists.get_codes(list_ids[0]), std::logic_error);
+      REQUIRE_THROWS_AS(pq_lists.insert_entries(0, vectors.data(), list_ids.data(), 1), std::logic_error);
+      REQUIRE_THROWS_AS(StorageIndex(&pq_lists), std::invalid_argument);
+    }
+
+    WHEN("queries are searched in the raw and in the quantized lists")
+    {
+      StorageIndex exact_index(&raw_lists);
+      StorageIndex pq_index(&pq_lists, &quantizer, centroids.data());
+      StorageIndex reranking_index(&pq_lists, &quantizer, centroids.data(), &raw_lists);
+
+      std::vector<list_id_t> lists_to_probe(n_lists);
+      for (len_t i = 0; i < n_lists; i++)
+      {
+        lists_to_probe[i] = i;
+      }
+      QueryBatch queries;
+      for (len_t i = 0; i < n_queries; i++)
+      {
+        queries.push_back(new Query(&vectors[(n_vectors + i) * vector_dim], lists_to_probe.data(), n_results, n_lists));
+      }
+      QueryResultsBatch exact_results = exact_index.batch_search_preassigned(queries);
+      QueryResultsBatch pq_results = pq_index.batch_search_preassigned(queries);
+      QueryResultsBatch reranked_results = reranking_index.batch_search_preassigned(queries);
+      for (Query *query : queries)
+      {
+        delete query;
+      }
+
+      auto get_recall = [&](const QueryResultsBatch &results)
+      {
+        len_t n_found = 0;
+        for (len_t i = 0; i < n_queries; i++)
+        {
+          std::unordered_set<vector_id_t> expected_ids;
+          for (const QueryResult &result : exact_results[i])
+          {
+            expected_ids.insert(result.vector_id);
+          }
+          for (const QueryResult &result : results[i])
+          {
+            n_found += expected_ids.count(result.vector_id);
+          }
+        }
+        return (double)n_found / (n_queries * n_results);
+      };
+
+      THEN("the approximate results have a high recall")
+      {
+        REQUIRE(pq_results[0].size() == n_results);
+        REQUIRE(get_recall(pq_results) >= 0.5);
+      }
+
+      THEN("re-ranking returns exact distances and improves the recall")
+      {
+        double reranked_recall = get_recall(reranked_results);
+        REQUIRE(reranked_recall >= 0.9);
+        REQUIRE(reranked_recall >= get_recall(pq_results));
+        for (len_t i = 0; i < n_queries; i++)
+        {
+          for (len_t j = 1; j < n_results; j++)
+          {
+            REQUIRE(reranked_results[i][j - 1].distance <= reranked_results[i][j].distance);
+          }
+          if (reranked_results[i][0].vector_id == exact_results[i][0].vector_id)
+          {
+            REQUIRE(reranked_results[i][0].distance == Approx(exact_results[i][0].distance).epsilon(1e-4));
+          }
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("StorageIndex: lists of 4-bit codes can be searched with fast-scan", "[StorageIndex][ProductQuantizer][FastScan][test]")
+{
+  GIVEN("clustered vectors stored raw, as packed 4-bit codes and in the fast-scan layout")
+  {
+    len_t vector_dim = 16;
+    len_t n_subvectors = 16;
+    len_t n_vectors = 3000;
+    len_t n_lists = 3;
+    len_t n_queries = 20;
+    len_t n_results = 10;
+    metric_t metric = GENERATE(METRIC_L2, METRIC_INNER_PRODUCT);
+    std::mt19937 rng(13);
+    std::vector<vector_el_t> vectors = gen_clustered_vectors(n_vectors + n_queries, vector_dim, 50, rng);
+    std::vector<vector_el_t> centroids(vectors.begin(), vectors.begin() + n_lists * vector_dim);
+
+    RootIndex root_index(vector_dim, centroids.data(), n_lists, METRIC_L2);
+    std::vector<list_id_t> list_ids(n_vectors);
+    for (len_t i = 0; i < n_vectors; i++)
+    {
+      Query query(&vectors[i * vector_dim], 1, 1);
+      root_index.preassign_query(&query);
+      list_ids[i] = query.get_list_to_probe(0);
+    }
+
+    ProductQuantizer quantizer(vector_dim, n_subvectors, 4);
+    quantizer.train(vectors.data(), n_vectors, centroids.data(), list_ids.data(), 10);
+
+    std::string raw_file = join(TMP_DIR, "raw_" + get_lists_filename());
+    std::string packed_file = join(TMP_DIR, "packed_" + get_lists_filename());
+    std::string fast_scan_file = join(TMP_DIR, "fast_scan_" + get_lists_filename());
+    remove(raw_file.c_str());
+    remove(packed_file.c_str());
+    remove(fast_scan_file.c_str());
+    StorageLists raw_lists(vector_dim, raw_file, metric);
+    StorageLists packed_lists(vector_dim, quantizer.get_code_size(), packed_file, metric);
+    StorageLists fast_scan_lists(vector_dim, quantizer.get_code_size(), fast_scan_file, metric, CODE_LAYOUT_FAST_SCAN);
+    std::vector<uint8_t> codes(n_vectors * quantizer.get_code_size());
+    for (len_t i = 0; i < n_vectors; i++)
+    {
+      const vector_el_t *vector = &vectors[i * vector_dim];
+      uint8_t *code = &codes[i * quantizer.get_code_size()];
+      vector_id_t id = (vector_id_t)i;
+      quantizer.encode(vector, 1, code, &centroids[list_ids[i] * vector_dim]);
+      raw_lists.insert_entries(list_ids[i], vector, &id, 1);
+      packed_lists.insert_codes(list_ids[i], code, &id, 1);
+      fast_scan_lists.insert_codes(list_ids[i], code, &id, 1);
+    }
+
+    THEN("4-bit codes take up half a byte per subvector")
+    {
+      REQUIRE(quantizer.get_code_size() == n_subvectors / 2);
+      REQUIRE(quantizer.get_table_size() == n_subvectors * 16);
+    }
+
+    THEN("the fast-scan lists hold the inserted codes")
+    {
+      std::vector<uint8_t> code(quantizer.get_code_size());
+      for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+      {
+        len_t list_length = fast_scan_lists.get_list_length(list_id);
+        REQUIRE(list_length == packed_lists.get_list_length(list_id));
+        const vector_id_t *ids = fast_scan_lists.get_ids(list_id);
+        for (len_t i = 0; i < list_length; i++)
+        {
+          get_fast_scan_code(fast_scan_lists.get_codes(list_id), quantizer.get_code_size(), i, code.data());
+          const uint8_t *expected_code = &codes[ids[i] * quantizer.get_code_size()];
+          REQUIRE(std::equal(code.begin(), code.end(), expected_code));
+        }
+      }
+    }
+
+    THEN("fast-scan requires 4-bit codes")
+    {
+      ProductQuantizer quantizer8(vector_dim, quantizer.get_code_size());
+      StorageLists lists8(vector_dim, quantizer8.get_code_size(), join(TMP_DIR, "lists8.bin"), metric, CODE_LAYOUT_FAST_SCAN);
+      REQUIRE_THROWS_AS(StorageIndex(&lists8, &quantizer8, centroids.data()), std::invalid_argument);
+    }
+
+    WHEN("queries are searched in the packed and in the fast-scan lists")
+    {
+      StorageIndex exact_index(&raw_lists);
+      StorageIndex packed_index(&packed_lists, &quantizer, centroids.data());
+      StorageIndex fast_scan_index(&fast_scan_lists, &quantizer, centroids.data());
+      StorageIndex reranking_index(&fast_scan_lists, &quantizer, centroids.data(), &raw_lists);
+
+      std::vector<list_id_t> lists_to_probe(n_lists);
+      for (len_t i = 0; i < n_lists; i++)
+      {
+        lists_to_probe[i] = i;
+      }
+      QueryBatch queries;
+      for (len_t i = 0; i < n_queries; i++)
+      {
+        queries.push_back(new Query(&vectors[(n_vectors + i) * vector_dim], lists_to_probe.data(), n_results, n_lists));
+      }
+      QueryResultsBatch exact_results = exact_index.batch_search_preassigned(queries);
+      QueryResultsBatch packed_results = packed_index.batch_search_preassigned(queries);
+      QueryResultsBatch fast_scan_results = fast_scan_index.batch_search_preassigned(queries);
+      QueryResultsBatch reranked_results = reranking_index.batch_search_preassigned(queries);
+      for (Query *query : queries)
+      {
+        delete query;
+      }
+
+      auto get_overlap = [&](const QueryResultsBatch &expected_results, const QueryResultsBatch &results)
+      {
+        len_t n_found = 0;
+        for (len_t i = 0; i < n_queries; i++)
+        {
+          std::unordered_set<vector_id_t> expected_ids;
+          for (const QueryResult &result : expected_results[i])
+          {
+            expected_ids.insert(result.vector_id);
+          }
+          for (const QueryResult &result : results[i])
+          {
+            n_found += expected_ids.count(result.vector_id);
+          }
+        }
+        return (double)n_found / (n_queries * n_results);
+      };
+
+      THEN("the quantized table barely lowers the recall of the exact table lookups")
+      {
+        REQUIRE(fast_scan_results[0].size() == n_results);
+        REQUIRE(get_overlap(exact_results, fast_scan_results) >= get_overlap(exact_results, packed_results) - 0.1);
+      }
+
+      THEN("re-ranking the fast-scan candidates has a high recall")
+      {
+        REQUIRE(get_overlap(exact_results, reranked_results) >= 0.9);
+      }
+    }
+  }
+}
@@ -0,0 +1,153 @@
+#include <random>
+#include <vector>
+#include <memory>
+
+#include "../lib/catch.hpp"
+
+#include "../include/tests/StorageListsTestUtils.hpp"
+#include "../include/root-node/RootNode.hpp"
+#include "../include/storage-node/StorageNode.hpp"
+
+using namespace ann_dkvs;
+
+SCENARIO("RootNode: queries are routed to the storage nodes owning their lists", "[RootNode][StorageNode][test]")
+{
+  GIVEN("lists distributed among storage nodes listening on loopback sockets")
+  {
+    len_t vector_dim = 12;
+    len_t n_lists = 10;
+    len_t n_shards = 3;
+    len_t n_queries = 25;
+    len_t n_results = 15;
+    len_t n_probes = 4;
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> gen_component(-8, 8);
+
+    // all lists are also stored locally to compare the results with
+    std::string local_file = join(TMP_DIR, "root_" + get_lists_filename());
+    remove(local_file.c_str());
+    StorageLists local_lists(vector_dim, local_file);
+    std::vector<std::unique_ptr<StorageLists>> shard_lists;
+    for (len_t s = 0; s < n_shards; s++)
+    {
+      std::string shard_file = join(TMP_DIR, "shard_" + std::to_string(s) + "_" + get_lists_filename());
+      remove(shard_file.c_str());
+      shard_lists.emplace_back(new StorageLists(vector_dim, shard_file));
+    }
+    vector_id_t next_id = 0;
+    std::vector<vector_el_t> centroids(n_lists * vector_dim);
+    for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+    {
+      len_t list_length = list_id * 20 + 3;
+      std::vector<vector_el_t> vectors(list_length * vector_dim);
+      std::vector<vector_id_t> ids(list_length);
+      for (vector_el_t &element : vectors)
+      {
+        element = (vector_el_t)gen_component(rng);
+      }
+      for (vector_id_t &id : ids)
+      {
+        id = next_id++;
+      }
+      for (len_t j = 0; j < vector_dim; j++)
+      {
+        centroids[list_id * vector_dim + j] = (vector_el_t)gen_component(rng);
+      }
+      local_lists.insert_entries(list_id, vectors.data(), ids.data(), list_length);
+      shard_lists[list_id % n_shards]->insert_entries(list_id, vectors.data(), ids.data(), list_length);
+    }
+
+    std::vector<std::unique_ptr<StorageNode>> nodes;
+    RootIndex root_index(vector_dim, centroids.data(), n_lists);
+    RootNode root_node(root_index);
+    for (len_t s = 0; s < n_shards; s++)
+    {
+      nodes.emplace_back(new StorageNode(std::move(shard_lists[s])));
+      StorageNodeAddress address = {"127.0.0.1", 0, ""};
+      if (s == 0)
+      {
+        address.socket_path = join(TMP_DIR, "shard.sock");
+        nodes[s]->listen_unix(address.socket_path);
+      }
+      else
+      {
+        address.port = nodes[s]->listen_tcp(address.host, 0);
+      }
+      REQUIRE(root_node.add_shard(address) == s);
+    }
+    for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+    {
+      root_node.assign_list(list_id, list_id % n_shards);
+    }
+
+    AND_GIVEN("a batch of queries")
+    {
+      std::vector<vector_el_t> query_vectors(n_queries * vector_dim);
+      for (vector_el_t &element : query_vectors)
+      {
+        element = (vector_el_t)gen_component(rng);
+      }
+      QueryBatch queries;
+      for (len_t i = 0; i < n_queries; i++)
+      {
+        queries.push_back(new Query(&query_vectors[i * vector_dim], n_results, n_probes));
+      }
+
+      WHEN("the batch is searched by the root node")
+      {
+        QueryResultsBatch results = root_node.batch_search(queries);
+        QueryResultsBatch second_results = root_node.batch_search(queries);
+
+        THEN("the results equal the results of searching all lists locally")
+        {
+          StorageIndex local_index(&local_lists);
+          QueryResultsBatch expected = local_index.batch_search_preassigned(queries);
+          REQUIRE(results.size() == n_queries);
+          for (len_t i = 0; i < n_queries; i++)
+          {
+            REQUIRE(results[i].size() == expected[i].size());
+            REQUIRE(second_results[i].size() == expected[i].size());
+            for (len_t j = 0; j < expected[i].size(); j++)
+            {
+              CHECK(results[i][j].vector_id == expected[i][j].vector_id);
+              CHECK(results[i][j].distance == expected[i][j].distance);
+              CHECK(second_results[i][j].vector_id == expected[i][j].vector_id);
+            }
+          }
+        }
+      }
+
+      WHEN("a query probes a list which is not assigned to a shard")
+      {
+        root_index.batch_preassign_queries(queries);
+        list_id_t missing_list_id = n_lists;
+        Query query(query_vectors.data(), &missing_list_id, n_results, 1);
+
+        THEN("the search fails without affecting later searches")
+        {
+          REQUIRE_THROWS_AS(root_node.batch_search_preassigned({&query}), std::invalid_argument);
+          REQUIRE(root_node.batch_search_preassigned(queries).size() == n_queries);
+        }
+      }
+
+      WHEN("a shard reports an error")
+      {
+        root_index.batch_preassign_queries(queries);
+        root_node.assign_list(n_lists, 1);
+        list_id_t lists_to_probe[] = {0, 1, (list_id_t)n_lists};
+        Query query(query_vectors.data(), lists_to_probe, n_results, 3);
+
+        THEN("the search fails without affecting later searches")
+        {
+          REQUIRE_THROWS_AS(root_node.batch_search_preassigned({&query}), std::runtime_error);
+          REQUIRE(root_node.batch_search_preassigned(queries).size() == n_queries);
+        }
+      }
+
+      for (Query *query : queries)
+      {
+        delete query;
+      }
+    }
+  }
+}
@@ -0,0 +1,253 @@
+#include <random>
+#include <vector>
+#include <limits>
+#include <unordered_set>
+
+#include "../lib/catch.hpp"
+
+#include "../include/tests/StorageListsTestUtils.hpp"
+#include "../include/ScalarQuantizer.hpp"
+#include "../include/Float16.hpp"
+#include "../include/storage-node/StorageIndex.hpp"
+#include "../include/L2Space.hpp"
+#include "../include/IPSpace.hpp"
+
+using namespace ann_dkvs;
+
+SCENARIO("float_to_fp16() and float_to_bf16(): floats are rounded to 16 bits", "[ScalarQuantizer][test]")
+{
+  GIVEN("floats which are exactly representable")
+  {
+    std::vector<float> values = {0.0f, -0.0f, 1.0f, -2.5f, 65504.0f, 0.000061035156f, 0.000000059604645f};
+    THEN("they survive a round trip through fp16")
+    {
+      for (float value : values)
+      {
+        REQUIRE(fp16_to_float(float_to_fp16(value)) == value);
+      }
+    }
+    THEN("the short ones survive a round trip through bf16")
+    {
+      for (float value : {0.0f, 1.0f, -2.5f, 65536.0f})
+      {
+        REQUIRE(bf16_to_float(float_to_bf16(value)) == value);
+      }
+    }
+  }
+  GIVEN("floats which are not representable")
+  {
+    THEN("they are rounded to the nearest value with ties to even")
+    {
+      REQUIRE(fp16_to_float(float_to_fp16(1.0f + 1.0f / 4096)) == 1.0f);
+      REQUIRE(fp16_to_float(float_to_fp16(1.0f + 3.0f / 2048)) == 1.0f + 2.0f / 1024);
+      REQUIRE(bf16_to_float(float_to_bf16(1.0f + 1.0f / 256)) == 1.0f);
+      REQUIRE(bf16_to_float(float_to_bf16(1.0f + 3.0f / 256)) == 1.0f + 2.0f / 128);
+    }
+    THEN("values too large for fp16 become infinity")
+    {
+      REQUIRE(fp16_to_float(float_to_fp16(1e6f)) == std::numeric_limits<float>::infinity());
+      REQUIRE(fp16_to_float(float_to_fp16(-1e6f)) == -std::numeric_limits<float>::infinity());
+    }
+  }
+}
+
+SCENARIO("ScalarQuantizer: codes are compared with queries without decoding", "[ScalarQuantizer][test]")
+{
+  GIVEN("a scalar quantizer trained on random vectors")
+  {
+    sq_type_t sq_type = GENERATE(SQ_8BIT, SQ_FP16, SQ_BF16);
+    len_t vector_dim = GENERATE(1, 7, 8, 17, 128);
+    len_t n_vectors = 100;
+    std::mt19937 rng(vector_dim);
+    std::uniform_real_distribution<vector_el_t> gen_element(-5, 20);
+    std::vector<vector_el_t> vectors(n_vectors * vector_dim);
+    for (vector_el_t &element : vectors)
+    {
+      element = gen_element(rng);
+    }
+    ScalarQuantizer quantizer(vector_dim, sq_type);
+
+    THEN("8-bit quantizers must be trained before encoding")
+    {
+      std::vector<uint8_t> codes(quantizer.get_code_size());
+      REQUIRE(quantizer.is_trained() == (sq_type != SQ_8BIT));
+      if (sq_type == SQ_8BIT)
+      {
+        REQUIRE_THROWS_AS(quantizer.encode(vectors.data(), 1, codes.data()), std::logic_error);
+      }
+    }
+
+    quantizer.train(vectors.data(), n_vectors);
+    std::vector<uint8_t> codes(n_vectors * quantizer.get_code_size());
+    std::vector<vector_el_t> decoded(n_vectors * vector_dim);
+    quantizer.encode(vectors.data(), n_vectors, codes.data());
+    quantizer.decode(codes.data(), n_vectors, decoded.data());
+
+    THEN("the codes are smaller than the vectors")
+    {
+      REQUIRE(quantizer.get_code_size() == vector_dim * (sq_type == SQ_8BIT ? 1 : 2));
+    }
+
+    THEN("the decoded vectors are close to the vectors")
+    {
+      for (len_t i = 0; i < n_vectors * vector_dim; i++)
+      {
+        REQUIRE(decoded[i] == Approx(vectors[i]).margin(0.1));
+      }
+    }
+
+    WHEN("the distances of a query to the codes are computed")
+    {
+      metric_t metric = GENERATE(METRIC_L2, METRIC_INNER_PRODUCT);
+      const vector_el_t *query = &vectors[0];
+      std::vector<vector_el_t> prepared_query(vector_dim);
+      distance_t query_term = quantizer.prepare_query(query, metric, prepared_query.data());
+      std::vector<distance_t> distances(n_vectors);
+      quantizer.compute_distances(prepared_query.data(), query_term, metric, codes.data(), n_vectors, distances.data());
+
+      THEN("they equal the distances to the decoded vectors")
+      {
+        for (len_t i = 0; i < n_vectors; i++)
+        {
+          const vector_el_t *decoded_vector = &decoded[i * vector_dim];
+          distance_t expected = metric == METRIC_L2 ? L2Sqr(query, decoded_vector, &vector_dim) : 1.0f - InnerProduct(query, decoded_vector, &vector_dim);
+          REQUIRE(distances[i] == Approx(expected).epsilon(1e-4).margin(1e-2));
+        }
+      }
+
+      THEN("the SIMD kernels agree with the scalar kernels")
+      {
+        code_distance_func_t scalar_func = metric == METRIC_L2 ? get_l2_code_distance_func(sq_type, SIMD_NONE) : get_inner_product_code_func(sq_type, SIMD_NONE);
+        code_distance_func_t simd_func = metric == METRIC_L2 ? get_l2_code_distance_func(sq_type, get_simd_level()) : get_inner_product_code_func(sq_type, get_simd_level());
+        std::vector<distance_t> weights(vector_dim, 0.5f);
+        for (len_t i = 0; i < n_vectors; i++)
+        {
+          const uint8_t *code = &codes[i * quantizer.get_code_size()];
+          distance_t expected = scalar_func(prepared_query.data(), code, weights.data(), vector_dim);
+          REQUIRE(simd_func(prepared_query.data(), code, weights.data(), vector_dim) == Approx(expected).epsilon(1e-4).margin(1e-3));
+        }
+      }
+    }
+
+    AND_WHEN("the quantizer is saved and loaded")
+    {
+      std::string file = join(TMP_DIR, "sq.bin");
+      quantizer.save(file);
+      ScalarQuantizer loaded_quantizer(file);
+      std::vector<uint8_t> loaded_codes(codes.size());
+      loaded_quantizer.encode(vectors.data(), n_vectors, loaded_codes.data());
+
+      THEN("the loaded quantizer produces the same codes")
+      {
+        REQUIRE(loaded_quantizer.get_sq_type() == sq_type);
+        REQUIRE(loaded_codes == codes);
+      }
+    }
+  }
+}
+
+SCENARIO("StorageIndex: scalar-quantized lists can be bulk loaded and searched", "[StorageIndex][ScalarQuantizer][test]")
+{
+  GIVEN("vectors in files assigned to lists")
+  {
+    sq_type_t sq_type = GENERATE(SQ_8BIT, SQ_FP16, SQ_BF16);
+    metric_t metric = GENERATE(METRIC_L2, METRIC_INNER_PRODUCT);
+    len_t vector_dim = 32;
+    len_t n_vectors = 3000;
+    len_t n_lists = 5;
+    len_t n_queries = 20;
+    len_t n_results = 10;
+    std::mt19937 rng(5);
+    std::normal_distribution<vector_el_t> gen_element(0, 1);
+    std::vector<vector_el_t> vectors((n_vectors + n_queries) * vector_dim);
+    for (vector_el_t &element : vectors)
+    {
+      element = gen_element(rng);
+    }
+    std::vector<vector_id_t> ids(n_vectors);
+    std::vector<list_id_t> list_ids(n_vectors);
+    for (len_t i = 0; i < n_vectors; i++)
+    {
+      ids[i] = (vector_id_t)i;
+      list_ids[i] = (list_id_t)(rng() % n_lists);
+    }
+    std::string vectors_file = join(TMP_DIR, "sq_vectors.bin");
+    std::string ids_file = join(TMP_DIR, "sq_ids.bin");
+    std::string list_ids_file = join(TMP_DIR, "sq_list_ids.bin");
+    write_to_file(vectors_file, vectors.data(), n_vectors * vector_dim * sizeof(vector_el_t));
+    write_to_file(ids_file, ids.data(), n_vectors * sizeof(vector_id_t));
+    write_to_file(list_ids_file, list_ids.data(), n_vectors * sizeof(list_id_t));
+
+    WHEN("the vectors are bulk loaded raw and scalar-quantized")
+    {
+      std::string raw_file = join(TMP_DIR, "raw_" + get_lists_filename());
+      std::string sq_file = join(TMP_DIR, "sq_" + get_lists_filename());
+      remove(raw_file.c_str());
+      remove(sq_file.c_str());
+      ScalarQuantizer quantizer(vector_dim, sq_type);
+      StorageLists raw_lists(vector_dim, raw_file, metric);
+      StorageLists sq_lists(vector_dim, quantizer.get_code_size(), sq_file, metric);
+      raw_lists.bulk_insert_entries(vectors_file, ids_file, list_ids_file, n_vectors);
+      sq_lists.bulk_insert_entries(vectors_file, ids_file, list_ids_file, n_vectors, &quantizer);
+
+      THEN("the quantizer was trained and the codes take up less space")
+      {
+        REQUIRE(quantizer.is_trained());
+        REQUIRE(sq_lists.get_vector_size() * (sq_type == SQ_8BIT ? 4 : 2) == raw_lists.get_vector_size());
+        for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+        {
+          REQUIRE(sq_lists.get_list_length(list_id) == raw_lists.get_list_length(list_id));
+        }
+      }
+
+      THEN("code lists cannot be bulk loaded without their quantizer")
+      {
+        std::string other_file = join(TMP_DIR, "other_" + get_lists_filename());
+        remove(other_file.c_str());
+        StorageLists other_lists(vector_dim, quantizer.get_code_size(), other_file, metric);
+        REQUIRE_THROWS_AS(other_lists.bulk_insert_entries(vectors_file, ids_file, list_ids_file, n_vectors), std::logic_error);
+      }
+
+      AND_WHEN("queries are searched in both lists")
+      {
+        StorageIndex exact_index(&raw_lists);
+        StorageIndex sq_index(&sq_lists, &quantizer);
+        std::vector<list_id_t> lists_to_probe(n_lists);
+        for (len_t i = 0; i < n_lists; i++)
+        {
+          lists_to_probe[i] = i;
+        }
+        QueryBatch queries;
+        for (len_t i = 0; i < n_queries; i++)
+        {
+          queries.push_back(new Query(&vectors[(n_vectors + i) * vector_dim], lists_to_probe.data(), n_results, n_lists));
+        }
+        QueryResultsBatch exact_results = exact_index.batch_search_preassigned(queries);
+        QueryResultsBatch sq_results = sq_index.batch_search_preassigned(queries);
+        for (Query *query : queries)
+        {
+          delete query;
+        }
+
+        THEN("the recall is close to the recall of the raw vectors")
+        {
+          len_t n_found = 0;
+          for (len_t i = 0; i < n_queries; i++)
+          {
+            REQUIRE(sq_results[i].size() == n_results);
+            std::unordered_set<vector_id_t> expected_ids;
+            for (const QueryResult &result : exact_results[i])
+            {
+              expected_ids.insert(result.vector_id);
+            }
+            for (const QueryResult &result : sq_results[i])
+            {
+              n_found += expected_ids.count(result.vector_id);
+            }
+          }
+          REQUIRE((double)n_found / (n_queries * n_results) >= 0.9);
+        }
+      }
+    }
+  }
+}
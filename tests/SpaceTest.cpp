@@ -0,0 +1,153 @@
+#include <cmath>
+#include <vector>
+
+#include "../lib/catch.hpp"
+
+#include "../include/L2Space.hpp"
+#include "../include/IPSpace.hpp"
+#include "../include/CosineSpace.hpp"
+#include "../include/CpuFeatures.hpp"
+
+#define MAX_KERNEL_TEST_DIM 150
+#define N_KERNEL_TEST_PAIRS 20
+
+using namespace ann_dkvs;
+
+auto gen_random_vector = [](len_t vector_dim)
+{
+  std::vector<vector_el_t> vector(vector_dim);
+  for (len_t i = 0; i < vector_dim; i++)
+  {
+    vector[i] = (vector_el_t)rand() / RAND_MAX * 200 - 100;
+  }
+  return vector;
+};
+
+SCENARIO("L2Space(): the distance kernel is selected at runtime", "[L2Space][test]")
+{
+  GIVEN("the SIMD level supported by the CPU")
+  {
+    simd_level_t supported_level = get_simd_level();
+    WARN("simd_level := " << get_simd_level_name(supported_level));
+
+    WHEN("an L2Space is created without specifying a SIMD level")
+    {
+      L2Space space(128);
+
+      THEN("the most capable supported kernel is used")
+      {
+        REQUIRE(space.get_simd_level() == supported_level);
+      }
+    }
+
+    WHEN("an L2Space is created with the scalar kernel")
+    {
+      L2Space space(128, SIMD_NONE);
+
+      THEN("the scalar kernel is used")
+      {
+        REQUIRE(space.get_simd_level() == SIMD_NONE);
+      }
+    }
+
+    WHEN("an L2Space is created with a SIMD level the CPU does not support")
+    {
+      THEN("an exception is thrown")
+      {
+        if (supported_level < SIMD_AVX512)
+        {
+          REQUIRE_THROWS_AS(L2Space(128, SIMD_AVX512), std::invalid_argument);
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("L2Space(): all supported kernels agree with the scalar kernel", "[L2Space][test]")
+{
+  GIVEN("pairs of random vectors of every dimension up to MAX_KERNEL_TEST_DIM")
+  {
+    distance_func_t scalar_distance_func = L2Space(1, SIMD_NONE).get_distance_func();
+
+    for (int level = SIMD_AVX; level <= get_simd_level(); level++)
+    {
+      distance_func_t distance_func = L2Space(1, (simd_level_t)level).get_distance_func();
+      for (len_t vector_dim = 1; vector_dim <= MAX_KERNEL_TEST_DIM; vector_dim++)
+      {
+        for (len_t pair = 0; pair < N_KERNEL_TEST_PAIRS; pair++)
+        {
+          std::vector<vector_el_t> a = gen_random_vector(vector_dim);
+          std::vector<vector_el_t> b = gen_random_vector(vector_dim);
+          distance_t expected = scalar_distance_func(a.data(), b.data(), &vector_dim);
+          distance_t actual = distance_func(a.data(), b.data(), &vector_dim);
+          REQUIRE(std::abs(actual - expected) <= 1e-4 * expected);
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("Space::create(): a space can be created for every metric", "[Space][test]")
+{
+  GIVEN("a vector dimension")
+  {
+    len_t vector_dim = 16;
+
+    THEN("the created spaces have the requested metric")
+    {
+      REQUIRE(Space::create(METRIC_L2, vector_dim).get_metric() == METRIC_L2);
+      REQUIRE(Space::create(METRIC_INNER_PRODUCT, vector_dim).get_metric() == METRIC_INNER_PRODUCT);
+      REQUIRE(Space::create(METRIC_COSINE, vector_dim).get_metric() == METRIC_COSINE);
+    }
+
+    AND_GIVEN("two orthogonal and two parallel vectors")
+    {
+      std::vector<vector_el_t> a(vector_dim, 0);
+      std::vector<vector_el_t> b(vector_dim, 0);
+      std::vector<vector_el_t> c(vector_dim, 0);
+      a[0] = 2;
+      b[1] = 3;
+      c[0] = 5;
+
+      THEN("the distances are correct")
+      {
+        distance_func_t ip = Space::create(METRIC_INNER_PRODUCT, vector_dim).get_distance_func();
+        distance_func_t cosine = Space::create(METRIC_COSINE, vector_dim).get_distance_func();
+        REQUIRE(ip(a.data(), b.data(), &vector_dim) == 1);
+        REQUIRE(ip(a.data(), c.data(), &vector_dim) == 1 - 2 * 5);
+        REQUIRE(cosine(a.data(), b.data(), &vector_dim) == Approx(1));
+        REQUIRE(cosine(a.data(), c.data(), &vector_dim) == Approx(0).margin(1e-6));
+        REQUIRE(get_inverse_norm(c.data(), vector_dim) == Approx(1.0 / 5));
+      }
+    }
+  }
+}
+
+SCENARIO("IPSpace() and CosineSpace(): all supported kernels agree with the scalar kernel", "[IPSpace][CosineSpace][test]")
+{
+  GIVEN("pairs of random vectors of every dimension up to MAX_KERNEL_TEST_DIM")
+  {
+    distance_func_t scalar_ip = IPSpace(1, SIMD_NONE).get_distance_func();
+    distance_func_t scalar_cosine = CosineSpace(1, SIMD_NONE).get_distance_func();
+
+    for (int level = SIMD_AVX; level <= get_simd_level(); level++)
+    {
+      distance_func_t ip = IPSpace(1, (simd_level_t)level).get_distance_func();
+      distance_func_t cosine = CosineSpace(1, (simd_level_t)level).get_distance_func();
+      for (len_t vector_dim = 1; vector_dim <= MAX_KERNEL_TEST_DIM; vector_dim++)
+      {
+        for (len_t pair = 0; pair < N_KERNEL_TEST_PAIRS; pair++)
+        {
+          std::vector<vector_el_t> a = gen_random_vector(vector_dim);
+          std::vector<vector_el_t> b = gen_random_vector(vector_dim);
+          distance_t expected_ip = scalar_ip(a.data(), b.data(), &vector_dim);
+          distance_t actual_ip = ip(a.data(), b.data(), &vector_dim);
+          REQUIRE(actual_ip == Approx(expected_ip).epsilon(1e-4).margin(1));
+          distance_t expected_cosine = scalar_cosine(a.data(), b.data(), &vector_dim);
+          distance_t actual_cosine = cosine(a.data(), b.data(), &vector_dim);
+          REQUIRE(actual_cosine == Approx(expected_cosine).margin(1e-4));
+        }
+      }
+    }
+  }
+}
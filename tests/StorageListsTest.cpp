@@ -3,11 +3,20 @@
 #include <limits>
 #include <stdlib.h>
 #include <fstream>
+#include <random>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <csignal>
+#include <thread>
+#include <unordered_set>
+#include <map>
+#include <atomic>
 
 #include "../lib/catch.hpp"
 
 #include "../include/tests/StorageListsTestUtils.hpp"
+#include "../include/CosineSpace.hpp"
 
 #ifndef TEST_VECTOR_DIM
 #define TEST_VECTOR_DIM 128
@@ -197,7 +206,7 @@ SCENARIO("create_list(): inverted lists can be created", "[.StorageLists]")
     len_t vector_dim = 1;
     StorageLists lists = get_inverted_lists_object(vector_dim);
 
-    WHEN("a list of size < 32B is created")
+    WHEN("a list of the smallest size is created")
     {
       list_id_t list_id = 1;
       len_t list_length = 1;
@@ -205,11 +214,11 @@ SCENARIO("create_list(): inverted lists can be created", "[.StorageLists]")
 
       size_t list_size = get_list_size(vector_dim, list_length);
 
-      CHECK(list_size < 32);
+      CHECK(list_size == 3 * get_aligned_size(1));
 
-      THEN("the total size is 32B")
+      THEN("the total size is the smallest region holding the list")
       {
-        REQUIRE(lists.get_total_size() == 32);
+        REQUIRE(lists.get_total_size() == get_total_size(list_size));
       }
 
       THEN("the number of lists is 1")
@@ -267,7 +276,7 @@ SCENARIO("get_free_space(): the free space of an StorageLists object is as expec
     len_t vector_dim = 2;
     StorageLists lists = get_inverted_lists_object(vector_dim);
 
-    WHEN("a list is created with size < 32B")
+    WHEN("a list of the smallest size is created")
     {
       list_id_t list_id = gen_list_id();
       len_t list_length = 1;
@@ -275,11 +284,11 @@ SCENARIO("get_free_space(): the free space of an StorageLists object is as expec
 
       len_t list_size = get_list_size(vector_dim, list_length);
 
-      CHECK(list_size < 32);
+      CHECK(list_size == 3 * get_aligned_size(1));
 
-      THEN("the free space is 32 - list size")
+      THEN("the free space is the size of the smallest region holding the list - list size")
       {
-        REQUIRE(lists.get_free_space() == 32 - list_size);
+        REQUIRE(lists.get_free_space() == get_total_size(list_size) - list_size);
       }
     }
   }
@@ -870,7 +879,14 @@ auto test_bulk_insert_entries =
           total_size += get_list_size(vector_dim, list.second.size());
         }
 
+#if DYNAMIC_INSERTION == 0
         REQUIRE(lists.get_total_size() == get_total_size(total_size));
+#else
+        // lists padded to LIST_ALIGNMENT may leave gaps as they grow one entry
+        // at a time, which can take one more doubling of the region
+        REQUIRE(lists.get_total_size() >= get_total_size(total_size));
+        REQUIRE(lists.get_total_size() <= 2 * get_total_size(total_size));
+#endif
       }
       AND_WHEN("the entries are bulk inserted again")
       {
@@ -991,6 +1007,48 @@ SCENARIO("bulk_insert_entries(): randomized testing", "[StorageLists][bulk_inser
   }
 }
 
+SCENARIO("bulk_insert_entries(): the entries of a list spread over several ranges keep their order", "[StorageLists][bulk_insert_entries][test]")
+{
+  GIVEN("vectors whose lists alternate, so that every list has entries in each of the BULK_INSERT_N_RANGES ranges")
+  {
+    len_t vector_dim = 8;
+    len_t n_lists = 5;
+    len_t n_entries = 7 * BULK_INSERT_N_RANGES + 3;
+    std::vector<vector_el_t> vectors(n_entries * vector_dim);
+    std::vector<vector_id_t> ids(n_entries);
+    std::vector<list_id_t> list_ids(n_entries);
+    for (len_t i = 0; i < n_entries; i++)
+    {
+      for (len_t j = 0; j < vector_dim; j++)
+      {
+        vectors[i * vector_dim + j] = (vector_el_t)(i * vector_dim + j);
+      }
+      ids[i] = i;
+      list_ids[i] = (list_id_t)(i * 3 % n_lists);
+    }
+
+    AND_GIVEN("the vectors, ids and list ids are written to files according to the format required by bulk_insert_entries()")
+    {
+      std::string vectors_filepath = join(TMP_DIR, "ranges_" + get_vectors_filename());
+      std::string vector_ids_filepath = join(TMP_DIR, std::string("ranges_") + VECTOR_IDS_FILENAME);
+      std::string list_ids_filepath = join(TMP_DIR, "ranges_" + get_list_ids_filename(0));
+      write_to_file(vectors_filepath, vectors.data(), n_entries * vector_dim * sizeof(vector_el_t));
+      write_to_file(vector_ids_filepath, ids.data(), n_entries * sizeof(vector_id_t));
+      write_to_file(list_ids_filepath, list_ids.data(), n_entries * sizeof(list_id_t));
+
+      test_bulk_insert_entries(
+          n_entries,
+          vector_dim,
+          vectors.data(),
+          ids.data(),
+          list_ids.data(),
+          vectors_filepath,
+          vector_ids_filepath,
+          list_ids_filepath);
+    }
+  }
+}
+
 SCENARIO("test bulk_insert_entries with SIFT1M", "[StorageLists][bulk_insert_entries][test][SIFT1M]")
 {
   len_t n_entries = (len_t)1E6;
@@ -1086,3 +1144,1334 @@ SCENARIO("benchmark bulk_insert_entries with SIFT1B", "[StorageLists][bulk_inser
   len_t n_lists = GENERATE(TEST_N_LISTS);
   bench_bulk_insert_entries_dataset("SIFT1B", n_entries, vector_dim, n_lists);
 }
+
+SCENARIO("get_inverse_norms(): inverse norms are maintained for the cosine metric", "[StorageLists][inverse_norms][test]")
+{
+  GIVEN("an StorageLists object using the cosine metric and random vectors")
+  {
+    len_t vector_dim = GENERATE(1, 7, 128);
+    std::string file = join(TMP_DIR, get_lists_filename());
+    remove(file.c_str());
+    StorageLists lists(vector_dim, file, METRIC_COSINE);
+
+    len_t n_entries = 300;
+    len_t n_lists = 3;
+    std::vector<vector_el_t> vectors(n_entries * vector_dim);
+    std::vector<vector_id_t> ids(n_entries);
+    for (len_t i = 0; i < n_entries * vector_dim; i++)
+    {
+      vectors[i] = (vector_el_t)(rand() % 2001 - 1000);
+    }
+    for (len_t i = 0; i < n_entries; i++)
+    {
+      ids[i] = i;
+    }
+
+    WHEN("the entries are inserted one by one, growing and moving the lists")
+    {
+      for (len_t i = 0; i < n_entries; i++)
+      {
+        lists.insert_entries(i % n_lists, &vectors[i * vector_dim], &ids[i], 1);
+      }
+
+      THEN("every list holds the inverse norms of its vectors")
+      {
+        for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+        {
+          len_t list_length = lists.get_list_length(list_id);
+          const vector_el_t *list_vectors = lists.get_vectors(list_id);
+          const vector_id_t *list_ids = lists.get_ids(list_id);
+          const distance_t *inverse_norms = lists.get_inverse_norms(list_id);
+          REQUIRE(list_length == n_entries / n_lists);
+          for (len_t j = 0; j < list_length; j++)
+          {
+            REQUIRE(list_ids[j] == (vector_id_t)(j * n_lists + list_id));
+            double norm_sqr = 0;
+            for (len_t k = 0; k < vector_dim; k++)
+            {
+              norm_sqr += list_vectors[j * vector_dim + k] * list_vectors[j * vector_dim + k];
+            }
+            double expected = norm_sqr == 0 ? 0 : 1 / std::sqrt(norm_sqr);
+            REQUIRE(inverse_norms[j] == Approx(expected));
+          }
+        }
+      }
+
+      AND_WHEN("a list is shrunk")
+      {
+        lists.resize_list(0, 10);
+
+        THEN("the remaining inverse norms are unchanged")
+        {
+          const vector_el_t *list_vectors = lists.get_vectors(0);
+          const distance_t *inverse_norms = lists.get_inverse_norms(0);
+          for (len_t j = 0; j < 10; j++)
+          {
+            REQUIRE(inverse_norms[j] == Approx(get_inverse_norm(&list_vectors[j * vector_dim], vector_dim)));
+          }
+        }
+      }
+    }
+  }
+
+  GIVEN("an StorageLists object using the L2 metric")
+  {
+    StorageLists lists = get_inverted_lists_object(4);
+    vector_el_t vector[] = {1, 2, 3, 4};
+    vector_id_t id = 0;
+    lists.insert_entries(0, vector, &id, 1);
+
+    THEN("no inverse norms are stored")
+    {
+      REQUIRE_THROWS_AS(lists.get_inverse_norms(0), std::logic_error);
+    }
+  }
+}
+
+SCENARIO("StorageLists(): an existing lists file can be reopened from its metadata", "[StorageLists][metadata][test]")
+{
+  GIVEN("lists which are filled, partly shrunk and then destroyed")
+  {
+    metric_t metric = GENERATE(METRIC_L2, METRIC_COSINE);
+    len_t vector_dim = 9;
+    len_t n_entries = 200;
+    len_t n_lists = 5;
+    std::string file = join(TMP_DIR, get_lists_filename());
+    remove(file.c_str());
+    remove((file + METADATA_FILE_EXT).c_str());
+    std::vector<vector_el_t> vectors(n_entries * vector_dim);
+    std::vector<vector_id_t> ids(n_entries);
+    std::mt19937 rng(metric);
+    std::uniform_int_distribution<int> gen_component(-1000, 1000);
+    for (len_t i = 0; i < n_entries * vector_dim; i++)
+    {
+      vectors[i] = (vector_el_t)gen_component(rng);
+    }
+    for (len_t i = 0; i < n_entries; i++)
+    {
+      ids[i] = i;
+    }
+    size_t total_size;
+    size_t free_space;
+    {
+      StorageLists lists(vector_dim, file, metric);
+      for (len_t i = 0; i < n_entries; i++)
+      {
+        lists.insert_entries(i % n_lists, &vectors[i * vector_dim], &ids[i], 1);
+      }
+      lists.resize_list(1, 3);
+      total_size = lists.get_total_size();
+      free_space = lists.get_free_space();
+    }
+
+    WHEN("the file is opened read-only")
+    {
+      StorageLists lists(file, OPEN_MODE_READ_ONLY);
+
+      THEN("the lists, their entries and the free space are restored")
+      {
+        REQUIRE(lists.get_vector_dim() == vector_dim);
+        REQUIRE(lists.get_metric() == metric);
+        REQUIRE(lists.get_length() == n_lists);
+        REQUIRE(lists.get_total_size() == total_size);
+        REQUIRE(lists.get_free_space() == free_space);
+        for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+        {
+          len_t list_length = lists.get_list_length(list_id);
+          REQUIRE(list_length == (list_id == 1 ? 3 : n_entries / n_lists));
+          const vector_id_t *list_ids = lists.get_ids(list_id);
+          for (len_t j = 0; j < list_length; j++)
+          {
+            REQUIRE(list_ids[j] == (vector_id_t)(j * n_lists + list_id));
+          }
+          are_vectors_equal(lists.get_vectors(list_id), &vectors[list_id * vector_dim], vector_dim, 1);
+        }
+      }
+
+      THEN("the lists cannot be modified")
+      {
+        REQUIRE_THROWS_AS(lists.insert_entries(0, vectors.data(), ids.data(), 1), std::logic_error);
+        REQUIRE_THROWS_AS(lists.update_entries(0, vectors.data(), ids.data(), 1, 0), std::logic_error);
+        REQUIRE_THROWS_AS(lists.resize_list(0, 1), std::logic_error);
+        REQUIRE_THROWS_AS(lists.flush(), std::logic_error);
+      }
+    }
+
+    WHEN("the file is opened read-write and modified")
+    {
+      {
+        StorageLists lists(file, OPEN_MODE_READ_WRITE);
+        lists.insert_entries(n_lists, vectors.data(), ids.data(), 1);
+        lists.resize_list(0, 1);
+      }
+      StorageLists lists(file, OPEN_MODE_READ_ONLY);
+
+      THEN("the modifications are visible after reopening")
+      {
+        REQUIRE(lists.get_length() == n_lists + 1);
+        REQUIRE(lists.get_list_length(0) == 1);
+        REQUIRE(lists.get_list_length(n_lists) == 1);
+        are_vectors_equal(lists.get_vectors(n_lists), vectors.data(), vector_dim, 1);
+        if (metric == METRIC_COSINE)
+        {
+          REQUIRE(lists.get_inverse_norms(n_lists)[0] == Approx(get_inverse_norm(vectors.data(), vector_dim)));
+        }
+      }
+    }
+
+    WHEN("the metadata file is missing or corrupt")
+    {
+      std::string metadata_file = file + METADATA_FILE_EXT;
+      std::ofstream(metadata_file, std::ios::binary | std::ios::app) << "x";
+
+      THEN("the file cannot be opened")
+      {
+        REQUIRE_THROWS_AS(StorageLists(file, OPEN_MODE_READ_ONLY), std::runtime_error);
+        remove(metadata_file.c_str());
+        REQUIRE_THROWS_AS(StorageLists(file, OPEN_MODE_READ_ONLY), std::runtime_error);
+      }
+    }
+  }
+}
+
+static void copy_file(const std::string &src, const std::string &dst)
+{
+  std::ifstream src_file(src, std::ios::binary);
+  std::ofstream dst_file(dst, std::ios::binary | std::ios::trunc);
+  dst_file << src_file.rdbuf();
+}
+
+SCENARIO("StorageLists(): modifications after the last flush are recovered from the write-ahead log", "[StorageLists][wal][test]")
+{
+  GIVEN("lists with a write-ahead log which are modified after their last flush")
+  {
+    metric_t metric = GENERATE(METRIC_L2, METRIC_COSINE);
+    len_t vector_dim = 7;
+    len_t n_entries = 300;
+    len_t n_lists = 6;
+    std::string file = join(TMP_DIR, get_lists_filename());
+    std::string crashed_file = file + "_crashed";
+    std::vector<vector_el_t> vectors(n_entries * vector_dim);
+    std::vector<vector_id_t> ids(n_entries);
+    std::mt19937 rng(metric + 1);
+    std::uniform_int_distribution<int> gen_component(-1000, 1000);
+    for (len_t i = 0; i < n_entries * vector_dim; i++)
+    {
+      vectors[i] = (vector_el_t)gen_component(rng);
+    }
+    for (len_t i = 0; i < n_entries; i++)
+    {
+      ids[i] = i;
+    }
+
+    // the files of crashed lists are simulated by copying them before the
+    // lists are destroyed, taking the lists file either from the last flush
+    // or after the modifications, as if all modified pages had been written
+    bool are_pages_written = GENERATE(false, true);
+    std::unordered_map<list_id_t, std::vector<vector_id_t>> expected_ids;
+    std::unordered_map<list_id_t, std::vector<vector_el_t>> expected_vectors;
+    {
+      StorageLists lists(vector_dim, file, metric);
+      for (len_t i = 0; i < n_entries / 2; i++)
+      {
+        lists.insert_entries(i % n_lists, &vectors[i * vector_dim], &ids[i], 1);
+      }
+      lists.enable_write_ahead_log();
+      copy_file(file, crashed_file);
+      for (len_t i = n_entries / 2; i < n_entries; i++)
+      {
+        lists.insert_entries(i % (n_lists + 1), &vectors[i * vector_dim], &ids[i], 1);
+      }
+      lists.resize_list(1, 4);
+      lists.update_entries(2, vectors.data(), ids.data(), 3, 5);
+      lists.create_list(n_lists + 1, 2);
+      lists.update_entries(n_lists + 1, &vectors[vector_dim], &ids[1], 2, 0);
+      // a batch is logged as one insertion per list
+      std::vector<list_id_t> batch_list_ids(20);
+      for (len_t i = 0; i < batch_list_ids.size(); i++)
+      {
+        batch_list_ids[i] = i * 5 % (n_lists + 2);
+      }
+      lists.batch_insert_entries(batch_list_ids.data(), vectors.data(), ids.data(), batch_list_ids.size());
+      lists.sync_write_ahead_log();
+
+      for (list_id_t list_id = 0; list_id < (list_id_t)n_lists + 2; list_id++)
+      {
+        len_t list_length = lists.get_list_length(list_id);
+        expected_ids[list_id].assign(lists.get_ids(list_id), lists.get_ids(list_id) + list_length);
+        expected_vectors[list_id].assign(lists.get_vectors(list_id), lists.get_vectors(list_id) + list_length * vector_dim);
+      }
+      if (are_pages_written)
+      {
+        copy_file(file, crashed_file);
+      }
+      copy_file(file + METADATA_FILE_EXT, crashed_file + METADATA_FILE_EXT);
+      copy_file(file + LOG_FILE_EXT, crashed_file + LOG_FILE_EXT);
+    }
+
+    WHEN("the crashed lists are opened read-write")
+    {
+      StorageLists lists(crashed_file, OPEN_MODE_READ_WRITE);
+
+      THEN("the logged modifications are replayed and the log is truncated")
+      {
+        REQUIRE(lists.is_write_ahead_log_enabled());
+        REQUIRE(lists.get_length() == n_lists + 2);
+        for (list_id_t list_id = 0; list_id < (list_id_t)n_lists + 2; list_id++)
+        {
+          len_t list_length = lists.get_list_length(list_id);
+          REQUIRE(list_length == expected_ids[list_id].size());
+          are_ids_equal(lists.get_ids(list_id), expected_ids[list_id].data(), list_length);
+          are_vectors_equal(lists.get_vectors(list_id), expected_vectors[list_id].data(), vector_dim, list_length);
+          if (metric == METRIC_COSINE)
+          {
+            REQUIRE(lists.get_inverse_norms(list_id)[0] == Approx(get_inverse_norm(expected_vectors[list_id].data(), vector_dim)));
+          }
+        }
+        std::ifstream log_file(lists.get_log_filename(), std::ios::binary | std::ios::ate);
+        REQUIRE((size_t)log_file.tellg() == sizeof(WalFileHeader));
+      }
+    }
+
+    WHEN("the log ends with an incomplete record")
+    {
+      std::ofstream(crashed_file + LOG_FILE_EXT, std::ios::binary | std::ios::app) << "incomplete record";
+      StorageLists lists(crashed_file, OPEN_MODE_READ_WRITE);
+
+      THEN("the complete records are replayed")
+      {
+        REQUIRE(lists.get_length() == n_lists + 2);
+        REQUIRE(lists.get_list_length(1) == expected_ids[1].size());
+        REQUIRE(lists.get_list_length(n_lists) == expected_ids[n_lists].size());
+      }
+    }
+
+    WHEN("the crashed lists are opened read-only")
+    {
+      THEN("the lists cannot be opened until the log is replayed")
+      {
+        REQUIRE_THROWS_AS(StorageLists(crashed_file, OPEN_MODE_READ_ONLY), std::runtime_error);
+        {
+          StorageLists lists(crashed_file, OPEN_MODE_READ_WRITE);
+        }
+        REQUIRE(StorageLists(crashed_file, OPEN_MODE_READ_ONLY).get_length() == n_lists + 2);
+      }
+    }
+
+    WHEN("the lists were destroyed properly")
+    {
+      StorageLists lists(file, OPEN_MODE_READ_ONLY);
+
+      THEN("the log is empty and the lists can be opened read-only")
+      {
+        REQUIRE(lists.get_length() == n_lists + 2);
+        REQUIRE(!lists.is_write_ahead_log_enabled());
+      }
+    }
+  }
+}
+
+SCENARIO("update_entries(): updates are logged ahead of overwriting the entries", "[StorageLists][wal][test]")
+{
+  GIVEN("lists with a write-ahead log whose entries belong to the last checkpoint")
+  {
+    len_t vector_dim = 5;
+    len_t n_entries = 20;
+    std::string file = join(TMP_DIR, get_lists_filename());
+    std::string crashed_file = file + "_crashed";
+    std::vector<vector_el_t> vectors(n_entries * vector_dim);
+    std::vector<vector_id_t> ids(n_entries);
+    for (len_t i = 0; i < n_entries; i++)
+    {
+      ids[i] = i;
+      for (len_t j = 0; j < vector_dim; j++)
+      {
+        vectors[i * vector_dim + j] = (vector_el_t)(i + j);
+      }
+    }
+    std::vector<vector_el_t> new_vectors(vectors.rbegin(), vectors.rend());
+    StorageLists *lists = new StorageLists(vector_dim, file);
+    lists->insert_entries(0, vectors.data(), ids.data(), n_entries);
+    lists->enable_write_ahead_log();
+
+    WHEN("entries are updated in place and the process crashes before the log is synced")
+    {
+      lists->update_entries(0, &new_vectors[vector_dim], &ids[1], n_entries - 2, 1);
+      // the lists file is taken after the update, as if its pages had been
+      // written back, which must not happen before the record is durable
+      std::ifstream log_file(lists->get_log_filename(), std::ios::binary | std::ios::ate);
+      size_t log_size = log_file.tellg();
+      copy_file(file, crashed_file);
+      copy_file(file + METADATA_FILE_EXT, crashed_file + METADATA_FILE_EXT);
+      copy_file(file + LOG_FILE_EXT, crashed_file + LOG_FILE_EXT);
+
+      THEN("the record of the update is durable and replayed")
+      {
+        REQUIRE(log_size > sizeof(WalFileHeader));
+        StorageLists crashed_lists(crashed_file, OPEN_MODE_READ_WRITE);
+        REQUIRE(crashed_lists.get_list_length(0) == n_entries);
+        are_vectors_equal(crashed_lists.get_vectors(0), vectors.data(), vector_dim, 1);
+        are_vectors_equal(&crashed_lists.get_vectors(0)[vector_dim], &new_vectors[vector_dim], vector_dim, n_entries - 2);
+      }
+    }
+    WHEN("an update is out of bounds")
+    {
+      THEN("it is neither applied nor logged")
+      {
+        REQUIRE_THROWS_AS(lists->update_entries(0, vectors.data(), ids.data(), 2, n_entries - 1), std::out_of_range);
+        lists->sync_write_ahead_log();
+        std::ifstream log_file(lists->get_log_filename(), std::ios::binary | std::ios::ate);
+        REQUIRE((size_t)log_file.tellg() == sizeof(WalFileHeader));
+      }
+    }
+    delete lists;
+  }
+}
+
+SCENARIO("delete_entries(), upsert_entries(): deletions are logged ahead of setting the tombstones", "[StorageLists][wal][test]")
+{
+  GIVEN("two lists with a write-ahead log and an id directory whose entries belong to the last checkpoint")
+  {
+    len_t vector_dim = 5;
+    len_t n_entries = 20;
+    std::string file = join(TMP_DIR, get_lists_filename());
+    std::string crashed_file = file + "_crashed";
+    std::vector<vector_el_t> vectors(n_entries * vector_dim);
+    std::vector<vector_id_t> ids(n_entries);
+    for (len_t i = 0; i < n_entries; i++)
+    {
+      ids[i] = i;
+      for (len_t j = 0; j < vector_dim; j++)
+      {
+        vectors[i * vector_dim + j] = (vector_el_t)(i + j);
+      }
+    }
+    std::vector<vector_el_t> new_vectors(vectors.rbegin(), vectors.rend());
+    StorageLists *lists = new StorageLists(vector_dim, file);
+    lists->insert_entries(0, vectors.data(), ids.data(), n_entries / 2);
+    lists->insert_entries(1, &vectors[n_entries / 2 * vector_dim], &ids[n_entries / 2], n_entries / 2);
+    lists->enable_id_directory();
+    lists->enable_write_ahead_log();
+    std::ifstream checkpoint_log_file(lists->get_log_filename(), std::ios::binary | std::ios::ate);
+    size_t checkpoint_log_size = checkpoint_log_file.tellg();
+    // the lists file of the crashed lists is either the checkpoint or taken
+    // after the modifications, as if their pages had been written back
+    copy_file(file, crashed_file);
+    std::map<vector_id_t, std::pair<list_id_t, const vector_el_t *>> old_entries;
+    for (len_t i = 0; i < n_entries; i++)
+    {
+      old_entries[ids[i]] = {i < n_entries / 2 ? 0 : 1, &vectors[i * vector_dim]};
+    }
+
+    // every id has to be stored once, in the expected list and with the expected vector
+    auto require_entries = [&](const std::map<vector_id_t, std::pair<list_id_t, const vector_el_t *>> &expected)
+    {
+      StorageLists crashed_lists(crashed_file, OPEN_MODE_READ_WRITE);
+      std::unordered_set<vector_id_t> found_ids;
+      for (list_id_t list_id = 0; list_id < 2; list_id++)
+      {
+        ListData list = crashed_lists.get_list_data(list_id);
+        for (len_t i = 0; i < list.length; i++)
+        {
+          if (list.tombstones[i / 64] >> (i % 64) & 1)
+          {
+            continue;
+          }
+          auto entry_it = expected.find(list.ids[i]);
+          REQUIRE(entry_it != expected.end());
+          REQUIRE(found_ids.insert(list.ids[i]).second);
+          REQUIRE(entry_it->second.first == list_id);
+          are_vectors_equal(&crashed_lists.get_vectors(list_id)[i * vector_dim], entry_it->second.second, vector_dim, 1);
+        }
+      }
+      REQUIRE(found_ids.size() == expected.size());
+    };
+
+    WHEN("entries are deleted and the process crashes once the deletion returns")
+    {
+      bool are_pages_written = GENERATE(false, true);
+      REQUIRE(lists->delete_entries(0, &ids[2], 3) == 3);
+      if (are_pages_written)
+      {
+        copy_file(file, crashed_file);
+      }
+      copy_file(file + METADATA_FILE_EXT, crashed_file + METADATA_FILE_EXT);
+      copy_file(file + LOG_FILE_EXT, crashed_file + LOG_FILE_EXT);
+
+      THEN("the record of the deletion is durable and replayed")
+      {
+        std::map<vector_id_t, std::pair<list_id_t, const vector_el_t *>> expected = old_entries;
+        expected.erase(ids[2]);
+        expected.erase(ids[3]);
+        expected.erase(ids[4]);
+        require_entries(expected);
+      }
+    }
+
+    // entries of the first list are moved to the second list and
+    // entries of the second list are updated in place
+    std::vector<len_t> upserted = {0, 1, 2, 3, 4, 10, 11};
+    std::vector<vector_el_t> upserted_vectors;
+    std::vector<vector_id_t> upserted_ids;
+    std::map<vector_id_t, std::pair<list_id_t, const vector_el_t *>> new_entries = old_entries;
+    for (len_t i : upserted)
+    {
+      upserted_vectors.insert(upserted_vectors.end(), &new_vectors[i * vector_dim], &new_vectors[(i + 1) * vector_dim]);
+      upserted_ids.push_back(ids[i]);
+      new_entries[ids[i]] = {1, &new_vectors[i * vector_dim]};
+    }
+
+    WHEN("entries are upserted and the process crashes once the upsert returns")
+    {
+      bool are_pages_written = GENERATE(false, true);
+      lists->upsert_entries(1, upserted_vectors.data(), upserted_ids.data(), upserted_ids.size());
+      if (are_pages_written)
+      {
+        copy_file(file, crashed_file);
+      }
+      copy_file(file + METADATA_FILE_EXT, crashed_file + METADATA_FILE_EXT);
+      copy_file(file + LOG_FILE_EXT, crashed_file + LOG_FILE_EXT);
+
+      THEN("the records of the upsert are durable and replayed")
+      {
+        require_entries(new_entries);
+      }
+    }
+    WHEN("entries are upserted and the process crashes while the log is synced, tearing the records of the upsert")
+    {
+      lists->upsert_entries(1, upserted_vectors.data(), upserted_ids.data(), upserted_ids.size());
+      copy_file(file + METADATA_FILE_EXT, crashed_file + METADATA_FILE_EXT);
+      copy_file(file + LOG_FILE_EXT, crashed_file + LOG_FILE_EXT);
+      std::ifstream log_file(crashed_file + LOG_FILE_EXT, std::ios::binary | std::ios::ate);
+      size_t log_size = log_file.tellg();
+      // the tears fall into the updates, the deletion and the insertion
+      size_t torn_log_size = GENERATE_COPY(
+          checkpoint_log_size + (log_size - checkpoint_log_size) / 4,
+          checkpoint_log_size + (log_size - checkpoint_log_size) / 2,
+          checkpoint_log_size + (log_size - checkpoint_log_size) * 3 / 4,
+          log_size - 1);
+      REQUIRE(truncate((crashed_file + LOG_FILE_EXT).c_str(), torn_log_size) == 0);
+
+      THEN("no record of the upsert is replayed, so that no moved entry is lost")
+      {
+        require_entries(old_entries);
+      }
+    }
+    delete lists;
+  }
+}
+
+SCENARIO("WriteAheadLog: a log whose records cannot be written fails until it is reset", "[WriteAheadLog][wal][test]")
+{
+  GIVEN("a log and a record which does not fit below the file size limit")
+  {
+    std::string file = join(TMP_DIR, get_lists_filename() + LOG_FILE_EXT);
+    remove(file.c_str());
+    WriteAheadLog wal(file);
+    std::vector<uint8_t> payload(4096, 7);
+    WalRecordHeader record = {0, WAL_RECORD_INSERT, 1, 2, 3, 0};
+
+    WHEN("the record is only partly written")
+    {
+      // writes beyond the limit fail with EFBIG instead of raising SIGXFSZ
+      struct rlimit limit;
+      getrlimit(RLIMIT_FSIZE, &limit);
+      struct rlimit small_limit = limit;
+      small_limit.rlim_cur = sizeof(WalFileHeader) + sizeof(WalRecordHeader) + 100;
+      auto previous_handler = signal(SIGXFSZ, SIG_IGN);
+      setrlimit(RLIMIT_FSIZE, &small_limit);
+      uint64_t lsn = wal.append(record, {{payload.data(), payload.size()}});
+      bool has_sync_failed = false;
+      try
+      {
+        wal.sync(lsn);
+      }
+      catch (const std::runtime_error &)
+      {
+        has_sync_failed = true;
+      }
+      setrlimit(RLIMIT_FSIZE, &limit);
+      signal(SIGXFSZ, previous_handler);
+
+      THEN("every later append and sync fails until the log is reset")
+      {
+        REQUIRE(has_sync_failed);
+        REQUIRE(wal.has_failed());
+        REQUIRE_THROWS_AS(wal.append(record, {{payload.data(), payload.size()}}), std::runtime_error);
+        REQUIRE_THROWS_AS(wal.sync(), std::runtime_error);
+        REQUIRE_THROWS_AS(wal.sync(lsn), std::runtime_error);
+
+        wal.reset(1);
+        REQUIRE(!wal.has_failed());
+        record.list_id = 5;
+        wal.sync(wal.append(record, {{payload.data(), payload.size()}}));
+        len_t n_records = 0;
+        wal.replay([&](const WalRecordHeader &header, const uint8_t *data)
+                   {
+                     REQUIRE(header.list_id == 5);
+                     REQUIRE(header.payload_size == payload.size());
+                     REQUIRE(data[0] == 7);
+                     n_records++; });
+        REQUIRE(n_records == 1);
+      }
+    }
+  }
+}
+
+SCENARIO("alloc_slot(): free slots are reused and merged as lists are resized", "[StorageLists][free_slots][test]")
+{
+  GIVEN("an StorageLists object with many short lists")
+  {
+    len_t vector_dim = 4;
+    len_t n_lists = 16;
+    StorageLists lists = get_inverted_lists_object(vector_dim);
+    std::vector<vector_el_t> vectors(64 * vector_dim, 1.0f);
+    std::vector<vector_id_t> ids(64);
+    for (len_t i = 0; i < ids.size(); i++)
+    {
+      ids[i] = i;
+    }
+    for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+    {
+      lists.insert_entries(list_id, vectors.data(), ids.data(), 1);
+    }
+
+    WHEN("every list is grown out of its slot and then shrunk again")
+    {
+      for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+      {
+        lists.insert_entries(list_id, vectors.data(), ids.data(), 63);
+      }
+      for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+      {
+        lists.resize_list(list_id, 1);
+      }
+
+      THEN("the slots of the grown lists are merged into one free slot")
+      {
+        size_t used_space = n_lists * get_list_size(vector_dim, 1);
+        REQUIRE(lists.get_free_space() == lists.get_total_size() - used_space);
+        REQUIRE(lists.get_largest_continuous_free_space() >= n_lists * get_list_size(vector_dim, 64) - used_space);
+      }
+    }
+
+    WHEN("the lists are grown and shrunk in random order")
+    {
+      std::mt19937 rng(13);
+      std::uniform_int_distribution<list_id_t> pick_list_id(0, n_lists - 1);
+      std::uniform_int_distribution<len_t> gen_length(1, ids.size());
+      std::vector<std::vector<vector_id_t>> expected_ids(n_lists, std::vector<vector_id_t>(1, 0));
+      for (len_t i = 0; i < 2000; i++)
+      {
+        list_id_t list_id = pick_list_id(rng);
+        std::vector<vector_id_t> &list_ids = expected_ids[list_id];
+        len_t length = gen_length(rng);
+        if (i % 3 == 0 && length < list_ids.size())
+        {
+          lists.resize_list(list_id, length);
+          list_ids.resize(length);
+        }
+        else if (list_ids.size() + length <= 1024)
+        {
+          lists.insert_entries(list_id, vectors.data(), ids.data(), length);
+          list_ids.insert(list_ids.end(), ids.begin(), ids.begin() + length);
+        }
+      }
+
+      THEN("no list overlaps another list or a free slot")
+      {
+        size_t used_space = 0;
+        for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+        {
+          len_t list_length = expected_ids[list_id].size();
+          REQUIRE(lists.get_list_length(list_id) == list_length);
+          are_ids_equal(lists.get_ids(list_id), expected_ids[list_id].data(), list_length);
+          used_space += get_list_size(vector_dim, list_length);
+        }
+        REQUIRE(lists.get_free_space() == lists.get_total_size() - used_space);
+        REQUIRE(lists.get_largest_continuous_free_space() <= lists.get_free_space());
+      }
+    }
+  }
+}
+
+SCENARIO("resize_region(): the region grows without moving the lists", "[StorageLists][region][test]")
+{
+  GIVEN("an StorageLists object with a list")
+  {
+    len_t vector_dim = 16;
+    StorageLists lists = get_inverted_lists_object(vector_dim);
+    std::vector<vector_el_t> vectors(1024 * vector_dim);
+    std::vector<vector_id_t> ids(1024);
+    for (len_t i = 0; i < ids.size(); i++)
+    {
+      ids[i] = i;
+      for (len_t j = 0; j < vector_dim; j++)
+      {
+        vectors[i * vector_dim + j] = (vector_el_t)(i + j);
+      }
+    }
+    lists.insert_entries(0, vectors.data(), ids.data(), 4);
+    const vector_el_t *list_vectors = lists.get_vectors(0);
+    const vector_id_t *list_ids = lists.get_ids(0);
+
+    WHEN("other lists grow the region many times")
+    {
+      size_t total_size = lists.get_total_size();
+      for (list_id_t list_id = 1; list_id <= 8; list_id++)
+      {
+        lists.insert_entries(list_id, vectors.data(), ids.data(), ids.size());
+      }
+
+      THEN("pointers into the list remain valid")
+      {
+        REQUIRE(lists.get_total_size() >= 256 * total_size);
+        REQUIRE(lists.get_vectors(0) == list_vectors);
+        REQUIRE(lists.get_ids(0) == list_ids);
+        are_vectors_equal(list_vectors, vectors.data(), vector_dim, 4);
+        are_ids_equal(list_ids, ids.data(), 4);
+        are_ids_equal(lists.get_ids(8), ids.data(), ids.size());
+      }
+    }
+  }
+}
+
+SCENARIO("set_mapping_policy(): the region can be backed by huge pages and the lists spread across NUMA nodes", "[StorageLists][mapping_policy][test]")
+{
+  GIVEN("an StorageLists object with lists")
+  {
+    len_t vector_dim = 16;
+    StorageLists lists = get_inverted_lists_object(vector_dim);
+    std::vector<vector_el_t> vectors(1024 * vector_dim);
+    std::vector<vector_id_t> ids(1024);
+    for (len_t i = 0; i < ids.size(); i++)
+    {
+      ids[i] = i;
+      for (len_t j = 0; j < vector_dim; j++)
+      {
+        vectors[i * vector_dim + j] = (vector_el_t)(i + j);
+      }
+    }
+    for (list_id_t list_id = 0; list_id < 4; list_id++)
+    {
+      lists.insert_entries(list_id, vectors.data(), ids.data(), 100);
+    }
+
+    WHEN("the default mapping policy is used")
+    {
+      MappingPolicy policy = lists.get_mapping_policy();
+
+      THEN("it is given by USE_HUGE_PAGES and N_NUMA_NODES")
+      {
+        REQUIRE(policy.use_huge_pages == (USE_HUGE_PAGES != 0));
+        REQUIRE(policy.n_numa_nodes >= 1);
+        REQUIRE(lists.get_list_numa_node(3) < (int)policy.n_numa_nodes);
+      }
+    }
+    WHEN("the lists are spread across the nodes of the machine")
+    {
+      lists.set_mapping_policy({false, 0, 0});
+
+      THEN("the number of nodes and the chunk size are set")
+      {
+        REQUIRE(lists.get_mapping_policy().n_numa_nodes >= 1);
+        REQUIRE(lists.get_mapping_policy().numa_chunk_size == NUMA_CHUNK_SIZE);
+      }
+    }
+    WHEN("huge pages are used, the lists are placed on 3 nodes in chunks of a page and the region grows")
+    {
+      size_t page_size = sysconf(_SC_PAGESIZE);
+      lists.set_mapping_policy({true, 3, page_size});
+      lists.place_lists_on_numa_nodes();
+      for (list_id_t list_id = 4; list_id < 8; list_id++)
+      {
+        lists.insert_entries(list_id, vectors.data(), ids.data(), ids.size());
+      }
+      lists.place_lists_on_numa_nodes();
+
+      THEN("every list is assigned to the node of the chunk holding its middle and keeps its entries")
+      {
+        REQUIRE(lists.get_mapping_policy().use_huge_pages);
+        std::unordered_set<int> nodes;
+        for (list_id_t list_id = 0; list_id < 8; list_id++)
+        {
+          ListLayout layout = lists.get_list_layout(list_id);
+          int node = lists.get_list_numa_node(list_id);
+          REQUIRE(node == (int)((layout.offset + layout.size / 2) / page_size % 3));
+          nodes.insert(node);
+        }
+        REQUIRE(nodes.size() > 1);
+        REQUIRE_THROWS_AS(lists.get_list_numa_node(8), std::invalid_argument);
+        for (list_id_t list_id = 0; list_id < 4; list_id++)
+        {
+          are_vectors_equal(lists.get_vectors(list_id), vectors.data(), vector_dim, 100);
+          are_ids_equal(lists.get_ids(list_id), ids.data(), 100);
+        }
+        are_vectors_equal(lists.get_vectors(7), vectors.data(), vector_dim, ids.size());
+      }
+    }
+    WHEN("the chunk size is not a multiple of the page size")
+    {
+      THEN("the policy is rejected")
+      {
+        REQUIRE_THROWS_AS(lists.set_mapping_policy({false, 2, 1000}), std::invalid_argument);
+      }
+    }
+  }
+}
+
+SCENARIO("alloc_list(): the blocks of every list are aligned to LIST_ALIGNMENT", "[StorageLists][alignment][test]")
+{
+  GIVEN("an StorageLists object using the cosine metric and vectors whose size is not a multiple of the alignment")
+  {
+    len_t vector_dim = GENERATE(1, 7, 19);
+    std::string file = join(TMP_DIR, get_lists_filename());
+    remove(file.c_str());
+    StorageLists lists(vector_dim, file, METRIC_COSINE);
+    std::vector<vector_el_t> vectors(100 * vector_dim, 1.0f);
+    std::vector<vector_id_t> ids(100);
+    for (len_t i = 0; i < ids.size(); i++)
+    {
+      ids[i] = i;
+    }
+
+    WHEN("lists of different lengths are inserted, grown and shrunk")
+    {
+      std::mt19937 rng(vector_dim);
+      for (list_id_t list_id = 0; list_id < 8; list_id++)
+      {
+        lists.insert_entries(list_id, vectors.data(), ids.data(), 1);
+      }
+      for (len_t i = 0; i < 200; i++)
+      {
+        list_id_t list_id = rng() % 8;
+        if (rng() % 4 == 0 && lists.get_list_length(list_id) > 1)
+        {
+          lists.resize_list(list_id, lists.get_list_length(list_id) / 2);
+        }
+        else
+        {
+          lists.insert_entries(list_id, vectors.data(), ids.data(), rng() % ids.size() + 1);
+        }
+      }
+
+      THEN("the vectors, ids, inverse norms and tombstones of every list start at aligned addresses")
+      {
+        for (list_id_t list_id = 0; list_id < 8; list_id++)
+        {
+          ListLayout layout = lists.get_list_layout(list_id);
+          REQUIRE(layout.offset % LIST_ALIGNMENT == 0);
+          REQUIRE(layout.ids_offset % LIST_ALIGNMENT == 0);
+          REQUIRE(layout.inverse_norms_offset % LIST_ALIGNMENT == 0);
+          REQUIRE(layout.tombstones_offset % LIST_ALIGNMENT == 0);
+          REQUIRE((uintptr_t)lists.get_vectors(list_id) % LIST_ALIGNMENT == 0);
+          REQUIRE((uintptr_t)lists.get_ids(list_id) % LIST_ALIGNMENT == 0);
+          REQUIRE((uintptr_t)lists.get_inverse_norms(list_id) % LIST_ALIGNMENT == 0);
+        }
+      }
+      AND_WHEN("the lists are reopened")
+      {
+        lists.flush();
+        StorageLists reopened_lists(file, OPEN_MODE_READ_ONLY);
+
+        THEN("the lists are read with the same layout")
+        {
+          for (list_id_t list_id = 0; list_id < 8; list_id++)
+          {
+            len_t list_length = lists.get_list_length(list_id);
+            REQUIRE(reopened_lists.get_list_length(list_id) == list_length);
+            are_ids_equal(reopened_lists.get_ids(list_id), lists.get_ids(list_id), list_length);
+            for (len_t j = 0; j < list_length; j++)
+            {
+              REQUIRE(reopened_lists.get_inverse_norms(list_id)[j] == lists.get_inverse_norms(list_id)[j]);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("enable_concurrent_reads(): lists can be read while they are modified", "[StorageLists][concurrent_reads][test]")
+{
+  GIVEN("lists whose entries hold their position within the list and which can be read concurrently")
+  {
+    len_t vector_dim = 4;
+    len_t n_lists = 8;
+    std::string file = join(TMP_DIR, get_lists_filename());
+    remove(file.c_str());
+    StorageLists lists(vector_dim, file);
+    // the id of an entry is list_id * ID_FACTOR + position, its components are its position
+    const vector_id_t ID_FACTOR = 1000000;
+    std::vector<len_t> list_lengths(2 * n_lists, 0);
+    auto insert_entries = [&](const list_id_t list_id, const len_t n_entries)
+    {
+      len_t start = list_lengths[list_id];
+      list_lengths[list_id] += n_entries;
+      std::vector<vector_el_t> vectors(n_entries * vector_dim);
+      std::vector<vector_id_t> ids(n_entries);
+      for (len_t i = 0; i < n_entries; i++)
+      {
+        ids[i] = list_id * ID_FACTOR + start + i;
+        std::fill(&vectors[i * vector_dim], &vectors[(i + 1) * vector_dim], (vector_el_t)(start + i));
+      }
+      lists.insert_entries(list_id, vectors.data(), ids.data(), n_entries);
+    };
+    for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+    {
+      insert_entries(list_id, 1);
+    }
+    lists.enable_concurrent_reads();
+    REQUIRE(lists.is_concurrent_reads_enabled());
+
+    WHEN("readers scan the lists while a writer keeps reallocating them")
+    {
+      std::atomic<bool> is_writing(true);
+      std::atomic<len_t> n_scans(0);
+      std::atomic<len_t> n_inconsistencies(0);
+      std::vector<std::thread> readers;
+      for (len_t r = 0; r < 4; r++)
+      {
+        readers.emplace_back([&, r]
+                             {
+                               std::mt19937 rng(r);
+                               while (is_writing)
+                               {
+                                 list_id_t list_id = rng() % n_lists;
+                                 EpochManager::Guard guard = lists.pin();
+                                 ListData list = lists.get_list_data(list_id);
+                                 const vector_el_t *vectors = (const vector_el_t *)list.codes;
+                                 for (len_t j = 0; j < list.length; j++)
+                                 {
+                                   if (list.ids[j] != (vector_id_t)(list_id * ID_FACTOR + j) || vectors[j * vector_dim] != (vector_el_t)j)
+                                   {
+                                     n_inconsistencies++;
+                                   }
+                                 }
+                                 n_scans++;
+                               } });
+      }
+      std::mt19937 rng(42);
+      for (len_t i = 0; i < 2000; i++)
+      {
+        insert_entries(rng() % n_lists, rng() % 8 + 1);
+      }
+      // the readers scan at least once while the lists are modified
+      while (n_scans < readers.size())
+      {
+        std::this_thread::yield();
+      }
+      is_writing = false;
+      for (std::thread &reader : readers)
+      {
+        reader.join();
+      }
+
+      THEN("every reader sees consistent versions of the lists")
+      {
+        REQUIRE(n_inconsistencies == 0);
+        for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+        {
+          const vector_id_t *ids = lists.get_ids(list_id);
+          for (len_t j = 0; j < lists.get_list_length(list_id); j++)
+          {
+            REQUIRE(ids[j] == (vector_id_t)(list_id * ID_FACTOR + j));
+          }
+        }
+      }
+    }
+    WHEN("a list is reallocated while a reader is pinned")
+    {
+      EpochManager::Guard guard = lists.pin();
+      ListData pinned_list = lists.get_list_data(0);
+      ListLayout pinned_layout = lists.get_list_layout(0);
+      insert_entries(0, 100);
+      for (list_id_t list_id = (list_id_t)n_lists; list_id < (list_id_t)n_lists + 8; list_id++)
+      {
+        insert_entries(list_id, 1);
+      }
+
+      THEN("the old slot is not reused and the pinned version is unchanged")
+      {
+        REQUIRE(lists.get_list_length(0) == 101);
+        REQUIRE(lists.get_list_data(0).ids != pinned_list.ids);
+        REQUIRE(pinned_list.length == 1);
+        REQUIRE(pinned_list.ids[0] == 0);
+        REQUIRE(((const vector_el_t *)pinned_list.codes)[0] == 0);
+        for (list_id_t list_id = (list_id_t)n_lists; list_id < (list_id_t)n_lists + 8; list_id++)
+        {
+          REQUIRE(lists.get_list_layout(list_id).offset != pinned_layout.offset);
+        }
+      }
+      AND_WHEN("the reader is unpinned and the lists are modified again")
+      {
+        guard = EpochManager::Guard();
+        size_t free_space_before = lists.get_free_space();
+        // a list resized without reallocation only publishes it
+        lists.resize_list(1, 1);
+
+        THEN("the old slot is freed")
+        {
+          REQUIRE(lists.get_free_space() == free_space_before + pinned_layout.size);
+        }
+      }
+      AND_WHEN("the lists are reopened while the reader is pinned")
+      {
+        lists.flush();
+        StorageLists reopened_lists(file, OPEN_MODE_READ_ONLY);
+
+        THEN("the retired slot is free in the reopened lists")
+        {
+          REQUIRE(reopened_lists.get_free_space() == lists.get_free_space() + pinned_layout.size);
+          REQUIRE(reopened_lists.get_list_length(0) == 101);
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("delete_entries(): deleted entries are skipped until compact_list() removes them", "[StorageLists][delete][test]")
+{
+  GIVEN("lists of vectors using the cosine metric whose components are their ids")
+  {
+    len_t vector_dim = 5;
+    len_t n_entries = 150;
+    std::string file = join(TMP_DIR, get_lists_filename());
+    remove(file.c_str());
+    remove((file + LOG_FILE_EXT).c_str());
+    std::vector<vector_el_t> vectors(n_entries * vector_dim);
+    std::vector<vector_id_t> ids(n_entries);
+    for (len_t i = 0; i < n_entries; i++)
+    {
+      ids[i] = i;
+      std::fill(&vectors[i * vector_dim], &vectors[(i + 1) * vector_dim], (vector_el_t)(i + 1));
+    }
+    // every third id is deleted, some of them twice
+    std::vector<vector_id_t> ids_to_delete;
+    for (len_t i = 0; i < n_entries; i += 3)
+    {
+      ids_to_delete.push_back(i);
+    }
+    ids_to_delete.push_back(0);
+    len_t n_deleted = (n_entries + 2) / 3;
+
+    StorageLists *lists = new StorageLists(vector_dim, file, METRIC_COSINE);
+    lists->insert_entries(0, vectors.data(), ids.data(), n_entries);
+    lists->insert_entries(1, vectors.data(), ids.data(), 10);
+
+    WHEN("entries of a list are deleted")
+    {
+      len_t n_deleted_entries = lists->delete_entries(0, ids_to_delete.data(), ids_to_delete.size());
+
+      THEN("they are marked by the tombstones of the list only")
+      {
+        REQUIRE(n_deleted_entries == n_deleted);
+        REQUIRE(lists->get_n_deleted_entries(0) == n_deleted);
+        REQUIRE(lists->get_n_deleted_entries(1) == 0);
+        REQUIRE(lists->get_list_length(0) == n_entries);
+        ListData list = lists->get_list_data(0);
+        for (len_t i = 0; i < n_entries; i++)
+        {
+          REQUIRE(((list.tombstones[i / 64] >> (i % 64)) & 1) == (i % 3 == 0));
+        }
+        REQUIRE(lists->delete_entries(0, ids_to_delete.data(), ids_to_delete.size()) == 0);
+      }
+      THEN("only the lists with enough deleted entries are to be compacted")
+      {
+        REQUIRE(lists->get_lists_to_compact(0.3f) == std::vector<list_id_t>({0}));
+        REQUIRE(lists->get_lists_to_compact(0.5f).empty());
+      }
+      AND_WHEN("a deleted entry is updated and the list is grown and shrunk")
+      {
+        lists->update_entries(0, vectors.data(), ids.data(), 1, 0);
+        lists->insert_entries(0, vectors.data(), ids.data(), n_entries);
+        lists->resize_list(0, n_entries);
+
+        THEN("the updated entry and the inserted entries are not deleted")
+        {
+          REQUIRE(lists->get_n_deleted_entries(0) == n_deleted - 1);
+        }
+      }
+      AND_WHEN("the list is compacted")
+      {
+        size_t free_space_before = lists->get_free_space();
+        size_t list_size_before = lists->get_list_layout(0).size;
+        len_t n_removed = lists->compact_list(0);
+
+        THEN("the remaining entries are moved to a smaller slot in their order")
+        {
+          REQUIRE(n_removed == n_deleted);
+          REQUIRE(lists->get_list_length(0) == n_entries - n_deleted);
+          REQUIRE(lists->get_n_deleted_entries(0) == 0);
+          REQUIRE(lists->get_list_layout(0).size < list_size_before);
+          REQUIRE(lists->get_free_space() == free_space_before + list_size_before - lists->get_list_layout(0).size);
+          const vector_id_t *list_ids = lists->get_ids(0);
+          const vector_el_t *list_vectors = lists->get_vectors(0);
+          const distance_t *inverse_norms = lists->get_inverse_norms(0);
+          len_t j = 0;
+          for (len_t i = 0; i < n_entries; i++)
+          {
+            if (i % 3 == 0)
+            {
+              continue;
+            }
+            REQUIRE(list_ids[j] == (vector_id_t)i);
+            REQUIRE(list_vectors[j * vector_dim] == (vector_el_t)(i + 1));
+            REQUIRE(inverse_norms[j] == Approx(get_inverse_norm(&vectors[i * vector_dim], vector_dim)));
+            j++;
+          }
+          REQUIRE(lists->compact_list(0) == 0);
+        }
+      }
+      AND_WHEN("every entry of a list is deleted and the list is compacted")
+      {
+        lists->delete_entries(1, ids.data(), 10);
+        lists->compact_list(1);
+
+        THEN("the list is kept without entries and can be inserted into")
+        {
+          REQUIRE(lists->get_list_length(1) == 0);
+          lists->insert_entries(1, vectors.data(), ids.data(), 2);
+          REQUIRE(lists->get_list_length(1) == 2);
+          REQUIRE(lists->get_n_deleted_entries(1) == 0);
+        }
+      }
+    }
+    WHEN("deletions and compactions are logged and the lists are reopened")
+    {
+      lists->enable_write_ahead_log();
+      lists->delete_entries(0, ids_to_delete.data(), ids_to_delete.size());
+      lists->delete_entries(1, ids_to_delete.data(), ids_to_delete.size());
+      lists->compact_list(0);
+      lists->sync_write_ahead_log();
+      std::string crashed_file = file + "_crashed";
+      copy_file(file, crashed_file);
+      copy_file(file + METADATA_FILE_EXT, crashed_file + METADATA_FILE_EXT);
+      copy_file(file + LOG_FILE_EXT, crashed_file + LOG_FILE_EXT);
+      StorageLists reopened_lists(crashed_file, OPEN_MODE_READ_WRITE);
+
+      THEN("the deletions and compactions are replayed")
+      {
+        REQUIRE(reopened_lists.get_list_length(0) == n_entries - n_deleted);
+        REQUIRE(reopened_lists.get_n_deleted_entries(0) == 0);
+        are_ids_equal(reopened_lists.get_ids(0), lists->get_ids(0), n_entries - n_deleted);
+        REQUIRE(reopened_lists.get_n_deleted_entries(1) == 4);
+      }
+    }
+    delete lists;
+  }
+  GIVEN("lists of 4-bit codes in the fast-scan layout")
+  {
+    size_t code_size = 4;
+    len_t n_entries = 100;
+    std::string file = join(TMP_DIR, get_lists_filename());
+    remove(file.c_str());
+    StorageLists lists(8, code_size, file, METRIC_L2, CODE_LAYOUT_FAST_SCAN);
+    std::vector<uint8_t> codes(n_entries * code_size);
+    std::vector<vector_id_t> ids(n_entries);
+    for (len_t i = 0; i < n_entries; i++)
+    {
+      ids[i] = i;
+      for (size_t k = 0; k < code_size; k++)
+      {
+        codes[i * code_size + k] = (uint8_t)((i + k) % 256);
+      }
+    }
+    lists.insert_codes(0, codes.data(), ids.data(), n_entries);
+
+    WHEN("the even entries are deleted and the list is compacted")
+    {
+      std::vector<vector_id_t> even_ids;
+      for (len_t i = 0; i < n_entries; i += 2)
+      {
+        even_ids.push_back(i);
+      }
+      lists.delete_entries(0, even_ids.data(), even_ids.size());
+      lists.compact_list(0);
+
+      THEN("the codes of the odd entries are interleaved at their new positions")
+      {
+        REQUIRE(lists.get_list_length(0) == n_entries / 2);
+        std::vector<uint8_t> code(code_size);
+        for (len_t j = 0; j < n_entries / 2; j++)
+        {
+          get_fast_scan_code(lists.get_codes(0), code_size, j, code.data());
+          REQUIRE(lists.get_ids(0)[j] == (vector_id_t)(2 * j + 1));
+          for (size_t k = 0; k < code_size; k++)
+          {
+            REQUIRE(code[k] == codes[(2 * j + 1) * code_size + k]);
+          }
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("enable_id_directory(): entries are looked up, upserted and deleted by id", "[StorageLists][id_directory][test]")
+{
+  GIVEN("lists with an id directory")
+  {
+    len_t vector_dim = 4;
+    len_t n_lists = 3;
+    len_t list_length = 50;
+    std::string file = join(TMP_DIR, get_lists_filename());
+    for (std::string ext : {"", METADATA_FILE_EXT, LOG_FILE_EXT, ID_DIRECTORY_FILE_EXT})
+    {
+      remove((file + ext).c_str());
+    }
+    // the id of entry i of list l is 1000 * l + i and its vector is filled with the id
+    auto get_vectors_of_ids = [vector_dim](const std::vector<vector_id_t> &ids)
+    {
+      std::vector<vector_el_t> vectors;
+      for (vector_id_t id : ids)
+      {
+        vectors.insert(vectors.end(), vector_dim, (vector_el_t)id);
+      }
+      return vectors;
+    };
+    StorageLists *lists = new StorageLists(vector_dim, file);
+    for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+    {
+      std::vector<vector_id_t> ids(list_length);
+      for (len_t i = 0; i < list_length; i++)
+      {
+        ids[i] = 1000 * list_id + i;
+      }
+      lists->insert_entries(list_id, get_vectors_of_ids(ids).data(), ids.data(), list_length);
+    }
+    lists->enable_id_directory();
+
+    WHEN("entries are looked up by id")
+    {
+      THEN("their locations and vectors are found")
+      {
+        REQUIRE(lists->is_id_directory_enabled());
+        for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+        {
+          for (len_t i = 0; i < list_length; i++)
+          {
+            EntryLocation location = lists->find_entry(1000 * list_id + i);
+            REQUIRE(location.list_id == list_id);
+            REQUIRE(location.offset == i);
+          }
+        }
+        REQUIRE(lists->get_vector(2007)[vector_dim - 1] == 2007.0f);
+        REQUIRE_THROWS_AS(lists->find_entry(list_length), std::invalid_argument);
+      }
+    }
+    WHEN("entries are upserted into a list")
+    {
+      // 1005 is stored in the list, 5 in another list and 9999 nowhere
+      std::vector<vector_id_t> ids = {1005, 5, 9999};
+      std::vector<vector_el_t> vectors(ids.size() * vector_dim, -1.0f);
+      lists->upsert_entries(1, vectors.data(), ids.data(), ids.size());
+
+      THEN("stored entries are updated or moved and the others are appended")
+      {
+        REQUIRE(lists->get_list_length(1) == list_length + 2);
+        REQUIRE(lists->find_entry(1005).offset == 5);
+        REQUIRE(lists->get_n_deleted_entries(0) == 1);
+        EntryLocation location = lists->find_entry(5);
+        REQUIRE(location.list_id == 1);
+        REQUIRE(location.offset == list_length);
+        REQUIRE(lists->find_entry(9999).offset == list_length + 1);
+        for (vector_id_t id : ids)
+        {
+          REQUIRE(lists->get_vector(id)[0] == -1.0f);
+        }
+        REQUIRE_THROWS_AS(lists->upsert_entries(1, vectors.data(), std::vector<vector_id_t>({7, 7}).data(), 2), std::invalid_argument);
+      }
+    }
+    WHEN("entries are deleted by id and the lists are compacted and shrunk")
+    {
+      std::vector<vector_id_t> ids = {0, 1, 2, 3, 1049, 5000};
+      len_t n_deleted = lists->delete_entries(ids.data(), ids.size());
+      lists->compact_list(0);
+      lists->resize_list(2, 20);
+
+      THEN("the deleted and removed ids are not found and the moved entries are")
+      {
+        REQUIRE(n_deleted == 5);
+        REQUIRE(lists->get_n_deleted_entries(1) == 1);
+        REQUIRE_THROWS_AS(lists->find_entry(2), std::invalid_argument);
+        REQUIRE_THROWS_AS(lists->find_entry(1049), std::invalid_argument);
+        REQUIRE_THROWS_AS(lists->find_entry(2020), std::invalid_argument);
+        REQUIRE(lists->find_entry(4).offset == 0);
+        REQUIRE(lists->get_vector(49)[0] == 49.0f);
+        REQUIRE(lists->find_entry(2019).offset == 19);
+        REQUIRE(lists->delete_entries(ids.data(), ids.size()) == 0);
+      }
+    }
+    WHEN("the lists are closed and opened again")
+    {
+      lists->enable_write_ahead_log();
+      delete lists;
+      lists = new StorageLists(file, OPEN_MODE_READ_WRITE);
+      lists->enable_id_directory();
+
+      THEN("the directory file is reused instead of being rebuilt")
+      {
+        REQUIRE(IdDirectory(lists->get_id_directory_filename()).get_token() != 0);
+        REQUIRE(lists->find_entry(1010).offset == 10);
+      }
+    }
+    WHEN("the lists are modified without the directory and opened again")
+    {
+      delete lists;
+      lists = new StorageLists(file, OPEN_MODE_READ_WRITE);
+      std::vector<vector_id_t> ids = {7000};
+      lists->insert_entries(0, get_vectors_of_ids(ids).data(), ids.data(), 1);
+      delete lists;
+      lists = new StorageLists(file, OPEN_MODE_READ_WRITE);
+      lists->enable_id_directory();
+
+      THEN("the stale directory is rebuilt")
+      {
+        REQUIRE(lists->find_entry(7000).offset == list_length);
+        REQUIRE(lists->find_entry(1010).list_id == 1);
+      }
+    }
+    WHEN("logged upserts are replayed after a crash")
+    {
+      lists->enable_write_ahead_log();
+      std::vector<vector_id_t> ids = {10, 2010};
+      std::vector<vector_el_t> vectors(ids.size() * vector_dim, -1.0f);
+      lists->upsert_entries(1, vectors.data(), ids.data(), ids.size());
+      lists->sync_write_ahead_log();
+      std::string crashed_file = file + "_crashed";
+      for (std::string ext : {"", METADATA_FILE_EXT, LOG_FILE_EXT, ID_DIRECTORY_FILE_EXT})
+      {
+        copy_file(file + ext, crashed_file + ext);
+      }
+      StorageLists crashed_lists(crashed_file, OPEN_MODE_READ_WRITE);
+      crashed_lists.enable_id_directory();
+
+      THEN("the directory modified after the last flush is rebuilt")
+      {
+        REQUIRE(crashed_lists.find_entry(10).list_id == 1);
+        REQUIRE(crashed_lists.find_entry(2010).offset == list_length + 1);
+        REQUIRE(crashed_lists.get_n_deleted_entries(0) == 1);
+        REQUIRE(crashed_lists.get_n_deleted_entries(2) == 1);
+      }
+    }
+    delete lists;
+  }
+  GIVEN("lists which are opened read-only")
+  {
+    std::string file = join(TMP_DIR, get_lists_filename());
+    remove(file.c_str());
+    {
+      StorageLists lists(4, file);
+      std::vector<vector_el_t> vector(4);
+      vector_id_t id = 0;
+      lists.insert_entries(0, vector.data(), &id, 1);
+    }
+    StorageLists lists(file, OPEN_MODE_READ_ONLY);
+
+    THEN("the id directory cannot be enabled")
+    {
+      REQUIRE_THROWS_AS(lists.enable_id_directory(), std::logic_error);
+      REQUIRE_THROWS_AS(lists.find_entry(0), std::logic_error);
+    }
+  }
+}
@@ -24,17 +24,23 @@ namespace ann_dkvs
     return vector_dim * sizeof(vector_el_t);
   }
 
+  size_t get_aligned_size(size_t size)
+  {
+    return (size + LIST_ALIGNMENT - 1) / LIST_ALIGNMENT * LIST_ALIGNMENT;
+  }
+
   size_t get_list_size(len_t vector_dim, len_t n_entries)
   {
     len_t entries_allocated = round_up_to_next_power_of_two(n_entries);
     entries_allocated = std::max((len_t)MIN_N_ENTRIES_PER_LIST, entries_allocated);
-    size_t list_size = entries_allocated * (get_vector_size(vector_dim) + sizeof(vector_id_t));
+    size_t tombstones_size = (entries_allocated + 63) / 64 * sizeof(uint64_t);
+    size_t list_size = get_aligned_size(entries_allocated * get_vector_size(vector_dim)) + get_aligned_size(entries_allocated * sizeof(vector_id_t)) + get_aligned_size(tombstones_size);
     return list_size;
   }
 
   size_t get_total_size(size_t used_space)
   {
-    size_t total_size = std::max((size_t)MIN_TOTAL_SIZE_BYTES, round_up_to_next_power_of_two(used_space));
+    size_t total_size = std::max(get_aligned_size(MIN_TOTAL_SIZE_BYTES), round_up_to_next_power_of_two(used_space));
     return total_size;
   }
 
@@ -0,0 +1,216 @@
+#include <random>
+#include <vector>
+#include <thread>
+#include <memory>
+
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../lib/catch.hpp"
+
+#include "../include/tests/StorageListsTestUtils.hpp"
+#include "../include/storage-node/StorageNode.hpp"
+#include "../include/storage-node/StorageNodeClient.hpp"
+#include "../include/Protocol.hpp"
+#include "../include/Socket.hpp"
+
+using namespace ann_dkvs;
+
+/**
+ * Creates lists of random vectors with small integer components,
+ * so that all distances are exact.
+ */
+static std::unique_ptr<StorageLists> create_random_lists(const len_t vector_dim, const len_t n_lists, std::mt19937 &rng)
+{
+  std::uniform_int_distribution<int> gen_component(-8, 8);
+  std::string file = join(TMP_DIR, "node_" + get_lists_filename());
+  remove(file.c_str());
+  std::unique_ptr<StorageLists> lists(new StorageLists(vector_dim, file));
+  vector_id_t next_id = 0;
+  for (list_id_t list_id = 0; list_id < (list_id_t)n_lists; list_id++)
+  {
+    len_t list_length = list_id * 100 + 5;
+    std::vector<vector_el_t> vectors(list_length * vector_dim);
+    std::vector<vector_id_t> ids(list_length);
+    for (vector_el_t &element : vectors)
+    {
+      element = (vector_el_t)gen_component(rng);
+    }
+    for (vector_id_t &id : ids)
+    {
+      id = next_id++;
+    }
+    lists->insert_entries(list_id, vectors.data(), ids.data(), list_length);
+  }
+  return lists;
+}
+
+SCENARIO("StorageNode: pre-assigned queries are searched by a server over loopback sockets", "[StorageNode][test]")
+{
+  GIVEN("a storage node listening on a TCP socket and a Unix domain socket")
+  {
+    len_t vector_dim = 16;
+    len_t n_lists = 6;
+    len_t n_queries = 30;
+    len_t n_results = 10;
+    std::mt19937 rng(42);
+    StorageNode node(create_random_lists(vector_dim, n_lists, rng));
+    uint16_t port = node.listen_tcp("127.0.0.1", 0);
+    std::string socket_path = join(TMP_DIR, "storage_node.sock");
+    node.listen_unix(socket_path);
+    StorageIndex local_index(node.get_lists());
+
+    AND_GIVEN("a batch of queries probing a varying number of lists")
+    {
+      std::uniform_int_distribution<int> gen_component(-8, 8);
+      std::vector<vector_el_t> query_vectors(n_queries * vector_dim);
+      for (vector_el_t &element : query_vectors)
+      {
+        element = (vector_el_t)gen_component(rng);
+      }
+      std::vector<list_id_t> lists_to_probe(n_queries * n_lists);
+      QueryBatch queries;
+      for (len_t i = 0; i < n_queries; i++)
+      {
+        len_t n_probes = i % n_lists + 1;
+        for (len_t j = 0; j < n_probes; j++)
+        {
+          lists_to_probe[i * n_lists + j] = (i + j) % n_lists;
+        }
+        queries.push_back(new Query(&query_vectors[i * vector_dim], &lists_to_probe[i * n_lists], n_results + i % 3, n_probes));
+      }
+      QueryResultsBatch expected = local_index.batch_search_preassigned(queries);
+
+      WHEN("several clients search the batch at the same time")
+      {
+        bool use_tcp = GENERATE(true, false);
+        len_t n_clients = 4;
+        len_t n_requests_per_client = 3;
+        std::vector<std::vector<QueryResultsBatch>> results(n_clients);
+        std::vector<std::thread> clients;
+        for (len_t c = 0; c < n_clients; c++)
+        {
+          clients.emplace_back([&, c]()
+                               {
+                                 std::unique_ptr<StorageNodeClient> client(use_tcp ? new StorageNodeClient("127.0.0.1", port) : new StorageNodeClient(socket_path));
+                                 for (len_t r = 0; r < n_requests_per_client; r++)
+                                 {
+                                   results[c].push_back(client->batch_search_preassigned(queries, vector_dim));
+                                 } });
+        }
+        for (std::thread &client : clients)
+        {
+          client.join();
+        }
+
+        THEN("every client receives the results of searching the batch locally")
+        {
+          for (len_t c = 0; c < n_clients; c++)
+          {
+            REQUIRE(results[c].size() == n_requests_per_client);
+            for (const QueryResultsBatch &batch_results : results[c])
+            {
+              REQUIRE(batch_results.size() == n_queries);
+              for (len_t i = 0; i < n_queries; i++)
+              {
+                REQUIRE(batch_results[i].size() == expected[i].size());
+                for (len_t j = 0; j < expected[i].size(); j++)
+                {
+                  CHECK(batch_results[i][j].vector_id == expected[i][j].vector_id);
+                  CHECK(batch_results[i][j].distance == expected[i][j].distance);
+                }
+              }
+            }
+          }
+        }
+      }
+
+      WHEN("an empty batch is searched")
+      {
+        StorageNodeClient client("127.0.0.1", port);
+        QueryResultsBatch results = client.batch_search_preassigned(QueryBatch(), vector_dim);
+
+        THEN("no results are returned")
+        {
+          REQUIRE(results.empty());
+        }
+      }
+
+      WHEN("invalid requests are sent")
+      {
+        StorageNodeClient client(socket_path);
+
+        THEN("the node reports an error and keeps serving the connection")
+        {
+          REQUIRE_THROWS_AS(client.batch_search_preassigned(queries, vector_dim + 1), std::runtime_error);
+          list_id_t missing_list_id = n_lists;
+          Query missing_list_query(query_vectors.data(), &missing_list_id, n_results, 1);
+          REQUIRE_THROWS_AS(client.batch_search_preassigned({&missing_list_query}, vector_dim), std::runtime_error);
+          Query no_results_query(query_vectors.data(), lists_to_probe.data(), 0, 1);
+          REQUIRE_THROWS_AS(client.batch_search_preassigned({&no_results_query}, vector_dim), std::runtime_error);
+          QueryResultsBatch results = client.batch_search_preassigned({queries[0]}, vector_dim);
+          REQUIRE(results.size() == 1);
+          REQUIRE(results[0].size() == expected[0].size());
+        }
+      }
+
+      WHEN("a frame with an invalid header is sent")
+      {
+        int fd = connect_tcp_socket("127.0.0.1", port);
+        FrameHeader header = {PROTOCOL_MAGIC + 1, MESSAGE_SEARCH_REQUEST, 0};
+        send_all(fd, &header, sizeof(header));
+        FrameHeader response_header;
+        receive_all(fd, &response_header, sizeof(response_header));
+        std::vector<uint8_t> message(response_header.body_size);
+        receive_all(fd, message.data(), message.size());
+        uint8_t byte;
+        ssize_t n_received = read(fd, &byte, 1);
+        close(fd);
+
+        THEN("the node responds with an error and closes the connection")
+        {
+          REQUIRE(response_header.magic == PROTOCOL_MAGIC);
+          REQUIRE(response_header.message_type == MESSAGE_ERROR);
+          REQUIRE(!message.empty());
+          REQUIRE(n_received == 0);
+        }
+      }
+
+      for (Query *query : queries)
+      {
+        delete query;
+      }
+    }
+
+    node.stop();
+    THEN("the Unix domain socket is removed when the node is stopped")
+    {
+      REQUIRE(!file_exists(socket_path));
+    }
+  }
+}
+
+SCENARIO("StorageNode: the workers share the OpenMP threads", "[StorageNode][test]")
+{
+  GIVEN("a storage node with several workers")
+  {
+    len_t n_workers = GENERATE(1, 3, 256);
+    std::mt19937 rng(7);
+    StorageNode node(create_random_lists(4, 2, rng), n_workers);
+
+    THEN("the workers together search with no more threads than a single batch would use, but at least one each")
+    {
+#ifdef _OPENMP
+      len_t n_threads = omp_get_max_threads();
+#else
+      len_t n_threads = 1;
+#endif
+      REQUIRE(node.get_n_threads_per_worker() >= 1);
+      REQUIRE(node.get_n_threads_per_worker() * n_workers <= std::max(n_threads, n_workers));
+      REQUIRE(node.get_n_threads_per_worker() == std::max((len_t)1, n_threads / n_workers));
+    }
+  }
+}
@@ -0,0 +1,124 @@
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "../lib/catch.hpp"
+
+#include "../include/TopK.hpp"
+#include "../include/Query.hpp"
+
+using namespace ann_dkvs;
+
+SCENARIO("TopK: the k smallest results are kept", "[TopK][test]")
+{
+  GIVEN("random candidates with many equal distances")
+  {
+    len_t k = GENERATE(0, 1, 10, 128, 129, 300);
+    len_t n_candidates = GENERATE(0, 5, 1000);
+    std::mt19937 rng(k * 1000 + n_candidates);
+    std::uniform_int_distribution<int> gen_distance(0, 50);
+    std::vector<distance_t> distances(n_candidates);
+    std::vector<vector_id_t> ids(n_candidates);
+    QueryResults candidates(n_candidates);
+    for (len_t i = 0; i < n_candidates; i++)
+    {
+      distances[i] = (distance_t)gen_distance(rng);
+      ids[i] = (vector_id_t)(n_candidates - i);
+      candidates[i] = {distances[i], ids[i]};
+    }
+    QueryResults expected = candidates;
+    std::sort(expected.begin(), expected.end());
+    expected.resize(std::min(k, n_candidates));
+
+    WHEN("the candidates are pushed one by one")
+    {
+      TopK<QueryResult> top_k(k);
+      for (const QueryResult &candidate : candidates)
+      {
+        top_k.push(candidate);
+      }
+
+      THEN("the sorted results are the k smallest candidates")
+      {
+        REQUIRE(top_k.size() == expected.size());
+        QueryResults results = top_k.extract_sorted();
+        REQUIRE(results.size() == expected.size());
+        for (len_t i = 0; i < expected.size(); i++)
+        {
+          REQUIRE(results[i].distance == expected[i].distance);
+          REQUIRE(results[i].vector_id == expected[i].vector_id);
+        }
+        REQUIRE(top_k.size() == 0);
+      }
+    }
+
+    WHEN("the candidates are pushed in batches")
+    {
+      TopK<QueryResult> top_k(k);
+      for (len_t batch_start = 0; batch_start < n_candidates; batch_start += 100)
+      {
+        len_t batch_size = std::min((len_t)100, n_candidates - batch_start);
+        const vector_id_t *batch_ids = &ids[batch_start];
+        top_k.push_batch(&distances[batch_start], batch_size, [batch_ids](len_t i)
+                         { return batch_ids[i]; });
+      }
+
+      THEN("the sorted results are the k smallest candidates")
+      {
+        TopK<QueryResult> copy = top_k;
+        QueryResults results = copy.extract_sorted();
+        REQUIRE(results.size() == expected.size());
+        for (len_t i = 0; i < expected.size(); i++)
+        {
+          REQUIRE(results[i].distance == expected[i].distance);
+          REQUIRE(results[i].vector_id == expected[i].vector_id);
+        }
+      }
+
+      THEN("the results can be popped from the largest to the smallest")
+      {
+        for (len_t i = expected.size(); i > 0; i--)
+        {
+          REQUIRE(top_k.top().vector_id == expected[i - 1].vector_id);
+          top_k.pop();
+        }
+        REQUIRE(top_k.size() == 0);
+      }
+    }
+  }
+}
+
+SCENARIO("filter_distances(): only distances below the threshold are selected", "[TopK][test]")
+{
+  GIVEN("distances of every length up to 70")
+  {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<distance_t> gen_distance(0, 1);
+    for (len_t n_distances = 0; n_distances <= 70; n_distances++)
+    {
+      std::vector<distance_t> distances(n_distances);
+      for (distance_t &distance : distances)
+      {
+        distance = gen_distance(rng);
+      }
+      distance_t threshold = n_distances > 0 ? distances[n_distances / 2] : 0.5f;
+      std::vector<uint32_t> indices(n_distances);
+
+      len_t n_selected = filter_distances(distances.data(), n_distances, threshold, indices.data());
+
+      std::vector<uint32_t> expected;
+      for (len_t i = 0; i < n_distances; i++)
+      {
+        if (distances[i] <= threshold)
+        {
+          expected.push_back(i);
+        }
+      }
+      REQUIRE(n_selected == expected.size());
+      for (len_t i = 0; i < n_selected; i++)
+      {
+        REQUIRE(indices[i] == expected[i]);
+      }
+    }
+  }
+}
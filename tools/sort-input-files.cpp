@@ -0,0 +1,39 @@
+#include <iostream>
+#include <string>
+#include <stdexcept>
+
+#include "InputFileSorter.hpp"
+
+using namespace ann_dkvs;
+
+/**
+ * Sorts clustered input files of bulk_insert_entries() by list id,
+ * storing the temporary bucket files next to the sorted vectors file.
+ */
+int main(int argc, char const *argv[])
+{
+	if (argc != 9 && argc != 10)
+	{
+		std::cerr << "usage: " << argv[0] << " <vector dim> <n entries> <vectors file> <vector ids file> <list ids file>"
+				  << " <sorted vectors file> <sorted vector ids file> <sorted list ids file> [memory budget in bytes]" << std::endl;
+		return 1;
+	}
+	try
+	{
+		len_t vector_dim = std::stoul(argv[1]);
+		len_t n_entries = std::stoul(argv[2]);
+		size_t memory_budget = argc == 10 ? std::stoul(argv[9]) : SORT_MEMORY_BUDGET;
+		std::string sorted_vectors_filename = argv[6];
+		size_t separator = sorted_vectors_filename.find_last_of('/');
+		std::string tmp_dir = separator == std::string::npos ? "." : sorted_vectors_filename.substr(0, separator);
+
+		InputFileSorter sorter(vector_dim, tmp_dir, memory_budget);
+		sorter.sort(argv[3], argv[4], argv[5], n_entries, argv[6], argv[7], argv[8]);
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}